@@ -0,0 +1,69 @@
+#include <stdio.h>
+
+#include "band_layout.h"
+#include "utilities.h"
+#include "const.h"
+
+/* the layouts there are kernels for */
+static const band_layout_t band_layouts[] =
+{
+    {PS4_IMAGE_BANDS, PS4_IMAGE_BANDS + 1, PS4_BLUE, PS4_GREEN, PS4_RED,
+     PS4_NIR, "PlanetScope 4-band"},
+    {SD8_IMAGE_BANDS, SD8_IMAGE_BANDS + 1, SD8_BLUE, SD8_GREEN, SD8_RED,
+     SD8_NIR, "SuperDove 8-band"}
+};
+
+/* layout of the run, 4-band until set_band_layout says otherwise */
+static const band_layout_t *band_layout = &band_layouts[0];
+
+/******************************************************************************
+MODULE:  set_band_layout
+
+PURPOSE:  Select the band layout of the run from the band count of the
+          scenes, as the ENVI header or the scene manifest gives it
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           no layout has that many bands
+SUCCESS         No errors encountered
+
+NOTES: called once before any scene is read; the kernels that depend on the
+       band count pick their 4-band or 8-band instance from it
+******************************************************************************/
+int set_band_layout
+(
+    int total_bands           /* I: bands of a scene, the mask included     */
+)
+{
+    int i;
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "set_band_layout";
+
+    for (i = 0; i < (int)(sizeof(band_layouts) / sizeof(band_layouts[0])); i++)
+    {
+        if (band_layouts[i].total_bands == total_bands)
+        {
+            band_layout = &band_layouts[i];
+            return (SUCCESS);
+        }
+    }
+
+    sprintf(errmsg, "Scenes of %d bands are neither 4-band nor 8-band "
+            "imagery plus a mask", total_bands);
+    RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+}
+
+/******************************************************************************
+MODULE:  get_band_layout
+
+PURPOSE:  Band layout of the run
+
+RETURN VALUE:
+Type = const band_layout_t *
+******************************************************************************/
+const band_layout_t *get_band_layout(void)
+{
+    return band_layout;
+}
@@ -0,0 +1,27 @@
+#ifndef BAND_LAYOUT_H
+#define BAND_LAYOUT_H
+
+#include "const.h"
+
+/* the bands of the scenes of a run: a record holds image_bands values in
+   file order and then the mask; the methods find the bands they weigh
+   and test by their role */
+typedef struct
+{
+    int image_bands;          /* reflectance bands of a record              */
+    int total_bands;          /* image bands and the mask                   */
+    int blue;                 /* band of every role                         */
+    int green;
+    int red;
+    int nir;
+    const char *name;         /* for logging                                */
+} band_layout_t;
+
+int set_band_layout
+(
+    int total_bands           /* I: bands of a scene, the mask included     */
+);
+
+const band_layout_t *get_band_layout(void);
+
+#endif // BAND_LAYOUT_H
@@ -0,0 +1,443 @@
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <omp.h>
+#include "gdal/gdal.h"
+#include "const.h"
+#include "utilities.h"
+#include "input.h"
+#include "scene_manifest.h"
+#include "2d_array.h"
+#include "scratch.h"
+#include "composite_methods.h"
+#include "band_layout.h"
+#include "tile.h"
+#include "batch.h"
+
+/* scenes of a job, read while the job before it is composited */
+typedef struct {
+    tile_job_t *job;
+    char **scene_list;            /* scene names in the windows, by date    */
+    int *sdate;                   /* julian date of every scene             */
+    int num_scenes;
+    input_meta_t meta;
+    int prune;                    /* TRUE to drop the scenes outside the windows */
+    int status;                   /* SUCCESS once the job is staged         */
+} job_stage_t;
+
+/******************************************************************************
+MODULE:  read_job_file
+
+PURPOSE:  Read the tiles of a batch, one per line as
+          <ARD folder> <tile id> <lower-upper>[,<lower-upper>...] <output folder>
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the file cannot be read, a line is malformed or has no job
+SUCCESS         No errors encountered
+
+NOTES: blank lines and lines starting with # are skipped. Every job gets the
+       settings of the batch with its own windows.
+******************************************************************************/
+int read_job_file
+(
+    char *job_path,           /* I: job file                                */
+    run_opts_t *opts,         /* I: settings shared by all jobs             */
+    tile_job_t **jobs,        /* O: jobs in file order, allocated here      */
+    int *num_jobs             /* O: number of jobs                          */
+)
+{
+    FILE *fp;
+    int n = 0;
+    int capacity = 0;
+    int line_no = 0;
+    tile_job_t *list = NULL;
+    tile_job_t *grown;
+    char line[4 * MAX_STR_LEN];
+    char first[MAX_STR_LEN];
+    char windows[MAX_STR_LEN];
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "read_job_file";
+
+    fp = fopen(job_path, "r");
+    if (fp == NULL)
+    {
+        sprintf(errmsg, "Opening job file %s", job_path);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        line_no++;
+        if ((sscanf(line, "%s", first) != 1) || (first[0] == '#'))
+            continue;
+
+        if (n == capacity)
+        {
+            capacity = (capacity == 0) ? 64 : 2 * capacity;
+            grown = (tile_job_t *)realloc(list, capacity * sizeof(tile_job_t));
+            if (grown == NULL)
+            {
+                free(list);
+                fclose(fp);
+                RETURN_ERROR("Allocating jobs", FUNC_NAME, ERROR);
+            }
+            list = grown;
+        }
+
+        list[n].opts = *opts;
+        list[n].opts.n_windows = 0;
+        if ((sscanf(line, "%s %d %s %s", list[n].in_path, &list[n].tile_id, windows,
+                    list[n].out_path) != 4)
+            || (parse_windows(windows, &list[n].opts) != SUCCESS))
+        {
+            free(list);
+            fclose(fp);
+            sprintf(errmsg, "Line %d of %s is not <ARD folder> <tile id> "
+                    "<lower-upper>[,...] <output folder>", line_no, job_path);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+        n++;
+    }
+    fclose(fp);
+
+    if (n == 0)
+    {
+        free(list);
+        sprintf(errmsg, "No job in %s", job_path);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    *jobs = list;
+    *num_jobs = n;
+
+    return SUCCESS;
+}
+
+/******************************************************************************
+MODULE:  stage_job
+
+PURPOSE:  Load the scene manifest of a job, drop the scenes outside its
+          windows if the method allows it and have the kernel read the
+          first rows of the rest
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the manifest cannot be read
+SUCCESS         No errors encountered
+
+NOTES: runs on the loader thread while the previous job is composited, so it
+       touches neither the band layout nor GDAL datasets of that job. The
+       readahead is a hint for raw BIP scenes; GDAL scenes are compressed and
+       their first rows are not at a known offset.
+******************************************************************************/
+static int stage_job
+(
+    job_stage_t *st           /* I/O: stage, job set by the caller          */
+)
+{
+    int i, fd;
+    int num_kept;
+    off_t stage_bytes;
+    tile_job_t *job = st->job;
+    char filename[MAX_STR_LEN];
+    char msg_str[MAX_STR_LEN];
+    char FUNC_NAME[] = "stage_job";
+
+    if (read_scene_manifest(job->in_path, job->opts.reader, st->scene_list,
+                            st->sdate, &st->num_scenes, &st->meta) != SUCCESS)
+        RETURN_ERROR("Reading the scene manifest", FUNC_NAME, ERROR);
+
+    if (st->prune)
+    {
+        prune_scenes_by_date(st->scene_list, st->sdate, st->num_scenes,
+                             job->opts.window_lower, job->opts.window_upper,
+                             job->opts.n_windows, &num_kept);
+        snprintf (msg_str, sizeof(msg_str), "tile %d: %d of %d scenes fall in the %d compositing window(s)\n",
+                  job->tile_id, num_kept, st->num_scenes, job->opts.n_windows);
+        LOG_MESSAGE (msg_str, FUNC_NAME);
+        st->num_scenes = num_kept;
+    }
+
+    if (job->opts.reader == READER_GDAL)
+        return SUCCESS;
+
+    stage_bytes = (off_t)BATCH_STAGE_ROWS * st->meta.samples * st->meta.bands
+                  * sizeof(short int);
+    for (i = 0; i < st->num_scenes; i++)
+    {
+        sprintf(filename, "%s/%s", job->in_path, st->scene_list[i]);
+        fd = open(filename, O_RDONLY);
+        if (fd < 0)
+            continue;
+        posix_fadvise(fd, 0, stage_bytes, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+
+    return SUCCESS;
+}
+
+/******************************************************************************
+MODULE:  stage_thread
+
+PURPOSE:  Loader thread: stage one job
+
+RETURN VALUE: NULL
+******************************************************************************/
+static void *stage_thread
+(
+    void *arg                 /* I/O: job_stage_t of the job                */
+)
+{
+    job_stage_t *st = (job_stage_t *)arg;
+
+    st->status = stage_job(st);
+
+    return NULL;
+}
+
+/******************************************************************************
+MODULE:  run_staged_job
+
+PURPOSE:  Composite a staged job with the thread pool and arenas of the batch
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the band layout, the scratch memory or compositing failed
+SUCCESS         No errors encountered
+
+NOTES: jobs may differ in scene count and band layout, so the arenas are
+       sized for every job; the OpenMP team and GDAL stay up across jobs
+******************************************************************************/
+static int run_staged_job
+(
+    job_stage_t *st,                      /* I: staged job                  */
+    const composite_method_t *composite,  /* I: compositing method          */
+    scratch_arena_t *arenas,              /* I/O: one per thread, unset     */
+    int n_threads                         /* I: compositing threads         */
+)
+{
+    int i, n_init;
+    int status = SUCCESS;
+    tile_job_t *job = st->job;
+    char FUNC_NAME[] = "run_staged_job";
+
+    if (set_band_layout(st->meta.bands) != SUCCESS)
+        RETURN_ERROR("Calling set_band_layout", FUNC_NAME, ERROR);
+
+    for (n_init = 0; n_init < n_threads; n_init++)
+    {
+        if (scratch_init(&arenas[n_init], st->num_scenes, composite->scratch_per_scene *
+                         get_band_layout()->image_bands / PS4_IMAGE_BANDS) != SUCCESS)
+        {
+            ERROR_MESSAGE("Allocating scratch arena", FUNC_NAME);
+            status = ERROR;
+            break;
+        }
+    }
+
+    if (status == SUCCESS)
+        status = composite_tile(job->in_path, job->out_path, job->tile_id,
+                                st->scene_list, st->sdate, st->num_scenes, &st->meta,
+                                &job->opts, composite->id, arenas, n_threads);
+
+    for (i = 0; i < n_init; i++)
+        scratch_free(&arenas[i]);
+
+    return status;
+}
+
+/******************************************************************************
+MODULE:  run_batch
+
+PURPOSE:  Composite every tile of a job file in this process, mode 6
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the jobs or the results file cannot be read or written, or
+                a job failed
+SUCCESS         every job was composited
+
+NOTES: GDAL is registered and the compositing threads are started once for
+       the batch. A loader thread reads the manifest of the next job and asks
+       for the first rows of its scenes while the current one is composited,
+       so one job's I/O overlaps the other's compute and at most two jobs
+       hold memory. The results file gets a line as soon as a job ends:
+       job,tile_id,status,scenes,seconds, status being done, staging_failed
+       or compositing_failed; a failed job does not stop the batch.
+******************************************************************************/
+int run_batch
+(
+    run_opts_t *opts,         /* I: settings of the batch, jobs= and results= */
+    int method                /* I: compositing method                      */
+)
+{
+    int i, k;
+    int num_jobs;
+    int n_threads;
+    int n_done = 0;
+    int loader_running = FALSE;
+    int status;
+    tile_job_t *jobs;
+    job_stage_t stages[2];
+    job_stage_t *st;
+    pthread_t loader;
+    scratch_arena_t *arenas;
+    const composite_method_t *composite;
+    struct timespec t0, t1;
+    FILE *fp_results;
+    const char *result;
+    char results_path[MAX_STR_LEN];
+    char msg_str[MAX_STR_LEN];
+    char FUNC_NAME[] = "run_batch";
+
+    if (opts->jobs_path[0] == '\0')
+        RETURN_ERROR("Mode 6 needs jobs=<job file>", FUNC_NAME, ERROR);
+    /* a time cube belongs to one tile */
+    if (opts->cube_path[0] != '\0')
+        RETURN_ERROR("cube= cannot be used for a batch of tiles", FUNC_NAME, ERROR);
+
+    composite = find_composite_method(method);
+    if (composite == NULL)
+        RETURN_ERROR("Unknown compositing method", FUNC_NAME, ERROR);
+
+    if (read_job_file(opts->jobs_path, opts, &jobs, &num_jobs) != SUCCESS)
+        RETURN_ERROR("Reading the job file", FUNC_NAME, ERROR);
+
+    if (opts->results_path[0] == '\0')
+        snprintf(results_path, sizeof(results_path), "%s.results.csv", opts->jobs_path);
+    else
+        strcpy(results_path, opts->results_path);
+    fp_results = fopen(results_path, "w");
+    if (fp_results == NULL)
+    {
+        free(jobs);
+        RETURN_ERROR("Creating the results file", FUNC_NAME, ERROR);
+    }
+    fprintf(fp_results, "job,tile_id,status,scenes,seconds\n");
+    fflush(fp_results);
+
+    for (i = 0; i < 2; i++)
+    {
+        stages[i].scene_list = (char **)allocate_2d_array(MAX_SCENE_LIST, ARD_STR_LEN,
+                                                          sizeof(char));
+        stages[i].sdate = (int *)malloc(MAX_SCENE_LIST * sizeof(int));
+        stages[i].prune = composite->prunable;
+        if ((stages[i].scene_list == NULL) || (stages[i].sdate == NULL))
+        {
+            fclose(fp_results);
+            free(jobs);
+            RETURN_ERROR("Allocating job stages", FUNC_NAME, ERROR);
+        }
+    }
+
+    /* threads=0 leaves the count to OMP_NUM_THREADS or the core count */
+    if (opts->threads > 0)
+        omp_set_num_threads(opts->threads);
+    n_threads = omp_get_max_threads();
+
+    arenas = (scratch_arena_t *)malloc(n_threads * sizeof(scratch_arena_t));
+    if (arenas == NULL)
+    {
+        fclose(fp_results);
+        free(jobs);
+        RETURN_ERROR("Allocating scratch arenas", FUNC_NAME, ERROR);
+    }
+
+    GDALAllRegister();
+
+    snprintf (msg_str, sizeof(msg_str), "batch of %d jobs from %s, method=%d (%s), threads=%d\n",
+              num_jobs, opts->jobs_path, composite->id, composite->name, n_threads);
+    LOG_MESSAGE (msg_str, FUNC_NAME);
+    if (composite->init != NULL)
+        composite->init();
+
+    stages[0].job = &jobs[0];
+    stages[0].status = stage_job(&stages[0]);
+
+    for (k = 0; k < num_jobs; k++)
+    {
+        st = &stages[k % 2];
+        if (loader_running)
+        {
+            pthread_join(loader, NULL);
+            loader_running = FALSE;
+        }
+
+        /* the next job is staged while this one is composited */
+        if (k + 1 < num_jobs)
+        {
+            stages[(k + 1) % 2].job = &jobs[k + 1];
+            if (pthread_create(&loader, NULL, stage_thread, &stages[(k + 1) % 2]) == 0)
+                loader_running = TRUE;
+            else
+                stages[(k + 1) % 2].status = stage_job(&stages[(k + 1) % 2]);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (st->status != SUCCESS)
+        {
+            result = "staging_failed";
+        }
+        else
+        {
+            snprintf (msg_str, sizeof(msg_str), "job %d of %d: tile %d from %s\n",
+                      k + 1, num_jobs, st->job->tile_id, st->job->in_path);
+            LOG_MESSAGE (msg_str, FUNC_NAME);
+
+            status = run_staged_job(st, composite, arenas, n_threads);
+            if (status == SUCCESS)
+            {
+                result = "done";
+                n_done++;
+            }
+            else
+            {
+                result = "compositing_failed";
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        fprintf(fp_results, "%d,%d,%s,%d,%.3f\n", k, st->job->tile_id, result,
+                (st->status == SUCCESS) ? st->num_scenes : 0,
+                (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9);
+        fflush(fp_results);
+    }
+
+    if (composite->finalize != NULL)
+        composite->finalize();
+
+    for (i = 0; i < 2; i++)
+    {
+        free_2d_array((void **)stages[i].scene_list);
+        free(stages[i].sdate);
+    }
+    free(arenas);
+    free(jobs);
+
+    snprintf (msg_str, sizeof(msg_str), "batch finished, %d of %d jobs done, results in %s\n",
+              n_done, num_jobs, results_path);
+    LOG_MESSAGE (msg_str, FUNC_NAME);
+
+    if (fclose(fp_results) != 0)
+        RETURN_ERROR("Writing the results file", FUNC_NAME, ERROR);
+
+    if (n_done < num_jobs)
+        RETURN_ERROR("Some jobs of the batch failed", FUNC_NAME, ERROR);
+
+    return SUCCESS;
+}
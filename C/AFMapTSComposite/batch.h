@@ -0,0 +1,29 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "const.h"
+#include "utilities.h"
+
+/* one line of a job file: <ARD folder> <tile id> <lower-upper>[,...] <output folder> */
+typedef struct {
+    char in_path[MAX_STR_LEN];    /* ARD image directory                    */
+    char out_path[MAX_STR_LEN];   /* directory for the composites           */
+    int tile_id;
+    run_opts_t opts;              /* settings of the batch, windows of the job */
+} tile_job_t;
+
+int read_job_file
+(
+    char *job_path,           /* I: job file                                */
+    run_opts_t *opts,         /* I: settings shared by all jobs             */
+    tile_job_t **jobs,        /* O: jobs in file order, allocated here      */
+    int *num_jobs             /* O: number of jobs                          */
+);
+
+int run_batch
+(
+    run_opts_t *opts,         /* I: settings of the batch, jobs= and results= */
+    int method                /* I: compositing method                      */
+);
+
+#endif // BATCH_H
@@ -0,0 +1,433 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "const.h"
+#include "utilities.h"
+#include "2d_array.h"
+#include "band_layout.h"
+#include "misc.h"
+#include "compositing.h"
+#include "block_scheduler.h"
+
+/* blocks dealt to a worker; the owner takes them from the head, in row
+   order, and idle workers steal from the tail */
+typedef struct {
+    int *blocks;                /* block indices                          */
+    int head;                   /* next block of the owner                */
+    int tail;                   /* one past the last block                */
+    pthread_mutex_t lock;
+} block_deque_t;
+
+typedef struct {
+    scanline_source_t *src;
+    run_opts_t *opts;
+    int method;
+    int block_rows;
+    int n_blocks;
+    int n_workers;
+    int image_bands;
+    int concurrent;             /* TRUE if rows may be read at once       */
+    block_deque_t *deques;      /* one per worker                         */
+    scratch_arena_t *arenas;    /* one per worker                         */
+    short int ***out;           /* composites of every block, NULL until
+                                   the block is done                      */
+    int max_ahead;              /* blocks a worker may start ahead of the
+                                   next one to write                      */
+    int next_written;           /* next block to hand to write_block      */
+    int failed;                 /* TRUE stops the workers and the writer  */
+    pthread_mutex_t lock;       /* guards out, next_written and failed    */
+    pthread_cond_t done;        /* a block was composited or written, or a
+                                   task failed                            */
+    pthread_mutex_t read_lock;  /* one reader at a time if not concurrent */
+} block_scheduler_t;
+
+typedef struct {
+    block_scheduler_t *sched;
+    int id;
+} block_worker_t;
+
+/******************************************************************************
+MODULE:  take_block
+
+PURPOSE:  Next block for a worker: the head of its own deque, otherwise the
+          tail of the fullest other deque
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+-1              every deque is empty
+block           index of the block to composite
+******************************************************************************/
+static int take_block
+(
+    block_scheduler_t *sched,   /* I/O: scheduler                         */
+    int id                      /* I: worker                              */
+)
+{
+    block_deque_t *dq = &sched->deques[id];
+    int b = -1;
+    int w, victim, most;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail)
+        b = dq->blocks[dq->head++];
+    pthread_mutex_unlock(&dq->lock);
+
+    /* no block is ever added, so a deque seen empty stays empty */
+    while (b < 0)
+    {
+        victim = -1;
+        most = 0;
+        for (w = 0; w < sched->n_workers; w++)
+        {
+            dq = &sched->deques[w];
+            pthread_mutex_lock(&dq->lock);
+            if (dq->tail - dq->head > most)
+            {
+                most = dq->tail - dq->head;
+                victim = w;
+            }
+            pthread_mutex_unlock(&dq->lock);
+        }
+        if (victim < 0)
+            break;
+
+        dq = &sched->deques[victim];
+        pthread_mutex_lock(&dq->lock);
+        if (dq->head < dq->tail)
+            b = dq->blocks[--dq->tail];
+        pthread_mutex_unlock(&dq->lock);
+    }
+
+    return b;
+}
+
+/******************************************************************************
+MODULE:  composite_block
+
+PURPOSE:  Read the rows of a block one at a time and composite every window
+          of each row into the block's output
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           reading or compositing a row failed
+SUCCESS         No errors encountered
+******************************************************************************/
+static int composite_block
+(
+    block_scheduler_t *sched,   /* I/O: scheduler                         */
+    int id,                     /* I: worker                              */
+    int block,                  /* I: block to composite                  */
+    scanline_slot_t *slot,      /* I/O: scanline buffers of the worker    */
+    short int **out             /* O: composites of the block             */
+)
+{
+    int first_row = block * sched->block_rows;
+    int n_rows = sched->src->num_lines - first_row;
+    int samples = sched->src->num_samples;
+    int r, w, b;
+    int status;
+    short int *row_out[MAX_IMAGE_BANDS];
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "composite_block";
+
+    if (n_rows > sched->block_rows)
+        n_rows = sched->block_rows;
+
+    for (r = 0; r < n_rows; r++)
+    {
+        if (sched->concurrent == FALSE)
+            pthread_mutex_lock(&sched->read_lock);
+        status = read_scanline(sched->src, slot, first_row + r);
+        if (sched->concurrent == FALSE)
+            pthread_mutex_unlock(&sched->read_lock);
+        if (status != SUCCESS)
+        {
+            sprintf(errmsg, "Error in reading ARD data for row_%d", first_row + r);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        for (w = 0; w < sched->opts->n_windows; w++)
+        {
+            for (b = 0; b < sched->image_bands; b++)
+                row_out[b] = out[w * sched->image_bands + b] + (size_t)r * samples;
+
+            status = compositing_scanline(slot->buf, slot->valid_date_array,
+                                          slot->valid_scene_count,
+                                          sched->opts->window_lower[w],
+                                          sched->opts->window_upper[w], samples,
+                                          sched->src->num_scenes, row_out,
+                                          sched->method, &sched->arenas[id], 1);
+            if (status != SUCCESS)
+            {
+                sprintf(errmsg, "Error in compositing for row_%d", first_row + r);
+                RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+            }
+        }
+    }
+
+    return SUCCESS;
+}
+
+/******************************************************************************
+MODULE:  block_worker
+
+PURPOSE:  Worker thread: composite blocks until none is left, handing each
+          to the writer as soon as it is done
+
+RETURN VALUE: NULL
+
+NOTES: a block max_ahead or more past the next one to write waits for the
+       writer before it is composited. The block the writer waits for is
+       always taken by a worker that can go on: a deque holds its blocks
+       in row order and its owner only steals once it is empty, so a
+       worker waiting on a far block never holds up a nearer one.
+******************************************************************************/
+static void *block_worker
+(
+    void *arg                   /* I: scheduler and worker index          */
+)
+{
+    block_scheduler_t *sched = ((block_worker_t *)arg)->sched;
+    int id = ((block_worker_t *)arg)->id;
+    scanline_slot_t *slot;
+    short int **out;
+    int block;
+    int stop;
+    int status = SUCCESS;
+
+    slot = allocate_scanline_slots(sched->src, 1);
+    if (slot == NULL)
+        status = ERROR;
+
+    while ((status == SUCCESS) && ((block = take_block(sched, id)) >= 0))
+    {
+        pthread_mutex_lock(&sched->lock);
+        while ((block - sched->next_written >= sched->max_ahead)
+               && (sched->failed == FALSE))
+            pthread_cond_wait(&sched->done, &sched->lock);
+        stop = sched->failed;
+        pthread_mutex_unlock(&sched->lock);
+        if (stop == TRUE)
+            break;
+
+        out = (short int **)allocate_2d_array(sched->opts->n_windows * sched->image_bands,
+                                              sched->block_rows * sched->src->num_samples,
+                                              sizeof(short int));
+        if (out == NULL)
+        {
+            status = ERROR;
+            break;
+        }
+
+        status = composite_block(sched, id, block, slot, out);
+        if (status != SUCCESS)
+        {
+            free_2d_array((void **)out);
+            break;
+        }
+
+        pthread_mutex_lock(&sched->lock);
+        sched->out[block] = out;
+        pthread_cond_broadcast(&sched->done);
+        pthread_mutex_unlock(&sched->lock);
+    }
+
+    if (status != SUCCESS)
+    {
+        pthread_mutex_lock(&sched->lock);
+        sched->failed = TRUE;
+        pthread_cond_broadcast(&sched->done);
+        pthread_mutex_unlock(&sched->lock);
+    }
+
+    if (slot != NULL)
+        free_scanline_slots(slot, 1);
+
+    return NULL;
+}
+
+/******************************************************************************
+MODULE:  composite_row_blocks
+
+PURPOSE:  Composite a whole tile as tasks of block_rows rows, each read and
+          composited by one worker, and hand the blocks to write_block in
+          row order
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           memory, a thread, a read, the compositing or the writer failed
+SUCCESS         No errors encountered
+
+NOTES: blocks are dealt round-robin, so every worker starts near the top of
+       the tile and the writer, running on the calling thread, rarely waits;
+       a worker whose deque runs dry steals from the tail of the fullest
+       one, which evens out rows of very different cost (cloudy rows, rows
+       that reach the robust fitter). A block waits in memory from the time
+       it is composited until the blocks above it are written; the calling
+       thread only hands it to write_block, which may queue it for another
+       thread rather than write it. No worker starts a block n_workers +
+       write_depth or more past the next one to write, so a stalled row
+       near the top holds at most that many blocks in memory whatever the
+       height of the tile.
+******************************************************************************/
+int composite_row_blocks
+(
+    scanline_source_t *src,     /* I/O: scanline source                   */
+    run_opts_t *opts,           /* I: compositing windows                 */
+    int method,                 /* I: compositing method                  */
+    int block_rows,             /* I: rows of a task                      */
+    int n_workers,              /* I: worker threads                      */
+    scratch_arena_t *arenas,    /* I/O: scratch memory, one per worker    */
+    block_writer_t write_block, /* I: ordered writer                      */
+    void *writer_arg            /* I/O: handed to write_block             */
+)
+{
+    block_scheduler_t sched;
+    block_worker_t *workers = NULL;
+    pthread_t *threads = NULL;
+    int n_started = 0;
+    int per_worker;
+    int b, w, n_rows;
+    int status = SUCCESS;
+    char FUNC_NAME[] = "composite_row_blocks";
+
+    sched.src = src;
+    sched.opts = opts;
+    sched.method = method;
+    sched.block_rows = block_rows;
+    sched.n_blocks = (src->num_lines + block_rows - 1) / block_rows;
+    sched.n_workers = n_workers;
+    sched.image_bands = get_band_layout()->image_bands;
+    sched.concurrent = scanline_source_concurrent(src);
+    sched.arenas = arenas;
+    sched.max_ahead = n_workers + opts->write_depth;
+    sched.next_written = 0;
+    sched.failed = FALSE;
+
+    per_worker = (sched.n_blocks + n_workers - 1) / n_workers;
+    sched.deques = (block_deque_t *)calloc(n_workers, sizeof(block_deque_t));
+    sched.out = (short int ***)calloc(sched.n_blocks, sizeof(short int **));
+    workers = (block_worker_t *)malloc(n_workers * sizeof(block_worker_t));
+    threads = (pthread_t *)malloc(n_workers * sizeof(pthread_t));
+    if ((sched.deques == NULL) || (sched.out == NULL) || (workers == NULL)
+        || (threads == NULL))
+    {
+        free(sched.deques);
+        free(sched.out);
+        free(workers);
+        free(threads);
+        RETURN_ERROR("Allocating scheduler memory", FUNC_NAME, ERROR);
+    }
+
+    for (w = 0; w < n_workers; w++)
+    {
+        sched.deques[w].blocks = (int *)malloc(per_worker * sizeof(int));
+        if (sched.deques[w].blocks == NULL)
+        {
+            status = ERROR;
+            break;
+        }
+        pthread_mutex_init(&sched.deques[w].lock, NULL);
+    }
+    if (status != SUCCESS)
+    {
+        while (--w >= 0)
+        {
+            free(sched.deques[w].blocks);
+            pthread_mutex_destroy(&sched.deques[w].lock);
+        }
+        free(sched.deques);
+        free(sched.out);
+        free(workers);
+        free(threads);
+        RETURN_ERROR("Allocating scheduler deques", FUNC_NAME, ERROR);
+    }
+
+    for (b = 0; b < sched.n_blocks; b++)
+    {
+        w = b % n_workers;
+        sched.deques[w].blocks[sched.deques[w].tail++] = b;
+    }
+
+    pthread_mutex_init(&sched.lock, NULL);
+    pthread_cond_init(&sched.done, NULL);
+    pthread_mutex_init(&sched.read_lock, NULL);
+
+    for (w = 0; w < n_workers; w++)
+    {
+        workers[w].sched = &sched;
+        workers[w].id = w;
+        if (pthread_create(&threads[w], NULL, block_worker, &workers[w]) != 0)
+        {
+            ERROR_MESSAGE("Starting a block worker", FUNC_NAME);
+            pthread_mutex_lock(&sched.lock);
+            sched.failed = TRUE;
+            pthread_cond_broadcast(&sched.done);
+            pthread_mutex_unlock(&sched.lock);
+            status = ERROR;
+            break;
+        }
+        n_started++;
+    }
+
+    /* the ordered writer */
+    for (b = 0; (status == SUCCESS) && (b < sched.n_blocks); b++)
+    {
+        pthread_mutex_lock(&sched.lock);
+        while ((sched.out[b] == NULL) && (sched.failed == FALSE))
+            pthread_cond_wait(&sched.done, &sched.lock);
+        if (sched.out[b] == NULL)
+            status = ERROR;
+        pthread_mutex_unlock(&sched.lock);
+        if (status != SUCCESS)
+            break;
+
+        n_rows = src->num_lines - b * block_rows;
+        if (n_rows > block_rows)
+            n_rows = block_rows;
+        status = write_block(writer_arg, b * block_rows, n_rows, sched.out[b]);
+        free_2d_array((void **)sched.out[b]);
+        if (status != SUCCESS)
+            ERROR_MESSAGE("Writing a block of composites", FUNC_NAME);
+
+        pthread_mutex_lock(&sched.lock);
+        sched.out[b] = NULL;
+        sched.next_written = b + 1;
+        if (status != SUCCESS)
+            sched.failed = TRUE;
+        pthread_cond_broadcast(&sched.done);
+        pthread_mutex_unlock(&sched.lock);
+    }
+
+    for (w = 0; w < n_started; w++)
+        pthread_join(threads[w], NULL);
+
+    /* blocks composited after a failure were never written */
+    for (b = 0; b < sched.n_blocks; b++)
+        if (sched.out[b] != NULL)
+            free_2d_array((void **)sched.out[b]);
+
+    for (w = 0; w < n_workers; w++)
+    {
+        free(sched.deques[w].blocks);
+        pthread_mutex_destroy(&sched.deques[w].lock);
+    }
+    pthread_mutex_destroy(&sched.lock);
+    pthread_cond_destroy(&sched.done);
+    pthread_mutex_destroy(&sched.read_lock);
+    free(sched.deques);
+    free(sched.out);
+    free(workers);
+    free(threads);
+
+    if (status != SUCCESS)
+        RETURN_ERROR("Compositing the tile by row blocks", FUNC_NAME, ERROR);
+
+    return SUCCESS;
+}
@@ -0,0 +1,31 @@
+#ifndef BLOCK_SCHEDULER_H
+#define BLOCK_SCHEDULER_H
+
+#include "prefetch.h"
+#include "scratch.h"
+#include "utilities.h"
+
+/* takes the composites of rows first_row to first_row + n_rows - 1, called
+   in row order; out[w * image_bands + b] holds band b of window w as
+   n_rows x samples values */
+typedef int (*block_writer_t)
+(
+    void *arg,                  /* I/O: what the writer was given         */
+    int first_row,              /* I: first row of the block              */
+    int n_rows,                 /* I: rows in the block                   */
+    short int **out             /* I: composites of the block             */
+);
+
+int composite_row_blocks
+(
+    scanline_source_t *src,     /* I/O: scanline source                   */
+    run_opts_t *opts,           /* I: compositing windows                 */
+    int method,                 /* I: compositing method                  */
+    int block_rows,             /* I: rows of a task                      */
+    int n_workers,              /* I: worker threads                      */
+    scratch_arena_t *arenas,    /* I/O: scratch memory, one per worker    */
+    block_writer_t write_block, /* I: ordered writer                      */
+    void *writer_arg            /* I/O: handed to write_block             */
+);
+
+#endif // BLOCK_SCHEDULER_H
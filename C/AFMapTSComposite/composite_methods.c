@@ -0,0 +1,246 @@
+#include <stdio.h>
+
+#include "const.h"
+#include "utilities.h"
+#include "misc.h"
+#include "compositing.h"
+#include "robust_fit.h"
+#include "fit_lanes.h"
+#include "composite_methods.h"
+
+/* a pixel of the methods without fitting keeps a copy or two of a band */
+#define SERIES_SCRATCH_PER_SCENE 16
+
+/******************************************************************************
+MODULE:  fit_tiers_init
+
+PURPOSE:  Start the path counts of the fitting methods from zero
+
+RETURN VALUE: None
+******************************************************************************/
+static void fit_tiers_init(void)
+{
+    reset_fit_tier_counts();
+}
+
+/******************************************************************************
+MODULE:  fit_tiers_finalize
+
+PURPOSE:  Log how many pixels took every path of the fitting methods
+
+RETURN VALUE: None
+******************************************************************************/
+static void fit_tiers_finalize(void)
+{
+    char FUNC_NAME[] = "fit_tiers_finalize";
+    char msg_str[MAX_STR_LEN];
+    long count[FIT_TIERS];
+
+    get_fit_tier_counts(count);
+    snprintf(msg_str, sizeof(msg_str), "fitting paths: no obs=%ld median=%ld "
+             "whole window=%ld outliers removed=%ld\n",
+             count[FIT_TIER_NOOBS], count[FIT_TIER_MEDIAN],
+             count[FIT_TIER_WINDOW], count[FIT_TIER_SUBSET]);
+    LOG_MESSAGE(msg_str, FUNC_NAME);
+}
+
+/* the pixel kernels, fixing the options every method runs with; what a
+   kernel does not take is cast to void */
+
+static int fit_weighted_pixel(short int **buf, int *valid_date_array,
+                              int valid_date_count, int lower_ordinal,
+                              int upper_ordinal, int i_col,
+                              short int **out_compositing, int b_diagnosis,
+                              Output_t *rec_c, scratch_arena_t *arena)
+{
+    return fitting_compositing(buf, valid_date_array, valid_date_count,
+                               lower_ordinal, upper_ordinal, i_col,
+                               out_compositing, TRUE, TRUE, b_diagnosis,
+                               rec_c, arena);
+}
+
+static int fit_normal_pixel(short int **buf, int *valid_date_array,
+                            int valid_date_count, int lower_ordinal,
+                            int upper_ordinal, int i_col,
+                            short int **out_compositing, int b_diagnosis,
+                            Output_t *rec_c, scratch_arena_t *arena)
+{
+    return fitting_compositing(buf, valid_date_array, valid_date_count,
+                               lower_ordinal, upper_ordinal, i_col,
+                               out_compositing, TRUE, FALSE, b_diagnosis,
+                               rec_c, arena);
+}
+
+static int fit_hot_pixel(short int **buf, int *valid_date_array,
+                         int valid_date_count, int lower_ordinal,
+                         int upper_ordinal, int i_col,
+                         short int **out_compositing, int b_diagnosis,
+                         Output_t *rec_c, scratch_arena_t *arena)
+{
+    return fitting_compositing(buf, valid_date_array, valid_date_count,
+                               lower_ordinal, upper_ordinal, i_col,
+                               out_compositing, FALSE, FALSE, b_diagnosis,
+                               rec_c, arena);
+}
+
+static int hot_pixel(short int **buf, int *valid_date_array,
+                     int valid_date_count, int lower_ordinal,
+                     int upper_ordinal, int i_col,
+                     short int **out_compositing, int b_diagnosis,
+                     Output_t *rec_c, scratch_arena_t *arena)
+{
+    (void)b_diagnosis;
+    (void)rec_c;
+    (void)arena;
+    return hot_compositing(buf, valid_date_array, valid_date_count,
+                           lower_ordinal, upper_ordinal, i_col,
+                           out_compositing);
+}
+
+static int average_pixel(short int **buf, int *valid_date_array,
+                         int valid_date_count, int lower_ordinal,
+                         int upper_ordinal, int i_col,
+                         short int **out_compositing, int b_diagnosis,
+                         Output_t *rec_c, scratch_arena_t *arena)
+{
+    (void)b_diagnosis;
+    (void)rec_c;
+    (void)arena;
+    return average_compositing(buf, valid_date_array, valid_date_count,
+                               lower_ordinal, upper_ordinal, i_col,
+                               out_compositing);
+}
+
+static int modified_hot_pixel(short int **buf, int *valid_date_array,
+                              int valid_date_count, int lower_ordinal,
+                              int upper_ordinal, int i_col,
+                              short int **out_compositing, int b_diagnosis,
+                              Output_t *rec_c, scratch_arena_t *arena)
+{
+    (void)b_diagnosis;
+    (void)rec_c;
+    return modified_hot_compositing(buf, valid_date_array, valid_date_count,
+                                    lower_ordinal, upper_ordinal, i_col,
+                                    out_compositing, arena);
+}
+
+static int medium_pixel(short int **buf, int *valid_date_array,
+                        int valid_date_count, int lower_ordinal,
+                        int upper_ordinal, int i_col,
+                        short int **out_compositing, int b_diagnosis,
+                        Output_t *rec_c, scratch_arena_t *arena)
+{
+    (void)b_diagnosis;
+    (void)rec_c;
+    return medium_compositing(buf, valid_date_array, valid_date_count,
+                              lower_ordinal, upper_ordinal, i_col,
+                              out_compositing, arena);
+}
+
+static int count_pixel(short int **buf, int *valid_date_array,
+                       int valid_date_count, int lower_ordinal,
+                       int upper_ordinal, int i_col,
+                       short int **out_compositing, int b_diagnosis,
+                       Output_t *rec_c, scratch_arena_t *arena)
+{
+    (void)b_diagnosis;
+    (void)rec_c;
+    return valid_obs_count(buf, valid_date_array, valid_date_count,
+                           lower_ordinal, upper_ordinal, i_col,
+                           out_compositing, arena);
+}
+
+/* the scanline kernels of the fitting methods */
+
+static int fit_weighted_lanes(short int **buf, int **valid_datearray,
+                              int *valid_datecount, int lower_ordinal,
+                              int upper_ordinal, int first_col, int lanes,
+                              int num_scenes, short int **out_compositing,
+                              int b_diagnosis, Output_t *rec_c,
+                              scratch_arena_t *arena)
+{
+    return fitting_compositing_lanes(buf, valid_datearray, valid_datecount,
+                                     lower_ordinal, upper_ordinal, first_col,
+                                     lanes, num_scenes, out_compositing,
+                                     TRUE, TRUE, b_diagnosis, rec_c, arena);
+}
+
+static int fit_normal_lanes(short int **buf, int **valid_datearray,
+                            int *valid_datecount, int lower_ordinal,
+                            int upper_ordinal, int first_col, int lanes,
+                            int num_scenes, short int **out_compositing,
+                            int b_diagnosis, Output_t *rec_c,
+                            scratch_arena_t *arena)
+{
+    return fitting_compositing_lanes(buf, valid_datearray, valid_datecount,
+                                     lower_ordinal, upper_ordinal, first_col,
+                                     lanes, num_scenes, out_compositing,
+                                     TRUE, FALSE, b_diagnosis, rec_c, arena);
+}
+
+static int fit_hot_lanes(short int **buf, int **valid_datearray,
+                         int *valid_datecount, int lower_ordinal,
+                         int upper_ordinal, int first_col, int lanes,
+                         int num_scenes, short int **out_compositing,
+                         int b_diagnosis, Output_t *rec_c,
+                         scratch_arena_t *arena)
+{
+    return fitting_compositing_lanes(buf, valid_datearray, valid_datecount,
+                                     lower_ordinal, upper_ordinal, first_col,
+                                     lanes, num_scenes, out_compositing,
+                                     FALSE, FALSE, b_diagnosis, rec_c, arena);
+}
+
+/* a pixel with fewer than MIN_SAMPLE clear observations in the window gets
+   the median of its whole series from the fitting methods, so their scenes
+   outside the window are not pruned */
+static const composite_method_t composite_methods[] =
+{
+    {1, "fitting-weighted", SCRATCH_BYTES_PER_SCENE, FALSE, fit_tiers_init,
+     fit_weighted_pixel, fit_weighted_lanes, FIT_LANES, fit_tiers_finalize},
+    {2, "fitting-normal", SCRATCH_BYTES_PER_SCENE, FALSE, fit_tiers_init,
+     fit_normal_pixel, fit_normal_lanes, FIT_LANES, fit_tiers_finalize},
+    {3, "hot", SERIES_SCRATCH_PER_SCENE, TRUE, NULL,
+     hot_pixel, NULL, 1, NULL},
+    {4, "average", SERIES_SCRATCH_PER_SCENE, TRUE, NULL,
+     average_pixel, NULL, 1, NULL},
+    {5, "fitting-hot", SCRATCH_BYTES_PER_SCENE, FALSE, fit_tiers_init,
+     fit_hot_pixel, fit_hot_lanes, FIT_LANES, fit_tiers_finalize},
+    {6, "modified-hot", SERIES_SCRATCH_PER_SCENE, TRUE, NULL,
+     modified_hot_pixel, NULL, 1, NULL},
+    {7, "medium", SERIES_SCRATCH_PER_SCENE, TRUE, NULL,
+     medium_pixel, NULL, 1, NULL},
+    {8, "valid-count", SERIES_SCRATCH_PER_SCENE, TRUE, NULL,
+     count_pixel, NULL, 1, NULL}
+};
+
+/******************************************************************************
+MODULE:  find_composite_method
+
+PURPOSE:  Look up a compositing method by its method= value
+
+RETURN VALUE:
+Type = const composite_method_t *
+Value           Description
+-----           -----------
+NULL            no such method
+pointer         the method's entry of the registry
+
+NOTES: a new method is a kernel and an entry of composite_methods[]; main
+       and the scanline loop go through this table only
+******************************************************************************/
+const composite_method_t *find_composite_method
+(
+    int id                      /* I: method= value                       */
+)
+{
+    int i;
+
+    for (i = 0; i < (int)(sizeof(composite_methods) / sizeof(composite_methods[0])); i++)
+    {
+        if (composite_methods[i].id == id)
+            return &composite_methods[i];
+    }
+
+    return NULL;
+}
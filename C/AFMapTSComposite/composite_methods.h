@@ -0,0 +1,61 @@
+#ifndef COMPOSITE_METHODS_H
+#define COMPOSITE_METHODS_H
+
+#include "misc.h"
+#include "scratch.h"
+
+/* kernel of one pixel; buf holds a series of short int per image band */
+typedef int (*composite_pixel_kernel_t)
+(
+    short int **buf,            /* I: band series of the pixel            */
+    int *valid_date_array,      /* I: valid dates                         */
+    int valid_date_count,       /* I: number of valid dates               */
+    int lower_ordinal,          /* I: lower ordinal date                  */
+    int upper_ordinal,          /* I: upper ordinal date                  */
+    int i_col,                  /* I: column of out_compositing to fill   */
+    short int **out_compositing, /* O: compositing results of every band  */
+    int b_diagnosis,            /* I: TRUE to fill rec_c                  */
+    Output_t *rec_c,            /* O: fitting diagnosis                   */
+    scratch_arena_t *arena      /* I/O: scratch memory, reset by the caller */
+);
+
+/* kernel of up to lanes pixels of a scanline at once */
+typedef int (*composite_lanes_kernel_t)
+(
+    short int **buf,            /* I: scanline time series, pixel c of band b
+                                      at buf[b] + c * num_scenes          */
+    int **valid_datearray,      /* I: valid dates of every lane           */
+    int *valid_datecount,       /* I: number of valid dates of every lane */
+    int lower_ordinal,          /* I: lower ordinal date                  */
+    int upper_ordinal,          /* I: upper ordinal date                  */
+    int first_col,              /* I: column of the first lane            */
+    int lanes,                  /* I: pixels in the batch                 */
+    int num_scenes,             /* I: the number of scenes                */
+    short int **out_compositing, /* O: compositing results of every band  */
+    int b_diagnosis,            /* I: TRUE to fill rec_c                  */
+    Output_t *rec_c,            /* O: fitting diagnosis of every lane     */
+    scratch_arena_t *arena      /* I/O: scratch memory of the calling thread */
+);
+
+/* a compositing method: the method= value of the variables file and what
+   running it takes; hooks that a method does not need are NULL */
+typedef struct
+{
+    int id;                     /* method= value                          */
+    const char *name;           /* for logging                            */
+    int scratch_per_scene;      /* scratch bytes a thread needs per scene */
+    int prunable;               /* TRUE if no scene outside the window can
+                                   change the composite                   */
+    void (*init)(void);         /* once before the first pixel            */
+    composite_pixel_kernel_t pixel_kernel;
+    composite_lanes_kernel_t lanes_kernel; /* scanlines, NULL for pixel by pixel */
+    int lanes;                  /* pixels lanes_kernel takes at a time    */
+    void (*finalize)(void);     /* once after the last pixel              */
+} composite_method_t;
+
+const composite_method_t *find_composite_method
+(
+    int id                      /* I: method= value                       */
+);
+
+#endif // COMPOSITE_METHODS_H
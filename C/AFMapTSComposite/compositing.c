@@ -1,3 +1,5 @@
+#include <string.h>
+#include <omp.h>
 #include <gsl/gsl_multifit.h>
 #include <gsl/gsl_vector.h>
 #include <gsl/gsl_matrix.h>
@@ -6,6 +8,16 @@
 #include "input.h"
 #include "utilities.h"
 #include "misc.h"
+#include "scratch.h"
+#include "hot_kernels.h"
+#include "median_select.h"
+#include "fit_lanes.h"
+#include "series_view.h"
+#include "composite_methods.h"
+#include "band_layout.h"
+
+/* pixels of the fitting methods by the path they took, see count_fit_tier */
+static long fit_tier_count[FIT_TIERS];
 
 /******************************************************************************
 MODULE:  greenband_test
@@ -34,7 +46,8 @@ int greenband_test
     float n_t,
     int *bl_ids,
     float *C0,
-    float *C1
+    float *C1,
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 )
 {
     char FUNC_NAME[] = "greenband_test";
@@ -43,10 +56,12 @@ int greenband_test
     float pred;
     int nums;
     float coefs[ROBUST_COEFFS];
+    int green = get_band_layout()->green;
+    size_t mark = scratch_mark(arena);
 
     nums = end - start + 1;
     /* Allocate memory */
-    x = (float **)allocate_2d_array(nums, ROBUST_COEFFS - 1, sizeof(float));
+    x = (float **)scratch_alloc_2d(arena, nums, ROBUST_COEFFS - 1, sizeof(float));
     if (x == NULL)
     {
         RETURN_ERROR("ERROR allocating x memory", FUNC_NAME, ERROR);
@@ -59,11 +74,14 @@ int greenband_test
 
     /******************************************************************/
     /*                                                                */
-    /* Do robust fitting for band 2 */
+    /* Do robust fitting for the green band */
     /*                                                                */
     /******************************************************************/
 
-    auto_robust_fit(x, clry, nums, start, 1, coefs);
+    if (auto_robust_fit(x, clry, nums, start, green, coefs, arena) != SUCCESS)
+    {
+        RETURN_ERROR("Calling auto_robust_fit", FUNC_NAME, ERROR);
+    }
 
     *C0 = coefs[0];
     *C1 = coefs[1];
@@ -78,7 +96,7 @@ int greenband_test
     for (i = 0; i < nums; i++)
     {
         pred = coefs[0] + coefs[1] * (float)clrx[i+start];
-        if (clry[1][i+start]-pred > (n_t * rmse))
+        if (clry[green][i+start]-pred > (n_t * rmse))
         {
             // int testy = clry[1][i+start];
             // int testx = clrx[i+start];
@@ -90,12 +108,7 @@ int greenband_test
         }
     }
 
-    /* Free allocated memory */
-    if (free_2d_array ((void **) x) != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: x\n", FUNC_NAME, ERROR);
-    }
-    x = NULL;
+    scratch_release(arena, mark);
 
     return (SUCCESS);
 }
@@ -127,7 +140,8 @@ int nirband_test
     float n_t,
     int *bl_ids,
     float *C0,
-    float *C1
+    float *C1,
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 )
 {
     char FUNC_NAME[] = "nirband_test";
@@ -136,10 +150,12 @@ int nirband_test
     float pred;
     int nums;
     float coefs[ROBUST_COEFFS];
+    int nir = get_band_layout()->nir;
+    size_t mark = scratch_mark(arena);
 
     nums = end - start + 1;
     /* Allocate memory */
-    x = (float **)allocate_2d_array(nums, ROBUST_COEFFS - 1, sizeof(float));
+    x = (float **)scratch_alloc_2d(arena, nums, ROBUST_COEFFS - 1, sizeof(float));
     if (x == NULL)
     {
         RETURN_ERROR("ERROR allocating x memory", FUNC_NAME, ERROR);
@@ -152,11 +168,14 @@ int nirband_test
 
     /******************************************************************/
     /*                                                                */
-    /* Do robust fitting for band 4 */
+    /* Do robust fitting for the nir band */
     /*                                                                */
     /******************************************************************/
 
-    auto_robust_fit(x, clry, nums, start, 3, coefs);
+    if (auto_robust_fit(x, clry, nums, start, nir, coefs, arena) != SUCCESS)
+    {
+        RETURN_ERROR("Calling auto_robust_fit", FUNC_NAME, ERROR);
+    }
 
     *C0 = coefs[0];
     *C1 = coefs[1];
@@ -171,7 +190,7 @@ int nirband_test
     for (i = 0; i < nums; i++)
     {
         pred = coefs[0] + coefs[1] * (float)clrx[i+start];
-        if (clry[3][i+start]-pred < -(n_t * rmse))
+        if (clry[nir][i+start]-pred < -(n_t * rmse))
         {
             bl_ids[i] = 1;
         }
@@ -181,12 +200,7 @@ int nirband_test
         }
     }
 
-    /* Free allocated memory */
-    if (free_2d_array ((void **) x) != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: x\n", FUNC_NAME, ERROR);
-    }
-    x = NULL;
+    scratch_release(arena, mark);
 
     return (SUCCESS);
 }
@@ -216,30 +230,29 @@ int average_compositing
     short int **out_compositing           /* O: outputted compositing results for four bands */
 )
 {
+    int image_bands = get_band_layout()->image_bands;
     int i, j;
-    double index_sum[TOTAL_IMAGE_BANDS];
+    double index_sum[MAX_IMAGE_BANDS];
     int valid_count_window= 0;
-    for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+    series_view_t view;
+    for(i = 0; i < image_bands; i++)
         index_sum[i] = 0;
 
+    series_view_window(buf, valid_date_array, valid_date_count, lower_ordinal,
+                       upper_ordinal, &view);
 
-    for(i = 0; i < valid_date_count; i++)
+    for(i = 0; i < view.count; i++)
     {
-        if((valid_date_array[i] > lower_ordinal - 1) && (valid_date_array[i] < upper_ordinal + 1))
+        for(j = 0; j < image_bands; j++)
         {
-            for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
-            {
-                index_sum[j] = index_sum[j] +  buf[j][i];
-            }
-            valid_count_window++;
-
+            index_sum[j] = index_sum[j] +  view.band[j][i];
         }
-
     }
+    valid_count_window = view.count;
 
     if(valid_count_window==0)
     {
-        for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+        for(i = 0; i < image_bands; i++)
         {
             out_compositing[i][i_col] = -9999;
         }
@@ -247,10 +260,12 @@ int average_compositing
     }
 
 
-    for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
+    for(j = 0; j < image_bands; j++)
     {
         out_compositing[j][i_col] = (short int)(index_sum[j] / valid_count_window);
     }
+
+    return SUCCESS;
 }
 
 /******************************************************************************
@@ -273,51 +288,48 @@ int median_compositing
     int *valid_date_array,      /* I: valid date time series               */
     int valid_date_count,       /* I: the number of valid dates               */
     int i_col,
-    short int **out_compositing           /* O: outputted compositing results for four bands */
+    short int **out_compositing,           /* O: outputted compositing results for four bands */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 )
 {
     char FUNC_NAME[] = "median_compositing";
+    int image_bands = get_band_layout()->image_bands;
     short int *var;         /* pointer for allocation variable memory            */
+    short int var_m;        /* value at rank m                                   */
+    short int var_m1;       /* value at rank m - 1                               */
     int i, j, m;
 
     if (valid_date_count == 1)
     {
-        for (i = 0; i < TOTAL_IMAGE_BANDS; i++)
+        for (i = 0; i < image_bands; i++)
           out_compositing[i][i_col] = buf[i][0];
         return SUCCESS;
     }
 
-    var = malloc(valid_date_count * sizeof(short int));
+    var = scratch_alloc(arena, valid_date_count * sizeof(short int));
     if (var == NULL)
     {
         RETURN_ERROR ("Allocating var memory", FUNC_NAME, ERROR);
     }
 
-    for (i = 0; i < TOTAL_IMAGE_BANDS; i++)
+    for (i = 0; i < image_bands; i++)
     {
         for (j = 0; j < valid_date_count; j++)
         {
             var[j] = buf[i][j];
 
         }
-        quick_sort_float(var, 0, valid_date_count-1);
-//            for (j = 0; j < dim2_end; j++)
-//            {
-//               printf("%f\n", var[j]);
-//            }
         m = (valid_date_count) / 2;
+        select_short(var, valid_date_count, m, &var_m, &var_m1);
         if (valid_date_count % 2 == 0)
         {
-            //printf("%f\n", var[m-1]);
-           //printf("%f\n", var[m]);
-            out_compositing[i][i_col] = (short int)(var[m-1] + var[m]) / 2.0;
+            out_compositing[i][i_col] = (short int)(var_m1 + var_m) / 2.0;
         }
         else
-            out_compositing[i][i_col] = var[m];
+            out_compositing[i][i_col] = var_m;
 
     }
 
-    free(var);
     return SUCCESS;
 
 }
@@ -346,35 +358,24 @@ int hot_compositing
     short int **out_compositing           /* O: outputted compositing results for four bands */
 )
 {
+    int image_bands = get_band_layout()->image_bands;
     int i, j;
-    double wt;
-    double index_sum[TOTAL_IMAGE_BANDS];
-    for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+    double index_sum[MAX_IMAGE_BANDS];
+    for(i = 0; i < image_bands; i++)
         index_sum[i] = 0;
     double wt_sum = 0;
     int valid_count_window = 0;
 
-    for(i = 0; i < valid_date_count; i++)
-    {
-        if((valid_date_array[i] > lower_ordinal - 1) && (valid_date_array[i] < upper_ordinal + 1))
-        {
-            wt = (double)1.0/((buf[BLUE_INDEX][i] - 0.5 * buf[RED_INDEX][i]) * (buf[BLUE_INDEX][i] - 0.5 * buf[RED_INDEX][i]));
-            //wt = (float)1/(abs(buf[BLUE_INDEX][i] - 0.5 * buf[RED_INDEX][i]));
-            for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
-            {
-                index_sum[j] = index_sum[j] + buf[j][i] * wt;
-            }
-            wt_sum = wt_sum + wt;
-            valid_count_window++;
-        }
-    }
+    /* weights 1/(blue - 0.5 red)^2, vectorized when the CPU allows */
+    hot_weighted_sums(buf, valid_date_array, valid_date_count, lower_ordinal,
+                      upper_ordinal, index_sum, &wt_sum, &valid_count_window);
 
     /********************************************/
     /*    condition 1: zero valid observation   */
     /********************************************/
     if(valid_count_window==0)
     {
-        for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+        for(i = 0; i < image_bands; i++)
         {
             out_compositing[i][i_col] = -9999;
         }
@@ -385,7 +386,7 @@ int hot_compositing
     /*    condition 2: standard procedures      */
     /********************************************/
 
-    for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
+    for(j = 0; j < image_bands; j++)
     {
         out_compositing[j][i_col] = (short int)(index_sum[j] / wt_sum);
         //out_compositing[j][i_col] = (short int)valid_count_window;
@@ -417,70 +418,28 @@ int modified_hot_compositing
     int lower_ordinal,
     int upper_ordinal,
     int i_col,
-    short int **out_compositing           /* O: outputted compositing results for four bands */
+    short int **out_compositing,           /* O: outputted compositing results for four bands */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 )
 {
+    const band_layout_t *layout = get_band_layout();
+    int image_bands = layout->image_bands;
     int i, j;
-    int status;
-    double wt;
-    double wt_shadow;
-    double wt_cloud;
-    double index_sum[TOTAL_IMAGE_BANDS];
-    for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+    double index_sum[MAX_IMAGE_BANDS];
+    for(i = 0; i < image_bands; i++)
         index_sum[i] = 0;
     double wt_sum = 0;
     int valid_count_window = 0;
     short int** ts_subset;
-    short int* ts_subset_selected_shadow;
-    short int* ts_subset_selected_blue;
     short int variogram_shadow;
     short int medium_shadow;
+    series_view_t view;
 
-    char FUNC_NAME[] = "modified_hot_compositing";
-
-    ts_subset = (short int**)allocate_2d_array(TOTAL_IMAGE_BANDS, valid_date_count, sizeof(short int));
-    if(ts_subset == NULL)
-    {
-        RETURN_ERROR ("Allocating ts_subset memory", FUNC_NAME, ERROR);
-    }
-
-    ts_subset_selected_shadow = (short int*)malloc(valid_date_count*sizeof(short int));
-    if(ts_subset_selected_shadow == NULL)
-    {
-        RETURN_ERROR ("Allocating ts_subset_selected_shadow memory", FUNC_NAME, ERROR);
-    }
-
-    ts_subset_selected_blue = (short int*)malloc(valid_date_count*sizeof(short int));
-    if(ts_subset_selected_blue == NULL)
-    {
-        RETURN_ERROR ("Allocating ts_subset_selected_blue memory", FUNC_NAME, ERROR);
-    }
-
-
-    for(i = 0; i < valid_date_count; i++)
-    {
-        if((valid_date_array[i] > lower_ordinal - 1) && (valid_date_array[i] < upper_ordinal + 1))
-        {
-            for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
-            {
-                ts_subset[j][valid_count_window] = buf[j][i];
-                if(j == NIR_INDEX)
-                {
-                   //ts_subset_selected_shadow[valid_count_window] = (buf[BLUE_INDEX][i] + buf[RED_INDEX][i] + buf[GREEN_INDEX][i])/3;
-		   ts_subset_selected_shadow[valid_count_window] = buf[NIR_INDEX][i];
-                    //printf("%i\n", ts_subset_selected[valid_count_window]);
-                }
-                if(j == BLUE_INDEX)
-                {
-                    ts_subset_selected_blue[valid_count_window] = buf[BLUE_INDEX][i];
-                    //printf("%i\n", ts_subset_selected[valid_count_window]);
-                }
-            }
-
-            valid_count_window++;
-
-        }
-    }
+    /* the window is read in place, nothing below writes to it */
+    series_view_window(buf, valid_date_array, valid_date_count, lower_ordinal,
+                       upper_ordinal, &view);
+    ts_subset = view.band;
+    valid_count_window = view.count;
 
 
     /********************************************/
@@ -488,7 +447,7 @@ int modified_hot_compositing
     /********************************************/
     if(valid_count_window < 3)
     {
-        for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+        for(i = 0; i < image_bands; i++)
         {
             out_compositing[i][i_col] = -9999;
         }
@@ -502,7 +461,8 @@ int modified_hot_compositing
     //m = valid_count_window / 2;
 
     //medium_shadow = (ts_subset_selected[m] + ts_subset_selected[m - 1] + ts_subset_selected[m + 1])/3;
-    single_median_variogram(ts_subset_selected_shadow, 0, valid_count_window - 1, &variogram_shadow, &medium_shadow);
+    single_median_variogram(ts_subset[layout->nir], 0, valid_count_window - 1, &variogram_shadow, &medium_shadow,
+                            arena);
     //single_median_quantile(ts_subset_selected_blue, 0, valid_count_window - 1, &quantile_blue, &medium_blue);
     //single_median_variogram(ts_subset_selected_hot, 0, valid_count_window - 1, &variogram_hot, &medium_hot);
     //penalty_slope = - 9.0 / (1000.0 * variogram);
@@ -547,45 +507,18 @@ int modified_hot_compositing
     /********************************************/
     /*    condition 2: standard procedures      */
     /********************************************/
-    double ratio;
-    for(i = 0; i < valid_count_window; i++)
-    {
-         wt_cloud = (double) 1.0 / (ts_subset_selected_blue[i] * ts_subset_selected_blue[i]);
-
-         if (ts_subset_selected_shadow[i] < medium_shadow)
-         {
-             ratio = (double)ts_subset_selected_shadow[i] / medium_shadow;
-             wt_shadow = ratio * ratio * ratio * ratio;
-         }
-         else
-             wt_shadow = 1.0;
-
-         wt = wt_cloud * wt_shadow;
-        //wt = (float)1/(abs(buf[BLUE_INDEX][i] - 0.5 * buf[RED_INDEX][i]));
-        for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
-        {
-            index_sum[j] = index_sum[j] + ts_subset[j][i] * wt;
-        }
-        wt_sum = wt_sum + wt;
-    }
+    /* weights 1/blue^2, times (nir/median nir)^4 for the shadowed        */
+    /* observations, vectorized when the CPU allows                       */
+    modified_hot_weighted_sums(ts_subset, valid_count_window, medium_shadow,
+                               index_sum, &wt_sum);
 
 
-    for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
+    for(j = 0; j < image_bands; j++)
     {
         out_compositing[j][i_col] = (short int)(index_sum[j] / wt_sum);
         //out_compositing[j][i_col] = (short int)valid_count_window;
     }
 
-    /* free memory*/
-    status = free_2d_array(ts_subset);
-    if (status != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: ts_subset\n",
-                      FUNC_NAME, FAILURE);
-    }
-    free(ts_subset_selected_shadow);
-    free(ts_subset_selected_blue);
-
     return SUCCESS;
 
 }
@@ -611,67 +544,33 @@ int valid_obs_count
     int lower_ordinal,
     int upper_ordinal,
     int i_col,
-    short int **out_compositing           /* O: outputted compositing results for four bands */
+    short int **out_compositing,           /* O: outputted compositing results for four bands */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 )
 {
-    int index_sum[TOTAL_IMAGE_BANDS];
-    int i, j, status;
-    for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+    int image_bands = get_band_layout()->image_bands;
+    int index_sum[MAX_IMAGE_BANDS];
+    int i, j;
+    for(i = 0; i < image_bands; i++)
         index_sum[i] = 0;
     int valid_count_window = 0;
-    short int** ts_subset;
-    short int* ts_subset_selected;
+    series_view_t view;
 
+    (void)arena;    /* counting needs no scratch */
 
-    char FUNC_NAME[] = "modified_hot_compositing";
-
-    ts_subset = (short int**)allocate_2d_array(TOTAL_IMAGE_BANDS, valid_date_count, sizeof(short int));
-    if(ts_subset == NULL)
-    {
-        RETURN_ERROR ("Allocating ts_subset memory", FUNC_NAME, ERROR);
-    }
-
-    ts_subset_selected = (short int*)malloc(valid_date_count*sizeof(short int));
-    if(ts_subset_selected == NULL)
-    {
-        RETURN_ERROR ("Allocating ts_subset_selected memory", FUNC_NAME, ERROR);
-    }
-
-    for(i = 0; i < valid_date_count; i++)
-    {
-        if((valid_date_array[i] > lower_ordinal - 1) && (valid_date_array[i] < upper_ordinal + 1))
-        {
-            for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
-            {
-                ts_subset[j][valid_count_window] = buf[j][i];
-                if(j == NIR_INDEX)
-                {
-                    ts_subset_selected[valid_count_window] = buf[NIR_INDEX][i];
-                    //printf("%i\n", ts_subset_selected[valid_count_window]);
-                }
-            }
-            valid_count_window++;
-
-        }
-    }
+    series_view_window(buf, valid_date_array, valid_date_count, lower_ordinal,
+                       upper_ordinal, &view);
+    valid_count_window = view.count;
 
 
 
 
-    for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
+    for(j = 0; j < image_bands; j++)
     {
 
         out_compositing[j][i_col] = (short int)valid_count_window;
     }
 
-    status = free_2d_array((void **)ts_subset);
-    if (status != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: ts_subset\n",
-                      FUNC_NAME, FAILURE);
-    }
-    free(ts_subset_selected);
-
     return SUCCESS;
 
 }
@@ -698,49 +597,42 @@ int medium_compositing
     int lower_ordinal,
     int upper_ordinal,
     int i_col,
-    short int **out_compositing           /* O: outputted compositing results for four bands */
+    short int **out_compositing,           /* O: outputted compositing results for four bands */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 )
 {
-    int i, j, m;
-    int status;
+    const band_layout_t *layout = get_band_layout();
+    int image_bands = layout->image_bands;
+    int i, m;
     double wt;
-    double index_sum[TOTAL_IMAGE_BANDS];
-    for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+    double index_sum[MAX_IMAGE_BANDS];
+    for(i = 0; i < image_bands; i++)
         index_sum[i] = 0;
     double wt_sum = 0;
     int valid_count_window = 0;
     short int** ts_subset;
     short int* ts_subset_selected;
     int* ts_subset_selected_index;
+    int index_m;            /* window position of the nir median             */
+    int index_m1;           /* window position of the rank below it          */
+    series_view_t view;
     char FUNC_NAME[] = "medium_compositing";
 
-    ts_subset = (short int*)allocate_2d_array(TOTAL_IMAGE_BANDS, valid_date_count, sizeof(short int));
-    if(ts_subset == NULL)
-    {
-        RETURN_ERROR ("Allocating ts_subset memory", FUNC_NAME, ERROR);
-    }
+    series_view_window(buf, valid_date_array, valid_date_count, lower_ordinal,
+                       upper_ordinal, &view);
+    ts_subset = view.band;
+    valid_count_window = view.count;
 
-    for(i = 0; i < valid_date_count; i++)
-    {
-        if((valid_date_array[i] > lower_ordinal - 1) && (valid_date_array[i] < upper_ordinal + 1))
-        {
-            for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
-            {
-                ts_subset[j][valid_count_window] = buf[j][i];
-            }
-            valid_count_window++;
-        }
-    }
+    /* only the nir copy is needed, the selection reorders it */
 
-
-    ts_subset_selected = (short int*)malloc(valid_count_window*sizeof(short int));
+    ts_subset_selected = (short int*)scratch_alloc(arena, valid_count_window*sizeof(short int));
     if(ts_subset_selected == NULL)
     {
         RETURN_ERROR ("Allocating ts_subset_selected memory", FUNC_NAME, ERROR);
     }
 
-    ts_subset_selected_index = (int*)malloc(valid_count_window*sizeof(int));
-    if(ts_subset_selected == NULL)
+    ts_subset_selected_index = (int*)scratch_alloc(arena, valid_count_window*sizeof(int));
+    if(ts_subset_selected_index == NULL)
     {
         RETURN_ERROR ("Allocating ts_subset_selected_index memory", FUNC_NAME, ERROR);
     }
@@ -748,7 +640,7 @@ int medium_compositing
     for(i = 0; i < valid_count_window; i++)
     {
 
-        ts_subset_selected[i] = ts_subset[NIR_INDEX][i];
+        ts_subset_selected[i] = ts_subset[layout->nir][i];
         ts_subset_selected_index[i] = i;
             //printf("%i\n", ts_subset_selected[valid_count_window]);
     }
@@ -760,7 +652,7 @@ int medium_compositing
     /********************************************/
     if(valid_count_window == 0)
     {
-        for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+        for(i = 0; i < image_bands; i++)
         {
             out_compositing[i][i_col] = -9999;
         }
@@ -768,47 +660,125 @@ int medium_compositing
     }
 
 
-    quick_sort_shortint_index(ts_subset_selected, ts_subset_selected_index,
-                              0, valid_count_window - 1);
-//    for (j = 0; j < valid_count_window; j++)
-//    {
-//       printf("%i  %i\n", ts_subset_selected[j], ts_subset_selected_index[j]);
-//    }
-
      m = valid_count_window / 2;
+    /* equal nir values are ranked by window position */
+    select_short_index(ts_subset_selected, ts_subset_selected_index,
+                       valid_count_window, m, &index_m, &index_m1);
     if (valid_count_window % 2 == 0)
     {
-        //printf("%f\n", var[m-1]);
-       //printf("%f\n", var[m]);
-        for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+        for(i = 0; i < image_bands; i++)
         {
-           out_compositing[i][i_col] = (short int)((ts_subset[i][ts_subset_selected_index[m-1]] +
-                   ts_subset[i][ts_subset_selected_index[m]]) / 2);
+           out_compositing[i][i_col] = (short int)((ts_subset[i][index_m1] +
+                   ts_subset[i][index_m]) / 2);
         }
 
     }
     else
     {
-        for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+        for(i = 0; i < image_bands; i++)
         {
-           out_compositing[i][i_col] = (short int)(ts_subset[i][ts_subset_selected_index[m]]);
+           out_compositing[i][i_col] = (short int)(ts_subset[i][index_m]);
         }
         //printf("%i\n", out_compositing[i][i_col]);
     }
 
 
-    status = free_2d_array((void**)ts_subset);
-    if (status != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: ts_subset\n",
-                      FUNC_NAME, FAILURE);
-    }
-    free(ts_subset_selected);
-
     return SUCCESS;
 
 }
 
+/******************************************************************************
+MODULE:  count_fit_tier
+
+PURPOSE:  Count a pixel of the fitting methods under the path it took
+
+RETURN VALUE: None
+
+NOTES: the paths are counted for methods 1, 2 and 5, but only method 2
+       has a final robust fit: there a FIT_TIER_WINDOW pixel takes the
+       green and nir test fits instead of refitting those two bands.
+       Methods 1 and 5 cost the same on every path.
+******************************************************************************/
+void count_fit_tier
+(
+    int tier                    /* I: FIT_TIER_NOOBS to FIT_TIER_SUBSET    */
+)
+{
+    __atomic_fetch_add(&fit_tier_count[tier], 1, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+MODULE:  reset_fit_tier_counts
+
+PURPOSE:  Start the counts of count_fit_tier from zero
+
+RETURN VALUE: None
+******************************************************************************/
+void reset_fit_tier_counts(void)
+{
+    int i;
+
+    for (i = 0; i < FIT_TIERS; i++)
+        __atomic_store_n(&fit_tier_count[i], 0, __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+MODULE:  get_fit_tier_counts
+
+PURPOSE:  Pixels counted under every path of the fitting methods so far
+
+RETURN VALUE: None
+******************************************************************************/
+void get_fit_tier_counts
+(
+    long *counts                /* O: FIT_TIERS counts                     */
+)
+{
+    int i;
+
+    for (i = 0; i < FIT_TIERS; i++)
+        counts[i] = __atomic_load_n(&fit_tier_count[i], __ATOMIC_RELAXED);
+}
+
+/******************************************************************************
+MODULE:  compositing_pixel
+
+PURPOSE:  Run the compositing method on the time series of one pixel
+
+RETURN VALUE:
+Type = int (SUCCESS, ERROR or FAILURE)
+
+NOTES: rec_c is only filled by the fitting methods (1, 2 and 5); arena is
+       reset here, so nothing a kernel allocates outlives the pixel; an
+       unknown method leaves out_compositing as it is
+******************************************************************************/
+int compositing_pixel
+(
+    short int **buf,            /* I:  pixel-based time series           */
+    int *valid_date_array,      /* I: valid date time series               */
+    int valid_date_count,       /* I: the number of valid dates               */
+    int lower_ordinal,          /* I: lower ordinal date               */
+    int upper_ordinal,          /* I: upper_ordinal for temporal range of composition   */
+    int i_col,                  /* I: column of out_compositing to fill   */
+    short int **out_compositing,           /* O: outputted compositing results for four bands */
+    int method,                 /* I: the compositing method               */
+    int b_diagnosis,            /* I: TRUE to fill rec_c                   */
+    Output_t* rec_c,            /* O: fitting diagnosis                    */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
+)
+{
+    const composite_method_t *composite = find_composite_method(method);
+
+    scratch_reset(arena);
+
+    if (composite == NULL)
+        return SUCCESS;
+
+    return composite->pixel_kernel(buf, valid_date_array, valid_date_count,
+                                   lower_ordinal, upper_ordinal, i_col,
+                                   out_compositing, b_diagnosis, rec_c, arena);
+}
+
 /******************************************************************************
 MODULE:  compositing_scanline
 
@@ -821,6 +791,10 @@ HISTORY:
 Date        Programmer       Reason
 --------    ---------------  -------------------------------------
 05/02/2019   Su Ye         Original Development
+
+NOTES: the pixels of the row are shared out among n_threads OpenMP threads,
+       thread t working in arenas[t]; every pixel writes only its own column
+       of out_compositing, so the result does not depend on the thread count
 ******************************************************************************/
 int compositing_scanline
 (
@@ -832,91 +806,87 @@ int compositing_scanline
     int num_samples,                /* I: the pixel number in a row              */
     int num_scenes,                 /* I: the number of scenes               */
     short int **out_compositing,           /* O: outputted compositing results for four bands */
-    int method                       /* I: the compositing method{1 - fitting-weighted; 2 - fitting-normal; 3 - hot; 4 - average}  */
+    int method,                       /* I: the compositing method{1 - fitting-weighted; 2 - fitting-normal; 3 - hot; 4 - average}  */
+    scratch_arena_t *arenas,          /* I/O: scratch memory, one per thread */
+    int n_threads                     /* I: compositing threads              */
 )
 {
-    int  j;
+    int image_bands = get_band_layout()->image_bands;
     int i_col;
-    short int **tmp_buf;                   /* This is the image bands buffer, valid pixel only*/
+    int batch, n_batches;
+    int failed = FALSE;
+    const composite_method_t *composite;
     char FUNC_NAME[] = "compositing_scanline";
-    int b_diagnosis = FALSE;
-    Output_t* rec_c;
 
-    tmp_buf = (short int **) allocate_2d_array (TOTAL_IMAGE_BANDS, num_scenes, sizeof (short int));
-    if(tmp_buf == NULL)
-    {
-        RETURN_ERROR("ERROR allocating tmp_buf memory", FUNC_NAME, FAILURE);
-    }
+    /* the method is looked up once, not for every pixel */
+    composite = find_composite_method(method);
+    if (composite == NULL)
+        return SUCCESS;
 
-    rec_c = malloc(sizeof(Output_t));
-    if(rec_c == NULL)
+    /* methods with a scanline kernel go composite->lanes pixels at a time */
+    if (composite->lanes_kernel != NULL)
     {
-        RETURN_ERROR("ERROR allocating rec_c memory", FUNC_NAME, FAILURE);
-    }
+        n_batches = (num_samples + composite->lanes - 1) / composite->lanes;
 
-    for(i_col = 0; i_col < num_samples; i_col++)
-    {
-        for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
+        #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 4)
+        for (batch = 0; batch < n_batches; batch++)
         {
-           tmp_buf[j]  = buf[j] + i_col * num_scenes;
+            Output_t rec_lanes[FIT_LANES];
+            int first_col = batch * composite->lanes;
+            int lanes = num_samples - first_col;
+            if (lanes > composite->lanes)
+                lanes = composite->lanes;
+
+            if (composite->lanes_kernel(buf, valid_datearray_scanline + first_col,
+                                        valid_datecount_scanline + first_col,
+                                        lower_ordinal, upper_ordinal, first_col,
+                                        lanes, num_scenes, out_compositing,
+                                        FALSE, rec_lanes,
+                                        &arenas[omp_get_thread_num()]) != SUCCESS)
+            {
+                #pragma omp atomic write
+                failed = TRUE;
+            }
         }
 
-        /*weighted fitting*/
-        if (1==method)
-        {
-            fitting_compositing(tmp_buf, valid_datearray_scanline[i_col],
-                        valid_datecount_scanline[i_col], lower_ordinal,
-                        upper_ordinal, i_col, out_compositing, TRUE, TRUE, b_diagnosis, rec_c);
-        }
-        /*normal fitting*/
-        else if (2==method)
-        {
-            fitting_compositing(tmp_buf, valid_datearray_scanline[i_col],
-                        valid_datecount_scanline[i_col], lower_ordinal,
-                        upper_ordinal, i_col, out_compositing, TRUE, FALSE, b_diagnosis, rec_c);
-        }
-        else if (3==method)
-        {
-            hot_compositing(tmp_buf, valid_datearray_scanline[i_col],
-                        valid_datecount_scanline[i_col], lower_ordinal,
-                        upper_ordinal, i_col, out_compositing);
-        }
-        else if (4==method)
-        {
-            average_compositing(tmp_buf, valid_datearray_scanline[i_col],
-                        valid_datecount_scanline[i_col], lower_ordinal,
-                        upper_ordinal, i_col, out_compositing);
-        }
-        else if (5==method)
-        {
-            fitting_compositing(tmp_buf, valid_datearray_scanline[i_col],
-                        valid_datecount_scanline[i_col], lower_ordinal,
-                        upper_ordinal, i_col, out_compositing, FALSE, FALSE, b_diagnosis, rec_c);
-        }
-        else if (6==method)
+        if (failed == TRUE)
         {
-            modified_hot_compositing(tmp_buf, valid_datearray_scanline[i_col],
-                        valid_datecount_scanline[i_col], lower_ordinal,
-                        upper_ordinal, i_col, out_compositing);
+            RETURN_ERROR("ERROR calling the scanline kernel",
+                         FUNC_NAME, FAILURE);
         }
+        return SUCCESS;
+    }
 
-        else if (7==method)
+    #pragma omp parallel for num_threads(n_threads) schedule(dynamic, 32)
+    for(i_col = 0; i_col < num_samples; i_col++)
+    {
+        short int *tmp_buf[MAX_IMAGE_BANDS]; /* band series of the pixel, views into buf */
+        Output_t rec_c;
+        scratch_arena_t *arena = &arenas[omp_get_thread_num()];
+        int j;
+
+        for(j = 0; j < image_bands; j++)
         {
-            medium_compositing(tmp_buf, valid_datearray_scanline[i_col],
-                               valid_datecount_scanline[i_col], lower_ordinal,
-                               upper_ordinal, i_col, out_compositing);
+           tmp_buf[j]  = buf[j] + i_col * num_scenes;
         }
-        else if (8==method)
+
+        scratch_reset(arena);
+        /* a kernel out of scratch leaves its column unwritten */
+        if (composite->pixel_kernel(tmp_buf, valid_datearray_scanline[i_col],
+                                    valid_datecount_scanline[i_col], lower_ordinal,
+                                    upper_ordinal, i_col, out_compositing,
+                                    FALSE, &rec_c, arena) != SUCCESS)
         {
-            valid_obs_count(tmp_buf, valid_datearray_scanline[i_col],
-                            valid_datecount_scanline[i_col], lower_ordinal,
-                            upper_ordinal, i_col, out_compositing);
+            #pragma omp atomic write
+            failed = TRUE;
         }
     }
 
-    free(rec_c);
-    free_2d_array((void **)tmp_buf);
-
+    if (failed == TRUE)
+    {
+        RETURN_ERROR("ERROR calling the pixel kernel",
+                     FUNC_NAME, FAILURE);
+    }
     return SUCCESS;
 }
 
@@ -945,14 +915,17 @@ int fitting_compositing
     int bfit,
     int bweighted,
     int b_diagnosis,
-    Output_t* rec_c
+    Output_t* rec_c,
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 )
 {
     char FUNC_NAME[] = "fitting_compositing";
+    const band_layout_t *layout = get_band_layout();
+    int image_bands = layout->image_bands;
     int status;
     float date_vario;           /* I: median date                                          */
     float max_date_difference;   /* I: maximum difference between two neighbor dates        */
-    float adj_rmse[TOTAL_IMAGE_BANDS]; /* Adjusted RMSE for all bands          */
+    float adj_rmse[MAX_IMAGE_BANDS]; /* Adjusted RMSE for all bands          */
     int *bl_ids;
     int n_clr;
     int n_clr_1;
@@ -969,31 +942,34 @@ int fitting_compositing
     int i;
     float C0; // intercept from each test output
     float C1; // slope from each test output
+    float green_coefs[ROBUST_COEFFS]; /* robust fit of the green test    */
+    float nir_coefs[ROBUST_COEFFS];   /* robust fit of the nir test      */
+    float *fitted[MAX_IMAGE_BANDS]; /* test fits the final fit reuses  */
+    series_view_t view;
 
-    clrx = (int*)calloc(valid_date_count, sizeof(int));
-    clry = (float **) allocate_2d_array (TOTAL_IMAGE_BANDS, valid_date_count,
+    /**************************************************************/
+    /*                                                            */
+    /*      select observations in the observation window          */
+    /*                                                            */
+    /**************************************************************/
+    series_view_window(buf, valid_date_array, valid_date_count, lower_ordinal,
+                       upper_ordinal, &view);
+    n_clr = view.count;
+    clrx = view.dates;
+
+    /* the tests below work on float values, so only these are converted */
+    clry = (float **) scratch_alloc_2d (arena, image_bands, n_clr,
                                              sizeof (float));
     if (clry == NULL)
     {
         RETURN_ERROR ("Allocating clry memory", FUNC_NAME, FAILURE);
     }
 
-    /**************************************************************/
-    /*                                                            */
-    /*      select observations in the observation window          */
-    /*                                                            */
-    /**************************************************************/
-    n_clr = 0;
-    for(i = 0; i < valid_date_count; i++)
+    for(b = 0; b < image_bands; b++)
     {
-        if((valid_date_array[i] > lower_ordinal - 1) && (valid_date_array[i] < upper_ordinal + 1))
+        for(i = 0; i < n_clr; i++)
         {
-            clrx[n_clr] = valid_date_array[i];
-            for(b = 0; b < TOTAL_IMAGE_BANDS; b++)
-            {
-                clry[b][n_clr] = (float)buf[b][i];
-            }
-            n_clr++;
+            clry[b][i] = (float)view.band[b][i];
         }
     }
 
@@ -1002,7 +978,7 @@ int fitting_compositing
     /********************************************/
     if(n_clr==0)
     {
-        for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+        for(i = 0; i < image_bands; i++)
         {
             out_compositing[i][i_col] = -9999;
         }
@@ -1012,14 +988,7 @@ int fitting_compositing
             rec_c->condition = NOOBS_CONDITION;
         }
 
-        free(clrx);
-        status = free_2d_array((void **)clry);
-        if (status != SUCCESS)
-        {
-            RETURN_ERROR ("Freeing memory: clry\n",
-                          FUNC_NAME, FAILURE);
-        }
-
+        count_fit_tier(FIT_TIER_NOOBS);
         return SUCCESS;
     }
 
@@ -1029,21 +998,14 @@ int fitting_compositing
     else if (n_clr < MIN_SAMPLE)
     {
         median_compositing(buf, valid_date_array, valid_date_count,
-                           i_col, out_compositing);
+                           i_col, out_compositing, arena);
 
         if(TRUE == b_diagnosis)
         {
             rec_c->condition = INEFFICIENT_CONDITION;
         }
 
-        free(clrx);
-        status = free_2d_array((void **)clry);
-        if (status != SUCCESS)
-        {
-            RETURN_ERROR ("Freeing memory: clry\n",
-                          FUNC_NAME, FAILURE);
-        }
-
+        count_fit_tier(FIT_TIER_MEDIAN);
         return SUCCESS;
     }
     else
@@ -1058,25 +1020,26 @@ int fitting_compositing
     /*    condition 3: standard procedure         */
     /**********************************************/
 
-    bl_ids = (int *)calloc(n_clr, sizeof(int));
+    bl_ids = (int *)scratch_alloc(arena, n_clr * sizeof(int));
     if (bl_ids == NULL)
     {
         RETURN_ERROR("ERROR allocating bl_ids memory", FUNC_NAME, FAILURE);
     }
+    memset(bl_ids, 0, n_clr * sizeof(int));
 
 
-    clrx_1 = (int *)calloc(n_clr, sizeof(int));
-    clry_1 = (float **) allocate_2d_array (TOTAL_IMAGE_BANDS, n_clr,
+    clrx_1 = (int *)scratch_alloc(arena, n_clr * sizeof(int));
+    clry_1 = (float **) scratch_alloc_2d (arena, image_bands, n_clr,
                                              sizeof (float));
-    if (clry_1 == NULL)
+    if ((clrx_1 == NULL) || (clry_1 == NULL))
     {
         RETURN_ERROR ("Allocating clry_1 memory", FUNC_NAME, FAILURE);
     }
 
-    clrx_2 = (int *)calloc(n_clr, sizeof(int));
-    clry_2 = (float **) allocate_2d_array (TOTAL_IMAGE_BANDS, n_clr,
+    clrx_2 = (int *)scratch_alloc(arena, n_clr * sizeof(int));
+    clry_2 = (float **) scratch_alloc_2d (arena, image_bands, n_clr,
                                              sizeof (float));
-    if (clry_2 == NULL)
+    if ((clrx_2 == NULL) || (clry_2 == NULL))
     {
         RETURN_ERROR ("Allocating clry_2 memory", FUNC_NAME, FAILURE);
     }
@@ -1086,9 +1049,9 @@ int fitting_compositing
     /*      calculate variogram for each band and dates.          */
     /*                                                            */
     /**************************************************************/
-    status = adjust_median_variogram(clrx, clry, TOTAL_IMAGE_BANDS,
+    status = adjust_median_variogram(clrx, clry, image_bands,
                                      0, n_clr-1, &date_vario,
-                                     &max_date_difference, adj_rmse);
+                                     &max_date_difference, adj_rmse, arena);
     if (status != SUCCESS)
     {
             RETURN_ERROR("ERROR calling median_variogram routine", FUNC_NAME,
@@ -1096,14 +1059,16 @@ int fitting_compositing
     }
 
 
-    status = greenband_test(clrx, clry, 0, n_clr-1, adj_rmse[1], T_CONST_SINGLETAIL_9999,
-            bl_ids, &C0, &C1);
+    status = greenband_test(clrx, clry, 0, n_clr-1, adj_rmse[layout->green], T_CONST_SINGLETAIL_9999,
+            bl_ids, &C0, &C1, arena);
 
     if (status != SUCCESS)
     {
         RETURN_ERROR("ERROR calling greenband_test",
                       FUNC_NAME, FAILURE);
     }
+    green_coefs[0] = C0;
+    green_coefs[1] = C1;
 
     if(TRUE == b_diagnosis)
     {
@@ -1123,7 +1088,7 @@ int fitting_compositing
         if(bl_ids[i] == 0)
         {
             clrx_1[n_clr_1] = clrx[i];
-            for (b = 0; b < TOTAL_IMAGE_BANDS; b++)
+            for (b = 0; b < image_bands; b++)
             {
                 clry_1[b][n_clr_1] = clry[b][i];
             }
@@ -1149,7 +1114,7 @@ int fitting_compositing
         {
 
             clrx_1[n_clr_1] = clrx[i];
-            for (b = 0; b < TOTAL_IMAGE_BANDS; b++)
+            for (b = 0; b < image_bands; b++)
             {
                 clry_1[b][n_clr_1] = (float)clry[b][i];
             }
@@ -1174,14 +1139,16 @@ int fitting_compositing
     for (k = 0; k < n_clr_1; k++)
        bl_ids[k] = 0;
 
-    status = nirband_test(clrx_1, clry_1, 0, n_clr_1-1, adj_rmse[3], T_CONST_SINGLETAIL_9999,
-            bl_ids, &C0, &C1);
+    status = nirband_test(clrx_1, clry_1, 0, n_clr_1-1, adj_rmse[layout->nir], T_CONST_SINGLETAIL_9999,
+            bl_ids, &C0, &C1, arena);
 
     if (status != SUCCESS)
     {
         RETURN_ERROR("ERROR calling nirband_test",
                       FUNC_NAME, FAILURE);
     }
+    nir_coefs[0] = C0;
+    nir_coefs[1] = C1;
 
     if(TRUE == b_diagnosis)
     {
@@ -1201,7 +1168,7 @@ int fitting_compositing
         if(bl_ids[i] == 0)
         {
             clrx_2[n_clr_2] = clrx_1[i];
-            for (b = 0; b < TOTAL_IMAGE_BANDS; b++)
+            for (b = 0; b < image_bands; b++)
             {
                 clry_2[b][n_clr_2] = clry_1[b][i];
             }
@@ -1226,7 +1193,7 @@ int fitting_compositing
         {
             n_clr_2 = 0;
             clrx_2[n_clr_2] = clrx_1[i];
-            for (b = 0; b < TOTAL_IMAGE_BANDS; b++)
+            for (b = 0; b < image_bands; b++)
             {
                 clry_2[b][n_clr_2] = clry_1[b][i];
             }
@@ -1242,23 +1209,41 @@ int fitting_compositing
     }
 
 
+    /* a test that removed nothing fitted its band on the very series the
+       final robust fit gets, so that fit is not repeated */
+    for (b = 0; b < image_bands; b++)
+        fitted[b] = NULL;
+    if (n_clr_2 == n_clr)
+        fitted[layout->green] = green_coefs;
+    if (n_clr_2 == n_clr_1)
+        fitted[layout->nir] = nir_coefs;
+    count_fit_tier((n_clr_2 == n_clr) ? FIT_TIER_WINDOW : FIT_TIER_SUBSET);
+
     if(bfit == TRUE)
-        linear_fit_centerdate(clrx_2, clry_2, n_clr_2, 0, (lower_ordinal + upper_ordinal)/2,i_col,
-                          out_compositing, bweighted, rec_c->C0_final, rec_c->C1_final);
+    {
+        status = linear_fit_centerdate(clrx_2, clry_2, n_clr_2, 0, (lower_ordinal + upper_ordinal)/2,i_col,
+                          out_compositing, bweighted, rec_c->C0_final, rec_c->C1_final,
+                          fitted, arena);
+        if (status != SUCCESS)
+        {
+            RETURN_ERROR("ERROR calling linear_fit_centerdate",
+                         FUNC_NAME, FAILURE);
+        }
+    }
     else
     {
         float wt;
         int j;
-        double index_sum[TOTAL_IMAGE_BANDS];
-        for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+        double index_sum[MAX_IMAGE_BANDS];
+        for(i = 0; i < image_bands; i++)
             index_sum[i] = 0;
         float wt_sum = 0;
 
 
         for(i = 0; i < n_clr_2; i++)
         {
-            wt = (float)1/((clry_2[BLUE_INDEX][i] - 0.5 * clry_2[RED_INDEX][i]) * (clry_2[BLUE_INDEX][i] - 0.5 * clry_2[RED_INDEX][i]));
-            for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
+            wt = (float)1/((clry_2[layout->blue][i] - 0.5 * clry_2[layout->red][i]) * (clry_2[layout->blue][i] - 0.5 * clry_2[layout->red][i]));
+            for(j = 0; j < image_bands; j++)
             {
                 index_sum[j] = index_sum[j] + clry_2[j][i] * wt;
             }
@@ -1269,39 +1254,13 @@ int fitting_compositing
         /*    condition 2: standard procedures      */
         /********************************************/
 
-        for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
+        for(j = 0; j < image_bands; j++)
         {
             out_compositing[j][i_col] = (short int)(index_sum[j] / wt_sum);
         }
 
     }
 
-
-    free(bl_ids);
-    free(clrx);
-    status = free_2d_array((void **)clry);
-    if (status != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: clry\n",
-                      FUNC_NAME, FAILURE);
-    }
-
-    free(clrx_1);
-    status = free_2d_array((void **)clry_1);
-    if (status != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: clry_1\n",
-                      FUNC_NAME, FAILURE);
-    }
-
-    free(clrx_2);
-    status = free_2d_array((void **)clry_2);
-    if (status != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: clry_2\n",
-                      FUNC_NAME, FAILURE);
-    }
-
     return SUCCESS;
 
 }
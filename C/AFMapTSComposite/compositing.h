@@ -1,6 +1,7 @@
 #ifndef COMPOSITING_H
 #define COMPOSITING_H
 #include "stdbool.h"
+#include "scratch.h"
 
 int hot_compositing
 (
@@ -34,7 +35,24 @@ int compositing_scanline
     int num_samples,                /* I: the pixel number in a row              */
     int num_scenes,                 /* I: the number of scenes               */
     short int **out_compositing,           /* O: outputted compositing results for four bands */
-    int method                       /* I: the compositing method{1 - fitting-weighted; 2 - fitting-normal; 3 - hot; 4 - average}*/
+    int method,                      /* I: the compositing method{1 - fitting-weighted; 2 - fitting-normal; 3 - hot; 4 - average}*/
+    scratch_arena_t *arenas,         /* I/O: scratch memory, one per thread */
+    int n_threads                    /* I: compositing threads              */
+);
+
+int compositing_pixel
+(
+    short int **buf,            /* I:  pixel-based time series           */
+    int *valid_date_array,      /* I: valid date time series               */
+    int valid_date_count,       /* I: the number of valid dates               */
+    int lower_ordinal,          /* I: lower ordinal date               */
+    int upper_ordinal,          /* I: upper_ordinal for temporal range of composition   */
+    int i_col,                  /* I: column of out_compositing to fill   */
+    short int **out_compositing,           /* O: outputted compositing results for four bands */
+    int method,                 /* I: the compositing method               */
+    int b_diagnosis,            /* I: TRUE to fill rec_c                   */
+    Output_t* rec_c,            /* O: fitting diagnosis                    */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 );
 
 //int fitting_compositing_scanline
@@ -49,6 +67,18 @@ int compositing_scanline
 //    short int **out_compositing           /* O: outputted compositing results for four bands */
 //);
 
+void count_fit_tier
+(
+    int tier                    /* I: FIT_TIER_NOOBS to FIT_TIER_SUBSET    */
+);
+
+void reset_fit_tier_counts(void);
+
+void get_fit_tier_counts
+(
+    long *counts                /* O: FIT_TIERS counts                     */
+);
+
 int greenband_test
 (
     int *clrx,
@@ -59,7 +89,8 @@ int greenband_test
     float n_t,
     int *bl_ids,
     float *C0,
-    float *C1
+    float *C1,
+    scratch_arena_t *arena
 );
 
 int nirband_test
@@ -72,7 +103,8 @@ int nirband_test
     float n_t,
     int *bl_ids,
     float *C0,
-    float *C1
+    float *C1,
+    scratch_arena_t *arena
 );
 
 int fitting_compositing
@@ -87,7 +119,8 @@ int fitting_compositing
     int bfit,
     int bweighted,
     int b_diagnosis,
-    Output_t* rec_c
+    Output_t* rec_c,
+    scratch_arena_t *arena
 );
 
 int median_compositing
@@ -96,7 +129,8 @@ int median_compositing
     int *valid_date_array,      /* I: valid date time series               */
     int valid_date_count,       /* I: the number of valid dates               */
     int i_col,
-    short int **out_compositing           /* O: outputted compositing results for four bands */
+    short int **out_compositing,           /* O: outputted compositing results for four bands */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 );
 
 
@@ -108,7 +142,8 @@ int modified_hot_compositing
     int ordinal_lower,
     int ordinal_upper,
     int i_col,
-    short int **out_compositing           /* O: outputted compositing results for four bands */
+    short int **out_compositing,           /* O: outputted compositing results for four bands */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 );
 
 int medium_compositing
@@ -119,7 +154,8 @@ int medium_compositing
     int lower_ordinal,
     int upper_ordinal,
     int i_col,
-    short int **out_compositing           /* O: outputted compositing results for four bands */
+    short int **out_compositing,           /* O: outputted compositing results for four bands */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 );
 
 int valid_obs_count
@@ -130,7 +166,8 @@ int valid_obs_count
     int lower_ordinal,
     int upper_ordinal,
     int i_col,
-    short int **out_compositing           /* O: outputted compositing results for four bands */
+    short int **out_compositing,           /* O: outputted compositing results for four bands */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 );
 
 #endif // COMPOSITING_H
@@ -33,14 +33,26 @@
 #define MAX_SCENE_LIST 3922
 #define ARD_STR_LEN 100
 
-#define TOTAL_BANDS 5
-#define TOTAL_IMAGE_BANDS 4
+/* a record holds the image bands in file order and then the mask; the
+   band layout of the scenes is read at run time, see band_layout.h */
+#define MAX_IMAGE_BANDS 8
+#define MAX_BANDS (MAX_IMAGE_BANDS + 1)
 #define MASK_FILL 10000
 
-#define BLUE_INDEX 0
-#define GREEN_INDEX 1
-#define RED_INDEX 2
-#define NIR_INDEX 3
+/* PlanetScope 4-band: blue, green, red, nir */
+#define PS4_IMAGE_BANDS 4
+#define PS4_BLUE 0
+#define PS4_GREEN 1
+#define PS4_RED 2
+#define PS4_NIR 3
+
+/* SuperDove 8-band: coastal blue, blue, green I, green, yellow, red,
+   red edge, nir */
+#define SD8_IMAGE_BANDS 8
+#define SD8_BLUE 1
+#define SD8_GREEN 3
+#define SD8_RED 5
+#define SD8_NIR 7
 
 #define PLANET_RES 3
 #define ROBUST_COEFFS 2
@@ -50,6 +62,13 @@
 #define NOOBS_CONDITION 1
 #define INEFFICIENT_CONDITION 2
 
+/* paths through the fitting methods, counted by count_fit_tier */
+#define FIT_TIER_NOOBS 0        /* no observation in the window               */
+#define FIT_TIER_MEDIAN 1       /* fewer than MIN_SAMPLE, median composite    */
+#define FIT_TIER_WINDOW 2       /* the tests kept the whole window            */
+#define FIT_TIER_SUBSET 3       /* the tests removed observations             */
+#define FIT_TIERS 4
+
 #define T_CONST_SINGLETAIL_99 2.32      /* Threshold for cloud, shadow, and snow detection (0.999) */
 #define T_CONST_SINGLETAIL_999 3.09      /* Threshold for cloud, shadow, and snow detection (0.999) */
 #define T_CONST_SINGLETAIL_9999 3.71      /* Threshold for cloud, shadow, and snow detection (0.9999) */
@@ -70,6 +89,18 @@
 #define RAINY_INTERVAL 75
 
 #define DEFAULT_COMPOSITING_METHOD 6
+#define DEFAULT_PREFETCH_DEPTH 1   /* scanlines read ahead of compositing */
+#define MAX_PREFETCH_DEPTH 16
+#define DEFAULT_WRITE_DEPTH 4      /* row blocks queued for the writer thread */
+#define MAX_WRITE_DEPTH 64
+#define MAX_WINDOWS 16            /* compositing windows of a single run */
+#define BATCH_STAGE_ROWS 64       /* rows of every scene of the next job read ahead */
+
+/* how scenes are read in mode 3 */
+#define READER_MMAP 0             /* map every scene, pread if mapping fails */
+#define READER_PREAD 1            /* pread through a bounded descriptor pool */
+#define READER_STDIO 2            /* one FILE per scene                      */
+#define READER_GDAL 3             /* GDAL block API, for tiled/compressed tifs */
 /* from 2darray.c */
 /* Define a unique (i.e. random) value that can be used to verify a pointer
    points to an LSRD_2D_ARRAY. This is used to verify the operation succeeds to
@@ -0,0 +1,542 @@
+#include <string.h>
+
+#include "const.h"
+#include "utilities.h"
+#include "misc.h"
+#include "compositing.h"
+#include "scratch.h"
+#include "robust_fit.h"
+#include "series_view.h"
+#include "band_layout.h"
+#include "fit_lanes.h"
+
+/* what fitting_compositing keeps for one pixel, for every lane of a batch */
+typedef struct
+{
+    short int *series[MAX_IMAGE_BANDS];   /* band series of the pixel      */
+    int *clrx;                /* dates inside the window                    */
+    float **clry;             /* band values inside the window              */
+    int n_clr;
+    int *clrx_1;              /* what the green test keeps                  */
+    float **clry_1;
+    int n_clr_1;
+    int *clrx_2;              /* what the nir test keeps                    */
+    float **clry_2;
+    int n_clr_2;
+    int *bl_ids;              /* 1 for the outliers of a test               */
+    float adj_rmse[MAX_IMAGE_BANDS];
+    float green_coefs[ROBUST_COEFFS]; /* robust fit of the green test       */
+    float nir_coefs[ROBUST_COEFFS];   /* robust fit of the nir test         */
+    float *fitted[MAX_IMAGE_BANDS];   /* test fits the final fit reuses     */
+} fit_lane_t;
+
+/******************************************************************************
+MODULE:  fit_band_lanes
+
+PURPOSE:  Robust fit of one band for every active lane at once, on the series
+          the lanes hold after the given stage
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           error allocating memory
+SUCCESS         no error encountered
+
+NOTES: stage 0 is the window, 1 after the green test, 2 after the nir test;
+       a lane bisquare_fit_lanes cannot fit goes through auto_robust_fit,
+       which hands it to GSL as it would for a single pixel
+******************************************************************************/
+static int fit_band_lanes
+(
+    fit_lane_t **active,      /* I: lanes to fit                              */
+    int na,                   /* I: number of active lanes                    */
+    int stage,                /* I: 0, 1 or 2                                 */
+    int band,                 /* I: band to fit                               */
+    float *coefs,             /* O: intercept and slope of lane s at 2s, 2s+1 */
+    scratch_arena_t *arena    /* I/O: scratch memory                          */
+)
+{
+    char FUNC_NAME[] = "fit_band_lanes";
+    int i, s, max_n;
+    int n[FIT_LANES];
+    int status[FIT_LANES];
+    int *clrx;
+    float **clry;
+    float *t, *y;
+    float **x;
+    size_t mark = scratch_mark(arena);
+
+    max_n = 0;
+    for (s = 0; s < na; s++)
+    {
+        n[s] = (stage == 0) ? active[s]->n_clr :
+               (stage == 1) ? active[s]->n_clr_1 : active[s]->n_clr_2;
+        if (n[s] > max_n)
+            max_n = n[s];
+    }
+
+    t = (float *)scratch_alloc(arena, max_n * FIT_LANES * sizeof(float));
+    y = (float *)scratch_alloc(arena, max_n * FIT_LANES * sizeof(float));
+    if ((t == NULL) || (y == NULL))
+    {
+        RETURN_ERROR("Allocating lane memory", FUNC_NAME, ERROR);
+    }
+    memset(t, 0, max_n * FIT_LANES * sizeof(float));
+    memset(y, 0, max_n * FIT_LANES * sizeof(float));
+
+    for (s = 0; s < na; s++)
+    {
+        clrx = (stage == 0) ? active[s]->clrx :
+               (stage == 1) ? active[s]->clrx_1 : active[s]->clrx_2;
+        clry = (stage == 0) ? active[s]->clry :
+               (stage == 1) ? active[s]->clry_1 : active[s]->clry_2;
+        for (i = 0; i < n[s]; i++)
+        {
+            t[i * FIT_LANES + s] = (float)clrx[i];
+            y[i * FIT_LANES + s] = clry[band][i];
+        }
+    }
+
+    if (bisquare_fit_lanes(t, y, n, na, FIT_LANES, coefs, status, arena)
+        != SUCCESS)
+    {
+        RETURN_ERROR("Calling bisquare_fit_lanes", FUNC_NAME, ERROR);
+    }
+
+    for (s = 0; s < na; s++)
+    {
+        if (status[s] == SUCCESS)
+            continue;
+
+        clrx = (stage == 0) ? active[s]->clrx :
+               (stage == 1) ? active[s]->clrx_1 : active[s]->clrx_2;
+        clry = (stage == 0) ? active[s]->clry :
+               (stage == 1) ? active[s]->clry_1 : active[s]->clry_2;
+        x = (float **)scratch_alloc_2d(arena, n[s], ROBUST_COEFFS - 1,
+                                       sizeof(float));
+        if (x == NULL)
+        {
+            RETURN_ERROR("Allocating x memory", FUNC_NAME, ERROR);
+        }
+        for (i = 0; i < n[s]; i++)
+        {
+            x[i][0] = (float)clrx[i];
+        }
+        if (auto_robust_fit(x, clry, n[s], 0, band, coefs + 2 * s, arena)
+            != SUCCESS)
+        {
+            RETURN_ERROR("Calling auto_robust_fit", FUNC_NAME, ERROR);
+        }
+    }
+
+    scratch_release(arena, mark);
+
+    return SUCCESS;
+}
+
+/******************************************************************************
+MODULE:  fitting_compositing_lanes
+
+PURPOSE:  fitting_compositing for up to FIT_LANES pixels of a scanline: the
+          green and nir outlier tests and the final robust fits run for all
+          lanes together, each lane keeping its own series length
+
+RETURN VALUE:
+Type = int (SUCCESS, ERROR or FAILURE)
+
+NOTES: the composites and the rec_c fields of every lane are those
+       fitting_compositing gives for the pixel on its own; pixels with
+       fewer than MIN_SAMPLE observations, the variogram, the outlier
+       bookkeeping and the HOT-weighted final fit stay per lane
+******************************************************************************/
+int fitting_compositing_lanes
+(
+    short int **buf,            /* I: scanline time series, pixel c of band b
+                                      at buf[b] + c * num_scenes          */
+    int **valid_datearray,      /* I: valid dates of every lane           */
+    int *valid_datecount,       /* I: number of valid dates of every lane */
+    int lower_ordinal,          /* I: lower ordinal date                  */
+    int upper_ordinal,          /* I: upper ordinal date                  */
+    int first_col,              /* I: column of the first lane            */
+    int lanes,                  /* I: pixels in the batch, at most FIT_LANES */
+    int num_scenes,             /* I: the number of scenes                */
+    short int **out_compositing, /* O: compositing results for four bands */
+    int bfit,                   /* I: TRUE to fit the final composite     */
+    int bweighted,              /* I: TRUE for the HOT-weighted final fit */
+    int b_diagnosis,            /* I: TRUE to fill rec_c                  */
+    Output_t *rec_c,            /* O: fitting diagnosis of every lane     */
+    scratch_arena_t *arena      /* I/O: scratch memory of the calling thread */
+)
+{
+    char FUNC_NAME[] = "fitting_compositing_lanes";
+    int status;
+    int i, b, l, s, na, i_col;
+    int n_outlier_1, n_outlier_2;
+    int center_date = (lower_ordinal + upper_ordinal) / 2;
+    float date_vario;
+    float max_date_difference;
+    float n_t = T_CONST_SINGLETAIL_9999;
+    float rmse, pred;
+    float coefs[2 * FIT_LANES];
+    float band_coefs[MAX_IMAGE_BANDS][2 * FIT_LANES];
+    fit_lane_t lane[FIT_LANES];
+    fit_lane_t *active[FIT_LANES];
+    fit_lane_t *refit[FIT_LANES];
+    int refit_lane[FIT_LANES];
+    int nr;
+    int active_col[FIT_LANES];
+    Output_t *rec[FIT_LANES];
+    fit_lane_t *p;
+    series_view_t view;
+    size_t mark;
+    const band_layout_t *layout = get_band_layout();
+    int image_bands = layout->image_bands;
+
+    scratch_reset(arena);
+
+    /**************************************************************/
+    /*                                                            */
+    /*      select observations in the observation window          */
+    /*                                                            */
+    /**************************************************************/
+    na = 0;
+    for (l = 0; l < lanes; l++)
+    {
+        p = &lane[l];
+        i_col = first_col + l;
+        for (b = 0; b < image_bands; b++)
+        {
+            p->series[b] = buf[b] + i_col * num_scenes;
+        }
+
+        series_view_window(p->series, valid_datearray[l], valid_datecount[l],
+                           lower_ordinal, upper_ordinal, &view);
+        p->n_clr = view.count;
+        p->clrx = view.dates;
+        p->clry = (float **)scratch_alloc_2d(arena, image_bands,
+                                             p->n_clr, sizeof(float));
+        if (p->clry == NULL)
+        {
+            RETURN_ERROR("Allocating clry memory", FUNC_NAME, FAILURE);
+        }
+
+        for (b = 0; b < image_bands; b++)
+        {
+            for (i = 0; i < p->n_clr; i++)
+            {
+                p->clry[b][i] = (float)view.band[b][i];
+            }
+        }
+
+        /* condition 1: zero valid observation */
+        if (p->n_clr == 0)
+        {
+            for (b = 0; b < image_bands; b++)
+            {
+                out_compositing[b][i_col] = -9999;
+            }
+            if (TRUE == b_diagnosis)
+                rec_c[l].condition = NOOBS_CONDITION;
+            count_fit_tier(FIT_TIER_NOOBS);
+            continue;
+        }
+
+        /* condition 2: inefficient observations */
+        if (p->n_clr < MIN_SAMPLE)
+        {
+            mark = scratch_mark(arena);
+            median_compositing(p->series, valid_datearray[l],
+                               valid_datecount[l], i_col, out_compositing,
+                               arena);
+            scratch_release(arena, mark);
+            if (TRUE == b_diagnosis)
+                rec_c[l].condition = INEFFICIENT_CONDITION;
+            count_fit_tier(FIT_TIER_MEDIAN);
+            continue;
+        }
+
+        if (TRUE == b_diagnosis)
+            rec_c[l].condition = NORMAL_CONDITION;
+
+        p->bl_ids = (int *)scratch_alloc(arena, p->n_clr * sizeof(int));
+        p->clrx_1 = (int *)scratch_alloc(arena, p->n_clr * sizeof(int));
+        p->clry_1 = (float **)scratch_alloc_2d(arena, image_bands,
+                                               p->n_clr, sizeof(float));
+        p->clrx_2 = (int *)scratch_alloc(arena, p->n_clr * sizeof(int));
+        p->clry_2 = (float **)scratch_alloc_2d(arena, image_bands,
+                                               p->n_clr, sizeof(float));
+        if ((p->bl_ids == NULL) || (p->clrx_1 == NULL) ||
+            (p->clry_1 == NULL) || (p->clrx_2 == NULL) || (p->clry_2 == NULL))
+        {
+            RETURN_ERROR("Allocating lane series memory", FUNC_NAME, FAILURE);
+        }
+
+        /* variogram for each band and dates */
+        status = adjust_median_variogram(p->clrx, p->clry, image_bands,
+                                         0, p->n_clr - 1, &date_vario,
+                                         &max_date_difference, p->adj_rmse,
+                                         arena);
+        if (status != SUCCESS)
+        {
+            RETURN_ERROR("ERROR calling median_variogram routine", FUNC_NAME,
+                         FAILURE);
+        }
+
+        active[na] = p;
+        active_col[na] = i_col;
+        rec[na] = &rec_c[l];
+        na++;
+    }
+
+    if (na == 0)
+        return SUCCESS;
+
+    /**************************************************/
+    /*                                                */
+    /* green band test, fitted for all lanes          */
+    /*                                                */
+    /**************************************************/
+    if (fit_band_lanes(active, na, 0, layout->green, coefs, arena) != SUCCESS)
+    {
+        RETURN_ERROR("ERROR fitting the green band", FUNC_NAME, FAILURE);
+    }
+
+    for (s = 0; s < na; s++)
+    {
+        p = active[s];
+        rmse = p->adj_rmse[layout->green];
+        for (i = 0; i < p->n_clr; i++)
+        {
+            pred = coefs[2 * s] + coefs[2 * s + 1] * (float)p->clrx[i];
+            p->bl_ids[i] = (p->clry[layout->green][i] - pred > (n_t * rmse)) ? 1 : 0;
+        }
+
+        p->green_coefs[0] = coefs[2 * s];
+        p->green_coefs[1] = coefs[2 * s + 1];
+        if (TRUE == b_diagnosis)
+        {
+            rec[s]->C0_green = coefs[2 * s];
+            rec[s]->C1_green = coefs[2 * s + 1];
+        }
+
+        /* remove outliers */
+        p->n_clr_1 = 0;
+        n_outlier_1 = 0;
+        for (i = 0; i < p->n_clr; i++)
+        {
+            if (p->bl_ids[i] == 0)
+            {
+                p->clrx_1[p->n_clr_1] = p->clrx[i];
+                for (b = 0; b < image_bands; b++)
+                {
+                    p->clry_1[b][p->n_clr_1] = p->clry[b][i];
+                }
+                p->n_clr_1++;
+            }
+            else if (TRUE == b_diagnosis)
+            {
+                rec[s]->outlier_dates_green[n_outlier_1] = p->clrx[i];
+                n_outlier_1++;
+            }
+        }
+        rec[s]->n_outlier_green = n_outlier_1;
+
+        /* the green test failed, go back to the whole window */
+        if (p->n_clr_1 < MIN_SAMPLE)
+        {
+            memcpy(p->clrx_1, p->clrx, p->n_clr * sizeof(int));
+            for (b = 0; b < image_bands; b++)
+            {
+                memcpy(p->clry_1[b], p->clry[b], p->n_clr * sizeof(float));
+            }
+            p->n_clr_1 = p->n_clr;
+            if (TRUE == b_diagnosis)
+                rec[s]->b_success_green = FAILURE;
+        }
+        else if (TRUE == b_diagnosis)
+            rec[s]->b_success_green = SUCCESS;
+    }
+
+    /**************************************************/
+    /*                                                */
+    /* nir band test, fitted for all lanes            */
+    /*                                                */
+    /**************************************************/
+    if (fit_band_lanes(active, na, 1, layout->nir, coefs, arena) != SUCCESS)
+    {
+        RETURN_ERROR("ERROR fitting the nir band", FUNC_NAME, FAILURE);
+    }
+
+    for (s = 0; s < na; s++)
+    {
+        p = active[s];
+        rmse = p->adj_rmse[layout->nir];
+        for (i = 0; i < p->n_clr_1; i++)
+        {
+            pred = coefs[2 * s] + coefs[2 * s + 1] * (float)p->clrx_1[i];
+            p->bl_ids[i] = (p->clry_1[layout->nir][i] - pred < -(n_t * rmse)) ? 1 : 0;
+        }
+
+        p->nir_coefs[0] = coefs[2 * s];
+        p->nir_coefs[1] = coefs[2 * s + 1];
+        if (TRUE == b_diagnosis)
+        {
+            rec[s]->C0_nir = coefs[2 * s];
+            rec[s]->C1_nir = coefs[2 * s + 1];
+        }
+
+        /* remove outliers */
+        p->n_clr_2 = 0;
+        n_outlier_2 = 0;
+        for (i = 0; i < p->n_clr_1; i++)
+        {
+            if (p->bl_ids[i] == 0)
+            {
+                p->clrx_2[p->n_clr_2] = p->clrx_1[i];
+                for (b = 0; b < image_bands; b++)
+                {
+                    p->clry_2[b][p->n_clr_2] = p->clry_1[b][i];
+                }
+                p->n_clr_2++;
+            }
+            else if (TRUE == b_diagnosis)
+            {
+                rec[s]->outlier_dates_nir[n_outlier_2] = p->clrx_1[i];
+                n_outlier_2++;
+            }
+        }
+        rec[s]->n_outlier_nir = n_outlier_2;
+
+        /* the nir test failed; fitting_compositing keeps only the last
+           observation here, and so do the lanes */
+        if (p->n_clr_2 < MIN_SAMPLE)
+        {
+            p->clrx_2[0] = p->clrx_1[p->n_clr_1 - 1];
+            for (b = 0; b < image_bands; b++)
+            {
+                p->clry_2[b][0] = p->clry_1[b][p->n_clr_1 - 1];
+            }
+            p->n_clr_2 = 1;
+            if (TRUE == b_diagnosis)
+                rec[s]->b_success_nir = FAILURE;
+        }
+        else if (TRUE == b_diagnosis)
+            rec[s]->b_success_nir = SUCCESS;
+
+        /* a test that removed nothing fitted its band on the very series
+           the final robust fit gets */
+        for (b = 0; b < image_bands; b++)
+            p->fitted[b] = NULL;
+        if (p->n_clr_2 == p->n_clr)
+            p->fitted[layout->green] = p->green_coefs;
+        if (p->n_clr_2 == p->n_clr_1)
+            p->fitted[layout->nir] = p->nir_coefs;
+        count_fit_tier((p->n_clr_2 == p->n_clr) ? FIT_TIER_WINDOW :
+                       FIT_TIER_SUBSET);
+    }
+
+    /**************************************************/
+    /*                                                */
+    /* final composite                                */
+    /*                                                */
+    /**************************************************/
+    if ((bfit == TRUE) && (bweighted == FALSE))
+    {
+        /* robust fit of every band at the center date, for the lanes
+           whose test did not fit it already; a band batch is only left
+           out when no lane of the batch needs it */
+        for (b = 0; b < image_bands; b++)
+        {
+            nr = 0;
+            for (s = 0; s < na; s++)
+            {
+                if (active[s]->fitted[b] != NULL)
+                {
+                    band_coefs[b][2 * s] = active[s]->fitted[b][0];
+                    band_coefs[b][2 * s + 1] = active[s]->fitted[b][1];
+                }
+                else
+                {
+                    refit[nr] = active[s];
+                    refit_lane[nr] = s;
+                    nr++;
+                }
+            }
+            if (nr == 0)
+                continue;
+
+            if (fit_band_lanes(refit, nr, 2, b, coefs, arena) != SUCCESS)
+            {
+                RETURN_ERROR("ERROR fitting the final composite", FUNC_NAME,
+                             FAILURE);
+            }
+            for (s = 0; s < nr; s++)
+            {
+                band_coefs[b][2 * refit_lane[s]] = coefs[2 * s];
+                band_coefs[b][2 * refit_lane[s] + 1] = coefs[2 * s + 1];
+            }
+        }
+
+        for (s = 0; s < na; s++)
+        {
+            for (b = 0; b < image_bands; b++)
+            {
+                out_compositing[b][active_col[s]] = (short int)(band_coefs[b][2 * s] +
+                    band_coefs[b][2 * s + 1] * center_date);
+                rec[s]->C0_final[b] = band_coefs[b][2 * s];
+                rec[s]->C1_final[b] = band_coefs[b][2 * s + 1];
+            }
+        }
+    }
+    else if (bfit == TRUE)
+    {
+        for (s = 0; s < na; s++)
+        {
+            p = active[s];
+            mark = scratch_mark(arena);
+            if (linear_fit_centerdate(p->clrx_2, p->clry_2, p->n_clr_2, 0,
+                                      center_date, active_col[s],
+                                      out_compositing, bweighted,
+                                      rec[s]->C0_final, rec[s]->C1_final,
+                                      NULL, arena) != SUCCESS)
+            {
+                RETURN_ERROR("ERROR fitting the final composite", FUNC_NAME,
+                             FAILURE);
+            }
+            scratch_release(arena, mark);
+        }
+    }
+    else
+    {
+        float wt;
+        float wt_sum;
+        double index_sum[MAX_IMAGE_BANDS];
+
+        for (s = 0; s < na; s++)
+        {
+            p = active[s];
+            for (b = 0; b < image_bands; b++)
+                index_sum[b] = 0;
+            wt_sum = 0;
+
+            for (i = 0; i < p->n_clr_2; i++)
+            {
+                wt = (float)1/((p->clry_2[layout->blue][i] - 0.5 * p->clry_2[layout->red][i]) *
+                               (p->clry_2[layout->blue][i] - 0.5 * p->clry_2[layout->red][i]));
+                for (b = 0; b < image_bands; b++)
+                {
+                    index_sum[b] = index_sum[b] + p->clry_2[b][i] * wt;
+                }
+                wt_sum = wt_sum + wt;
+            }
+
+            for (b = 0; b < image_bands; b++)
+            {
+                out_compositing[b][active_col[s]] = (short int)(index_sum[b] / wt_sum);
+            }
+        }
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,27 @@
+#ifndef FIT_LANES_H
+#define FIT_LANES_H
+
+#include "misc.h"
+#include "scratch.h"
+#include "robust_fit.h"
+
+int fitting_compositing_lanes
+(
+    short int **buf,            /* I: scanline time series, pixel c of band b
+                                      at buf[b] + c * num_scenes          */
+    int **valid_datearray,      /* I: valid dates of every lane           */
+    int *valid_datecount,       /* I: number of valid dates of every lane */
+    int lower_ordinal,          /* I: lower ordinal date                  */
+    int upper_ordinal,          /* I: upper ordinal date                  */
+    int first_col,              /* I: column of the first lane            */
+    int lanes,                  /* I: pixels in the batch, at most FIT_LANES */
+    int num_scenes,             /* I: the number of scenes                */
+    short int **out_compositing, /* O: compositing results for four bands */
+    int bfit,                   /* I: TRUE to fit the final composite     */
+    int bweighted,              /* I: TRUE for the HOT-weighted final fit */
+    int b_diagnosis,            /* I: TRUE to fill rec_c                  */
+    Output_t *rec_c,            /* O: fitting diagnosis of every lane     */
+    scratch_arena_t *arena      /* I/O: scratch memory of the calling thread */
+);
+
+#endif // FIT_LANES_H
@@ -0,0 +1,597 @@
+#include <pthread.h>
+
+#include "hot_kernels.h"
+#include "band_layout.h"
+#include "const.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HOT_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* observations weighted per SIMD step */
+#define HOT_AVX2_STEP 8
+#define HOT_AVX512_STEP 16
+
+typedef void (*hot_kernel_t)(short int **, int *, int, int, int, int,
+                             double *, double *, int *);
+typedef void (*modified_hot_kernel_t)(short int **, int, int, short int,
+                                      double *, double *);
+
+/* kernels of every band layout, [0] 4-band and [1] 8-band records */
+static hot_kernel_t hot_kernel[2] = {NULL, NULL};
+static modified_hot_kernel_t modified_hot_kernel[2] = {NULL, NULL};
+static const char *hot_isa = "scalar";
+static pthread_once_t hot_once = PTHREAD_ONCE_INIT;
+
+/* kernel instances for a band layout: the bodies are inlined with the band
+   count and the role bands constants, so the per-band vectors stay in
+   registers as they did when the layout was fixed at compile time */
+#define HOT_INSTANCE(name, body, image_bands, blue, red, ...)                 \
+    __VA_ARGS__ static void name(short int **buf, int *valid_date_array,     \
+                                 int first, int valid_date_count,            \
+                                 int lower_ordinal, int upper_ordinal,       \
+                                 double *index_sum, double *wt_sum,          \
+                                 int *valid_count_window)                    \
+    {                                                                        \
+        body(buf, valid_date_array, first, valid_date_count, lower_ordinal,  \
+             upper_ordinal, index_sum, wt_sum, valid_count_window,           \
+             image_bands, blue, red);                                        \
+    }
+
+#define MODIFIED_HOT_INSTANCE(name, body, image_bands, blue, nir, ...)        \
+    __VA_ARGS__ static void name(short int **ts_subset, int first,           \
+                                 int valid_count_window,                     \
+                                 short int medium_shadow,                    \
+                                 double *index_sum, double *wt_sum)          \
+    {                                                                        \
+        body(ts_subset, first, valid_count_window, medium_shadow, index_sum, \
+             wt_sum, image_bands, blue, nir);                                \
+    }
+
+/******************************************************************************
+MODULE:  hot_sums_scalar
+
+PURPOSE:  Reference kernel: add the HOT weight 1/(blue - 0.5 red)^2 of every
+          observation inside the window, and the weighted band values, to
+          the sums
+
+RETURN VALUE: None
+
+NOTES: this is the loop hot_compositing had; the SIMD kernels below fall
+       back to it for the observations that do not fill a vector
+******************************************************************************/
+static inline __attribute__((always_inline)) void hot_sums_scalar
+(
+    short int **buf,
+    int *valid_date_array,
+    int first,                /* I: first observation to process            */
+    int valid_date_count,
+    int lower_ordinal,
+    int upper_ordinal,
+    double *index_sum,
+    double *wt_sum,
+    int *valid_count_window,
+    const int image_bands,    /* I: bands of the layout                     */
+    const int blue,           /* I: blue band of the layout                 */
+    const int red             /* I: red band of the layout                  */
+)
+{
+    int i, j;
+    double wt;
+
+    for(i = first; i < valid_date_count; i++)
+    {
+        if((valid_date_array[i] > lower_ordinal - 1) && (valid_date_array[i] < upper_ordinal + 1))
+        {
+            wt = (double)1.0/((buf[blue][i] - 0.5 * buf[red][i]) * (buf[blue][i] - 0.5 * buf[red][i]));
+            for(j = 0; j < image_bands; j++)
+            {
+                index_sum[j] = index_sum[j] + buf[j][i] * wt;
+            }
+            *wt_sum = *wt_sum + wt;
+            *valid_count_window = *valid_count_window + 1;
+        }
+    }
+}
+
+HOT_INSTANCE(hot_sums_scalar_4, hot_sums_scalar, PS4_IMAGE_BANDS, PS4_BLUE, PS4_RED)
+HOT_INSTANCE(hot_sums_scalar_8, hot_sums_scalar, SD8_IMAGE_BANDS, SD8_BLUE, SD8_RED)
+
+/******************************************************************************
+MODULE:  modified_hot_sums_scalar
+
+PURPOSE:  Reference kernel: weight every observation of the window by
+          1/blue^2, times (nir/median nir)^4 below the median nir, and add
+          the weights and the weighted band values to the sums
+
+RETURN VALUE: None
+
+NOTES: this is the loop modified_hot_compositing had
+******************************************************************************/
+static inline __attribute__((always_inline)) void modified_hot_sums_scalar
+(
+    short int **ts_subset,
+    int first,                /* I: first observation to process            */
+    int valid_count_window,
+    short int medium_shadow,
+    double *index_sum,
+    double *wt_sum,
+    const int image_bands,    /* I: bands of the layout                     */
+    const int blue,           /* I: blue band of the layout                 */
+    const int nir             /* I: nir band of the layout                  */
+)
+{
+    int i, j;
+    double wt;
+    double wt_shadow;
+    double wt_cloud;
+    double ratio;
+
+    for(i = first; i < valid_count_window; i++)
+    {
+        wt_cloud = (double) 1.0 / (ts_subset[blue][i] * ts_subset[blue][i]);
+
+        if (ts_subset[nir][i] < medium_shadow)
+        {
+            ratio = (double)ts_subset[nir][i] / medium_shadow;
+            wt_shadow = ratio * ratio * ratio * ratio;
+        }
+        else
+            wt_shadow = 1.0;
+
+        wt = wt_cloud * wt_shadow;
+        for(j = 0; j < image_bands; j++)
+        {
+            index_sum[j] = index_sum[j] + ts_subset[j][i] * wt;
+        }
+        *wt_sum = *wt_sum + wt;
+    }
+}
+
+MODIFIED_HOT_INSTANCE(modified_hot_sums_scalar_4, modified_hot_sums_scalar,
+                      PS4_IMAGE_BANDS, PS4_BLUE, PS4_NIR)
+MODIFIED_HOT_INSTANCE(modified_hot_sums_scalar_8, modified_hot_sums_scalar,
+                      SD8_IMAGE_BANDS, SD8_BLUE, SD8_NIR)
+
+#ifdef HOT_X86_SIMD
+
+/******************************************************************************
+MODULE:  add_float_lanes
+
+PURPOSE:  Add the lanes of a stored float vector to a double sum
+
+RETURN VALUE: None
+******************************************************************************/
+static inline void add_float_lanes
+(
+    const float *lanes,
+    int n,
+    double *sum
+)
+{
+    int k;
+
+    for (k = 0; k < n; k++)
+        *sum += lanes[k];
+}
+
+/******************************************************************************
+MODULE:  hot_sums_avx2
+
+PURPOSE:  HOT weights of 8 observations per step: int16 bands widened to
+          float, the date window applied as a lane mask
+
+RETURN VALUE: None
+
+NOTES: sums are kept per lane in float, so the composite can differ from
+       the reference by the truncation of the last digit (at most 1 DN)
+******************************************************************************/
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void hot_sums_avx2
+(
+    short int **buf,
+    int *valid_date_array,
+    int first,
+    int valid_date_count,
+    int lower_ordinal,
+    int upper_ordinal,
+    double *index_sum,
+    double *wt_sum,
+    int *valid_count_window,
+    const int image_bands,
+    const int blue,
+    const int red
+)
+{
+    int i, j;
+    const __m256i lower = _mm256_set1_epi32(lower_ordinal - 1);
+    const __m256i upper = _mm256_set1_epi32(upper_ordinal + 1);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    __m256i dates, in_window;
+    __m256 band[MAX_IMAGE_BANDS];
+    __m256 acc[MAX_IMAGE_BANDS];
+    __m256 acc_wt = _mm256_setzero_ps();
+    __m256 diff, wt;
+    float lanes[HOT_AVX2_STEP] __attribute__((aligned(32)));
+    unsigned int bits;
+
+    for (j = 0; j < image_bands; j++)
+        acc[j] = _mm256_setzero_ps();
+
+    for (i = first; i + HOT_AVX2_STEP <= valid_date_count; i += HOT_AVX2_STEP)
+    {
+        dates = _mm256_loadu_si256((const __m256i *)(valid_date_array + i));
+        in_window = _mm256_and_si256(_mm256_cmpgt_epi32(dates, lower),
+                                     _mm256_cmpgt_epi32(upper, dates));
+        bits = (unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(in_window));
+        if (bits == 0)
+            continue;
+
+        for (j = 0; j < image_bands; j++)
+            band[j] = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+                _mm_loadu_si128((const __m128i *)(buf[j] + i))));
+
+        diff = _mm256_sub_ps(band[blue], _mm256_mul_ps(half, band[red]));
+        wt = _mm256_div_ps(one, _mm256_mul_ps(diff, diff));
+        wt = _mm256_and_ps(wt, _mm256_castsi256_ps(in_window));
+
+        for (j = 0; j < image_bands; j++)
+            acc[j] = _mm256_add_ps(acc[j], _mm256_mul_ps(band[j], wt));
+        acc_wt = _mm256_add_ps(acc_wt, wt);
+        *valid_count_window += __builtin_popcount(bits);
+    }
+
+    for (j = 0; j < image_bands; j++)
+    {
+        _mm256_store_ps(lanes, acc[j]);
+        add_float_lanes(lanes, HOT_AVX2_STEP, &index_sum[j]);
+    }
+    _mm256_store_ps(lanes, acc_wt);
+    add_float_lanes(lanes, HOT_AVX2_STEP, wt_sum);
+
+    hot_sums_scalar(buf, valid_date_array, i, valid_date_count, lower_ordinal,
+                    upper_ordinal, index_sum, wt_sum, valid_count_window,
+                    image_bands, blue, red);
+}
+
+HOT_INSTANCE(hot_sums_avx2_4, hot_sums_avx2, PS4_IMAGE_BANDS, PS4_BLUE, PS4_RED,
+             __attribute__((target("avx2"))))
+HOT_INSTANCE(hot_sums_avx2_8, hot_sums_avx2, SD8_IMAGE_BANDS, SD8_BLUE, SD8_RED,
+             __attribute__((target("avx2"))))
+
+/******************************************************************************
+MODULE:  modified_hot_sums_avx2
+
+PURPOSE:  Modified HOT weights of 8 observations per step
+
+RETURN VALUE: None
+******************************************************************************/
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void modified_hot_sums_avx2
+(
+    short int **ts_subset,
+    int first,
+    int valid_count_window,
+    short int medium_shadow,
+    double *index_sum,
+    double *wt_sum,
+    const int image_bands,
+    const int blue,
+    const int nir
+)
+{
+    int i, j;
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 median = _mm256_set1_ps((float)medium_shadow);
+    __m256 band[MAX_IMAGE_BANDS];
+    __m256 acc[MAX_IMAGE_BANDS];
+    __m256 acc_wt = _mm256_setzero_ps();
+    __m256 ratio, wt_shadow, wt;
+    float lanes[HOT_AVX2_STEP] __attribute__((aligned(32)));
+
+    for (j = 0; j < image_bands; j++)
+        acc[j] = _mm256_setzero_ps();
+
+    for (i = first; i + HOT_AVX2_STEP <= valid_count_window; i += HOT_AVX2_STEP)
+    {
+        for (j = 0; j < image_bands; j++)
+            band[j] = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+                _mm_loadu_si128((const __m128i *)(ts_subset[j] + i))));
+
+        ratio = _mm256_div_ps(band[nir], median);
+        ratio = _mm256_mul_ps(ratio, ratio);
+        wt_shadow = _mm256_blendv_ps(one, _mm256_mul_ps(ratio, ratio),
+                                     _mm256_cmp_ps(band[nir], median, _CMP_LT_OQ));
+        wt = _mm256_div_ps(wt_shadow, _mm256_mul_ps(band[blue], band[blue]));
+
+        for (j = 0; j < image_bands; j++)
+            acc[j] = _mm256_add_ps(acc[j], _mm256_mul_ps(band[j], wt));
+        acc_wt = _mm256_add_ps(acc_wt, wt);
+    }
+
+    for (j = 0; j < image_bands; j++)
+    {
+        _mm256_store_ps(lanes, acc[j]);
+        add_float_lanes(lanes, HOT_AVX2_STEP, &index_sum[j]);
+    }
+    _mm256_store_ps(lanes, acc_wt);
+    add_float_lanes(lanes, HOT_AVX2_STEP, wt_sum);
+
+    modified_hot_sums_scalar(ts_subset, i, valid_count_window, medium_shadow,
+                             index_sum, wt_sum, image_bands, blue, nir);
+}
+
+MODIFIED_HOT_INSTANCE(modified_hot_sums_avx2_4, modified_hot_sums_avx2,
+                      PS4_IMAGE_BANDS, PS4_BLUE, PS4_NIR,
+                      __attribute__((target("avx2"))))
+MODIFIED_HOT_INSTANCE(modified_hot_sums_avx2_8, modified_hot_sums_avx2,
+                      SD8_IMAGE_BANDS, SD8_BLUE, SD8_NIR,
+                      __attribute__((target("avx2"))))
+
+/******************************************************************************
+MODULE:  hot_sums_avx512
+
+PURPOSE:  HOT weights of 16 observations per step, the date window applied
+          as a mask register
+
+RETURN VALUE: None
+******************************************************************************/
+__attribute__((target("avx512f")))
+static inline __attribute__((always_inline)) void hot_sums_avx512
+(
+    short int **buf,
+    int *valid_date_array,
+    int first,
+    int valid_date_count,
+    int lower_ordinal,
+    int upper_ordinal,
+    double *index_sum,
+    double *wt_sum,
+    int *valid_count_window,
+    const int image_bands,
+    const int blue,
+    const int red
+)
+{
+    int i, j;
+    const __m512i lower = _mm512_set1_epi32(lower_ordinal - 1);
+    const __m512i upper = _mm512_set1_epi32(upper_ordinal + 1);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    __m512i dates;
+    __mmask16 in_window;
+    __m512 band[MAX_IMAGE_BANDS];
+    __m512 acc[MAX_IMAGE_BANDS];
+    __m512 acc_wt = _mm512_setzero_ps();
+    __m512 diff, wt;
+    float lanes[HOT_AVX512_STEP] __attribute__((aligned(64)));
+
+    for (j = 0; j < image_bands; j++)
+        acc[j] = _mm512_setzero_ps();
+
+    for (i = first; i + HOT_AVX512_STEP <= valid_date_count; i += HOT_AVX512_STEP)
+    {
+        dates = _mm512_loadu_si512((const void *)(valid_date_array + i));
+        in_window = _mm512_cmpgt_epi32_mask(dates, lower)
+                    & _mm512_cmpgt_epi32_mask(upper, dates);
+        if (in_window == 0)
+            continue;
+
+        for (j = 0; j < image_bands; j++)
+            band[j] = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(
+                _mm256_loadu_si256((const __m256i *)(buf[j] + i))));
+
+        diff = _mm512_sub_ps(band[blue], _mm512_mul_ps(half, band[red]));
+        wt = _mm512_maskz_div_ps(in_window, one, _mm512_mul_ps(diff, diff));
+
+        for (j = 0; j < image_bands; j++)
+            acc[j] = _mm512_add_ps(acc[j], _mm512_mul_ps(band[j], wt));
+        acc_wt = _mm512_add_ps(acc_wt, wt);
+        *valid_count_window += __builtin_popcount((unsigned int)in_window);
+    }
+
+    for (j = 0; j < image_bands; j++)
+    {
+        _mm512_store_ps(lanes, acc[j]);
+        add_float_lanes(lanes, HOT_AVX512_STEP, &index_sum[j]);
+    }
+    _mm512_store_ps(lanes, acc_wt);
+    add_float_lanes(lanes, HOT_AVX512_STEP, wt_sum);
+
+    hot_sums_scalar(buf, valid_date_array, i, valid_date_count, lower_ordinal,
+                    upper_ordinal, index_sum, wt_sum, valid_count_window,
+                    image_bands, blue, red);
+}
+
+HOT_INSTANCE(hot_sums_avx512_4, hot_sums_avx512, PS4_IMAGE_BANDS, PS4_BLUE, PS4_RED,
+             __attribute__((target("avx512f"))))
+HOT_INSTANCE(hot_sums_avx512_8, hot_sums_avx512, SD8_IMAGE_BANDS, SD8_BLUE, SD8_RED,
+             __attribute__((target("avx512f"))))
+
+/******************************************************************************
+MODULE:  modified_hot_sums_avx512
+
+PURPOSE:  Modified HOT weights of 16 observations per step
+
+RETURN VALUE: None
+******************************************************************************/
+__attribute__((target("avx512f")))
+static inline __attribute__((always_inline)) void modified_hot_sums_avx512
+(
+    short int **ts_subset,
+    int first,
+    int valid_count_window,
+    short int medium_shadow,
+    double *index_sum,
+    double *wt_sum,
+    const int image_bands,
+    const int blue,
+    const int nir
+)
+{
+    int i, j;
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 median = _mm512_set1_ps((float)medium_shadow);
+    __m512 band[MAX_IMAGE_BANDS];
+    __m512 acc[MAX_IMAGE_BANDS];
+    __m512 acc_wt = _mm512_setzero_ps();
+    __m512 ratio, wt_shadow, wt;
+    float lanes[HOT_AVX512_STEP] __attribute__((aligned(64)));
+
+    for (j = 0; j < image_bands; j++)
+        acc[j] = _mm512_setzero_ps();
+
+    for (i = first; i + HOT_AVX512_STEP <= valid_count_window; i += HOT_AVX512_STEP)
+    {
+        for (j = 0; j < image_bands; j++)
+            band[j] = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(
+                _mm256_loadu_si256((const __m256i *)(ts_subset[j] + i))));
+
+        ratio = _mm512_div_ps(band[nir], median);
+        ratio = _mm512_mul_ps(ratio, ratio);
+        wt_shadow = _mm512_mask_blend_ps(
+            _mm512_cmp_ps_mask(band[nir], median, _CMP_LT_OQ),
+            one, _mm512_mul_ps(ratio, ratio));
+        wt = _mm512_div_ps(wt_shadow, _mm512_mul_ps(band[blue], band[blue]));
+
+        for (j = 0; j < image_bands; j++)
+            acc[j] = _mm512_add_ps(acc[j], _mm512_mul_ps(band[j], wt));
+        acc_wt = _mm512_add_ps(acc_wt, wt);
+    }
+
+    for (j = 0; j < image_bands; j++)
+    {
+        _mm512_store_ps(lanes, acc[j]);
+        add_float_lanes(lanes, HOT_AVX512_STEP, &index_sum[j]);
+    }
+    _mm512_store_ps(lanes, acc_wt);
+    add_float_lanes(lanes, HOT_AVX512_STEP, wt_sum);
+
+    modified_hot_sums_scalar(ts_subset, i, valid_count_window, medium_shadow,
+                             index_sum, wt_sum, image_bands, blue, nir);
+}
+
+MODIFIED_HOT_INSTANCE(modified_hot_sums_avx512_4, modified_hot_sums_avx512,
+                      PS4_IMAGE_BANDS, PS4_BLUE, PS4_NIR,
+                      __attribute__((target("avx512f"))))
+MODIFIED_HOT_INSTANCE(modified_hot_sums_avx512_8, modified_hot_sums_avx512,
+                      SD8_IMAGE_BANDS, SD8_BLUE, SD8_NIR,
+                      __attribute__((target("avx512f"))))
+
+#endif // HOT_X86_SIMD
+
+/******************************************************************************
+MODULE:  init_hot_dispatch
+
+PURPOSE:  Pick the widest kernels the running CPU supports, in their
+          instances for each band layout
+
+RETURN VALUE: None
+
+NOTES: both layouts are resolved, as a batch may switch layout between tiles
+******************************************************************************/
+static void init_hot_dispatch(void)
+{
+    hot_kernel[0] = hot_sums_scalar_4;
+    hot_kernel[1] = hot_sums_scalar_8;
+    modified_hot_kernel[0] = modified_hot_sums_scalar_4;
+    modified_hot_kernel[1] = modified_hot_sums_scalar_8;
+    hot_isa = "scalar";
+
+#ifdef HOT_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        hot_kernel[0] = hot_sums_avx512_4;
+        hot_kernel[1] = hot_sums_avx512_8;
+        modified_hot_kernel[0] = modified_hot_sums_avx512_4;
+        modified_hot_kernel[1] = modified_hot_sums_avx512_8;
+        hot_isa = "avx512";
+    }
+    else if (__builtin_cpu_supports("avx2"))
+    {
+        hot_kernel[0] = hot_sums_avx2_4;
+        hot_kernel[1] = hot_sums_avx2_8;
+        modified_hot_kernel[0] = modified_hot_sums_avx2_4;
+        modified_hot_kernel[1] = modified_hot_sums_avx2_8;
+        hot_isa = "avx2";
+    }
+#endif
+}
+
+/******************************************************************************
+MODULE:  hot_weighted_sums
+
+PURPOSE:  Add the HOT weights of the observations inside the window, and the
+          weighted band values, to the sums of hot_compositing
+
+RETURN VALUE: None
+
+NOTES: the sums and the count are added to, the caller zeroes them
+******************************************************************************/
+void hot_weighted_sums
+(
+    short int **buf,          /* I: band series of one pixel                  */
+    int *valid_date_array,    /* I: date of every observation                 */
+    int valid_date_count,     /* I: number of observations                    */
+    int lower_ordinal,        /* I: first date of the window                  */
+    int upper_ordinal,        /* I: last date of the window                   */
+    double *index_sum,        /* O: weighted sum of every band                */
+    double *wt_sum,           /* O: sum of the weights                        */
+    int *valid_count_window   /* O: observations inside the window            */
+)
+{
+    int sd8 = (get_band_layout()->image_bands == SD8_IMAGE_BANDS);
+
+    pthread_once(&hot_once, init_hot_dispatch);
+
+    hot_kernel[sd8](buf, valid_date_array, 0, valid_date_count, lower_ordinal,
+                    upper_ordinal, index_sum, wt_sum, valid_count_window);
+}
+
+/******************************************************************************
+MODULE:  modified_hot_weighted_sums
+
+PURPOSE:  Add the modified HOT weights of the window observations, and the
+          weighted band values, to the sums of modified_hot_compositing
+
+RETURN VALUE: None
+
+NOTES: the sums are added to, the caller zeroes them
+******************************************************************************/
+void modified_hot_weighted_sums
+(
+    short int **ts_subset,    /* I: band series of the window                 */
+    int valid_count_window,   /* I: number of observations of the window      */
+    short int medium_shadow,  /* I: median nir of the window                  */
+    double *index_sum,        /* O: weighted sum of every band                */
+    double *wt_sum            /* O: sum of the weights                        */
+)
+{
+    int sd8 = (get_band_layout()->image_bands == SD8_IMAGE_BANDS);
+
+    pthread_once(&hot_once, init_hot_dispatch);
+
+    modified_hot_kernel[sd8](ts_subset, 0, valid_count_window, medium_shadow,
+                             index_sum, wt_sum);
+}
+
+/******************************************************************************
+MODULE:  hot_kernels_isa_name
+
+PURPOSE:  Name of the kernels the HOT weighted sums dispatch to, for logging
+
+RETURN VALUE:
+Type = const char *
+Value           Description
+-----           -----------
+name            "avx512", "avx2" or "scalar"
+******************************************************************************/
+const char *hot_kernels_isa_name(void)
+{
+    pthread_once(&hot_once, init_hot_dispatch);
+
+    return hot_isa;
+}
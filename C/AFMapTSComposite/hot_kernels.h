@@ -0,0 +1,29 @@
+#ifndef HOT_KERNELS_H
+#define HOT_KERNELS_H
+
+#include "const.h"
+
+void hot_weighted_sums
+(
+    short int **buf,          /* I: band series of one pixel                  */
+    int *valid_date_array,    /* I: date of every observation                 */
+    int valid_date_count,     /* I: number of observations                    */
+    int lower_ordinal,        /* I: first date of the window                  */
+    int upper_ordinal,        /* I: last date of the window                   */
+    double *index_sum,        /* O: weighted sum of every band                */
+    double *wt_sum,           /* O: sum of the weights                        */
+    int *valid_count_window   /* O: observations inside the window            */
+);
+
+void modified_hot_weighted_sums
+(
+    short int **ts_subset,    /* I: band series of the window                 */
+    int valid_count_window,   /* I: number of observations of the window      */
+    short int medium_shadow,  /* I: median nir of the window                  */
+    double *index_sum,        /* O: weighted sum of every band                */
+    double *wt_sum            /* O: sum of the weights                        */
+);
+
+const char *hot_kernels_isa_name(void);
+
+#endif // HOT_KERNELS_H
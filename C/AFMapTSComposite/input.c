@@ -1,9 +1,12 @@
+#define _FILE_OFFSET_BITS 64
  #include <dirent.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
 #include "input.h"
+#include "input_compact.h"
+#include "band_layout.h"
 #include "utilities.h"
 #include "const.h"
 
@@ -187,6 +190,65 @@ int is_leap_year
     }
 }
 
+/******************************************************************************
+MODULE:  prune_scenes_by_date
+
+PURPOSE:  Keep only the scenes acquired within one of the compositing
+          windows [lower_ordinal, upper_ordinal], so that no other scene is
+          opened or read
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+SUCCESS         No errors encountered
+
+NOTES: scene_list and sdate are compacted in place and keep their order.
+       Only for methods whose composite ignores the observations outside
+       its window (prunable in the method registry); the sparse-pixel
+       median of the fitting methods runs over the whole series. If no
+       scene falls in any window the first scene is kept, which yields the
+       same fill output as reading them all.
+******************************************************************************/
+int prune_scenes_by_date
+(
+    char **scene_list,      /* I/O: sorted scene_list, pruned as output      */
+    int *sdate,             /* I/O: julian date of every scene, pruned       */
+    int num_scenes,         /* I: number of scenes in the scene list         */
+    int *lower_ordinal,     /* I: lower bound of every compositing window    */
+    int *upper_ordinal,     /* I: upper bound of every compositing window    */
+    int n_windows,          /* I: number of compositing windows              */
+    int *num_kept           /* O: number of scenes left in the list          */
+)
+{
+    int i, w;
+    int n = 0;
+
+    for (i = 0; i < num_scenes; i++)
+    {
+        for (w = 0; w < n_windows; w++)
+            if ((sdate[i] > lower_ordinal[w] - 1) && (sdate[i] < upper_ordinal[w] + 1))
+                break;
+
+        if (w < n_windows)
+        {
+            if (n != i)
+            {
+                strcpy(scene_list[n], scene_list[i]);
+                sdate[n] = sdate[i];
+            }
+            n++;
+        }
+    }
+
+    if ((n == 0) && (num_scenes > 0))
+        n = 1;
+
+    *num_kept = n;
+
+    return (SUCCESS);
+}
+
 /*****************************************************************************
 MODULE:  create_scene_list
 
@@ -333,6 +395,9 @@ int read_envi_header
         RETURN_ERROR ("opening header file", FUNC_NAME, FAILURE);
     }
 
+    /* headers without a band count are of the 4-band scenes */
+    meta->bands = PS4_IMAGE_BANDS + 1;
+
     /* process line by line */
     while(fgets(buffer, MAX_STR_LEN, in) != NULL)
     {
@@ -369,6 +434,12 @@ int read_envi_header
                 meta->samples = atoi(tokenptr);
             }
 
+            if (strcmp(label,"bands") == 0)
+            {
+                tokenptr = trimwhitespace(strtok(NULL, seperator));
+                meta->bands = atoi(tokenptr);
+            }
+
             if (strcmp(label,"interleave") == 0)
             {
                 tokenptr = trimwhitespace(strtok(NULL, seperator));
@@ -479,9 +550,10 @@ int read_bip_lines
     int  i, j, k;                     /* band loop counter.                   */
     char errmsg[MAX_STR_LEN];   /* for printing error text to the log.  */
     short int *tmp_buf;
+    const band_layout_t *bands = get_band_layout();
     char FUNC_NAME[] ="read_bip_lines";
 
-    tmp_buf = malloc(sizeof(short int) * TOTAL_BANDS);
+    tmp_buf = malloc(sizeof(short int) * bands->total_bands);
 
     /******************************************************************/
     /*                                                                */
@@ -496,7 +568,7 @@ int read_bip_lines
 
          for(k = 0; k < num_samples; k++)
          {
-             if (read_raw_binary(f_bip[i], 1, TOTAL_BANDS,
+             if (read_raw_binary(f_bip[i], 1, bands->total_bands,
                                  sizeof(short int), tmp_buf) != 0)
              {
                  sprintf(errmsg, "error reading %d scene, %d row, %d col\n", i, cur_row, k);
@@ -504,9 +576,9 @@ int read_bip_lines
              }
 
              // if it is a valid pixel
-             if ((tmp_buf[TOTAL_BANDS - 1] < MASK_FILL) && (tmp_buf[0]!= IMAGE_FILL))
+             if ((tmp_buf[bands->total_bands - 1] < MASK_FILL) && (tmp_buf[0]!= IMAGE_FILL))
              {
-                 for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
+                 for(j = 0; j < bands->image_bands; j++)
                  {
                      //printf("%d\n", valid_scene_count[k]);
                      image_buf[j][k * num_scenes + valid_scene_count[k]] = tmp_buf[j];
@@ -524,6 +596,66 @@ int read_bip_lines
 
 }
 
+/******************************************************************************
+MODULE: read_bip_scanlines
+
+PURPOSE: reading bip images by line, one fread per scene and scanline
+
+RETURN VALUE:
+Type = success or fail
+
+NOTES: same output as read_bip_lines; the whole scanline of a scene is read
+       in one call and split/filtered by compact_bip_scanline, which uses
+       the SIMD kernel the CPU supports. Rows may come in any order, a file
+       is only repositioned when the row is not the next one
+*****************************************************************************/
+
+int read_bip_scanlines
+(
+    FILE **f_bip,            /* I/O: file pointer array for BIP  file names */
+    int  num_samples,         /* I:   number of image samples (X width)      */
+    int  num_scenes,      /* I:   current num. in list of scenes to read */
+    int *sdate,              /* I:   Original array of julian date values         */
+    short int  **image_buf,          /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,           /* I/O: x/y is not always valid for gridded data,  */
+    int **updated_sdate_array,         /* I/O: new buf of valid date values for each pixel */
+    int cur_row
+)
+{
+    int  i;
+    char errmsg[MAX_STR_LEN];   /* for printing error text to the log.  */
+    short int *line_buf;
+    int total_bands = get_band_layout()->total_bands;
+    off_t offset = (off_t)cur_row * total_bands * num_samples * sizeof(short int);
+    char FUNC_NAME[] ="read_bip_scanlines";
+
+    line_buf = malloc(sizeof(short int) * total_bands * num_samples);
+    if (line_buf == NULL)
+        RETURN_ERROR("Allocating line_buf memory", FUNC_NAME, ERROR);
+
+    for (i = 0; i < num_scenes; i++)
+    {
+        /* rows read in order need no seek */
+        if (ftello(f_bip[i]) != offset)
+            fseeko(f_bip[i], offset, SEEK_SET);
+
+        if (read_raw_binary(f_bip[i], 1, total_bands * num_samples,
+                            sizeof(short int), line_buf) != 0)
+        {
+            free(line_buf);
+            sprintf(errmsg, "error reading %d scene, %d row\n", i, cur_row);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        compact_bip_scanline(line_buf, num_samples, num_scenes, sdate[i],
+                             image_buf, valid_scene_count, updated_sdate_array);
+    }
+
+    free(line_buf);
+
+    return (SUCCESS);
+}
+
 /******************************************************************************
 MODULE: read_bip_lines
 
@@ -568,8 +700,9 @@ int read_bip
     char FUNC_NAME[] = "read_bip"; /* function name */
     short int *tmp_buf;
     int j;
+    const band_layout_t *bands = get_band_layout();
 
-    tmp_buf = malloc(sizeof(short int) * TOTAL_BANDS);
+    tmp_buf = malloc(sizeof(short int) * bands->total_bands);
     /******************************************************************/
     /*                                                                */
     /* Determine the BIP file name, open, fseek.                      */
@@ -597,7 +730,7 @@ int read_bip
 
      /* read quality band, and check if the pixel is valid */
      fseek(fp_bip[curr_scene_num], (((row - 1)* num_samples + col - 1) *
-         TOTAL_BANDS + TOTAL_BANDS - 1) * sizeof(short int), SEEK_SET);
+         bands->total_bands + bands->total_bands - 1) * sizeof(short int), SEEK_SET);
 
      qa_val = malloc(sizeof(short int));
      read_raw_binary(fp_bip[curr_scene_num], 1, 1,
@@ -606,18 +739,18 @@ int read_bip
      if (*qa_val < MASK_FILL)
      {
          fseek(fp_bip[curr_scene_num], ((row - 1)* num_samples + col - 1) *
-                       TOTAL_BANDS * sizeof(short int), SEEK_SET);
+                       bands->total_bands * sizeof(short int), SEEK_SET);
 
-         if (read_raw_binary(fp_bip[curr_scene_num], 1, TOTAL_BANDS,
+         if (read_raw_binary(fp_bip[curr_scene_num], 1, bands->total_bands,
                              sizeof(short int), tmp_buf) != 0)
          {
              sprintf(errmsg, "error reading %d scene, %d row, %d col\n", curr_scene_num, row, col);
              RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
          }
-         if ((tmp_buf[TOTAL_BANDS - 1] < MASK_FILL) && (tmp_buf[0]!= IMAGE_FILL))
+         if ((tmp_buf[bands->total_bands - 1] < MASK_FILL) && (tmp_buf[0]!= IMAGE_FILL))
          {
              //printf("%d\n", tmp_buf[0]);
-             for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
+             for(j = 0; j < bands->image_bands; j++)
              {
                  //printf("%d\n", valid_scene_count[k]);
                  image_buf[j][*valid_scene_count] = tmp_buf[j];
@@ -8,6 +8,7 @@
 typedef struct {
     int lines;            /* number of lines in a scene */
     int samples;          /* number of samples in a scene */
+    int bands;            /* bands of a scene, the mask included */
     int data_type;        /* envi data type */
     int byte_order;       /* envi byte order */
     int utm_zone;         /* UTM zone; use a negative number if this is a
@@ -32,6 +33,17 @@ int is_leap_year
     int year        /*I: Year to test         */
 );
 
+int prune_scenes_by_date
+(
+    char **scene_list,      /* I/O: sorted scene_list, pruned as output      */
+    int *sdate,             /* I/O: julian date of every scene, pruned       */
+    int num_scenes,         /* I: number of scenes in the scene list         */
+    int *lower_ordinal,     /* I: lower bound of every compositing window    */
+    int *upper_ordinal,     /* I: upper bound of every compositing window    */
+    int n_windows,          /* I: number of compositing windows              */
+    int *num_kept           /* O: number of scenes left in the list          */
+);
+
 int create_scene_list
 (
     const char *in_path,         /* I: string of ARD image directory          */
@@ -59,6 +71,18 @@ int read_bip_lines
     int cur_row
 );
 
+int read_bip_scanlines
+(
+    FILE **f_bip,            /* I/O: file pointer array for BIP  file names */
+    int  num_samples,         /* I:   number of image samples (X width)      */
+    int  num_scenes,      /* I:   current num. in list of scenes to read */
+    int *sdate,              /* I:   Original array of julian date values         */
+    short int  **image_buf,          /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,           /* I/O: x/y is not always valid for gridded data,  */
+    int **updated_sdate_array,         /* I/O: new buf of valid date values for each pixel */
+    int cur_row
+);
+
 int read_bip
 (
     char *in_path,       /* I: Landsat ARD directory  */
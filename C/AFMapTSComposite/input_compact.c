@@ -0,0 +1,398 @@
+#include <pthread.h>
+
+#include "input_compact.h"
+#include "band_layout.h"
+#include "const.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define COMPACT_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* samples de-interleaved per SIMD step */
+#define COMPACT_SSSE3_STEP 8
+#define COMPACT_AVX2_STEP 16
+
+typedef void (*compact_kernel_t)(const short int *, int, int, int, int,
+                                 short int **, int *, int **);
+
+/* kernel of every band layout, [0] 4-band and [1] 8-band records */
+static compact_kernel_t compact_kernel[2] = {NULL, NULL};
+static const char *compact_isa = "scalar";
+static pthread_once_t compact_once = PTHREAD_ONCE_INIT;
+
+/* a kernel instance for the records of a band layout: the body is inlined
+   with image_bands a constant, so its band loops unroll as they did when
+   the band count was fixed at compile time */
+#define COMPACT_INSTANCE(name, body, image_bands, ...)                        \
+    __VA_ARGS__ static void name(const short int *line, int first_sample,    \
+                                 int num_samples, int num_scenes,            \
+                                 int scene_date, short int **image_buf,      \
+                                 int *valid_scene_count,                     \
+                                 int **updated_sdate_array)                  \
+    {                                                                        \
+        body(line, first_sample, num_samples, num_scenes, scene_date,        \
+             image_buf, valid_scene_count, updated_sdate_array, image_bands); \
+    }
+
+/******************************************************************************
+MODULE:  compact_bip_scalar
+
+PURPOSE:  Reference kernel: test every record of a scanline and append the
+          valid ones to the per-pixel series, one sample at a time
+
+RETURN VALUE: None
+
+NOTES: this is the per-sample logic of read_bip_lines; the SIMD kernels
+       below fall back to it for the samples that do not fill a vector
+******************************************************************************/
+static inline __attribute__((always_inline)) void compact_bip_scalar
+(
+    const short int *line,
+    int  first_sample,       /* I: first sample of the scanline to process */
+    int  num_samples,
+    int  num_scenes,
+    int  scene_date,
+    short int  **image_buf,
+    int *valid_scene_count,
+    int **updated_sdate_array,
+    const int image_bands    /* I: image bands of a record, the mask follows */
+)
+{
+    int j, k;
+    const short int *rec;
+
+    for(k = first_sample; k < num_samples; k++)
+    {
+        rec = line + (long)k * (image_bands + 1);
+
+        // if it is a valid pixel
+        if ((rec[image_bands] < MASK_FILL) && (rec[0]!= IMAGE_FILL))
+        {
+            for(j = 0; j < image_bands; j++)
+            {
+                image_buf[j][k * num_scenes + valid_scene_count[k]] = rec[j];
+            }
+            updated_sdate_array[k][valid_scene_count[k]] = scene_date;
+            valid_scene_count[k] = valid_scene_count[k] + 1;
+        }
+    }
+}
+
+COMPACT_INSTANCE(compact_bip_scalar_4, compact_bip_scalar, PS4_IMAGE_BANDS)
+COMPACT_INSTANCE(compact_bip_scalar_8, compact_bip_scalar, SD8_IMAGE_BANDS)
+
+#ifdef COMPACT_X86_SIMD
+
+/* pshufb controls: deinterleave_mask[sd8][b][r] moves the band-b values
+   held in the r-th 16-byte register of an 8-sample group into lanes 0..7; a
+   group of 8 records of total_bands values fills total_bands registers */
+static unsigned char deinterleave_mask[2][MAX_BANDS][MAX_BANDS][16]
+    __attribute__((aligned(16)));
+
+static void init_deinterleave_mask(int sd8, int total_bands)
+{
+    int b, r, k, s;
+
+    for (b = 0; b < total_bands; b++)
+        for (r = 0; r < total_bands; r++)
+            for (k = 0; k < 8; k++)
+            {
+                s = k * total_bands + b;     /* short index in the group */
+                if (s / 8 == r)
+                {
+                    deinterleave_mask[sd8][b][r][2 * k] = (unsigned char)(2 * (s % 8));
+                    deinterleave_mask[sd8][b][r][2 * k + 1] = (unsigned char)(2 * (s % 8) + 1);
+                }
+                else
+                {
+                    deinterleave_mask[sd8][b][r][2 * k] = 0x80;
+                    deinterleave_mask[sd8][b][r][2 * k + 1] = 0x80;
+                }
+            }
+}
+
+/******************************************************************************
+MODULE:  scatter_valid_samples
+
+PURPOSE:  Append the samples flagged in a validity bitmask, already split into
+          band planes, to their per-pixel series
+
+RETURN VALUE: None
+******************************************************************************/
+static inline __attribute__((always_inline)) void scatter_valid_samples
+(
+    short int planes[MAX_IMAGE_BANDS][COMPACT_AVX2_STEP],
+    unsigned int bits,        /* I: bit k set if sample k0 + k is valid      */
+    int  k0,                  /* I: first sample of the group                */
+    int  num_scenes,
+    int  scene_date,
+    short int  **image_buf,
+    int *valid_scene_count,
+    int **updated_sdate_array,
+    const int image_bands
+)
+{
+    int j, k, pos;
+
+    while (bits != 0)
+    {
+        k = __builtin_ctz(bits);
+        bits &= bits - 1;
+
+        pos = (k0 + k) * num_scenes + valid_scene_count[k0 + k];
+        for(j = 0; j < image_bands; j++)
+            image_buf[j][pos] = planes[j][k];
+        updated_sdate_array[k0 + k][valid_scene_count[k0 + k]] = scene_date;
+        valid_scene_count[k0 + k]++;
+    }
+}
+
+/******************************************************************************
+MODULE:  compact_bip_ssse3
+
+PURPOSE:  De-interleave 8 records per step with pshufb, test all 8 for
+          validity at once and compact the valid ones
+
+RETURN VALUE: None
+******************************************************************************/
+__attribute__((target("ssse3")))
+static inline __attribute__((always_inline)) void compact_bip_ssse3
+(
+    const short int *line,
+    int  first_sample,       /* I: first sample of the scanline to process */
+    int  num_samples,
+    int  num_scenes,
+    int  scene_date,
+    short int  **image_buf,
+    int *valid_scene_count,
+    int **updated_sdate_array,
+    const int image_bands
+)
+{
+    const int total_bands = image_bands + 1;
+    int b, r, k;
+    __m128i reg[MAX_BANDS];
+    __m128i mask[MAX_BANDS][MAX_BANDS];
+    __m128i band[MAX_BANDS];
+    __m128i valid;
+    const __m128i image_fill = _mm_set1_epi16(IMAGE_FILL);
+    const __m128i mask_fill = _mm_set1_epi16(MASK_FILL);
+    short int planes[MAX_IMAGE_BANDS][COMPACT_AVX2_STEP] __attribute__((aligned(16)));
+    unsigned int bits;
+
+    for (b = 0; b < total_bands; b++)
+        for (r = 0; r < total_bands; r++)
+            mask[b][r] = _mm_load_si128((const __m128i *)
+                deinterleave_mask[image_bands == SD8_IMAGE_BANDS][b][r]);
+
+    for (k = first_sample; k + COMPACT_SSSE3_STEP <= num_samples; k += COMPACT_SSSE3_STEP)
+    {
+        for (r = 0; r < total_bands; r++)
+            reg[r] = _mm_loadu_si128((const __m128i *)(line + (long)k * total_bands) + r);
+
+        for (b = 0; b < total_bands; b++)
+        {
+            band[b] = _mm_shuffle_epi8(reg[0], mask[b][0]);
+            for (r = 1; r < total_bands; r++)
+                band[b] = _mm_or_si128(band[b], _mm_shuffle_epi8(reg[r], mask[b][r]));
+        }
+
+        /* QA below MASK_FILL and the first band not filled */
+        valid = _mm_andnot_si128(_mm_cmpeq_epi16(band[0], image_fill),
+                                 _mm_cmplt_epi16(band[total_bands - 1], mask_fill));
+        bits = (unsigned int)_mm_movemask_epi8(_mm_packs_epi16(valid, _mm_setzero_si128()));
+        if (bits == 0)
+            continue;
+
+        for (b = 0; b < image_bands; b++)
+            _mm_store_si128((__m128i *)planes[b], band[b]);
+
+        scatter_valid_samples(planes, bits, k, num_scenes, scene_date,
+                              image_buf, valid_scene_count, updated_sdate_array,
+                              image_bands);
+    }
+
+    if (k < num_samples)
+        compact_bip_scalar(line, k, num_samples, num_scenes, scene_date,
+                           image_buf, valid_scene_count, updated_sdate_array,
+                           image_bands);
+}
+
+COMPACT_INSTANCE(compact_bip_ssse3_4, compact_bip_ssse3, PS4_IMAGE_BANDS,
+                 __attribute__((target("ssse3"))))
+COMPACT_INSTANCE(compact_bip_ssse3_8, compact_bip_ssse3, SD8_IMAGE_BANDS,
+                 __attribute__((target("ssse3"))))
+
+/******************************************************************************
+MODULE:  compact_bip_avx2
+
+PURPOSE:  Same as compact_bip_ssse3 on 16 records per step; the two 8-record
+          groups sit in the two 128-bit lanes so the in-lane pshufb controls
+          are reused unchanged
+
+RETURN VALUE: None
+******************************************************************************/
+__attribute__((target("avx2")))
+static inline __attribute__((always_inline)) void compact_bip_avx2
+(
+    const short int *line,
+    int  first_sample,       /* I: first sample of the scanline to process */
+    int  num_samples,
+    int  num_scenes,
+    int  scene_date,
+    short int  **image_buf,
+    int *valid_scene_count,
+    int **updated_sdate_array,
+    const int image_bands
+)
+{
+    const int total_bands = image_bands + 1;
+    int b, r, k;
+    const __m128i *src;
+    __m256i reg[MAX_BANDS];
+    __m256i mask[MAX_BANDS][MAX_BANDS];
+    __m256i band[MAX_BANDS];
+    __m256i valid;
+    const __m256i image_fill = _mm256_set1_epi16(IMAGE_FILL);
+    const __m256i mask_fill = _mm256_set1_epi16(MASK_FILL);
+    short int planes[MAX_IMAGE_BANDS][COMPACT_AVX2_STEP] __attribute__((aligned(32)));
+    unsigned int bits;
+
+    for (b = 0; b < total_bands; b++)
+        for (r = 0; r < total_bands; r++)
+            mask[b][r] = _mm256_broadcastsi128_si256(
+                _mm_load_si128((const __m128i *)
+                    deinterleave_mask[image_bands == SD8_IMAGE_BANDS][b][r]));
+
+    for (k = first_sample; k + COMPACT_AVX2_STEP <= num_samples; k += COMPACT_AVX2_STEP)
+    {
+        src = (const __m128i *)(line + (long)k * total_bands);
+        for (r = 0; r < total_bands; r++)
+            reg[r] = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128(src + r)),
+                _mm_loadu_si128(src + total_bands + r), 1);
+
+        for (b = 0; b < total_bands; b++)
+        {
+            band[b] = _mm256_shuffle_epi8(reg[0], mask[b][0]);
+            for (r = 1; r < total_bands; r++)
+                band[b] = _mm256_or_si256(band[b], _mm256_shuffle_epi8(reg[r], mask[b][r]));
+        }
+
+        valid = _mm256_andnot_si256(_mm256_cmpeq_epi16(band[0], image_fill),
+                                    _mm256_cmpgt_epi16(mask_fill, band[total_bands - 1]));
+        /* packs works per lane: samples 0..7 land in bits 0..7, 8..15 in 16..23 */
+        bits = (unsigned int)_mm256_movemask_epi8(
+            _mm256_packs_epi16(valid, _mm256_setzero_si256()));
+        bits = (bits & 0xFF) | ((bits >> 8) & 0xFF00);
+        if (bits == 0)
+            continue;
+
+        for (b = 0; b < image_bands; b++)
+            _mm256_store_si256((__m256i *)planes[b], band[b]);
+
+        scatter_valid_samples(planes, bits, k, num_scenes, scene_date,
+                              image_buf, valid_scene_count, updated_sdate_array,
+                              image_bands);
+    }
+
+    if (k < num_samples)
+        compact_bip_ssse3(line, k, num_samples, num_scenes, scene_date,
+                          image_buf, valid_scene_count, updated_sdate_array,
+                          image_bands);
+}
+
+COMPACT_INSTANCE(compact_bip_avx2_4, compact_bip_avx2, PS4_IMAGE_BANDS,
+                 __attribute__((target("avx2"))))
+COMPACT_INSTANCE(compact_bip_avx2_8, compact_bip_avx2, SD8_IMAGE_BANDS,
+                 __attribute__((target("avx2"))))
+
+#endif // COMPACT_X86_SIMD
+
+/******************************************************************************
+MODULE:  init_compact_dispatch
+
+PURPOSE:  Pick the widest kernel the running CPU supports, in its instance
+          for each band layout
+
+RETURN VALUE: None
+
+NOTES: both layouts are resolved, as a batch may switch layout between tiles
+******************************************************************************/
+static void init_compact_dispatch(void)
+{
+    compact_kernel[0] = compact_bip_scalar_4;
+    compact_kernel[1] = compact_bip_scalar_8;
+    compact_isa = "scalar";
+
+#ifdef COMPACT_X86_SIMD
+    __builtin_cpu_init();
+    init_deinterleave_mask(0, PS4_IMAGE_BANDS + 1);
+    init_deinterleave_mask(1, SD8_IMAGE_BANDS + 1);
+    if (__builtin_cpu_supports("avx2"))
+    {
+        compact_kernel[0] = compact_bip_avx2_4;
+        compact_kernel[1] = compact_bip_avx2_8;
+        compact_isa = "avx2";
+    }
+    else if (__builtin_cpu_supports("ssse3"))
+    {
+        compact_kernel[0] = compact_bip_ssse3_4;
+        compact_kernel[1] = compact_bip_ssse3_8;
+        compact_isa = "ssse3";
+    }
+#endif
+}
+
+/******************************************************************************
+MODULE:  compact_bip_scanline
+
+PURPOSE:  Split one scanline of BIP records into bands, test the QA and fill
+          values of all samples, and append the valid records and the scene
+          date to the per-pixel series
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+SUCCESS         No errors encountered
+
+NOTES: output layout is the one of read_bip_lines: sample k of band j goes
+       to image_buf[j][k * num_scenes + valid_scene_count[k]]
+******************************************************************************/
+int compact_bip_scanline
+(
+    const short int *line,    /* I:   one scanline of BIP records of the band layout */
+    int  num_samples,         /* I:   number of image samples (X width)      */
+    int  num_scenes,          /* I:   column stride of the per-pixel series  */
+    int  scene_date,          /* I:   julian date of the scene               */
+    short int  **image_buf,   /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,   /* I/O: x/y is not always valid for gridded data,  */
+    int **updated_sdate_array /* I/O: new buf of valid date values for each pixel */
+)
+{
+    int sd8 = (get_band_layout()->image_bands == SD8_IMAGE_BANDS);
+
+    pthread_once(&compact_once, init_compact_dispatch);
+
+    compact_kernel[sd8](line, 0, num_samples, num_scenes, scene_date, image_buf,
+                        valid_scene_count, updated_sdate_array);
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  compact_bip_isa_name
+
+PURPOSE:  Name of the kernel compact_bip_scanline dispatches to, for logging
+
+RETURN VALUE:
+Type = const char *
+******************************************************************************/
+const char *compact_bip_isa_name(void)
+{
+    pthread_once(&compact_once, init_compact_dispatch);
+
+    return compact_isa;
+}
@@ -0,0 +1,19 @@
+#ifndef INPUT_COMPACT_H
+#define INPUT_COMPACT_H
+
+#include "const.h"
+
+int compact_bip_scanline
+(
+    const short int *line,    /* I:   one scanline of BIP records of the band layout */
+    int  num_samples,         /* I:   number of image samples (X width)      */
+    int  num_scenes,          /* I:   column stride of the per-pixel series  */
+    int  scene_date,          /* I:   julian date of the scene               */
+    short int  **image_buf,   /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,   /* I/O: x/y is not always valid for gridded data,  */
+    int **updated_sdate_array /* I/O: new buf of valid date values for each pixel */
+);
+
+const char *compact_bip_isa_name(void);
+
+#endif // INPUT_COMPACT_H
@@ -0,0 +1,372 @@
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "input_cube.h"
+#include "prefetch.h"
+#include "band_layout.h"
+#include "utilities.h"
+#include "const.h"
+
+/******************************************************************************
+MODULE:  open_time_cube
+
+PURPOSE:  Open a time cube written by write_time_cube and check that it
+          matches the ARD folder it is used with
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the cube cannot be read, is of another version, or its size
+                or scene count differs from the expected one
+SUCCESS         No errors encountered
+******************************************************************************/
+int open_time_cube
+(
+    char *cube_path,          /* I: time cube file                          */
+    int num_lines,            /* I: expected number of lines                */
+    int num_samples,          /* I: expected number of samples              */
+    int num_scenes,           /* I: expected number of scenes               */
+    time_cube_t *cube         /* O: opened cube                             */
+)
+{
+    int i;
+    size_t max_chunk = 0;
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "open_time_cube";
+
+    cube->row_offset = NULL;
+    cube->chunk = NULL;
+    cube->chunk_size = 0;
+
+    cube->fp = fopen(cube_path, "rb");
+    if (cube->fp == NULL)
+    {
+        sprintf(errmsg, "Opening time cube %s", cube_path);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    if ((fread(&cube->hdr, sizeof(cube_header_t), 1, cube->fp) != 1)
+        || (memcmp(cube->hdr.magic, CUBE_MAGIC, sizeof(cube->hdr.magic)) != 0)
+        || (cube->hdr.version != CUBE_VERSION))
+    {
+        close_time_cube(cube);
+        sprintf(errmsg, "%s is not a version %d time cube", cube_path, CUBE_VERSION);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    if (cube->hdr.bands != get_band_layout()->image_bands)
+    {
+        close_time_cube(cube);
+        sprintf(errmsg, "Time cube %s holds %d bands, the scenes %d", cube_path,
+                cube->hdr.bands, get_band_layout()->image_bands);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    if ((cube->hdr.lines != num_lines) || (cube->hdr.samples != num_samples)
+        || (cube->hdr.num_scenes != num_scenes))
+    {
+        close_time_cube(cube);
+        sprintf(errmsg, "Time cube %s is %dx%d with %d scenes, ARD is %dx%d with %d",
+                cube_path, cube->hdr.lines, cube->hdr.samples, cube->hdr.num_scenes,
+                num_lines, num_samples, num_scenes);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    cube->row_offset = (long long *)malloc((num_lines + 1) * sizeof(long long));
+    if (cube->row_offset == NULL)
+    {
+        close_time_cube(cube);
+        RETURN_ERROR("Allocating row_offset memory", FUNC_NAME, ERROR);
+    }
+
+    if (fread(cube->row_offset, sizeof(long long), num_lines + 1, cube->fp)
+        != (size_t)(num_lines + 1))
+    {
+        close_time_cube(cube);
+        RETURN_ERROR("Reading time cube row offsets", FUNC_NAME, ERROR);
+    }
+
+    for (i = 0; i < num_lines; i++)
+        if ((size_t)(cube->row_offset[i + 1] - cube->row_offset[i]) > max_chunk)
+            max_chunk = (size_t)(cube->row_offset[i + 1] - cube->row_offset[i]);
+
+    cube->chunk = (char *)malloc(max_chunk);
+    if (cube->chunk == NULL)
+    {
+        close_time_cube(cube);
+        RETURN_ERROR("Allocating chunk memory", FUNC_NAME, ERROR);
+    }
+    cube->chunk_size = max_chunk;
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  read_cube_lines
+
+PURPOSE:  Load the per-pixel series of one scanline from a time cube; same
+          output layout as read_bip_lines
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the row chunk is truncated or inconsistent
+SUCCESS         No errors encountered
+
+NOTES: one fread per row; rows read in order need no seek, so a whole run
+       is a single sequential stream through the file
+******************************************************************************/
+int read_cube_lines
+(
+    time_cube_t *cube,        /* I/O: opened cube                           */
+    int  num_scenes,          /* I:   column stride of the per-pixel series */
+    short int  **image_buf,   /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,   /* O:   number of valid values per pixel      */
+    int **updated_sdate_array,/* O:   new buf of valid date values for each pixel */
+    int cur_row               /* I:   row to read                           */
+)
+{
+    int j, k, n;
+    int samples = cube->hdr.samples;
+    size_t bytes;
+    size_t pos;
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "read_cube_lines";
+
+    bytes = (size_t)(cube->row_offset[cur_row + 1] - cube->row_offset[cur_row]);
+
+    if ((long long)ftello(cube->fp) != cube->row_offset[cur_row])
+        fseeko(cube->fp, (off_t)cube->row_offset[cur_row], SEEK_SET);
+
+    if (fread(cube->chunk, 1, bytes, cube->fp) != bytes)
+    {
+        sprintf(errmsg, "Reading time cube row %d", cur_row);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    memcpy(valid_scene_count, cube->chunk, samples * sizeof(int));
+    pos = samples * sizeof(int);
+
+    for (k = 0; k < samples; k++)
+    {
+        n = valid_scene_count[k];
+        if ((n < 0) || (n > num_scenes)
+            || (pos + (size_t)n * (sizeof(int) + cube->hdr.bands * sizeof(short int)) > bytes))
+        {
+            sprintf(errmsg, "Corrupted time cube row %d, col %d", cur_row, k);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        memcpy(updated_sdate_array[k], cube->chunk + pos, n * sizeof(int));
+        pos += n * sizeof(int);
+
+        for (j = 0; j < cube->hdr.bands; j++)
+        {
+            memcpy(&image_buf[j][k * num_scenes], cube->chunk + pos, n * sizeof(short int));
+            pos += n * sizeof(short int);
+        }
+    }
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  close_time_cube
+
+PURPOSE:  Close a time cube and free its buffers
+
+RETURN VALUE: None
+******************************************************************************/
+void close_time_cube
+(
+    time_cube_t *cube         /* I/O: opened cube                           */
+)
+{
+    if (cube->fp != NULL)
+        fclose(cube->fp);
+    cube->fp = NULL;
+    free(cube->row_offset);
+    cube->row_offset = NULL;
+    free(cube->chunk);
+    cube->chunk = NULL;
+    cube->chunk_size = 0;
+}
+
+/******************************************************************************
+MODULE:  write_cube_row
+
+PURPOSE:  Append the per-pixel series of one scanline to a time cube as a
+          row chunk
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           writing failed
+SUCCESS         No errors encountered
+******************************************************************************/
+int write_cube_row
+(
+    FILE *fp,                 /* I: cube file, positioned at the row chunk  */
+    int  num_samples,         /* I: number of image samples (X width)       */
+    int  num_scenes,          /* I: column stride of the per-pixel series   */
+    short int  **image_buf,   /* I: band values of the scanline             */
+    int *valid_scene_count,   /* I: number of valid values per pixel        */
+    int **updated_sdate_array,/* I: dates of the valid values per pixel     */
+    long long *chunk_bytes    /* O: bytes written                           */
+)
+{
+    int j, k, n;
+    int image_bands = get_band_layout()->image_bands;
+    char FUNC_NAME[] = "write_cube_row";
+
+    if (fwrite(valid_scene_count, sizeof(int), num_samples, fp) != (size_t)num_samples)
+        RETURN_ERROR("Writing time cube counts", FUNC_NAME, ERROR);
+    *chunk_bytes = (long long)num_samples * sizeof(int);
+
+    for (k = 0; k < num_samples; k++)
+    {
+        n = valid_scene_count[k];
+        if (n == 0)
+            continue;
+
+        if (fwrite(updated_sdate_array[k], sizeof(int), n, fp) != (size_t)n)
+            RETURN_ERROR("Writing time cube dates", FUNC_NAME, ERROR);
+        for (j = 0; j < image_bands; j++)
+            if (fwrite(&image_buf[j][k * num_scenes], sizeof(short int), n, fp) != (size_t)n)
+                RETURN_ERROR("Writing time cube values", FUNC_NAME, ERROR);
+
+        *chunk_bytes += (long long)n * (sizeof(int) + image_bands * sizeof(short int));
+    }
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  write_time_cube
+
+PURPOSE:  Transpose the scene-major BIP stack of a source into a pixel-major
+          time cube: every row becomes one chunk holding, pixel after pixel,
+          the dates and band values of the valid observations only
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           reading the scenes or writing the cube failed; no cube is
+                left behind
+SUCCESS         No errors encountered
+
+NOTES: the cube is written to <cube_path>.tmp and renamed when complete, so
+       an interrupted conversion never leaves a truncated cube in place
+******************************************************************************/
+int write_time_cube
+(
+    char *cube_path,          /* I: time cube file to create                */
+    scanline_source_t *src,   /* I: BIP scanline source                     */
+    int depth                 /* I: scanlines read ahead while writing      */
+)
+{
+    int i;
+    FILE *fp;
+    cube_header_t hdr;
+    long long *row_offset;
+    long long chunk_bytes;
+    scanline_prefetch_t prefetch;
+    scanline_slot_t *slot;
+    int status = SUCCESS;
+    char tmp_path[MAX_STR_LEN];
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "write_time_cube";
+
+    row_offset = (long long *)calloc(src->num_lines + 1, sizeof(long long));
+    if (row_offset == NULL)
+        RETURN_ERROR("Allocating row_offset memory", FUNC_NAME, ERROR);
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cube_path);
+    fp = fopen(tmp_path, "wb");
+    if (fp == NULL)
+    {
+        free(row_offset);
+        sprintf(errmsg, "Creating time cube %s", tmp_path);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    memset(&hdr, 0, sizeof(cube_header_t));
+    memcpy(hdr.magic, CUBE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CUBE_VERSION;
+    hdr.lines = src->num_lines;
+    hdr.samples = src->num_samples;
+    hdr.num_scenes = src->num_scenes;
+    hdr.bands = get_band_layout()->image_bands;
+    hdr.first_date = src->sdate[0];
+    hdr.last_date = src->sdate[src->num_scenes - 1];
+
+    /* offsets are rewritten once all chunk sizes are known */
+    if ((fwrite(&hdr, sizeof(cube_header_t), 1, fp) != 1)
+        || (fwrite(row_offset, sizeof(long long), src->num_lines + 1, fp)
+            != (size_t)(src->num_lines + 1)))
+    {
+        fclose(fp);
+        remove(tmp_path);
+        free(row_offset);
+        RETURN_ERROR("Writing time cube header", FUNC_NAME, ERROR);
+    }
+    row_offset[0] = (long long)sizeof(cube_header_t)
+                    + (long long)(src->num_lines + 1) * sizeof(long long);
+
+    if (open_scanline_prefetch(src, depth, &prefetch) != SUCCESS)
+    {
+        fclose(fp);
+        remove(tmp_path);
+        free(row_offset);
+        RETURN_ERROR("Starting scanline prefetch", FUNC_NAME, ERROR);
+    }
+
+    for (i = 0; i < src->num_lines; i++)
+    {
+        slot = acquire_scanline(&prefetch, i);
+        if (slot == NULL)
+        {
+            sprintf(errmsg, "Error in reading ARD data for row_%d", i);
+            ERROR_MESSAGE(errmsg, FUNC_NAME);
+            status = ERROR;
+            break;
+        }
+
+        status = write_cube_row(fp, src->num_samples, src->num_scenes, slot->buf,
+                                slot->valid_scene_count, slot->valid_date_array,
+                                &chunk_bytes);
+        release_scanline(&prefetch, slot);
+        if (status != SUCCESS)
+            break;
+
+        row_offset[i + 1] = row_offset[i] + chunk_bytes;
+    }
+
+    close_scanline_prefetch(&prefetch);
+
+    if ((status == SUCCESS)
+        && ((fseeko(fp, (off_t)sizeof(cube_header_t), SEEK_SET) != 0)
+            || (fwrite(row_offset, sizeof(long long), src->num_lines + 1, fp)
+                != (size_t)(src->num_lines + 1))))
+        status = ERROR;
+
+    if (fclose(fp) != 0)
+        status = ERROR;
+    free(row_offset);
+
+    if ((status != SUCCESS) || (rename(tmp_path, cube_path) != 0))
+    {
+        remove(tmp_path);
+        sprintf(errmsg, "Writing time cube %s", cube_path);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    return (SUCCESS);
+}
@@ -0,0 +1,79 @@
+#ifndef INPUT_CUBE_H
+#define INPUT_CUBE_H
+
+#include <stdio.h>
+#include "const.h"
+
+#define CUBE_MAGIC "AFTSCUBE"
+#define CUBE_VERSION 1
+
+/* file header; followed by lines + 1 row chunk offsets (long long), then
+   one chunk per row. A chunk is int counts[samples], then for every pixel
+   in turn int dates[n] and short int values[bands][n], with n
+   the number of valid observations of the pixel. Native byte order. */
+typedef struct {
+    char magic[8];            /* CUBE_MAGIC                                 */
+    int version;              /* CUBE_VERSION                               */
+    int lines;                /* number of image lines (Y height)           */
+    int samples;              /* number of image samples (X width)          */
+    int num_scenes;           /* scenes the cube was built from             */
+    int bands;                /* image bands of the band layout             */
+    int first_date;           /* julian date of the first scene             */
+    int last_date;            /* julian date of the last scene              */
+    int reserved;
+} cube_header_t;
+
+typedef struct {
+    FILE *fp;
+    cube_header_t hdr;
+    long long *row_offset;    /* byte offset of every row chunk, lines + 1  */
+    char *chunk;              /* read buffer for one row chunk              */
+    size_t chunk_size;        /* allocated bytes of chunk                   */
+} time_cube_t;
+
+int open_time_cube
+(
+    char *cube_path,          /* I: time cube file                          */
+    int num_lines,            /* I: expected number of lines                */
+    int num_samples,          /* I: expected number of samples              */
+    int num_scenes,           /* I: expected number of scenes               */
+    time_cube_t *cube         /* O: opened cube                             */
+);
+
+int read_cube_lines
+(
+    time_cube_t *cube,        /* I/O: opened cube                           */
+    int  num_scenes,          /* I:   column stride of the per-pixel series */
+    short int  **image_buf,   /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,   /* O:   number of valid values per pixel      */
+    int **updated_sdate_array,/* O:   new buf of valid date values for each pixel */
+    int cur_row               /* I:   row to read                           */
+);
+
+void close_time_cube
+(
+    time_cube_t *cube         /* I/O: opened cube                           */
+);
+
+int write_cube_row
+(
+    FILE *fp,                 /* I: cube file, positioned at the row chunk  */
+    int  num_samples,         /* I: number of image samples (X width)       */
+    int  num_scenes,          /* I: column stride of the per-pixel series   */
+    short int  **image_buf,   /* I: band values of the scanline             */
+    int *valid_scene_count,   /* I: number of valid values per pixel        */
+    int **updated_sdate_array,/* I: dates of the valid values per pixel     */
+    long long *chunk_bytes    /* O: bytes written                           */
+);
+
+/* defined in prefetch.h */
+struct scanline_source;
+
+int write_time_cube
+(
+    char *cube_path,          /* I: time cube file to create                */
+    struct scanline_source *src, /* I: BIP scanline source                  */
+    int depth                 /* I: scanlines read ahead while writing      */
+);
+
+#endif // INPUT_CUBE_H
@@ -0,0 +1,573 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "input_gdal.h"
+#include "input_compact.h"
+#include "band_layout.h"
+#include "utilities.h"
+#include "const.h"
+
+/* descriptors left to the rest of the program when the dataset bound is
+   derived from RLIMIT_NOFILE */
+#define GDAL_RESERVED_FDS 64
+
+/******************************************************************************
+MODULE:  read_gdal_meta
+
+PURPOSE:  Fill the scene size and upper left corner from a GDAL dataset, in
+          place of read_envi_header for inputs that have no ENVI header
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the scene cannot be opened by GDAL
+SUCCESS         No errors encountered
+******************************************************************************/
+int read_gdal_meta
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char *scene_name,         /* I: scene name                              */
+    input_meta_t *meta        /* O: size and upper left corner of the scene */
+)
+{
+    GDALDatasetH ds;
+    double geo[6];
+    char filename[MAX_STR_LEN];
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "read_gdal_meta";
+
+    GDALAllRegister();
+
+    sprintf(filename, "%s/%s", in_path, scene_name);
+    ds = GDALOpen(filename, GA_ReadOnly);
+    if (ds == NULL)
+    {
+        sprintf(errmsg, "Opening %s with GDAL", filename);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    meta->lines = GDALGetRasterYSize(ds);
+    meta->samples = GDALGetRasterXSize(ds);
+    meta->bands = GDALGetRasterCount(ds);
+    meta->data_type = 2;
+    meta->byte_order = 0;
+    meta->utm_zone = 0;
+    strcpy(meta->interleave, "bip");
+
+    if (GDALGetGeoTransform(ds, geo) == CE_None)
+    {
+        meta->upper_left_x = (int)geo[0];
+        meta->upper_left_y = (int)geo[3];
+        meta->pixel_size = (int)geo[1];
+    }
+    else
+    {
+        meta->upper_left_x = 0;
+        meta->upper_left_y = 0;
+        meta->pixel_size = PLANET_RES;
+    }
+
+    GDALClose(ds);
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  read_gdal_projection
+
+PURPOSE:  Get the projection of a scene as WKT
+
+RETURN VALUE:
+Type = char *
+Value           Description
+-----           -----------
+NULL            the scene cannot be opened by GDAL or memory cannot be had
+WKT             the projection, "" if the scene has none; the caller frees it
+******************************************************************************/
+char *read_gdal_projection
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char *scene_name          /* I: scene name                              */
+)
+{
+    GDALDatasetH ds;
+    char *wkt;
+    char filename[MAX_STR_LEN];
+
+    GDALAllRegister();
+
+    sprintf(filename, "%s/%s", in_path, scene_name);
+    ds = GDALOpen(filename, GA_ReadOnly);
+    if (ds == NULL)
+        return NULL;
+
+    wkt = strdup(GDALGetProjectionRef(ds));
+    GDALClose(ds);
+
+    return wkt;
+}
+
+/******************************************************************************
+MODULE:  lru_unlink
+
+PURPOSE:  Take a cached block row out of the LRU list
+
+RETURN VALUE: None
+******************************************************************************/
+static void lru_unlink
+(
+    gdal_scenes_t *scenes,    /* I/O: opened scenes                         */
+    int s                     /* I:   scene index                           */
+)
+{
+    if (scenes->prev[s] >= 0)
+        scenes->next[scenes->prev[s]] = scenes->next[s];
+    else
+        scenes->head = scenes->next[s];
+
+    if (scenes->next[s] >= 0)
+        scenes->prev[scenes->next[s]] = scenes->prev[s];
+    else
+        scenes->tail = scenes->prev[s];
+
+    scenes->prev[s] = -1;
+    scenes->next[s] = -1;
+}
+
+/******************************************************************************
+MODULE:  lru_push_front
+
+PURPOSE:  Put a cached block row at the most recently used end of the list
+
+RETURN VALUE: None
+******************************************************************************/
+static void lru_push_front
+(
+    gdal_scenes_t *scenes,    /* I/O: opened scenes                         */
+    int s                     /* I:   scene index                           */
+)
+{
+    scenes->prev[s] = -1;
+    scenes->next[s] = scenes->head;
+    if (scenes->head >= 0)
+        scenes->prev[scenes->head] = s;
+    scenes->head = s;
+    if (scenes->tail < 0)
+        scenes->tail = s;
+}
+
+/******************************************************************************
+MODULE:  row_bytes
+
+PURPOSE:  Size of the decoded block row of a scene
+
+RETURN VALUE:
+Type = long long
+Value           Description
+-----           -----------
+bytes           block height x samples x bands values
+******************************************************************************/
+static long long row_bytes
+(
+    gdal_scenes_t *scenes,    /* I: opened scenes                           */
+    int s                     /* I: scene index                             */
+)
+{
+    return (long long)scenes->block_ysize[s] * scenes->num_samples
+           * get_band_layout()->total_bands * sizeof(short int);
+}
+
+/******************************************************************************
+MODULE:  evict_block_row
+
+PURPOSE:  Free the cached block row of a scene
+
+RETURN VALUE: None
+******************************************************************************/
+static void evict_block_row
+(
+    gdal_scenes_t *scenes,    /* I/O: opened scenes                         */
+    int s                     /* I:   scene index                           */
+)
+{
+    lru_unlink(scenes, s);
+    free(scenes->rows[s]);
+    scenes->rows[s] = NULL;
+    scenes->block_row[s] = -1;
+    scenes->cache_bytes -= row_bytes(scenes, s);
+}
+
+/******************************************************************************
+MODULE:  open_scene_dataset
+
+PURPOSE:  Open the dataset of a scene and check that it can stand in for a
+          int16 BIP scene of the tile and band layout
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the scene cannot be opened or does not match the tile
+SUCCESS         No errors encountered
+******************************************************************************/
+static int open_scene_dataset
+(
+    gdal_scenes_t *scenes,    /* I/O: opened scenes                         */
+    int s                     /* I:   scene index                           */
+)
+{
+    int b;
+    int bxs, bys;
+    int total_bands = get_band_layout()->total_bands;
+    GDALRasterBandH hb;
+    char filename[MAX_STR_LEN];
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "open_scene_dataset";
+
+    sprintf(filename, "%s/%s", scenes->in_path, scenes->scene_list[s]);
+    scenes->ds[s] = GDALOpen(filename, GA_ReadOnly);
+    if (scenes->ds[s] == NULL)
+    {
+        sprintf(errmsg, "Opening %s with GDAL", filename);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+    scenes->n_open++;
+
+    if ((GDALGetRasterXSize(scenes->ds[s]) != scenes->num_samples)
+        || (GDALGetRasterYSize(scenes->ds[s]) != scenes->num_lines)
+        || (GDALGetRasterCount(scenes->ds[s]) != total_bands))
+    {
+        sprintf(errmsg, "%s is not a %dx%d image of %d bands", filename,
+                scenes->num_samples, scenes->num_lines, total_bands);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    hb = GDALGetRasterBand(scenes->ds[s], 1);
+    GDALGetBlockSize(hb, &bxs, &bys);
+    for (b = 0; b < total_bands; b++)
+    {
+        if (GDALGetRasterDataType(GDALGetRasterBand(scenes->ds[s], b + 1)) != GDT_Int16)
+        {
+            sprintf(errmsg, "Band %d of %s is not int16", b + 1, filename);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+    }
+
+    if ((scenes->block_ysize[s] != 0) && (scenes->block_ysize[s] != bys))
+    {
+        sprintf(errmsg, "Block height of %s changed while reading", filename);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+    scenes->block_ysize[s] = bys;
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  load_block_row
+
+PURPOSE:  Decode the block row of a scene holding a given line, all bands,
+          into its cache entry as BIP lines; the least recently used entries
+          are freed first if the budget would be exceeded
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the scene cannot be opened or a block cannot be read
+SUCCESS         No errors encountered
+
+NOTES: called with the lock held. A dataset stays open afterwards only while
+       fewer than max_open are, so scenes beyond the bound are reopened at
+       every block row.
+******************************************************************************/
+static int load_block_row
+(
+    gdal_scenes_t *scenes,    /* I/O: opened scenes                         */
+    int s,                    /* I:   scene index                           */
+    int row                   /* I:   line the block row has to hold        */
+)
+{
+    int b, bx, r, c;
+    int bxs, bys;
+    int by, nbx, rows_in_block, cols_in_block;
+    long long need;
+    short int *dst;
+    int total_bands = get_band_layout()->total_bands;
+    GDALRasterBandH hb;
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "load_block_row";
+
+    if (scenes->ds[s] == NULL)
+    {
+        if (open_scene_dataset(scenes, s) != SUCCESS)
+            RETURN_ERROR("Opening scene dataset", FUNC_NAME, ERROR);
+    }
+
+    GDALGetBlockSize(GDALGetRasterBand(scenes->ds[s], 1), &bxs, &bys);
+    by = row / bys;
+    nbx = (scenes->num_samples + bxs - 1) / bxs;
+    rows_in_block = (scenes->num_lines - by * bys < bys) ? scenes->num_lines - by * bys : bys;
+
+    if (scenes->rows[s] == NULL)
+    {
+        need = row_bytes(scenes, s);
+        while ((scenes->cache_limit > 0) && (scenes->tail >= 0)
+               && (scenes->cache_bytes + need > scenes->cache_limit))
+            evict_block_row(scenes, scenes->tail);
+
+        scenes->rows[s] = (short int *)malloc(need);
+        if (scenes->rows[s] == NULL)
+            RETURN_ERROR("Allocating block row memory", FUNC_NAME, ERROR);
+        scenes->cache_bytes += need;
+        lru_push_front(scenes, s);
+    }
+    else if (scenes->head != s)
+    {
+        lru_unlink(scenes, s);
+        lru_push_front(scenes, s);
+    }
+
+    if ((size_t)bxs * bys > scenes->block_buf_len)
+    {
+        free(scenes->block_buf);
+        scenes->block_buf_len = (size_t)bxs * bys;
+        scenes->block_buf = (short int *)malloc(scenes->block_buf_len * sizeof(short int));
+        if (scenes->block_buf == NULL)
+        {
+            scenes->block_buf_len = 0;
+            RETURN_ERROR("Allocating block memory", FUNC_NAME, ERROR);
+        }
+    }
+
+    /* scatter every block into the BIP layout read_bip_lines expects */
+    for (b = 0; b < total_bands; b++)
+    {
+        hb = GDALGetRasterBand(scenes->ds[s], b + 1);
+        for (bx = 0; bx < nbx; bx++)
+        {
+            if (GDALReadBlock(hb, bx, by, scenes->block_buf) != CE_None)
+            {
+                scenes->block_row[s] = -1;
+                sprintf(errmsg, "Reading block %d,%d of band %d of %s", bx, by, b + 1,
+                        scenes->scene_list[s]);
+                RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+            }
+
+            cols_in_block = (scenes->num_samples - bx * bxs < bxs) ?
+                            scenes->num_samples - bx * bxs : bxs;
+            for (r = 0; r < rows_in_block; r++)
+            {
+                dst = scenes->rows[s] + ((long long)r * scenes->num_samples + bx * bxs)
+                      * total_bands + b;
+                for (c = 0; c < cols_in_block; c++)
+                    dst[c * total_bands] = scenes->block_buf[r * bxs + c];
+            }
+        }
+    }
+
+    scenes->block_row[s] = by;
+    scenes->n_decoded++;
+
+    if (scenes->n_open > scenes->max_open)
+    {
+        GDALClose(scenes->ds[s]);
+        scenes->ds[s] = NULL;
+        scenes->n_open--;
+    }
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  open_gdal_scenes
+
+PURPOSE:  Set up block-based reading of the scenes of a list; datasets are
+          opened on first use
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           memory allocation failed
+SUCCESS         No errors encountered
+
+NOTES: the scanline loop needs one block row of every scene at a time, i.e.
+       num_scenes x block height x samples x 10 bytes; a cache_mb below that
+       still gives correct results but decodes block rows again. Striped or
+       small-tile inputs keep the working set small.
+******************************************************************************/
+int open_gdal_scenes
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char **scene_list,        /* I: list of scene names                     */
+    int num_scenes,           /* I: number of scenes in the list            */
+    int num_lines,            /* I: number of lines in a scene              */
+    int num_samples,          /* I: number of samples in a scene            */
+    int max_open,             /* I: dataset bound, 0 = from RLIMIT_NOFILE   */
+    int cache_mb,             /* I: decoded block row budget, 0 = no limit  */
+    gdal_scenes_t *scenes     /* O: opened scenes                           */
+)
+{
+    int i;
+    struct rlimit rl;
+    char FUNC_NAME[] = "open_gdal_scenes";
+
+    GDALAllRegister();
+
+    if (max_open <= 0)
+    {
+        max_open = num_scenes;
+        if ((getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur != RLIM_INFINITY)
+            && (rl.rlim_cur < (rlim_t)num_scenes + GDAL_RESERVED_FDS))
+            max_open = (int)rl.rlim_cur - GDAL_RESERVED_FDS;
+    }
+    if (max_open < 1)
+        max_open = 1;
+
+    scenes->in_path = in_path;
+    scenes->scene_list = scene_list;
+    scenes->num_scenes = num_scenes;
+    scenes->num_lines = num_lines;
+    scenes->num_samples = num_samples;
+    scenes->max_open = max_open;
+    scenes->n_open = 0;
+    scenes->cache_limit = (long long)cache_mb * 1024 * 1024;
+    scenes->cache_bytes = 0;
+    scenes->n_decoded = 0;
+    scenes->head = -1;
+    scenes->tail = -1;
+    scenes->block_buf = NULL;
+    scenes->block_buf_len = 0;
+
+    scenes->ds = (GDALDatasetH *)calloc(num_scenes, sizeof(GDALDatasetH));
+    scenes->block_ysize = (int *)calloc(num_scenes, sizeof(int));
+    scenes->block_row = (int *)malloc(num_scenes * sizeof(int));
+    scenes->rows = (short int **)calloc(num_scenes, sizeof(short int *));
+    scenes->prev = (int *)malloc(num_scenes * sizeof(int));
+    scenes->next = (int *)malloc(num_scenes * sizeof(int));
+    if ((scenes->ds == NULL) || (scenes->block_ysize == NULL) || (scenes->block_row == NULL)
+        || (scenes->rows == NULL) || (scenes->prev == NULL) || (scenes->next == NULL))
+    {
+        free(scenes->ds);
+        free(scenes->block_ysize);
+        free(scenes->block_row);
+        free(scenes->rows);
+        free(scenes->prev);
+        free(scenes->next);
+        RETURN_ERROR("Allocating gdal scenes memory", FUNC_NAME, ERROR);
+    }
+
+    for (i = 0; i < num_scenes; i++)
+    {
+        scenes->block_row[i] = -1;
+        scenes->prev[i] = -1;
+        scenes->next[i] = -1;
+    }
+
+    pthread_mutex_init(&scenes->lock, NULL);
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  read_gdal_lines
+
+PURPOSE:  Build the valid per-pixel series of one scanline from the cached
+          block rows, decoding a scene's next block row when the line leaves
+          the cached one; same output layout as read_bip_lines
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           decoding a block row failed
+SUCCESS         No errors encountered
+******************************************************************************/
+int read_gdal_lines
+(
+    gdal_scenes_t *scenes,    /* I/O: opened scenes                         */
+    int  num_samples,         /* I:   number of image samples (X width)     */
+    int  num_scenes,          /* I:   number of scenes to read              */
+    int *sdate,               /* I:   Original array of julian date values  */
+    short int  **image_buf,   /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,   /* I/O: x/y is not always valid for gridded data,  */
+    int **updated_sdate_array,/* I/O: new buf of valid date values for each pixel */
+    int cur_row               /* I:   row to read                           */
+)
+{
+    int i;
+    int bys;
+    const short int *line;
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "read_gdal_lines";
+
+    /* GDAL datasets are not safe to share between threads */
+    pthread_mutex_lock(&scenes->lock);
+
+    for (i = 0; i < num_scenes; i++)
+    {
+        bys = scenes->block_ysize[i];
+        if ((bys == 0) || (scenes->block_row[i] != cur_row / bys))
+        {
+            if (load_block_row(scenes, i, cur_row) != SUCCESS)
+            {
+                pthread_mutex_unlock(&scenes->lock);
+                sprintf(errmsg, "error reading %d scene, %d row", i, cur_row);
+                RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+            }
+            bys = scenes->block_ysize[i];
+        }
+
+        line = scenes->rows[i] + (long long)(cur_row - scenes->block_row[i] * bys)
+               * num_samples * get_band_layout()->total_bands;
+        compact_bip_scanline(line, num_samples, num_scenes, sdate[i],
+                             image_buf, valid_scene_count, updated_sdate_array);
+    }
+
+    pthread_mutex_unlock(&scenes->lock);
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  close_gdal_scenes
+
+PURPOSE:  Close every open dataset and free the cached block rows
+
+RETURN VALUE: None
+******************************************************************************/
+void close_gdal_scenes
+(
+    gdal_scenes_t *scenes     /* I/O: opened scenes                         */
+)
+{
+    int i;
+
+    for (i = 0; i < scenes->num_scenes; i++)
+    {
+        if (scenes->ds[i] != NULL)
+            GDALClose(scenes->ds[i]);
+        free(scenes->rows[i]);
+    }
+
+    pthread_mutex_destroy(&scenes->lock);
+
+    free(scenes->ds);
+    free(scenes->block_ysize);
+    free(scenes->block_row);
+    free(scenes->rows);
+    free(scenes->prev);
+    free(scenes->next);
+    free(scenes->block_buf);
+    scenes->ds = NULL;
+    scenes->block_ysize = NULL;
+    scenes->block_row = NULL;
+    scenes->rows = NULL;
+    scenes->prev = NULL;
+    scenes->next = NULL;
+    scenes->block_buf = NULL;
+    scenes->n_open = 0;
+}
@@ -0,0 +1,78 @@
+#ifndef INPUT_GDAL_H
+#define INPUT_GDAL_H
+
+#include <pthread.h>
+#include "gdal/gdal.h"
+#include "input.h"
+#include "const.h"
+
+/* scenes in any GDAL format, read block by block; the decoded block row
+   holding the current scanline is kept per scene, so a scanline costs one
+   decode per block row instead of one per line */
+typedef struct {
+    char *in_path;            /* ARD image directory                        */
+    char **scene_list;        /* scene names                                */
+    int num_scenes;           /* number of scenes in the list               */
+    int num_lines;            /* number of lines in a scene                 */
+    int num_samples;          /* number of samples in a scene               */
+    int max_open;             /* datasets kept open between block rows      */
+    int n_open;               /* datasets open now                          */
+    long long cache_limit;    /* bytes of decoded block rows, 0 = no limit  */
+    long long cache_bytes;    /* bytes of decoded block rows held now       */
+    long long n_decoded;      /* block rows decoded so far                  */
+    GDALDatasetH *ds;         /* dataset of every scene, NULL if closed     */
+    int *block_ysize;         /* block height of every scene, 0 if unknown  */
+    int *block_row;           /* block row cached for every scene, -1 none  */
+    short int **rows;         /* cached block row of every scene, as BIP    */
+    int *prev;                /* LRU list of cached block rows, most recent */
+    int *next;                /*   at head, -1 terminated                   */
+    int head;
+    int tail;
+    short int *block_buf;     /* one decoded block of one band              */
+    size_t block_buf_len;     /* values block_buf can hold                  */
+    pthread_mutex_t lock;
+} gdal_scenes_t;
+
+int read_gdal_meta
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char *scene_name,         /* I: scene name                              */
+    input_meta_t *meta        /* O: size and upper left corner of the scene */
+);
+
+char *read_gdal_projection
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char *scene_name          /* I: scene name                              */
+);
+
+int open_gdal_scenes
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char **scene_list,        /* I: list of scene names                     */
+    int num_scenes,           /* I: number of scenes in the list            */
+    int num_lines,            /* I: number of lines in a scene              */
+    int num_samples,          /* I: number of samples in a scene            */
+    int max_open,             /* I: dataset bound, 0 = from RLIMIT_NOFILE   */
+    int cache_mb,             /* I: decoded block row budget, 0 = no limit  */
+    gdal_scenes_t *scenes     /* O: opened scenes                           */
+);
+
+int read_gdal_lines
+(
+    gdal_scenes_t *scenes,    /* I/O: opened scenes                         */
+    int  num_samples,         /* I:   number of image samples (X width)     */
+    int  num_scenes,          /* I:   number of scenes to read              */
+    int *sdate,               /* I:   Original array of julian date values  */
+    short int  **image_buf,   /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,   /* I/O: x/y is not always valid for gridded data,  */
+    int **updated_sdate_array,/* I/O: new buf of valid date values for each pixel */
+    int cur_row               /* I:   row to read                           */
+);
+
+void close_gdal_scenes
+(
+    gdal_scenes_t *scenes     /* I/O: opened scenes                         */
+);
+
+#endif // INPUT_GDAL_H
@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "input_mmap.h"
+#include "input_compact.h"
+#include "band_layout.h"
+#include "utilities.h"
+#include "const.h"
+
+/* rows handed to the kernel as one MADV_WILLNEED window */
+#define MMAP_ADVISE_ROWS 16
+
+/******************************************************************************
+MODULE:  advise_mmap_rows
+
+PURPOSE:  Ask the kernel to start reading a window of rows of a mapped scene
+          ahead of the compositing loop
+
+RETURN VALUE: None
+
+NOTES: madvise wants a page-aligned start address, so the window is widened
+       down to the page boundary that holds its first byte
+******************************************************************************/
+static void advise_mmap_rows
+(
+    mmap_scene_t *scene,      /* I: mapped scene                            */
+    int num_samples,          /* I: number of samples in a scene            */
+    int first_row,            /* I: first row of the window                 */
+    int n_rows                /* I: number of rows in the window            */
+)
+{
+    size_t row_bytes = (size_t)num_samples * get_band_layout()->total_bands
+                       * sizeof(short int);
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = (size_t)first_row * row_bytes;
+    size_t end = start + (size_t)n_rows * row_bytes;
+    size_t aligned;
+
+    if (start >= scene->size)
+        return;
+    if (end > scene->size)
+        end = scene->size;
+
+    aligned = start - start % page;
+    madvise((char *)scene->base + aligned, end - aligned, MADV_WILLNEED);
+}
+
+/******************************************************************************
+MODULE:  open_mmap_scenes
+
+PURPOSE:  Map every BIP scene of the list read-only into memory once, so the
+          scanline loop can build per-pixel series straight from the page
+          cache instead of going through one fread per sample
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           a scene could not be opened, is shorter than the header
+                says, or could not be mapped; nothing is left mapped
+SUCCESS         No errors encountered
+
+NOTES: the mappings are MAP_SHARED on the page cache, so two runs over the
+       same ARD folder (dry and wet season) reuse each other's pages
+******************************************************************************/
+int open_mmap_scenes
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char **scene_list,        /* I: list of scene names                     */
+    int num_scenes,           /* I: number of scenes in the list            */
+    int num_lines,            /* I: number of lines in a scene              */
+    int num_samples,          /* I: number of samples in a scene            */
+    mmap_scene_t *scenes      /* O: mapped scene array                      */
+)
+{
+    int i;
+    int fd;
+    struct stat st;
+    void *addr;
+    size_t expected_size;
+    char filename[MAX_STR_LEN];
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "open_mmap_scenes";
+
+    expected_size = (size_t)num_lines * num_samples * get_band_layout()->total_bands
+                    * sizeof(short int);
+
+    for (i = 0; i < num_scenes; i++)
+    {
+        scenes[i].base = NULL;
+        scenes[i].size = 0;
+    }
+
+    for (i = 0; i < num_scenes; i++)
+    {
+        sprintf(filename, "%s/%s", in_path, scene_list[i]);
+
+        fd = open(filename, O_RDONLY);
+        if (fd < 0)
+        {
+            close_mmap_scenes(scenes, i);
+            sprintf(errmsg, "Opening %d scene file %s", i, filename);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        if ((fstat(fd, &st) != 0) || ((size_t)st.st_size < expected_size))
+        {
+            close(fd);
+            close_mmap_scenes(scenes, i);
+            sprintf(errmsg, "Scene %s is smaller than its header size", filename);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        addr = mmap(NULL, expected_size, PROT_READ, MAP_SHARED, fd, 0);
+        /* the mapping keeps its own reference to the file */
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            close_mmap_scenes(scenes, i);
+            sprintf(errmsg, "Mapping %d scene file %s", i, filename);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        scenes[i].base = (short int *)addr;
+        scenes[i].size = expected_size;
+
+        /* every scene is walked top to bottom exactly once */
+        madvise(addr, expected_size, MADV_SEQUENTIAL);
+        advise_mmap_rows(&scenes[i], num_samples, 0, MMAP_ADVISE_ROWS);
+    }
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  read_mmap_lines
+
+PURPOSE:  Build the valid per-pixel series of one scanline from mapped scenes;
+          same output layout as read_bip_lines
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+SUCCESS         No errors encountered
+
+NOTES: unlike read_bip_lines the row is addressed explicitly, so rows can be
+       read in any order
+******************************************************************************/
+int read_mmap_lines
+(
+    mmap_scene_t *scenes,     /* I: mapped scene array                      */
+    int  num_lines,           /* I:   number of image lines (Y height)      */
+    int  num_samples,         /* I:   number of image samples (X width)     */
+    int  num_scenes,          /* I:   number of scenes to read              */
+    int *sdate,               /* I:   Original array of julian date values  */
+    short int  **image_buf,   /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,   /* I/O: x/y is not always valid for gridded data,  */
+    int **updated_sdate_array,/* I/O: new buf of valid date values for each pixel */
+    int cur_row               /* I:   row to read                           */
+)
+{
+    int i;
+    const short int *line;    /* first record of cur_row in a scene         */
+    int next_window;          /* first row of the next readahead window     */
+    int total_bands = get_band_layout()->total_bands;
+
+    next_window = (cur_row / MMAP_ADVISE_ROWS + 1) * MMAP_ADVISE_ROWS;
+
+    for (i = 0; i < num_scenes; i++)
+    {
+        line = scenes[i].base + (size_t)cur_row * num_samples * total_bands;
+
+        compact_bip_scanline(line, num_samples, num_scenes, sdate[i], image_buf,
+                             valid_scene_count, updated_sdate_array);
+
+        /* keep the kernel one window ahead of the cursor */
+        if ((cur_row % MMAP_ADVISE_ROWS == 0) && (next_window < num_lines))
+            advise_mmap_rows(&scenes[i], num_samples, next_window,
+                             MMAP_ADVISE_ROWS);
+    }
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  close_mmap_scenes
+
+PURPOSE:  Unmap the scenes mapped by open_mmap_scenes
+
+RETURN VALUE: None
+******************************************************************************/
+void close_mmap_scenes
+(
+    mmap_scene_t *scenes,     /* I: mapped scene array                      */
+    int num_scenes            /* I: number of mapped scenes                 */
+)
+{
+    int i;
+
+    for (i = 0; i < num_scenes; i++)
+    {
+        if (scenes[i].base != NULL)
+            munmap(scenes[i].base, scenes[i].size);
+        scenes[i].base = NULL;
+        scenes[i].size = 0;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef INPUT_MMAP_H
+#define INPUT_MMAP_H
+
+#include <stddef.h>
+#include "const.h"
+
+typedef struct {
+    short int *base;      /* first BIP record of the mapped scene          */
+    size_t size;          /* mapped length in bytes                        */
+} mmap_scene_t;
+
+int open_mmap_scenes
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char **scene_list,        /* I: list of scene names                     */
+    int num_scenes,           /* I: number of scenes in the list            */
+    int num_lines,            /* I: number of lines in a scene              */
+    int num_samples,          /* I: number of samples in a scene            */
+    mmap_scene_t *scenes      /* O: mapped scene array                      */
+);
+
+int read_mmap_lines
+(
+    mmap_scene_t *scenes,     /* I: mapped scene array                      */
+    int  num_lines,           /* I:   number of image lines (Y height)      */
+    int  num_samples,         /* I:   number of image samples (X width)     */
+    int  num_scenes,          /* I:   number of scenes to read              */
+    int *sdate,               /* I:   Original array of julian date values  */
+    short int  **image_buf,   /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,   /* I/O: x/y is not always valid for gridded data,  */
+    int **updated_sdate_array,/* I/O: new buf of valid date values for each pixel */
+    int cur_row               /* I:   row to read                           */
+);
+
+void close_mmap_scenes
+(
+    mmap_scene_t *scenes,     /* I: mapped scene array                      */
+    int num_scenes            /* I: number of mapped scenes                 */
+);
+
+#endif // INPUT_MMAP_H
@@ -0,0 +1,348 @@
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "input_pool.h"
+#include "input_compact.h"
+#include "band_layout.h"
+#include "utilities.h"
+#include "const.h"
+
+/* descriptors left to the rest of the program when the pool is sized from
+   RLIMIT_NOFILE */
+#define POOL_RESERVED_FDS 64
+
+/******************************************************************************
+MODULE:  lru_unlink
+
+PURPOSE:  Take an open scene out of the LRU list
+
+RETURN VALUE: None
+******************************************************************************/
+static void lru_unlink
+(
+    scene_pool_t *pool,       /* I/O: scene pool                            */
+    int s                     /* I:   scene index                           */
+)
+{
+    if (pool->prev[s] >= 0)
+        pool->next[pool->prev[s]] = pool->next[s];
+    else
+        pool->head = pool->next[s];
+
+    if (pool->next[s] >= 0)
+        pool->prev[pool->next[s]] = pool->prev[s];
+    else
+        pool->tail = pool->prev[s];
+
+    pool->prev[s] = -1;
+    pool->next[s] = -1;
+}
+
+/******************************************************************************
+MODULE:  lru_push_front
+
+PURPOSE:  Put a scene at the most recently used end of the LRU list
+
+RETURN VALUE: None
+******************************************************************************/
+static void lru_push_front
+(
+    scene_pool_t *pool,       /* I/O: scene pool                            */
+    int s                     /* I:   scene index                           */
+)
+{
+    pool->prev[s] = -1;
+    pool->next[s] = pool->head;
+    if (pool->head >= 0)
+        pool->prev[pool->head] = s;
+    pool->head = s;
+    if (pool->tail < 0)
+        pool->tail = s;
+}
+
+/******************************************************************************
+MODULE:  get_scene_fd
+
+PURPOSE:  Return an open descriptor for a scene, opening it and closing the
+          least recently used idle one if the pool is full
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+-1              the scene could not be opened
+fd              open descriptor
+
+NOTES: called with the pool lock held. Scenes with reads in flight are never
+       closed; if all open scenes are busy the bound is exceeded briefly.
+******************************************************************************/
+static int get_scene_fd
+(
+    scene_pool_t *pool,       /* I/O: scene pool                            */
+    int s                     /* I:   scene index                           */
+)
+{
+    int victim;
+    char filename[MAX_STR_LEN];
+
+    if (pool->fd[s] >= 0)
+    {
+        if (pool->head != s)
+        {
+            lru_unlink(pool, s);
+            lru_push_front(pool, s);
+        }
+        return pool->fd[s];
+    }
+
+    while (pool->n_open >= pool->max_open)
+    {
+        victim = pool->tail;
+        while ((victim >= 0) && (pool->pin[victim] > 0))
+            victim = pool->prev[victim];
+        if (victim < 0)
+            break;
+
+        lru_unlink(pool, victim);
+        close(pool->fd[victim]);
+        pool->fd[victim] = -1;
+        pool->n_open--;
+    }
+
+    sprintf(filename, "%s/%s", pool->in_path, pool->scene_list[s]);
+    pool->fd[s] = open(filename, O_RDONLY);
+    if (pool->fd[s] < 0)
+        return -1;
+
+    lru_push_front(pool, s);
+    pool->n_open++;
+
+    return pool->fd[s];
+}
+
+/******************************************************************************
+MODULE:  open_scene_pool
+
+PURPOSE:  Set up offset-based access to the scenes of a list with at most
+          max_open descriptors open at a time; no file is opened yet
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           memory allocation failed
+SUCCESS         No errors encountered
+******************************************************************************/
+int open_scene_pool
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char **scene_list,        /* I: list of scene names                     */
+    int num_scenes,           /* I: number of scenes in the list            */
+    int max_open,             /* I: descriptor bound, 0 = from RLIMIT_NOFILE */
+    scene_pool_t *pool        /* O: scene pool                              */
+)
+{
+    int i;
+    struct rlimit rl;
+    char FUNC_NAME[] = "open_scene_pool";
+
+    if (max_open <= 0)
+    {
+        max_open = num_scenes;
+        if ((getrlimit(RLIMIT_NOFILE, &rl) == 0) && (rl.rlim_cur != RLIM_INFINITY)
+            && (rl.rlim_cur < (rlim_t)num_scenes + POOL_RESERVED_FDS))
+            max_open = (int)rl.rlim_cur - POOL_RESERVED_FDS;
+    }
+    if (max_open < 1)
+        max_open = 1;
+
+    pool->in_path = in_path;
+    pool->scene_list = scene_list;
+    pool->num_scenes = num_scenes;
+    pool->max_open = max_open;
+    pool->n_open = 0;
+    pool->head = -1;
+    pool->tail = -1;
+
+    pool->fd = (int *)malloc(num_scenes * sizeof(int));
+    pool->pin = (int *)calloc(num_scenes, sizeof(int));
+    pool->prev = (int *)malloc(num_scenes * sizeof(int));
+    pool->next = (int *)malloc(num_scenes * sizeof(int));
+    if ((pool->fd == NULL) || (pool->pin == NULL) || (pool->prev == NULL)
+        || (pool->next == NULL))
+    {
+        free(pool->fd);
+        free(pool->pin);
+        free(pool->prev);
+        free(pool->next);
+        RETURN_ERROR("Allocating scene pool memory", FUNC_NAME, ERROR);
+    }
+
+    for (i = 0; i < num_scenes; i++)
+    {
+        pool->fd[i] = -1;
+        pool->prev[i] = -1;
+        pool->next[i] = -1;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  read_scene_bytes
+
+PURPOSE:  Read a byte range of a scene with pread, independent of any file
+          position, so rows can be read in any order and from any thread
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the scene could not be opened or is too short
+SUCCESS         No errors encountered
+******************************************************************************/
+int read_scene_bytes
+(
+    scene_pool_t *pool,       /* I/O: scene pool                            */
+    int scene,                /* I:   scene index                           */
+    long long offset,         /* I:   byte offset in the scene file         */
+    size_t bytes,             /* I:   number of bytes to read               */
+    void *dst                 /* O:   destination buffer                    */
+)
+{
+    int fd;
+    ssize_t n;
+    size_t done = 0;
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "read_scene_bytes";
+
+    pthread_mutex_lock(&pool->lock);
+    fd = get_scene_fd(pool, scene);
+    if (fd < 0)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        sprintf(errmsg, "Opening %d scene file %s", scene, pool->scene_list[scene]);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+    pool->pin[scene]++;
+    pthread_mutex_unlock(&pool->lock);
+
+    while (done < bytes)
+    {
+        n = pread(fd, (char *)dst + done, bytes - done, (off_t)(offset + done));
+        if ((n < 0) && (errno == EINTR))
+            continue;
+        if (n <= 0)
+            break;
+        done += (size_t)n;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pin[scene]--;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (done < bytes)
+    {
+        sprintf(errmsg, "Reading %zu bytes at %lld of scene %s", bytes, offset,
+                pool->scene_list[scene]);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  read_pool_lines
+
+PURPOSE:  Build the valid per-pixel series of one scanline with one pread per
+          scene; same output layout as read_bip_lines
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           reading a scene failed
+SUCCESS         No errors encountered
+
+NOTES: the row is addressed explicitly, so rows can be read in any order
+******************************************************************************/
+int read_pool_lines
+(
+    scene_pool_t *pool,       /* I/O: scene pool                            */
+    int  num_samples,         /* I:   number of image samples (X width)     */
+    int  num_scenes,          /* I:   number of scenes to read              */
+    int *sdate,               /* I:   Original array of julian date values  */
+    short int  **image_buf,   /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,   /* I/O: x/y is not always valid for gridded data,  */
+    int **updated_sdate_array,/* I/O: new buf of valid date values for each pixel */
+    int cur_row               /* I:   row to read                           */
+)
+{
+    int i;
+    size_t row_bytes = (size_t)num_samples * get_band_layout()->total_bands
+                       * sizeof(short int);
+    short int *line_buf;
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "read_pool_lines";
+
+    line_buf = (short int *)malloc(row_bytes);
+    if (line_buf == NULL)
+        RETURN_ERROR("Allocating line_buf memory", FUNC_NAME, ERROR);
+
+    for (i = 0; i < num_scenes; i++)
+    {
+        if (read_scene_bytes(pool, i, (long long)cur_row * row_bytes, row_bytes,
+                             line_buf) != SUCCESS)
+        {
+            free(line_buf);
+            sprintf(errmsg, "error reading %d scene, %d row", i, cur_row);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        compact_bip_scanline(line_buf, num_samples, num_scenes, sdate[i],
+                             image_buf, valid_scene_count, updated_sdate_array);
+    }
+
+    free(line_buf);
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  close_scene_pool
+
+PURPOSE:  Close every open descriptor and free the pool
+
+RETURN VALUE: None
+******************************************************************************/
+void close_scene_pool
+(
+    scene_pool_t *pool        /* I/O: scene pool                            */
+)
+{
+    int i;
+
+    for (i = 0; i < pool->num_scenes; i++)
+        if (pool->fd[i] >= 0)
+            close(pool->fd[i]);
+
+    pthread_mutex_destroy(&pool->lock);
+
+    free(pool->fd);
+    free(pool->pin);
+    free(pool->prev);
+    free(pool->next);
+    pool->fd = NULL;
+    pool->pin = NULL;
+    pool->prev = NULL;
+    pool->next = NULL;
+    pool->n_open = 0;
+}
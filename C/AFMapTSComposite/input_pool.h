@@ -0,0 +1,59 @@
+#ifndef INPUT_POOL_H
+#define INPUT_POOL_H
+
+#include <pthread.h>
+#include "const.h"
+
+/* scenes read by offset through a bounded set of open descriptors; the
+   least recently used descriptor is closed when the bound is reached */
+typedef struct {
+    char *in_path;            /* ARD image directory                        */
+    char **scene_list;        /* scene names                                */
+    int num_scenes;           /* number of scenes in the list               */
+    int max_open;             /* most descriptors open at once              */
+    int n_open;               /* descriptors open now                       */
+    int *fd;                  /* descriptor of every scene, -1 if closed    */
+    int *pin;                 /* reads in flight on every scene             */
+    int *prev;                /* LRU list of open scenes, most recent at    */
+    int *next;                /*   head, -1 terminated                      */
+    int head;
+    int tail;
+    pthread_mutex_t lock;
+} scene_pool_t;
+
+int open_scene_pool
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char **scene_list,        /* I: list of scene names                     */
+    int num_scenes,           /* I: number of scenes in the list            */
+    int max_open,             /* I: descriptor bound, 0 = from RLIMIT_NOFILE */
+    scene_pool_t *pool        /* O: scene pool                              */
+);
+
+int read_scene_bytes
+(
+    scene_pool_t *pool,       /* I/O: scene pool                            */
+    int scene,                /* I:   scene index                           */
+    long long offset,         /* I:   byte offset in the scene file         */
+    size_t bytes,             /* I:   number of bytes to read               */
+    void *dst                 /* O:   destination buffer                    */
+);
+
+int read_pool_lines
+(
+    scene_pool_t *pool,       /* I/O: scene pool                            */
+    int  num_samples,         /* I:   number of image samples (X width)     */
+    int  num_scenes,          /* I:   number of scenes to read              */
+    int *sdate,               /* I:   Original array of julian date values  */
+    short int  **image_buf,   /* O:   pointer to a scanline for 2-D image band values array */
+    int *valid_scene_count,   /* I/O: x/y is not always valid for gridded data,  */
+    int **updated_sdate_array,/* I/O: new buf of valid date values for each pixel */
+    int cur_row               /* I:   row to read                           */
+);
+
+void close_scene_pool
+(
+    scene_pool_t *pool        /* I/O: scene pool                            */
+);
+
+#endif // INPUT_POOL_H
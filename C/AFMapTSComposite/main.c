@@ -11,68 +11,50 @@
 #include "const.h"
 #include "utilities.h"
 #include "input.h"
+#include "input_mmap.h"
+#include "input_compact.h"
+#include "hot_kernels.h"
+#include "robust_fit.h"
+#include "prefetch.h"
+#include "points.h"
+#include "scene_manifest.h"
 #include "2d_array.h"
 #include "misc.h"
+#include "scratch.h"
 #include "compositing.h"
+#include "composite_methods.h"
+#include "band_layout.h"
+#include "tile.h"
+#include "batch.h"
 
 
-int write_output_binary
-(
-    FILE *fptr,      /* I: pointer to the binary file */
-    Output_t t          /* I: outputted structure     */
-)
-{
-    int nvals;               /* number of values written to the file */
-    char FUNC_NAME[] = "write_output_binary"; /* function name */
-
-    nvals = fwrite(&t, sizeof(Output_t), 1, fptr);
-
-    if (nvals != 1)
-    {
-        RETURN_ERROR("Incorrect amount of data written", FUNC_NAME, ERROR);
-    }
-
-    return (SUCCESS);
-}
-
 int main(int argc, char *argv[])
 {
     char in_dir[MAX_STR_LEN];
     char out_dir[MAX_STR_LEN];
-    char out_path[MAX_STR_LEN];
     char msg_str[MAX_STR_LEN];        /* Input data scene name                  */
     int result;
     int i, j;
     FILE *fd;
     char FUNC_NAME[] = "main";        /* For printing error messages            */
     char errmsg[MAX_STR_LEN];   /* for printing error text to the log.  */
-    char scene_list_filename[] = "scene_list.txt"; /* file name containing list of input sceneIDs */
-    char scene_list_directory[MAX_STR_LEN]; /* full directory of scene list*/
-    char tmpstr[MAX_STR_LEN];        /* char string for text manipulation      */
-    char filename[MAX_STR_LEN];      /* file name constructed from sceneID   */
-    char srsfilename[MAX_STR_LEN];               /* source file for outputted projection*/
-    char *pszSRS_ref = NULL;
     time_t now;                      /* For logging the start, stop, and some     */
     char **scene_list;               /* 2-D array for list of scene IDs        */
     int num_scenes;                  /* Number of input scenes defined        */
     int *sdate;                      /* Pointer to list of acquisition dates  */
     int status;                      /* Return value from function call       */
     FILE **f_bip;                  /* Array of file pointers of BIP files    */
+    scanline_source_t scanline_src;  /* where the scanline loop reads from     */
+    run_opts_t opts;                 /* optional key=value settings            */
+    char cube_out_path[MAX_STR_LEN]; /* time cube written in mode 4            */
+    point_t *points;         /* points of mode 5                               */
+    int num_points;          /* number of points of mode 5                     */
+    const composite_method_t *composite; /* registry entry of method       */
+    int image_bands;                 /* image bands of the scenes, mask aside */
     input_meta_t *meta;              /* Structure for ENVI metadata hdr info  */
     short int **buf;                       /* This is the image bands buffer, valid pixel only*/
-    int **valid_date_array_scanline;
     short int **fmask_buf_scanline;        /* fmask buf, valid pixels only*/
-    int* valid_scene_count_scanline;
-    short int **poutScanline;           /* outputted compositing results for four bands */
     short int **poutPoint;   /* outputted compositing results for mode = pixel-based */
-    /* gdal related */
-    GDALRasterBandH hBand[TOTAL_IMAGE_BANDS];
-    GDALDatasetH hDstDS;
-    char **papszOptions = NULL;
-    double adfGeoTransform[6];
-    GDALDriverH hDriver;
-    GDALDatasetH  srsDataset;
-    const char *pszFormat = "GTiff";
     time (&now);                      /*  intermediate times.                   */
     int mode;
     int row;
@@ -91,6 +73,8 @@ int main(int argc, char *argv[])
     int method;
     int b_diagnosis = FALSE;
     Output_t* rec_c;
+    scratch_arena_t *arenas;           /* per-pixel scratch memory, one per thread */
+    int n_threads;                     /* compositing threads of mode 3          */
     // short int **buf1, **buf2, **buf3;
 
     // printf("argc = %d\n", argc);
@@ -113,87 +97,84 @@ int main(int argc, char *argv[])
     /*                                                            */
     /**************************************************************/
     result = get_args(argc, argv, in_dir, out_dir, &tile_id, &lower_ordinal,
-                      &upper_ordinal, &mode, &row, &col, &method);
+                      &upper_ordinal, &mode, &row, &col, &method, &opts);
 
     if(result == ERROR)
     {
          RETURN_ERROR("Fail to read program variables. The program stops!", FUNC_NAME, FAILURE);
     }
 
-    sprintf(scene_list_directory, "%s/%s", in_dir, scene_list_filename);
-
-    if (access(scene_list_directory, F_OK) != 0) /* File does not exist */
+    /* pixel and point modes seek into raw BIP files */
+    if ((opts.reader == READER_GDAL) && ((mode == 1) || (mode == 5)))
     {
-        status = create_scene_list(in_dir, &num_scenes, scene_list_filename);
-        if(status != SUCCESS)
-            RETURN_ERROR("Running create_scene_list file", FUNC_NAME, FAILURE);
-    }
-    else
-    {
-        num_scenes = MAX_SCENE_LIST;
+        RETURN_ERROR("reader=gdal only works for modes 3 and 4", FUNC_NAME, FAILURE);
     }
 
-    /**************************************************************/
-    /*                                                            */
-    /* Fill the scene list array with full path names.            */
-    /*                                                            */
-    /**************************************************************/
-    fd = fopen(scene_list_directory, "r");
-    if (fd == NULL)
+    composite = find_composite_method(method);
+    if (composite == NULL)
     {
-        RETURN_ERROR("Opening scene_list file", FUNC_NAME, FAILURE);
+        sprintf(errmsg, "Unknown compositing method %d\n", method);
+        RETURN_ERROR(errmsg, FUNC_NAME, FAILURE);
     }
 
-    for (i = 0; i < num_scenes; i++)
+    /* a job file of tiles, all composited by this process as in mode 3 */
+    if (mode == 6)
     {
-        if (fscanf(fd, "%s", tmpstr) == EOF)
-            break;
-        strcpy(scene_list[i], tmpstr);
-    }
-
-    num_scenes = i;
+        free_2d_array((void **) scene_list);
+        status = run_batch(&opts, method);
 
-    fclose(fd);
+        time(&now);
+        snprintf (msg_str, sizeof(msg_str), "compositing end_time=%s\n", ctime (&now));
+        LOG_MESSAGE (msg_str, FUNC_NAME);
 
-    f_bip = (FILE **)malloc(num_scenes * sizeof (FILE*));
-    if (f_bip == NULL)
-    {
-        RETURN_ERROR ("Allocating f_bip memory", FUNC_NAME, FAILURE);
+        if (status != SUCCESS)
+        {
+            RETURN_ERROR("Running the batch", FUNC_NAME, FAILURE);
+        }
+        return SUCCESS;
     }
 
-    sdate = (int*)malloc(num_scenes * sizeof(int));
+    sdate = (int*)malloc(MAX_SCENE_LIST * sizeof(int));
     if (sdate == NULL)
     {
         RETURN_ERROR("ERROR allocating sdate memory", FUNC_NAME, FAILURE);
     }
 
+    meta = (input_meta_t *)malloc(sizeof(input_meta_t));
+    if (meta == NULL)
+    {
+        RETURN_ERROR("ERROR allocating meta memory", FUNC_NAME, FAILURE);
+    }
 
     /**************************************************************/
     /*                                                            */
-    /* Sort scene_list based on year & julian_day, then do the    */
-    /* swath filter, but read it above first.                     */
+    /* Scene list sorted by year & julian_day, dates and the      */
+    /* metadata shared by all scenes, from the scene manifest.    */
     /*                                                            */
     /**************************************************************/
 
-    status = sort_scene_based_on_year_doy_row(scene_list, num_scenes, sdate);
+    status = read_scene_manifest(in_dir, opts.reader, scene_list, sdate,
+                                 &num_scenes, meta);
     if (status != SUCCESS)
     {
-        RETURN_ERROR ("Calling sort_scene_based_on_year_jday",
+        RETURN_ERROR ("Calling read_scene_manifest",
                       FUNC_NAME, FAILURE);
     }
 
-    /**************************************************************/
-    /*                                                            */
-    /*    read metadata info                                      */
-    /*                                                            */
-    /**************************************************************/
+    /* 4-band or 8-band scenes, every band loop below follows the layout */
+    if (set_band_layout(meta->bands) != SUCCESS)
+    {
+        RETURN_ERROR ("Calling set_band_layout", FUNC_NAME, FAILURE);
+    }
+    image_bands = get_band_layout()->image_bands;
+    snprintf (msg_str, sizeof(msg_str), "band layout=%s\n",
+              get_band_layout()->name);
+    LOG_MESSAGE (msg_str, FUNC_NAME);
 
-    meta = (input_meta_t *)malloc(sizeof(input_meta_t));
-    status = read_envi_header(in_dir, scene_list[0], meta);
-    if (status != SUCCESS)
+    f_bip = (FILE **)malloc(num_scenes * sizeof (FILE*));
+    if (f_bip == NULL)
     {
-       RETURN_ERROR ("Calling read_envi_header",
-                          FUNC_NAME, FAILURE);
+        RETURN_ERROR ("Allocating f_bip memory", FUNC_NAME, FAILURE);
     }
 
 //    for (i = 0; i < num_scenes; i++)
@@ -209,34 +190,42 @@ int main(int argc, char *argv[])
         RETURN_ERROR("ERROR allocating fmask_buf_scanline memory", FUNC_NAME, FAILURE);
     }
 
-    valid_scene_count_scanline = (int*)malloc(meta->samples * sizeof(int));
-    if (valid_scene_count_scanline == NULL)
+    poutPoint = (short int **) allocate_2d_array (image_bands, 1,
+                                               sizeof(short int));
+    if (poutPoint == NULL)
     {
-        RETURN_ERROR("ERROR allocating valid_scene_count_scanline memory", FUNC_NAME, FAILURE);
+        RETURN_ERROR ("Allocating poutPoint memory",
+                                 FUNC_NAME, FAILURE);
     }
 
-    valid_date_array_scanline = (int**)allocate_2d_array (meta->samples, num_scenes, sizeof (int));
-    if (valid_date_array_scanline == NULL)
-    {
-        RETURN_ERROR("ERROR allocating valid_date_array_scanline memory", FUNC_NAME, FAILURE);
-    }
+    /* threads=0 leaves the count to OMP_NUM_THREADS or the core count */
+    if (opts.threads > 0)
+        omp_set_num_threads(opts.threads);
+    n_threads = omp_get_max_threads();
 
-    poutScanline = (short int **) allocate_2d_array (TOTAL_IMAGE_BANDS, meta->samples,
-                                               sizeof(short int));
-    if (poutScanline == NULL)
+    arenas = (scratch_arena_t *)malloc(n_threads * sizeof(scratch_arena_t));
+    if (arenas == NULL)
     {
-        RETURN_ERROR ("Allocating poutScanline memory",
-                                 FUNC_NAME, FAILURE);
+        RETURN_ERROR ("Allocating scratch arenas", FUNC_NAME, FAILURE);
     }
 
-    poutPoint = (short int **) allocate_2d_array (TOTAL_IMAGE_BANDS, 1,
-                                               sizeof(short int));
-    if (poutPoint == NULL)
+    /* the scratch of a method is declared for 4-band series */
+    for (i = 0; i < n_threads; i++)
     {
-        RETURN_ERROR ("Allocating poutPoint memory",
-                                 FUNC_NAME, FAILURE);
+        status = scratch_init(&arenas[i], num_scenes, composite->scratch_per_scene *
+                              image_bands / PS4_IMAGE_BANDS);
+        if (status != SUCCESS)
+        {
+            RETURN_ERROR ("Allocating scratch arena", FUNC_NAME, FAILURE);
+        }
     }
 
+    snprintf (msg_str, sizeof(msg_str), "compositing method=%d (%s)\n",
+              composite->id, composite->name);
+    LOG_MESSAGE (msg_str, FUNC_NAME);
+    if (composite->init != NULL)
+        composite->init();
+
     /**************************************************************/
     /*                                                            */
     /*            Allocating memory finished.                     */
@@ -246,7 +235,7 @@ int main(int argc, char *argv[])
     /* pixel-based detection */
     if(mode == 1)
     {
-        buf = (short int **) allocate_2d_array (TOTAL_IMAGE_BANDS, num_scenes, sizeof (short int));
+        buf = (short int **) allocate_2d_array (image_bands, num_scenes, sizeof (short int));
         if (buf == NULL)
         {
             RETURN_ERROR ("Allocating buf memory", FUNC_NAME, FAILURE);
@@ -273,7 +262,7 @@ int main(int argc, char *argv[])
         }
         /* temporally hard-coded*/
 
-        compositing_result = (short int **) allocate_2d_array (TOTAL_IMAGE_BANDS, 1,
+        compositing_result = (short int **) allocate_2d_array (image_bands, 1,
                                                    sizeof (short int));
         if (compositing_result == NULL)
         {
@@ -312,67 +301,22 @@ int main(int argc, char *argv[])
         fd = fopen(pointTS_obs_path, "w");
         for (i = 0; i < valid_scene_count; i++)
         {
-            fprintf(fd, "%i, %d, %d, %d, %d, %d\n", valid_date_array[i], (short int)buf[0][i],
-                    (short int)buf[1][i], (short int)buf[2][i], (short int)buf[3][i], (short int)fmask_buf[i]);
+            fprintf(fd, "%i", valid_date_array[i]);
+            for (j = 0; j < image_bands; j++)
+                fprintf(fd, ", %d", (short int)buf[j][i]);
+            fprintf(fd, ", %d\n", (short int)fmask_buf[i]);
 
         }
         fclose(fd);
 
 //        status = compositing_scanline(buf,valid_date_array, valid_scene_count, center_date,
 //            half_interval, 1, num_scenes, compositing_result, method);
-        /*weighted fitting*/
-        if (1==method)
-        {
-            fitting_compositing(buf, valid_date_array,
-                        valid_scene_count, lower_ordinal,
-                        upper_ordinal, 0, compositing_result, TRUE, TRUE,
-                                b_diagnosis, rec_c);
-        }
-        /*normal fitting*/
-        else if (2==method)
-        {
-            fitting_compositing(buf, valid_date_array,
-                                valid_scene_count, lower_ordinal,
-                                upper_ordinal, 0, compositing_result,
-                                TRUE, FALSE, b_diagnosis, rec_c);
-        }
-        else if (3==method)
-        {
-            hot_compositing(buf, valid_date_array,
-                            valid_scene_count, lower_ordinal,
-                            upper_ordinal, 0, compositing_result);
-        }
-        else if (4==method)
-        {
-            average_compositing(buf, valid_date_array,
-                                valid_scene_count, lower_ordinal,
-                                upper_ordinal, 0, compositing_result);
-        }
-        else if (5==method)
-        {
-
-            fitting_compositing(buf, valid_date_array,
-                        valid_scene_count, lower_ordinal,
-                                upper_ordinal, 0, compositing_result, FALSE, TRUE,
-                                b_diagnosis, rec_c);
-        }
-
-        else if (6==method)
-        {
-            modified_hot_compositing(buf, valid_date_array,
-                            valid_scene_count, lower_ordinal,
-                                     upper_ordinal, 0, compositing_result);
-        }
-
-        else if (7==method)
-        {
-            medium_compositing(buf, valid_date_array,
-                            valid_scene_count, lower_ordinal,
-                               upper_ordinal, 0, compositing_result);
-        }
+        compositing_pixel(buf, valid_date_array, valid_scene_count,
+                          lower_ordinal, upper_ordinal, 0, compositing_result,
+                          method, b_diagnosis, rec_c, &arenas[0]);
 
         fd = fopen(pointTS_result_path, "w");
-        result = write_output_binary(fd, *rec_c);
+        result = write_output_binary(fd, rec_c);
         if (result != SUCCESS)
         {
             RETURN_ERROR ("write_output_binary failed\n",
@@ -405,239 +349,92 @@ int main(int argc, char *argv[])
     /* whole scene */
     else if (mode == 3)
     {
-
-        for (i = 0; i < num_scenes; i++)
+        /* scenes outside all windows are never opened, unless the method
+           reads them; a time cube holds all of them and is checked against
+           the full list */
+        if ((opts.cube_path[0] == '\0') && composite->prunable)
         {
-            sprintf(filename, "%s/%s", in_dir, scene_list[i]);
-            f_bip[i] = open_raw_binary(filename,"rb");
-            if (f_bip[i] == NULL)
+            status = prune_scenes_by_date(scene_list, sdate, num_scenes,
+                                          opts.window_lower, opts.window_upper,
+                                          opts.n_windows, &i);
+            if (status != SUCCESS)
             {
-                sprintf(errmsg, "Opening %d scene files\n", i);
-                RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+                RETURN_ERROR("Pruning scenes by date", FUNC_NAME, FAILURE);
             }
+            snprintf (msg_str, sizeof(msg_str), "%d of %d scenes fall in the %d compositing window(s)\n",
+                      i, num_scenes, opts.n_windows);
+            LOG_MESSAGE (msg_str, FUNC_NAME);
+            num_scenes = i;
         }
 
-        // outputted tif name
-        sprintf(out_filename, "tile%d_%d_%d_pcs.tif", tile_id, lower_ordinal, upper_ordinal);
-
-        //sprintf(out_filename, "composite_%d_%d.tif", center_date, half_interval);
-        // create a complete path for output composite file
-        sprintf(out_path, "%s/%s", out_dir, out_filename);
+        GDALAllRegister();
 
-        buf = (short int **) allocate_2d_array (TOTAL_IMAGE_BANDS,
-                                                num_scenes * meta->samples, sizeof (short int));
-        if (buf == NULL)
+        status = composite_tile(in_dir, out_dir, tile_id, scene_list, sdate,
+                                num_scenes, meta, &opts, method, arenas, n_threads);
+        if (status != SUCCESS)
         {
-            RETURN_ERROR("ERROR allocating buf memory", FUNC_NAME, FAILURE);
+            RETURN_ERROR("Compositing the tile", FUNC_NAME, FAILURE);
         }
-
-
-        /**************************************************************/
-        /*                                                            */
-        /*            create gdal dataset                             */
-        /*                                                            */
-        /**************************************************************/
-
-        GDALAllRegister();
-
-        hDriver = GDALGetDriverByName(pszFormat);
-        hDstDS = GDALCreate(hDriver, out_path, meta->samples, meta->lines, TOTAL_IMAGE_BANDS,  GDT_Int16,
-                             papszOptions);
-
-        /**************************************************************/
-        /*                                                            */
-        /*            set projection from srs file                   */
-        /*                                                            */
-        /**************************************************************/
-
-        sprintf(srsfilename, "%s/%s", in_dir, scene_list[0]);
-        srsDataset = GDALOpen(srsfilename, GA_ReadOnly);
-        pszSRS_ref = GDALGetProjectionRef(srsDataset);
-        GDALSetProjection(hDstDS, pszSRS_ref);
-        GDALClose(srsDataset);
-        /**************************************************************/
-        /*                                                            */
-        /*            set geotransform from srs file                   */
-        /*                                                            */
-        /**************************************************************/
-        adfGeoTransform[0] = meta->upper_left_x;
-        adfGeoTransform[1] = PLANET_RES;
-        adfGeoTransform[2] = 0;
-        adfGeoTransform[3] = meta->upper_left_y;
-        adfGeoTransform[4] = 0;
-        adfGeoTransform[5] = -PLANET_RES;
-
-        GDALSetGeoTransform( hDstDS, adfGeoTransform);
-
-        for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
-            hBand[i] = GDALGetRasterBand(hDstDS, i+1);
-
-
-
-        for (i = 0; i < meta->lines; i ++)
+    }
+    /* convert the ARD folder into a pixel-major time cube */
+    else if (mode == 4)
+    {
+        /* here the cube is the output; the scenes are read as in mode 3 */
+        if (opts.cube_path[0] == '\0')
+            sprintf(cube_out_path, "%s/tile%d_cube.bin", out_dir, tile_id);
+        else
+            strcpy(cube_out_path, opts.cube_path);
+        opts.cube_path[0] = '\0';
+
+        status = open_scanline_source(in_dir, scene_list, num_scenes, meta->lines,
+                                      meta->samples, sdate, &opts, &scanline_src);
+        if (status != SUCCESS)
         {
-            for(j = 0; j < meta->samples; j++)
-            {
-                valid_scene_count_scanline[j] = 0;
-                // valid_scene_count_scanline_tmp[j] = 0;
-            }
-//            if(method == 3) // HOT index needs mediam filtering for each image
-//            {
-//                if(i == 0)
-//                {
-//                    result = read_bip_lines(f_bip, meta->samples,
-//                                            num_scenes, sdate, buf1,
-//                                            valid_scene_count_scanline,
-//                                            valid_date_array_scanline, i);
-//                    for(b = 0; b < TOTAL_IMAGE_BANDS; b++)
-//                        for(j = 0; j < num_scenes * meta->samples; j++)
-//                            buf2[b][j] = buf1[b][j];
-
-//                    result = read_bip_lines(f_bip, meta->samples,
-//                                            num_scenes, sdate, buf3,
-//                                            valid_scene_count_scanline_tmp,
-//                                            valid_date_array_scanline_tmp, i + 1);
-
-//                    median_filter(buf1, buf2, buf3, buf, valid_scene_count_scanline, num_scenes, meta->samples);
-//                }
-//                else if(i == meta->lines - 1) // last row doesn't need read buf 3
-//                {
-//                    //memcpy(buf1, buf2, TOTAL_IMAGE_BANDS * num_scenes * meta->samples *sizeof(short int));
-//                    //memcpy(buf2, buf3, TOTAL_IMAGE_BANDS * num_scenes * meta->samples *sizeof(short int));
-
-//                    for(j = 0; j < num_scenes; j++)
-//                    {
-//                         valid_scene_count_scanline[j] = valid_scene_count_scanline_tmp[j];
-//                         for (b = 0; b < meta->samples; b++)
-//                             valid_date_array_scanline[b][j] = valid_date_array_scanline_tmp[b][j];
-//                    }
-
-//                    //memcpy(valid_date_array_scanline, valid_date_array_scanline_tmp, num_scenes * meta->samples *sizeof(int));
-//                    // median_filter(buf2, buf3, buf3, buf, meta->samples);
-//                    median_filter(buf1, buf2, buf3, buf, valid_scene_count_scanline, num_scenes, meta->samples);
-
-//                }
-//                else
-//                {
-//                    for(b = 0; b < TOTAL_IMAGE_BANDS; b++)
-//                    {
-//                        for(j = 0; j < num_scenes * meta->samples; j++)
-//                        {
-//                            buf1[b][j] = buf2[b][j];
-//                            buf2[b][j] = buf3[b][j];
-//                        }
-//                    }
-
-//                    for(j = 0; j < num_scenes; j++)
-//                    {
-//                         valid_scene_count_scanline[j] = valid_scene_count_scanline_tmp[j];
-//                         valid_scene_count_scanline_tmp[j] = 0;
-//                         for (b = 0; b < meta->samples; b++)
-//                             valid_date_array_scanline[b][j] = valid_date_array_scanline_tmp[b][j];
-//                    }
-
-//                    //memcpy(valid_scene_count_scanline, valid_scene_count_scanline_tmp, meta->samples *sizeof(int));
-//                    //memcpy(valid_date_array_scanline, valid_date_array_scanline_tmp, num_scenes * meta->samples *sizeof(int));
-
-//                    result = read_bip_lines(f_bip, meta->samples,
-//                                            num_scenes, sdate, buf3,
-//                                            valid_scene_count_scanline_tmp,
-//                                            valid_date_array_scanline_tmp, i + 1);
-//                    median_filter(buf1, buf2, buf3, buf, valid_scene_count_scanline, num_scenes, meta->samples);
-//                }
-//            }
-//            else
-//            {
-                result = read_bip_lines(f_bip, meta->samples,
-                                        num_scenes, sdate, buf,
-                                        valid_scene_count_scanline,
-                                        valid_date_array_scanline, i);
-//            }
-
-            if (result != SUCCESS)
-            {
-                sprintf(errmsg, "Error in reading ARD data for row_%d \n", i);
-                RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
-            }
-
-            /**************************************************************/
-            /*                                                            */
-            /*            compositing based on scanline                   */
-            /*                                                            */
-            /**************************************************************/
-            result = compositing_scanline(buf, valid_date_array_scanline, valid_scene_count_scanline,
-                                          lower_ordinal, upper_ordinal, meta->samples, num_scenes,
-                                          poutScanline, method);
-            // printf("row_%d finished\n", i);
-            if (result != SUCCESS)
-            {
-                sprintf(errmsg, "Error in compositing for row_%d \n", i);
-                RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
-            }
-
-            for(j = 0; j < TOTAL_IMAGE_BANDS; j++)
-                GDALRasterIO(hBand[j], GF_Write, 0, i, meta->samples, 1,
-                          poutScanline[j], meta->samples, 1, GDT_Int16,
-                          0, 0 );
-
-
+            RETURN_ERROR("Opening ARD scanline source", FUNC_NAME, FAILURE);
         }
 
-        /**************************************************************/
-        /*                                                            */
-        /*                  Free memory                               */
-        /*                                                            */
-        /**************************************************************/
+        status = write_time_cube(cube_out_path, &scanline_src, opts.prefetch_depth);
+        close_scanline_source(&scanline_src);
+        if (status != SUCCESS)
+        {
+            RETURN_ERROR("Converting ARD into a time cube", FUNC_NAME, FAILURE);
+        }
 
-        for (i = 0; i < num_scenes; i++)
+        snprintf (msg_str, sizeof(msg_str), "time cube written to %s\n", cube_out_path);
+        LOG_MESSAGE (msg_str, FUNC_NAME);
+    }
+    /* mode 1 for every point of a csv, reading each scene once per batch */
+    else if (mode == 5)
+    {
+        if (opts.points_path[0] == '\0')
         {
-            close_raw_binary(f_bip[i]);
+            RETURN_ERROR("Mode 5 needs points=<csv of row,col>", FUNC_NAME, FAILURE);
         }
 
-        status = free_2d_array ((void **) buf);
+        status = read_point_list(opts.points_path, meta->lines, meta->samples,
+                                 &points, &num_points);
         if (status != SUCCESS)
         {
-            RETURN_ERROR ("Freeing memory: buf\n",
-                          FUNC_NAME, FAILURE);
+            RETURN_ERROR("Reading the point list", FUNC_NAME, FAILURE);
         }
 
+        status = extract_point_batch(in_dir, scene_list, num_scenes, sdate,
+                                     meta->samples, points, num_points, &opts,
+                                     method, out_dir, &arenas[0]);
+        free(points);
+        if (status != SUCCESS)
+        {
+            RETURN_ERROR("Extracting the point batch", FUNC_NAME, FAILURE);
+        }
 
-//        status = free_2d_array ((void **) buf1);
-//        if (status != SUCCESS)
-//        {
-//            RETURN_ERROR ("Freeing memory: buf1\n",
-//                          FUNC_NAME, FAILURE);
-//        }
-
-
-//        status = free_2d_array ((void **) buf2);
-//        if (status != SUCCESS)
-//        {
-//            RETURN_ERROR ("Freeing memory: buf2\n",
-//                          FUNC_NAME, FAILURE);
-//        }
-
-
-//        status = free_2d_array ((void **) buf3);
-//        if (status != SUCCESS)
-//        {
-//            RETURN_ERROR ("Freeing memory: buf3\n",
-//                          FUNC_NAME, FAILURE);
-//        }
-
-//        status = free_2d_array((void **)valid_date_array_scanline_tmp);
-//        if (status != SUCCESS)
-//        {
-//            RETURN_ERROR ("Freeing memory: valid_date_array_scanline_tmp\n",
-//                          FUNC_NAME, FAILURE);
-//        }
-
-//        free(valid_scene_count_scanline_tmp);
-        GDALClose(hDstDS);
-
+        snprintf (msg_str, sizeof(msg_str), "%d points extracted to %s\n", num_points, out_dir);
+        LOG_MESSAGE (msg_str, FUNC_NAME);
     }
 
     free(f_bip);
+    for (i = 0; i < n_threads; i++)
+        scratch_free(&arenas[i]);
+    free(arenas);
 
     status = free_2d_array ((void **) scene_list);
     if (status != SUCCESS)
@@ -654,22 +451,6 @@ int main(int argc, char *argv[])
                       FUNC_NAME, FAILURE);
     }
 
-    status = free_2d_array((void **)valid_date_array_scanline);
-    if (status != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: valid_date_array_scanline\n",
-                      FUNC_NAME, FAILURE);
-    }
-
-    free(valid_scene_count_scanline);
-
-    status = free_2d_array((void **)poutScanline);
-    if (status != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: poutScanline\n",
-                      FUNC_NAME, FAILURE);
-    }
-
     status = free_2d_array((void **)poutPoint);
     if (status != SUCCESS)
     {
@@ -679,6 +460,9 @@ int main(int argc, char *argv[])
 
 
 
+    if (composite->finalize != NULL)
+        composite->finalize();
+
     time(&now);
     snprintf (msg_str, sizeof(msg_str), "compositing end_time=%s\n", ctime (&now));
     LOG_MESSAGE (msg_str, FUNC_NAME);
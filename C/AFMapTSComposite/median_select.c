@@ -0,0 +1,389 @@
+#include <string.h>
+
+#include "median_select.h"
+
+/******************************************************************************
+MODULE:  hist_select
+
+PURPOSE:  Find the (k-1)-th and k-th smallest of values known to lie in
+          [min_value, min_value + bins), by counting them
+
+RETURN VALUE: None
+
+NOTES: linear in n + bins; values holds shorts or ints as is_short tells,
+       so that the short and int selections share it
+******************************************************************************/
+static void hist_select
+(
+    const void *values,
+    int is_short,             /* I: TRUE for short values, FALSE for int    */
+    int n,
+    int k,
+    int min_value,
+    int bins,
+    int *kth,
+    int *below
+)
+{
+    int counts[MEDIAN_HIST_BINS];
+    int i, seen;
+    const short int *s = (const short int *)values;
+    const int *v = (const int *)values;
+
+    memset(counts, 0, bins * sizeof(int));
+    if (is_short)
+        for (i = 0; i < n; i++)
+            counts[s[i] - min_value]++;
+    else
+        for (i = 0; i < n; i++)
+            counts[v[i] - min_value]++;
+
+    /* walk the bins up to the one holding rank k */
+    *below = min_value;
+    seen = 0;
+    for (i = 0; i < bins; i++)
+    {
+        if (counts[i] == 0)
+            continue;
+        if (seen + counts[i] > k)
+            break;
+        seen += counts[i];
+        *below = min_value + i;
+    }
+    *kth = min_value + i;
+
+    /* rank k-1 falls in the same bin unless k opens it */
+    if ((k == 0) || (seen < k))
+        *below = *kth;
+}
+
+/******************************************************************************
+MODULE:  select_short
+
+PURPOSE:  k-th and (k-1)-th smallest of a short array in linear time: by
+          counting when the value range is narrow, else by quickselect with
+          a median-of-three pivot and three-way partitioning
+
+RETURN VALUE: None
+
+NOTES: replaces a full sort for medians and quantiles; runs of equal
+       values and sorted input stay linear
+******************************************************************************/
+void select_short
+(
+    short int *arr,           /* I/O: values, reordered on return           */
+    int n,                    /* I:   number of values                      */
+    int k,                    /* I:   rank wanted, 0 = smallest             */
+    short int *kth,           /* O:   k-th smallest value                   */
+    short int *below          /* O:   (k-1)-th smallest, kth when k is 0    */
+)
+{
+    int i, lo, hi, lt, gt;
+    int min_value, max_value;
+    int hist_kth, hist_below;
+    short int pivot, a, b, c, tmp;
+
+    min_value = max_value = arr[0];
+    for (i = 1; i < n; i++)
+    {
+        if (arr[i] < min_value)
+            min_value = arr[i];
+        else if (arr[i] > max_value)
+            max_value = arr[i];
+    }
+
+    if ((max_value - min_value < MEDIAN_HIST_BINS)
+        && (max_value - min_value < MEDIAN_HIST_RATIO * n))
+    {
+        hist_select(arr, 1, n, k, min_value, max_value - min_value + 1,
+                    &hist_kth, &hist_below);
+        *kth = (short int)hist_kth;
+        *below = (short int)hist_below;
+        return;
+    }
+
+    lo = 0;
+    hi = n - 1;
+    while (lo < hi)
+    {
+        a = arr[lo];
+        b = arr[lo + (hi - lo) / 2];
+        c = arr[hi];
+        if (a > b) { tmp = a; a = b; b = tmp; }
+        if (b > c) { b = c; }
+        pivot = (a > b) ? a : b;
+
+        /* arr[lo..lt) < pivot, arr[lt..i) == pivot, arr(gt..hi] > pivot */
+        lt = lo;
+        i = lo;
+        gt = hi;
+        while (i <= gt)
+        {
+            if (arr[i] < pivot)
+            {
+                tmp = arr[lt]; arr[lt] = arr[i]; arr[i] = tmp;
+                lt++;
+                i++;
+            }
+            else if (arr[i] > pivot)
+            {
+                tmp = arr[gt]; arr[gt] = arr[i]; arr[i] = tmp;
+                gt--;
+            }
+            else
+                i++;
+        }
+
+        if (k < lt)
+            hi = lt - 1;
+        else if (k > gt)
+            lo = gt + 1;
+        else
+            break;
+    }
+
+    *kth = arr[k];
+    *below = arr[k];
+    if (k > 0)
+    {
+        *below = arr[0];
+        for (i = 1; i < k; i++)
+            if (arr[i] > *below)
+                *below = arr[i];
+    }
+}
+
+/******************************************************************************
+MODULE:  select_int
+
+PURPOSE:  k-th and (k-1)-th smallest of an int array, as select_short
+
+RETURN VALUE: None
+******************************************************************************/
+void select_int
+(
+    int *arr,                 /* I/O: values, reordered on return           */
+    int n,                    /* I:   number of values                      */
+    int k,                    /* I:   rank wanted, 0 = smallest             */
+    int *kth,                 /* O:   k-th smallest value                   */
+    int *below                /* O:   (k-1)-th smallest, kth when k is 0    */
+)
+{
+    int i, lo, hi, lt, gt;
+    int min_value, max_value;
+    int pivot, a, b, c, tmp;
+
+    min_value = max_value = arr[0];
+    for (i = 1; i < n; i++)
+    {
+        if (arr[i] < min_value)
+            min_value = arr[i];
+        else if (arr[i] > max_value)
+            max_value = arr[i];
+    }
+
+    if (((long long)max_value - min_value < MEDIAN_HIST_BINS)
+        && ((long long)max_value - min_value < (long long)MEDIAN_HIST_RATIO * n))
+    {
+        hist_select(arr, 0, n, k, min_value, max_value - min_value + 1,
+                    kth, below);
+        return;
+    }
+
+    lo = 0;
+    hi = n - 1;
+    while (lo < hi)
+    {
+        a = arr[lo];
+        b = arr[lo + (hi - lo) / 2];
+        c = arr[hi];
+        if (a > b) { tmp = a; a = b; b = tmp; }
+        if (b > c) { b = c; }
+        pivot = (a > b) ? a : b;
+
+        lt = lo;
+        i = lo;
+        gt = hi;
+        while (i <= gt)
+        {
+            if (arr[i] < pivot)
+            {
+                tmp = arr[lt]; arr[lt] = arr[i]; arr[i] = tmp;
+                lt++;
+                i++;
+            }
+            else if (arr[i] > pivot)
+            {
+                tmp = arr[gt]; arr[gt] = arr[i]; arr[i] = tmp;
+                gt--;
+            }
+            else
+                i++;
+        }
+
+        if (k < lt)
+            hi = lt - 1;
+        else if (k > gt)
+            lo = gt + 1;
+        else
+            break;
+    }
+
+    *kth = arr[k];
+    *below = arr[k];
+    if (k > 0)
+    {
+        *below = arr[0];
+        for (i = 1; i < k; i++)
+            if (arr[i] > *below)
+                *below = arr[i];
+    }
+}
+
+/******************************************************************************
+MODULE:  select_float
+
+PURPOSE:  k-th and (k-1)-th smallest of a float array, as select_short
+          without the counting path
+
+RETURN VALUE: None
+******************************************************************************/
+void select_float
+(
+    float *arr,               /* I/O: values, reordered on return           */
+    int n,                    /* I:   number of values                      */
+    int k,                    /* I:   rank wanted, 0 = smallest             */
+    float *kth,               /* O:   k-th smallest value                   */
+    float *below              /* O:   (k-1)-th smallest, kth when k is 0    */
+)
+{
+    int i, lo, hi, lt, gt;
+    float pivot, a, b, c, tmp;
+
+    lo = 0;
+    hi = n - 1;
+    while (lo < hi)
+    {
+        a = arr[lo];
+        b = arr[lo + (hi - lo) / 2];
+        c = arr[hi];
+        if (a > b) { tmp = a; a = b; b = tmp; }
+        if (b > c) { b = c; }
+        pivot = (a > b) ? a : b;
+
+        lt = lo;
+        i = lo;
+        gt = hi;
+        while (i <= gt)
+        {
+            if (arr[i] < pivot)
+            {
+                tmp = arr[lt]; arr[lt] = arr[i]; arr[i] = tmp;
+                lt++;
+                i++;
+            }
+            else if (arr[i] > pivot)
+            {
+                tmp = arr[gt]; arr[gt] = arr[i]; arr[i] = tmp;
+                gt--;
+            }
+            else
+                i++;
+        }
+
+        if (k < lt)
+            hi = lt - 1;
+        else if (k > gt)
+            lo = gt + 1;
+        else
+            break;
+    }
+
+    *kth = arr[k];
+    *below = arr[k];
+    if (k > 0)
+    {
+        *below = arr[0];
+        for (i = 1; i < k; i++)
+            if (arr[i] > *below)
+                *below = arr[i];
+    }
+}
+
+/******************************************************************************
+MODULE:  select_short_index
+
+PURPOSE:  Rank the values of a short array together with their tags and
+          return the tags at ranks k-1 and k; equal values are ordered by
+          tag, so the same observation is picked whatever the input order
+
+RETURN VALUE: None
+******************************************************************************/
+void select_short_index
+(
+    short int *arr,           /* I/O: values, reordered on return           */
+    int *index,               /* I/O: distinct tag of every value           */
+    int n,                    /* I:   number of values                      */
+    int k,                    /* I:   rank wanted, 0 = smallest             */
+    int *kth_index,           /* O:   tag of the k-th smallest value        */
+    int *below_index          /* O:   tag of the (k-1)-th smallest          */
+)
+{
+    int i, lo, hi, store;
+    int mid, pivot_index, tmp_index;
+    short int pivot, tmp;
+
+/* (value, tag) of position p is smaller than (v, t) */
+#define KEY_LESS(p, v, t) ((arr[p] < (v)) || ((arr[p] == (v)) && (index[p] < (t))))
+#define SWAP_KEYS(p, q) { tmp = arr[p]; arr[p] = arr[q]; arr[q] = tmp; \
+                          tmp_index = index[p]; index[p] = index[q]; index[q] = tmp_index; }
+
+    lo = 0;
+    hi = n - 1;
+    while (lo < hi)
+    {
+        /* median of three keys moved to hi as the pivot */
+        mid = lo + (hi - lo) / 2;
+        if (KEY_LESS(mid, arr[lo], index[lo]))
+            SWAP_KEYS(mid, lo);
+        if (KEY_LESS(hi, arr[lo], index[lo]))
+            SWAP_KEYS(hi, lo);
+        if (KEY_LESS(mid, arr[hi], index[hi]))
+            SWAP_KEYS(mid, hi);
+        pivot = arr[hi];
+        pivot_index = index[hi];
+
+        /* keys are distinct, so a two-way partition is enough */
+        store = lo;
+        for (i = lo; i < hi; i++)
+        {
+            if (KEY_LESS(i, pivot, pivot_index))
+            {
+                SWAP_KEYS(i, store);
+                store++;
+            }
+        }
+        SWAP_KEYS(store, hi);
+
+        if (k < store)
+            hi = store - 1;
+        else if (k > store)
+            lo = store + 1;
+        else
+            break;
+    }
+
+    *kth_index = index[k];
+    *below_index = index[k];
+    if (k > 0)
+    {
+        store = 0;
+        for (i = 1; i < k; i++)
+            if (!KEY_LESS(i, arr[store], index[store]))
+                store = i;
+        *below_index = index[store];
+    }
+
+#undef KEY_LESS
+#undef SWAP_KEYS
+}
@@ -0,0 +1,46 @@
+#ifndef MEDIAN_SELECT_H
+#define MEDIAN_SELECT_H
+
+/* a counting histogram replaces quickselect when the values span at most
+   this many bins and no more than MEDIAN_HIST_RATIO bins per value */
+#define MEDIAN_HIST_BINS 2048
+#define MEDIAN_HIST_RATIO 4
+
+void select_short
+(
+    short int *arr,           /* I/O: values, reordered on return           */
+    int n,                    /* I:   number of values                      */
+    int k,                    /* I:   rank wanted, 0 = smallest             */
+    short int *kth,           /* O:   k-th smallest value                   */
+    short int *below          /* O:   (k-1)-th smallest, kth when k is 0    */
+);
+
+void select_int
+(
+    int *arr,                 /* I/O: values, reordered on return           */
+    int n,                    /* I:   number of values                      */
+    int k,                    /* I:   rank wanted, 0 = smallest             */
+    int *kth,                 /* O:   k-th smallest value                   */
+    int *below                /* O:   (k-1)-th smallest, kth when k is 0    */
+);
+
+void select_float
+(
+    float *arr,               /* I/O: values, reordered on return           */
+    int n,                    /* I:   number of values                      */
+    int k,                    /* I:   rank wanted, 0 = smallest             */
+    float *kth,               /* O:   k-th smallest value                   */
+    float *below              /* O:   (k-1)-th smallest, kth when k is 0    */
+);
+
+void select_short_index
+(
+    short int *arr,           /* I/O: values, reordered on return           */
+    int *index,               /* I/O: distinct tag of every value           */
+    int n,                    /* I:   number of values                      */
+    int k,                    /* I:   rank wanted, 0 = smallest             */
+    int *kth_index,           /* O:   tag of the k-th smallest value        */
+    int *below_index          /* O:   tag of the (k-1)-th smallest          */
+);
+
+#endif // MEDIAN_SELECT_H
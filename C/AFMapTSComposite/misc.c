@@ -1,12 +1,54 @@
 #include <math.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include "2d_array.h"
 #include "const.h"
 #include "misc.h"
+#include "band_layout.h"
 #include "utilities.h"
+#include "scratch.h"
+#include "median_select.h"
+#include "robust_fit.h"
 #include <gsl/gsl_multifit.h>
 #include <gsl/gsl_randist.h>
 #include <gsl/gsl_fit.h>
 
+/******************************************************************************
+MODULE:  write_output_binary
+
+PURPOSE:  Write the fitting diagnosis of a pixel as one binary record
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           writing failed
+SUCCESS         No errors encountered
+
+NOTES: C0_final and C1_final are written for the bands of the layout only,
+       so the record of 4-band scenes keeps the layout it always had
+******************************************************************************/
+int write_output_binary
+(
+    FILE *fptr,                 /* I: pointer to the binary file          */
+    Output_t *t                 /* I: outputted structure                 */
+)
+{
+    int image_bands = get_band_layout()->image_bands;
+    size_t tail = sizeof(Output_t) - offsetof(Output_t, outlier_dates_green);
+    char FUNC_NAME[] = "write_output_binary";
+
+    if ((fwrite(t, offsetof(Output_t, C0_final), 1, fptr) != 1)
+        || (fwrite(t->C0_final, sizeof(float), image_bands, fptr) != (size_t)image_bands)
+        || (fwrite(t->C1_final, sizeof(float), image_bands, fptr) != (size_t)image_bands)
+        || (fwrite(t->outlier_dates_green, tail, 1, fptr) != 1))
+    {
+        RETURN_ERROR("Incorrect amount of data written", FUNC_NAME, ERROR);
+    }
+
+    return (SUCCESS);
+}
+
 /******************************************************************************
 MODULE:  rmse_from_square_root_mean
 
@@ -86,29 +128,68 @@ MODULE:  auto_robust_fit
 
 PURPOSE:  Robust fit for one band
 
-RETURN VALUE: None
+RETURN VALUE:
+Type = int
+ERROR error out due to memory allocation
+SUCCESS no error encounted
 
 HISTORY:
 Date        Programmer       Reason
 --------    ---------------  -------------------------------------
 5/28/2019   Su Ye            Original Development
 
-NOTES:
+NOTES: bisquare_fit_2param does the fit; the GSL path, with x, y, c and
+       cov as views over arena memory, is only taken when the weighted
+       system is singular and needs the SVD solution
 ******************************************************************************/
-void auto_robust_fit
+int auto_robust_fit
 (
     float **clrx,
     float **clry,
     int nums,
     int start,
     int band_index,
-    float *coefs
+    float *coefs,
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 )
 {
+    char FUNC_NAME[] = "auto_robust_fit";
     int i, j;
     const int p = 2; /* linear fit */
     gsl_matrix *x, *cov;
     gsl_vector *y, *c;
+    gsl_matrix_view x_view, cov_view;
+    gsl_vector_view y_view, c_view;
+    double *x_data, *y_data;
+    double c_data[2], cov_data[4];
+    float *t;
+    size_t mark = scratch_mark(arena);
+
+    t = (float *)scratch_alloc(arena, nums * sizeof(float));
+    if (t == NULL)
+    {
+        RETURN_ERROR("Allocating date memory", FUNC_NAME, ERROR);
+    }
+    for (i = 0; i < nums; ++i)
+    {
+        t[i] = clrx[i][0];
+    }
+    if (bisquare_fit_2param(t, &clry[band_index][start], nums, coefs,
+                            arena) == SUCCESS)
+    {
+        scratch_release(arena, mark);
+        return SUCCESS;
+    }
+
+    /* gsl_multifit_robust takes no fewer observations than coefficients;
+       the one observation a failed nir test leaves is its own fit */
+    if (nums < p)
+    {
+        coefs[0] = (nums > 0) ? clry[band_index][start] : 0;
+        coefs[1] = 0;
+        scratch_release(arena, mark);
+        return SUCCESS;
+    }
 
     /******************************************************************/
     /*                                                                */
@@ -116,11 +197,21 @@ void auto_robust_fit
     /*                                                                */
     /******************************************************************/
 
-    x = gsl_matrix_alloc (nums, p);
-    y = gsl_vector_alloc (nums);
+    x_data = (double *)scratch_alloc(arena, nums * p * sizeof(double));
+    y_data = (double *)scratch_alloc(arena, nums * sizeof(double));
+    if ((x_data == NULL) || (y_data == NULL))
+    {
+        RETURN_ERROR("Allocating design matrix memory", FUNC_NAME, ERROR);
+    }
 
-    c = gsl_vector_alloc (p);
-    cov = gsl_matrix_alloc (p, p);
+    x_view = gsl_matrix_view_array(x_data, nums, p);
+    y_view = gsl_vector_view_array(y_data, nums);
+    c_view = gsl_vector_view_array(c_data, p);
+    cov_view = gsl_matrix_view_array(cov_data, p, p);
+    x = &x_view.matrix;
+    y = &y_view.vector;
+    c = &c_view.vector;
+    cov = &cov_view.matrix;
 
     /******************************************************************/
     /*                                                                */
@@ -157,20 +248,9 @@ void auto_robust_fit
         coefs[j] = gsl_vector_get(c, j);
     }
 
-    /******************************************************************/
-    /*                                                                */
-    /* Free the memories                                              */
-    /*                                                                */
-    /******************************************************************/
+    scratch_release(arena, mark);
 
-    gsl_matrix_free (x);
-    x = NULL;
-    gsl_vector_free (y);
-    y = NULL;
-    gsl_vector_free (c);
-    c = NULL;
-    gsl_matrix_free (cov);
-    cov = NULL;
+    return SUCCESS;
 }
 
 
@@ -201,7 +281,8 @@ int auto_mask
     float t_b1,
     float t_b2,
     float n_t,
-    int *bl_ids
+    int *bl_ids,
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
 )
 {
     char FUNC_NAME[] = "auto_mask";
@@ -211,10 +292,11 @@ int auto_mask
     int nums;
     float coefs[ROBUST_COEFFS];
     float coefs2[ROBUST_COEFFS];
+    size_t mark = scratch_mark(arena);
 
     nums = end - start + 1;
     /* Allocate memory */
-    x = (float **)allocate_2d_array(nums, ROBUST_COEFFS - 1, sizeof(float));
+    x = (float **)scratch_alloc_2d(arena, nums, ROBUST_COEFFS - 1, sizeof(float));
     if (x == NULL)
     {
         RETURN_ERROR("ERROR allocating x memory", FUNC_NAME, ERROR);
@@ -231,7 +313,10 @@ int auto_mask
     /*                                                                */
     /******************************************************************/
 
-    auto_robust_fit(x, clry, nums, start, 1, coefs);
+    if (auto_robust_fit(x, clry, nums, start, 1, coefs, arena) != SUCCESS)
+    {
+        RETURN_ERROR("Calling auto_robust_fit for band 2", FUNC_NAME, ERROR);
+    }
 
     /******************************************************************/
     /*                                                                */
@@ -239,7 +324,10 @@ int auto_mask
     /*                                                                */
     /******************************************************************/
 
-    auto_robust_fit(x, clry, nums, start, 3, coefs2);
+    if (auto_robust_fit(x, clry, nums, start, 3, coefs2, arena) != SUCCESS)
+    {
+        RETURN_ERROR("Calling auto_robust_fit for band 4", FUNC_NAME, ERROR);
+    }
 
     /******************************************************************/
     /*                                                                */
@@ -263,11 +351,7 @@ int auto_mask
         }
     }
 
-    /* Free allocated memory */
-    if (free_2d_array ((void **) x) != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: x\n", FUNC_NAME, ERROR);
-    }
+    scratch_release(arena, mark);
 
     return (SUCCESS);
 }
@@ -299,15 +383,20 @@ int adjust_median_variogram
     int dim2_end,               /* I: dimension 2 end index                          */
     float *date_vario,          /* O: outputted median variogran for dates           */
     float *max_neighdate_diff,  /* O: maximum difference for two neighbor times       */
-    float *output_array        /* O: output array                                   */
+    float *output_array,       /* O: output array                                   */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory                     */
 )
 {
     int i, j;           /* loop indecies                                     */
-    float *var;         /* pointer for allocation variable memory            */
+    int *var;           /* pointer for allocation variable memory            */
+    int var_m;          /* value at rank m                                   */
+    int var_m1;         /* value at rank m - 1                               */
+    int var_max;
     int dim2_len = dim2_end - dim2_start + 1; /* perhaps should get defined  */
     char FUNC_NAME[] = "adjust_median_variogram"; /* for error messages             */
     int max_freq;
     int m;
+    size_t mark = scratch_mark(arena);
 
 //    for (i = 0; i < dim2_len; i++)
 //    {
@@ -328,27 +417,31 @@ int adjust_median_variogram
         }
     }
 
-    var = malloc((dim2_len-1) * sizeof(float));
+    /* the differences are whole numbers, so ints hold them exactly */
+    var = scratch_alloc(arena, (dim2_len-1) * sizeof(int));
     if (var == NULL)
     {
         RETURN_ERROR ("Allocating var memory", FUNC_NAME, ERROR);
     }
 
+    var_max = 0;
     for (j = dim2_start; j < dim2_end; j++)
     {
-        var[j] = abs(clrx[j+1] - clrx[j]);
+        var[j - dim2_start] = abs(clrx[j+1] - clrx[j]);
+        if (var[j - dim2_start] > var_max)
+            var_max = var[j - dim2_start];
     }
-    quick_sort_float(var, dim2_start, dim2_end-1);
     m = (dim2_len-1) / 2;
+    select_int(var, dim2_len-1, m, &var_m, &var_m1);
     if ((dim2_len-1) % 2 == 0)
     {
 
-        *date_vario = (var[m-1] + var[m]) / 2.0;
+        *date_vario = (var_m1 + var_m) / 2.0;
     }
     else
-        *date_vario = var[m];
+        *date_vario = var_m;
 
-    *max_neighdate_diff = var[dim2_len-2];
+    *max_neighdate_diff = var_max;
 
 
 
@@ -356,29 +449,19 @@ int adjust_median_variogram
     {
         for (j = dim2_start; j < dim2_end; j++)
         {
-            var[j] = abs(array[i][j+1] - array[i][j]);
-            //printf("%d var for band %d: %f\n", j, i+1, (float)var[j]);
-
+            var[j - dim2_start] = abs((int)(array[i][j+1] - array[i][j]));
         }
-        quick_sort_float(var, dim2_start, dim2_end-1);
-//            for (j = 0; j < dim2_end; j++)
-//            {
-//               printf("%f\n", var[j]);
-//            }
-        m = (dim2_len-1) / 2;
+        select_int(var, dim2_len-1, m, &var_m, &var_m1);
         if ((dim2_len-1) % 2 == 0)
         {
-            //printf("%f\n", var[m-1]);
-           //printf("%f\n", var[m]);
-            output_array[i] = (var[m-1] + var[m]) / 2.0;
+            output_array[i] = (var_m1 + var_m) / 2.0;
         }
         else
-            output_array[i] = var[m];
+            output_array[i] = var_m;
 
     }
 
-    free(var);
-
+    scratch_release(arena, mark);
 
     return (SUCCESS);
 }
@@ -408,15 +491,19 @@ int single_median_variogram
     int i_start,
     int i_end,
     short int *variogram,
-    short int *mediam_value          /* O: outputted mediam value                         */
+    short int *mediam_value,         /* O: outputted mediam value                         */
+    scratch_arena_t *arena           /* I/O: per-pixel scratch memory                     */
 )
 {
     int j, m;           /* loop indecies                                     */
     char FUNC_NAME[] = "single_median_variogram"; /* for error messages             */
     short int *var;         /* pointer for allocation variable memory            */
+    short int var_m;        /* value at rank m                                   */
+    short int var_m1;       /* value at rank m - 1                               */
     int obs_num;
     int var_count = 0;
     short int *array_cpy;
+    size_t mark = scratch_mark(arena);
 
     obs_num = i_end - i_start + 1;
 
@@ -434,13 +521,13 @@ int single_median_variogram
 
     }
 
-    var = malloc((obs_num-1) * sizeof(short int));
+    var = scratch_alloc(arena, (obs_num-1) * sizeof(short int));
     if (var == NULL)
     {
         RETURN_ERROR ("Allocating var memory", FUNC_NAME, ERROR);
     }
 
-    array_cpy = malloc(obs_num * sizeof(short int));
+    array_cpy = scratch_alloc(arena, obs_num * sizeof(short int));
     if (array_cpy == NULL)
     {
         RETURN_ERROR ("Allocating array_cpy memory", FUNC_NAME, ERROR);
@@ -449,51 +536,37 @@ int single_median_variogram
 
     for (j = i_start; j < i_end; j++)
     {
-        var[j] = (short int)abs(array[j+1] - array[j]);
-        //printf("%d var for band %d: %f\n", j, i+1, (float)var[j]);
-
+        var[j - i_start] = (short int)abs(array[j+1] - array[j]);
     }
 
     for (j = i_start; j < i_end+1; j++)
     {
-        array_cpy[j] = array[j];
-        //printf("%d var for band %d: %f\n", j, i+1, (float)var[j]);
-
+        array_cpy[j - i_start] = array[j];
     }
-    quick_sort_shortint(var, 0, obs_num-2);
-//            for (j = 0; j < obs_num-1; j++)
-//            {
-//               printf("%d\n", var[j]);
-//            }
 
     /* compute variogram */
     m = (obs_num-1) / 2;
+    select_short(var, obs_num-1, m, &var_m, &var_m1);
     if ((obs_num-1) % 2 == 0)
     {
-        *variogram = (short int) ((var[m-1] + var[m]) / 2.0);
+        *variogram = (short int) ((var_m1 + var_m) / 2.0);
     }
     else
-        *variogram = var[m];
+        *variogram = var_m;
 
 
     /* compute mediam value */
-    quick_sort_shortint(array_cpy, i_start, i_end);
-//    for (j = 0; j < obs_num; j++)
-//    {
-//       printf("%d\n", array_cpy[j]);
-//    }
-
     m = obs_num / 2;
+    select_short(array_cpy, obs_num, m, &var_m, &var_m1);
     if (obs_num % 2 == 0)
     {
-        *mediam_value = (short int)((array_cpy[m-1] + array_cpy[m]) / 2.0);
+        *mediam_value = (short int)((var_m1 + var_m) / 2.0);
     }
     else
-        *mediam_value = array_cpy[m];
+        *mediam_value = var_m;
 
 
-    free(var);
-    free(array_cpy);
+    scratch_release(arena, mark);
 
     return (SUCCESS);
 }
@@ -523,15 +596,18 @@ int single_median_quantile
     int i_start,
     int i_end,
     short int *quantile,          /* O: outputted quantile value                         */
-    short int *mediam_value
+    short int *mediam_value,
+    scratch_arena_t *arena        /* I/O: per-pixel scratch memory                       */
 )
 {
     int j, m;           /* loop indecies                                     */
     char FUNC_NAME[] = "single_median_quantile"; /* for error messages             */
-    short int *var;         /* pointer for allocation variable memory            */
+    short int var_m;        /* value at rank m                                   */
+    short int var_m1;       /* value at rank m - 1                               */
     int obs_num;
     int var_count = 0;
     short int *array_cpy;
+    size_t mark = scratch_mark(arena);
 
     obs_num = i_end - i_start + 1;
 
@@ -549,48 +625,31 @@ int single_median_quantile
 
     }
 
-    var = malloc((obs_num-1) * sizeof(short int));
-    if (var == NULL)
-    {
-        RETURN_ERROR ("Allocating var memory", FUNC_NAME, ERROR);
-    }
-
-    array_cpy = malloc(obs_num * sizeof(short int));
+    array_cpy = scratch_alloc(arena, obs_num * sizeof(short int));
     if (array_cpy == NULL)
     {
         RETURN_ERROR ("Allocating array_cpy memory", FUNC_NAME, ERROR);
     }
 
-
-
-
     for (j = i_start; j < i_end+1; j++)
     {
-        array_cpy[j] = array[j];
-        //printf("%d var for band %d: %f\n", j, i+1, (float)var[j]);
-
+        array_cpy[j - i_start] = array[j];
     }
 
 
     /* compute mediam value */
-    quick_sort_shortint(array_cpy, i_start, i_end);
-//    for (j = 0; j < obs_num; j++)
-//    {
-//       printf("%d\n", array_cpy[j]);
-//    }
-
     m = obs_num / 2;
+    select_short(array_cpy, obs_num, m, &var_m, &var_m1);
     if (obs_num % 2 == 0)
     {
-        *mediam_value = (short int)((array_cpy[m-1] + array_cpy[m]) / 2.0);
+        *mediam_value = (short int)((var_m1 + var_m) / 2.0);
     }
     else
-        *mediam_value = array_cpy[m];
+        *mediam_value = var_m;
 
-    *quantile = array_cpy[obs_num / 4];
+    select_short(array_cpy, obs_num, obs_num / 4, quantile, &var_m1);
 
-    free(var);
-    free(array_cpy);
+    scratch_release(arena, mark);
 
     return (SUCCESS);
 }
@@ -622,8 +681,6 @@ int single_mean_rmse
 )
 {
     int j, m;           /* loop indecies                                     */
-    char FUNC_NAME[] = "single_mean_rse"; /* for error messages             */
-    short int *var;         /* pointer for allocation variable memory            */
     int obs_num;
     int sum = 0;
     int rmse_sum = 0;
@@ -644,13 +701,6 @@ int single_mean_rmse
 
     }
 
-    var = malloc((obs_num-1) * sizeof(short int));
-    if (var == NULL)
-    {
-        RETURN_ERROR ("Allocating var memory", FUNC_NAME, ERROR);
-    }
-
-
     for (j = i_start; j < i_end + 1; j++)
     {
         sum = sum + (int)array[j];
@@ -669,157 +719,196 @@ int single_mean_rmse
 
 
 /******************************************************************************
-MODULE:  linear_fit_centerdate
+MODULE:  fused_wlinear_fit_bands
 
-PURPOSE:  Robust fit for one band
+PURPOSE:  fused_wlinear_fit for the bands of one layout
 
 RETURN VALUE: None
 
-HISTORY:
-Date        Programmer       Reason
---------    ---------------  -------------------------------------
-5/31/2019   Su Ye            Original Development
-
-NOTES:
+NOTES: inlined with the band count and role bands constants, so the band
+       loops inside the observation loops unroll
 ******************************************************************************/
-void linear_fit_centerdate
+static inline __attribute__((always_inline)) void fused_wlinear_fit_bands
 (
     int *clrx,
     float **clry,
     int nums,
     int start,
     int center_date,
-    int i_col,
-    short int **composites,
-    int bweighted,
-    float *C0,
-    float *C1
+    double *c0,
+    double *c1,
+    short int *pred,
+    float *rmse,
+    const int image_bands,      /* I: bands of the layout                 */
+    const int blue,             /* I: blue band of the layout             */
+    const int red               /* I: red band of the layout              */
 )
 {
-    char FUNC_NAME[] = "linear_fit_centerdate";
-    double c0;
-    double c1;
-    double cov00;
-    double cov01;
-    double cov11;
-    double sumsq;
-    int i;
-    double* x;
-    double* y_b1;
-    double* y_b2;
-    double* y_b3;
-    double* y_b4;
-    double* w;
-    float coefs[ROBUST_COEFFS];
-    float** x_t;
-
+    int i, b;
+    double wi, x, dx, d;
+    double W = 0, wm_x = 0, wm_dx2 = 0;
+    double wm_y[MAX_IMAGE_BANDS], wm_dxdy[MAX_IMAGE_BANDS];
+    double dy[MAX_IMAGE_BANDS], d2[MAX_IMAGE_BANDS];
 
-    x = (double*)malloc(nums * sizeof(double));
-    if (x == NULL)
+    for (b = 0; b < image_bands; b++)
     {
-        RETURN_ERROR("ERROR allocating x memory", FUNC_NAME, FAILURE);
+        wm_y[b] = 0;
+        wm_dxdy[b] = 0;
+        d2[b] = 0;
     }
 
-    y_b1 = (double*)malloc(nums * sizeof(double));
-    if (y_b1 == NULL)
+    /* weighted means */
+    for (i = start; i < start + nums; i++)
     {
-        RETURN_ERROR("ERROR allocating y_b1 memory", FUNC_NAME, FAILURE);
-    }
-
-    y_b2 = (double*)malloc(nums * sizeof(double));
-    if (y_b2 == NULL)
-    {
-        RETURN_ERROR("ERROR allocating y_b2 memory", FUNC_NAME, FAILURE);
+        wi = (double)1/(abs((int)((double)clry[blue][i] - 0.5 * (double)clry[red][i])));
+        if (wi > 0)
+        {
+            W += wi;
+            wm_x += ((double)clrx[i] - wm_x) * (wi / W);
+            for (b = 0; b < image_bands; b++)
+                wm_y[b] += ((double)clry[b][i] - wm_y[b]) * (wi / W);
+        }
     }
 
-    y_b3 = (double*)malloc(nums * sizeof(double));
-    if (y_b3 == NULL)
+    /* weighted deviations from the means */
+    W = 0;
+    for (i = start; i < start + nums; i++)
     {
-        RETURN_ERROR("ERROR allocating y_b3 memory", FUNC_NAME, FAILURE);
+        wi = (double)1/(abs((int)((double)clry[blue][i] - 0.5 * (double)clry[red][i])));
+        if (wi > 0)
+        {
+            x = (double)clrx[i];
+            dx = x - wm_x;
+            W += wi;
+            wm_dx2 += (dx * dx - wm_dx2) * (wi / W);
+            for (b = 0; b < image_bands; b++)
+            {
+                dy[b] = (double)clry[b][i] - wm_y[b];
+                wm_dxdy[b] += (dx * dy[b] - wm_dxdy[b]) * (wi / W);
+            }
+        }
     }
 
-    y_b4 = (double*)malloc(nums * sizeof(double));
-    if (y_b4 == NULL)
+    for (b = 0; b < image_bands; b++)
     {
-        RETURN_ERROR("ERROR allocating y_b4 memory", FUNC_NAME, FAILURE);
+        c1[b] = wm_dxdy[b] / wm_dx2;
+        c0[b] = wm_y[b] - wm_x * c1[b];
+        pred[b] = (short int)(c0[b] + c1[b] * center_date);
     }
 
-    w = (double*)malloc(nums * sizeof(double));
-    if (w == NULL)
-    {
-        RETURN_ERROR("ERROR allocating y_b4 memory", FUNC_NAME, FAILURE);
-    }
+    if (rmse == NULL)
+        return;
 
-    x_t = (float **)allocate_2d_array(nums, ROBUST_COEFFS - 1, sizeof(float));
-    if (x_t == NULL)
+    for (i = start; i < start + nums; i++)
     {
-        RETURN_ERROR("ERROR allocating x_t memory", FUNC_NAME, ERROR);
+        wi = (double)1/(abs((int)((double)clry[blue][i] - 0.5 * (double)clry[red][i])));
+        if (wi > 0)
+        {
+            dx = (double)clrx[i] - wm_x;
+            for (b = 0; b < image_bands; b++)
+            {
+                d = ((double)clry[b][i] - wm_y[b]) - c1[b] * dx;
+                d2[b] += wi * d * d;
+            }
+        }
     }
+    for (b = 0; b < image_bands; b++)
+        rmse[b] = (float)sqrt(d2[b] / W);
+}
 
-    for (i = 0; i < nums; i++)
-    {
-        x_t[i][0] = (float)clrx[i+start];
-    }
+/******************************************************************************
+MODULE:  fused_wlinear_fit
 
+PURPOSE:  HOT-weighted least squares line of every band in one pass over
+          the observations, with the prediction at the center date
 
-    /******************************************************************/
-    /*                                                                */
-    /* Defines the inputs/outputs for robust fitting                  */
-    /*                                                                */
-    /******************************************************************/
-
+RETURN VALUE: None
 
+NOTES: the weight of an observation is 1/|blue - 0.5 red| as
+       linear_fit_centerdate has it.  The running weighted means are
+       those of gsl_fit_wlinear: the date moments are shared by the bands
+       and each band adds its own, so the coefficients are the ones a
+       gsl_fit_wlinear call per band gives, to the last bit.  rmse is the
+       weighted root mean square residual, sqrt(sum w d^2 / sum w).
+******************************************************************************/
+void fused_wlinear_fit
+(
+    int *clrx,                  /* I: dates of the observations           */
+    float **clry,               /* I: band values of the observations     */
+    int nums,                   /* I: number of observations              */
+    int start,                  /* I: first observation                   */
+    int center_date,            /* I: date the composite is predicted at  */
+    double *c0,                 /* O: intercept of every band             */
+    double *c1,                 /* O: slope of every band                 */
+    short int *pred,            /* O: prediction at center_date per band  */
+    float *rmse                 /* O: residual rmse per band, NULL to skip */
+)
+{
+    if (get_band_layout()->image_bands == SD8_IMAGE_BANDS)
+        fused_wlinear_fit_bands(clrx, clry, nums, start, center_date, c0, c1,
+                                pred, rmse, SD8_IMAGE_BANDS, SD8_BLUE, SD8_RED);
+    else
+        fused_wlinear_fit_bands(clrx, clry, nums, start, center_date, c0, c1,
+                                pred, rmse, PS4_IMAGE_BANDS, PS4_BLUE, PS4_RED);
+}
 
+/******************************************************************************
+MODULE:  linear_fit_centerdate
 
-    /******************************************************************/
-    /*                                                                */
-    /* construct design matrix x for linear fit                       */
-    /*                                                                */
-    /******************************************************************/
+PURPOSE:  Robust fit for one band
 
-    for (i = 0; i < nums; ++i)
-    {
-        x[i] = (double)clrx[i];
-        y_b1[i] = (double)clry[0][i];
-        y_b2[i] = (double)clry[1][i];
-        y_b3[i] = (double)clry[2][i];
-        y_b4[i] = (double)clry[3][i];
+RETURN VALUE:
+Type = int
+ERROR error out due to memory allocation
+SUCCESS no error encounted
 
-    }
+HISTORY:
+Date        Programmer       Reason
+--------    ---------------  -------------------------------------
+5/31/2019   Su Ye            Original Development
 
-    /******************************************************************/
-    /*                                                                */
-    /* perform robust fit                                             */
-    /*                                                                */
-    /******************************************************************/
+NOTES: the weighted fit goes through fused_wlinear_fit and needs no scratch;
+       fitted_coefs holds the robust fits the caller already did on this
+       very series, which the unweighted fit takes instead of refitting
+******************************************************************************/
+int linear_fit_centerdate
+(
+    int *clrx,
+    float **clry,
+    int nums,
+    int start,
+    int center_date,
+    int i_col,
+    short int **composites,
+    int bweighted,
+    float *C0,
+    float *C1,
+    float **fitted_coefs,       /* I: robust fit of a band on this series, NULL
+                                      for the bands to fit, or NULL for all */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory           */
+)
+{
+    char FUNC_NAME[] = "linear_fit_centerdate";
+    double c0[MAX_IMAGE_BANDS];
+    double c1[MAX_IMAGE_BANDS];
+    short int pred[MAX_IMAGE_BANDS];
+    int i;
+    int image_bands = get_band_layout()->image_bands;
+    float coefs[ROBUST_COEFFS];
+    float** x_t;
+    size_t mark = scratch_mark(arena);
 
     if (bweighted == TRUE)
     {
-        /* create hot weights */
-        for (i = 0; i < nums; ++i)
+        /* HOT-weighted fit of all bands in one pass */
+        fused_wlinear_fit(clrx, clry, nums, start, center_date, c0, c1,
+                          pred, NULL);
+        for (i = 0; i < image_bands; i++)
         {
-             w[i] = (double)1/(abs(y_b1[i] - 0.5 * y_b3[i]));
+            composites[i][i_col] = pred[i];
+            C0[i] = (float)c0[i];
+            C1[i] = (float)c1[i];
         }
-
-        gsl_fit_wlinear (x, 1, w, 1, y_b1, 1, nums, &c0, &c1, &cov00, &cov01, &cov11, &sumsq);
-        composites[0][i_col] = (short int)(c0 + c1 * center_date);
-        C0[0] = (float)c0;
-        C1[0] = (float)c1;
-
-        gsl_fit_wlinear (x, 1, w, 1, y_b2, 1, nums, &c0, &c1, &cov00, &cov01, &cov11, &sumsq);
-        composites[1][i_col] = (short int)(c0 + c1 * center_date);
-        C0[1] = (float)c0;
-        C1[1] = (float)c1;
-
-        gsl_fit_wlinear (x, 1, w, 1, y_b3, 1, nums, &c0, &c1, &cov00, &cov01, &cov11, &sumsq);
-        composites[2][i_col] = (short int)(c0 + c1 * center_date);
-        C0[2] = (float)c0;
-        C1[2] = (float)c1;
-
-        gsl_fit_wlinear (x, 1, w, 1, y_b4, 1, nums, &c0, &c1, &cov00, &cov01, &cov11, &sumsq);
-        composites[3][i_col] = (short int)(c0 + c1 * center_date);
-        C0[3] = (float)c0;
-        C1[3] = (float)c1;
     }
     else
     {
@@ -844,9 +933,29 @@ void linear_fit_centerdate
 //        C0[3] = (float)c0;
 //        C1[3] = (float)c1;
         /* robust regression */
-        for(i = 0; i < TOTAL_IMAGE_BANDS; i++)
+        x_t = (float **)scratch_alloc_2d(arena, nums, ROBUST_COEFFS - 1, sizeof(float));
+        if (x_t == NULL)
+        {
+            RETURN_ERROR("ERROR allocating x_t memory", FUNC_NAME, ERROR);
+        }
+
+        for (i = 0; i < nums; i++)
+        {
+            x_t[i][0] = (float)clrx[i+start];
+        }
+
+        for(i = 0; i < image_bands; i++)
         {
-            auto_robust_fit(x_t, clry, nums, start, i, coefs);
+            if ((fitted_coefs != NULL) && (fitted_coefs[i] != NULL))
+            {
+                coefs[0] = fitted_coefs[i][0];
+                coefs[1] = fitted_coefs[i][1];
+            }
+            else if (auto_robust_fit(x_t, clry, nums, start, i, coefs,
+                                     arena) != SUCCESS)
+            {
+                RETURN_ERROR("Calling auto_robust_fit", FUNC_NAME, ERROR);
+            }
             composites[i][i_col] = (short int)(coefs[0] + coefs[1] * center_date);
             C0[i] = (float)coefs[0];
             C1[i] = (float)coefs[1];
@@ -859,24 +968,9 @@ void linear_fit_centerdate
 
 
 
-    /******************************************************************/
-    /*                                                                */
-    /* Free the memories                                              */
-    /*                                                                */
-    /******************************************************************/
-
-    free (x);
-    free (y_b1);
-    free (y_b2);
-    free (y_b3);
-    free (y_b4);
-    free (w);
-    /* Free allocated memory */
-    if (free_2d_array ((void **) x_t) != SUCCESS)
-    {
-        RETURN_ERROR ("Freeing memory: x_t\n", FUNC_NAME, ERROR);
-    }
+    scratch_release(arena, mark);
 
+    return SUCCESS;
 }
 
 /******************************************************************************
@@ -906,6 +1000,7 @@ int median_filter
 {
     int i, b, j;
     short int window[9];
+    int image_bands = get_band_layout()->image_bands;
 
     for(i = 0; i < n_cols; i++)
     {
@@ -913,7 +1008,7 @@ int median_filter
         {
             if(i==0)
             {
-                for(b = 0; b < TOTAL_IMAGE_BANDS; b++)
+                for(b = 0; b < image_bands; b++)
                 {
                     window[0] = buf1[b][i * num_scenes + j];
                     window[1] = buf1[b][i * num_scenes + j];
@@ -933,7 +1028,7 @@ int median_filter
             }
             else if (i == n_cols - 1)
             {
-                for(b = 0; b < TOTAL_IMAGE_BANDS; b++)
+                for(b = 0; b < image_bands; b++)
                 {
                     window[0] = buf1[b][(i-1) * num_scenes + j];
                     window[1] = buf1[b][i * num_scenes + j];
@@ -953,7 +1048,7 @@ int median_filter
             }
             else
             {
-                for(b = 0; b < TOTAL_IMAGE_BANDS; b++)
+                for(b = 0; b < image_bands; b++)
                 {
                     window[0] = buf1[b][(i-1) * num_scenes + j];
                     window[1] = buf1[b][i * num_scenes + j];
@@ -1,6 +1,8 @@
 #ifndef MISC_H
 #define MISC_H
+#include <stdio.h>
 #include "const.h"
+#include "scratch.h"
 
 /* Output structure for fitting compositing approach */
 typedef struct
@@ -9,8 +11,8 @@ typedef struct
     float C1_green;             /* slope for green-band test    */
     float C0_nir;             /* intercept for green-band test  */
     float C1_nir;             /* slope for green-band test    */
-    float C0_final[TOTAL_IMAGE_BANDS];             /* intercept for green-band test  */
-    float C1_final[TOTAL_IMAGE_BANDS];             /* slope for green-band test    */
+    float C0_final[MAX_IMAGE_BANDS];             /* intercept for green-band test  */
+    float C1_final[MAX_IMAGE_BANDS];             /* slope for green-band test    */
     int outlier_dates_green[MAX_NUM_OUTLIERS];
     int outlier_dates_nir[MAX_NUM_OUTLIERS];
     int b_success_green;      /* 0-success; 1-fail */
@@ -20,6 +22,12 @@ typedef struct
     int n_outlier_nir;
 } Output_t;
 
+int write_output_binary
+(
+    FILE *fptr,                 /* I: pointer to the binary file          */
+    Output_t *t                 /* I: outputted structure                 */
+);
+
 int auto_mask
 (
     int *clrx,
@@ -30,7 +38,8 @@ int auto_mask
     float t_b1,
     float t_b2,
     float n_t,
-    int *bl_ids
+    int *bl_ids,
+    scratch_arena_t *arena
 );
 
 int adjust_median_variogram
@@ -42,20 +51,35 @@ int adjust_median_variogram
     int dim2_end,               /* I: dimension 2 end index                          */
     float *date_vario,          /* O: outputted median variogran for dates           */
     float *max_neighdate_diff,  /* O: maximum difference for two neighbor times       */
-    float *output_array        /* O: output array                                   */
+    float *output_array,       /* O: output array                                   */
+    scratch_arena_t *arena      /* I/O: per-pixel scratch memory                     */
 );
 
-void auto_robust_fit
+int auto_robust_fit
 (
     float **clrx,
     float **clry,
     int nums,
     int start,
     int band_index,
-    float *coefs
+    float *coefs,
+    scratch_arena_t *arena
+);
+
+void fused_wlinear_fit
+(
+    int *clrx,                  /* I: dates of the observations           */
+    float **clry,               /* I: band values of the observations     */
+    int nums,                   /* I: number of observations              */
+    int start,                  /* I: first observation                   */
+    int center_date,            /* I: date the composite is predicted at  */
+    double *c0,                 /* O: intercept of every band             */
+    double *c1,                 /* O: slope of every band                 */
+    short int *pred,            /* O: prediction at center_date per band  */
+    float *rmse                 /* O: residual rmse per band, NULL to skip */
 );
 
-void linear_fit_centerdate
+int linear_fit_centerdate
 (
     int *clrx,
     float **clry,
@@ -66,7 +90,9 @@ void linear_fit_centerdate
     short int **composites,
     int bweighted,
     float* C0,
-    float* C1
+    float* C1,
+    float **fitted_coefs,
+    scratch_arena_t *arena
 );
 
 int median_filter
@@ -86,7 +112,8 @@ int single_median_quantile
     int i_start,
     int i_end,
     short int *quantile,          /* O: outputted quantile value                         */
-    short int *mediam_value
+    short int *mediam_value,
+    scratch_arena_t *arena        /* I/O: per-pixel scratch memory                       */
 );
 
 int single_median_variogram
@@ -95,7 +122,8 @@ int single_median_variogram
     int i_start,
     int i_end,
     short int *variogram,
-    short int *mediam_value          /* O: outputted mediam value                         */
+    short int *mediam_value,         /* O: outputted mediam value                         */
+    scratch_arena_t *arena           /* I/O: per-pixel scratch memory                     */
 );
 
 int single_mean_rmse
@@ -0,0 +1,339 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "points.h"
+#include "input_pool.h"
+#include "2d_array.h"
+#include "misc.h"
+#include "compositing.h"
+#include "const.h"
+#include "band_layout.h"
+
+typedef struct {
+    long long offset;         /* byte offset of the BIP record              */
+    int index;                /* point index within the chunk               */
+} point_offset_t;
+
+static int compare_point_offset(const void *a, const void *b)
+{
+    long long oa = ((const point_offset_t *)a)->offset;
+    long long ob = ((const point_offset_t *)b)->offset;
+
+    return (oa > ob) - (oa < ob);
+}
+
+/******************************************************************************
+MODULE:  read_point_list
+
+PURPOSE:  Read the points of a batch from a csv file with one row,col pair
+          per line; lines that do not start with two numbers (a header, say)
+          are skipped
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the file cannot be read, a point is outside the image or
+                there is no point
+SUCCESS         No errors encountered
+******************************************************************************/
+int read_point_list
+(
+    char *csv_path,           /* I: csv with one row,col pair per line      */
+    int num_lines,            /* I: number of lines in a scene              */
+    int num_samples,          /* I: number of samples in a scene            */
+    point_t **points,         /* O: points, allocated here                  */
+    int *num_points           /* O: number of points                        */
+)
+{
+    FILE *fp;
+    char line[MAX_STR_LEN];
+    char errmsg[MAX_STR_LEN];
+    int row, col;
+    int n = 0;
+    int capacity = 1024;
+    point_t *tmp;
+    char FUNC_NAME[] = "read_point_list";
+
+    fp = fopen(csv_path, "r");
+    if (fp == NULL)
+    {
+        sprintf(errmsg, "Opening point list %s", csv_path);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    *points = (point_t *)malloc(capacity * sizeof(point_t));
+    if (*points == NULL)
+    {
+        fclose(fp);
+        RETURN_ERROR("Allocating points memory", FUNC_NAME, ERROR);
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        if (sscanf(line, "%d , %d", &row, &col) != 2)
+            continue;
+
+        if ((row < 1) || (row > num_lines) || (col < 1) || (col > num_samples))
+        {
+            fclose(fp);
+            free(*points);
+            sprintf(errmsg, "Point row %d, col %d is outside the %dx%d image",
+                    row, col, num_lines, num_samples);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        if (n == capacity)
+        {
+            capacity *= 2;
+            tmp = (point_t *)realloc(*points, capacity * sizeof(point_t));
+            if (tmp == NULL)
+            {
+                fclose(fp);
+                free(*points);
+                RETURN_ERROR("Allocating points memory", FUNC_NAME, ERROR);
+            }
+            *points = tmp;
+        }
+
+        (*points)[n].row = row;
+        (*points)[n].col = col;
+        n++;
+    }
+
+    fclose(fp);
+
+    if (n == 0)
+    {
+        free(*points);
+        sprintf(errmsg, "No row,col point in %s", csv_path);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    *num_points = n;
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  extract_point_batch
+
+PURPOSE:  Extract the time series of many points in one run: every scene is
+          opened once per chunk of POINT_BATCH points and its records are
+          read in increasing file offset; the series, the composite of every
+          window and the fitting diagnosis of every point are then written
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           reading a scene or writing an output failed
+SUCCESS         No errors encountered
+
+NOTES: outputs in out_path, points in the order of the csv:
+       coutput_points_obs.csv        row, col, date, blue, green, red, nir, qa
+                                     for every valid observation, as the
+                                     mode 1 coutput_<row>_<col>_obs.csv
+       coutput_points_composite.csv  row, col, lower, upper, blue, green,
+                                     red, nir, status for every window,
+                                     status being done or failed
+       coutput_points_result         one Output_t per point and window, in
+                                     the order of the composite csv; only
+                                     the fitting methods fill it
+       A window the method fails on gets IMAGE_FILL bands and a zeroed
+       Output_t; the other points go on, and ERROR is returned at the end.
+******************************************************************************/
+int extract_point_batch
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char **scene_list,        /* I: sorted list of scene names              */
+    int num_scenes,           /* I: number of scenes in the list            */
+    int *sdate,               /* I: julian date of every scene              */
+    int num_samples,          /* I: number of samples in a scene            */
+    point_t *points,          /* I: points to extract                       */
+    int num_points,           /* I: number of points                        */
+    run_opts_t *opts,         /* I: windows and descriptor bound            */
+    int method,               /* I: compositing method                      */
+    char *out_path,           /* I: directory for the outputs               */
+    scratch_arena_t *arena    /* I/O: scratch memory of the kernels         */
+)
+{
+    int i, j, k, s, w;
+    int first, n;
+    int pos;
+    int n_failed = 0;
+    int status = SUCCESS;
+    int pixel_status;
+    scene_pool_t pool;
+    point_offset_t *order = NULL;
+    short int **buf = NULL;          /* band values, POINT_BATCH series     */
+    short int *qa = NULL;            /* QA of every stored value            */
+    int **dates = NULL;              /* dates of every stored value         */
+    int *count = NULL;               /* stored values per point             */
+    short int *pixel_buf[MAX_IMAGE_BANDS];
+    short int **pout = NULL;
+    short int rec[MAX_BANDS];
+    Output_t rec_c;
+    FILE *fp_obs = NULL;
+    FILE *fp_comp = NULL;
+    FILE *fp_result = NULL;
+    char filename[MAX_STR_LEN];
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "extract_point_batch";
+    int image_bands = get_band_layout()->image_bands;
+    int total_bands = get_band_layout()->total_bands;
+
+    if (open_scene_pool(in_path, scene_list, num_scenes, opts->max_open_files,
+                        &pool) != SUCCESS)
+        RETURN_ERROR("Opening scene pool", FUNC_NAME, ERROR);
+
+    order = (point_offset_t *)malloc(POINT_BATCH * sizeof(point_offset_t));
+    buf = (short int **)allocate_2d_array(image_bands, POINT_BATCH * num_scenes,
+                                          sizeof(short int));
+    qa = (short int *)malloc((size_t)POINT_BATCH * num_scenes * sizeof(short int));
+    dates = (int **)allocate_2d_array(POINT_BATCH, num_scenes, sizeof(int));
+    count = (int *)malloc(POINT_BATCH * sizeof(int));
+    pout = (short int **)allocate_2d_array(image_bands, 1, sizeof(short int));
+    if ((order == NULL) || (buf == NULL) || (qa == NULL) || (dates == NULL)
+        || (count == NULL) || (pout == NULL))
+    {
+        ERROR_MESSAGE("Allocating point batch memory", FUNC_NAME);
+        status = ERROR;
+        goto cleanup;
+    }
+
+    sprintf(filename, "%s/coutput_points_obs.csv", out_path);
+    fp_obs = fopen(filename, "w");
+    sprintf(filename, "%s/coutput_points_composite.csv", out_path);
+    fp_comp = fopen(filename, "w");
+    sprintf(filename, "%s/coutput_points_result", out_path);
+    fp_result = fopen(filename, "wb");
+    if ((fp_obs == NULL) || (fp_comp == NULL) || (fp_result == NULL))
+    {
+        ERROR_MESSAGE("Creating point batch outputs", FUNC_NAME);
+        status = ERROR;
+        goto cleanup;
+    }
+
+    for (first = 0; first < num_points; first += POINT_BATCH)
+    {
+        n = (num_points - first < POINT_BATCH) ? num_points - first : POINT_BATCH;
+
+        /* visit the records of a scene front to back */
+        for (k = 0; k < n; k++)
+        {
+            order[k].offset = (((long long)(points[first + k].row - 1) * num_samples
+                               + points[first + k].col - 1) * total_bands)
+                              * (long long)sizeof(short int);
+            order[k].index = k;
+            count[k] = 0;
+        }
+        qsort(order, n, sizeof(point_offset_t), compare_point_offset);
+
+        for (s = 0; s < num_scenes; s++)
+        {
+            for (i = 0; i < n; i++)
+            {
+                if (read_scene_bytes(&pool, s, order[i].offset,
+                                    total_bands * sizeof(short int), rec) != SUCCESS)
+                {
+                    sprintf(errmsg, "error reading %d scene, %d row, %d col", s,
+                            points[first + order[i].index].row,
+                            points[first + order[i].index].col);
+                    ERROR_MESSAGE(errmsg, FUNC_NAME);
+                    status = ERROR;
+                    goto cleanup;
+                }
+
+                // if it is a valid pixel
+                if ((rec[image_bands] < MASK_FILL) && (rec[0]!= IMAGE_FILL))
+                {
+                    k = order[i].index;
+                    pos = k * num_scenes + count[k];
+                    for (j = 0; j < image_bands; j++)
+                        buf[j][pos] = rec[j];
+                    qa[pos] = rec[image_bands];
+                    dates[k][count[k]] = sdate[s];
+                    count[k]++;
+                }
+            }
+        }
+
+        for (k = 0; k < n; k++)
+        {
+            for (i = 0; i < count[k]; i++)
+            {
+                pos = k * num_scenes + i;
+                fprintf(fp_obs, "%d, %d, %i", points[first + k].row,
+                        points[first + k].col, dates[k][i]);
+                for (j = 0; j < image_bands; j++)
+                    fprintf(fp_obs, ", %d", buf[j][pos]);
+                fprintf(fp_obs, ", %d\n", qa[pos]);
+            }
+
+            for (j = 0; j < image_bands; j++)
+                pixel_buf[j] = buf[j] + k * num_scenes;
+
+            for (w = 0; w < opts->n_windows; w++)
+            {
+                memset(&rec_c, 0, sizeof(Output_t));
+                pixel_status = compositing_pixel(pixel_buf, dates[k], count[k],
+                                                 opts->window_lower[w],
+                                                 opts->window_upper[w], 0, pout,
+                                                 method, TRUE, &rec_c, arena);
+
+                /* what a failed kernel left behind is not written */
+                if (pixel_status != SUCCESS)
+                {
+                    for (j = 0; j < image_bands; j++)
+                        pout[j][0] = IMAGE_FILL;
+                    memset(&rec_c, 0, sizeof(Output_t));
+                    n_failed++;
+                }
+
+                fprintf(fp_comp, "%d, %d, %d, %d", points[first + k].row,
+                        points[first + k].col, opts->window_lower[w],
+                        opts->window_upper[w]);
+                for (j = 0; j < image_bands; j++)
+                    fprintf(fp_comp, ", %d", pout[j][0]);
+                fprintf(fp_comp, ", %s\n",
+                        (pixel_status == SUCCESS) ? "done" : "failed");
+
+                if (write_output_binary(fp_result, &rec_c) != SUCCESS)
+                {
+                    ERROR_MESSAGE("Writing coutput_points_result", FUNC_NAME);
+                    status = ERROR;
+                    goto cleanup;
+                }
+            }
+        }
+    }
+
+    if (n_failed > 0)
+    {
+        sprintf(errmsg, "Compositing failed on %d of %d point windows", n_failed,
+                num_points * opts->n_windows);
+        ERROR_MESSAGE(errmsg, FUNC_NAME);
+        status = ERROR;
+    }
+
+cleanup:
+    if ((fp_obs != NULL) && (fclose(fp_obs) != 0))
+        status = ERROR;
+    if ((fp_comp != NULL) && (fclose(fp_comp) != 0))
+        status = ERROR;
+    if ((fp_result != NULL) && (fclose(fp_result) != 0))
+        status = ERROR;
+    close_scene_pool(&pool);
+    free(order);
+    free(qa);
+    free(count);
+    if (buf != NULL)
+        free_2d_array((void **)buf);
+    if (dates != NULL)
+        free_2d_array((void **)dates);
+    if (pout != NULL)
+        free_2d_array((void **)pout);
+
+    return status;
+}
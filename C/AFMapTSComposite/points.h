@@ -0,0 +1,40 @@
+#ifndef POINTS_H
+#define POINTS_H
+
+#include "const.h"
+#include "utilities.h"
+#include "scratch.h"
+
+/* chunk of points whose series are held in memory at once */
+#define POINT_BATCH 2048
+
+typedef struct {
+    int row;                  /* 1-based row, as in mode 1                  */
+    int col;                  /* 1-based col, as in mode 1                  */
+} point_t;
+
+int read_point_list
+(
+    char *csv_path,           /* I: csv with one row,col pair per line      */
+    int num_lines,            /* I: number of lines in a scene              */
+    int num_samples,          /* I: number of samples in a scene            */
+    point_t **points,         /* O: points, allocated here                  */
+    int *num_points           /* O: number of points                        */
+);
+
+int extract_point_batch
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char **scene_list,        /* I: sorted list of scene names              */
+    int num_scenes,           /* I: number of scenes in the list            */
+    int *sdate,               /* I: julian date of every scene              */
+    int num_samples,          /* I: number of samples in a scene            */
+    point_t *points,          /* I: points to extract                       */
+    int num_points,           /* I: number of points                        */
+    run_opts_t *opts,         /* I: windows and descriptor bound            */
+    int method,               /* I: compositing method                      */
+    char *out_path,           /* I: directory for the outputs               */
+    scratch_arena_t *arena    /* I/O: scratch memory of the kernels         */
+);
+
+#endif // POINTS_H
@@ -0,0 +1,526 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "prefetch.h"
+#include "input.h"
+#include "2d_array.h"
+#include "band_layout.h"
+#include "utilities.h"
+#include "const.h"
+
+/******************************************************************************
+MODULE:  open_scanline_source
+
+PURPOSE:  Open the input of the scanline loop: the time cube if one is given,
+          otherwise the scenes with the reader of the run options; mmap
+          falls back to the pread pool if mapping fails
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the cube or a scene could not be opened
+SUCCESS         No errors encountered
+******************************************************************************/
+int open_scanline_source
+(
+    char *in_path,                /* I: ARD image directory                 */
+    char **scene_list,            /* I: list of scene names                 */
+    int num_scenes,               /* I: number of scenes in the list        */
+    int num_lines,                /* I: number of lines in a scene          */
+    int num_samples,              /* I: number of samples in a scene        */
+    int *sdate,                   /* I: julian date of every scene          */
+    run_opts_t *opts,             /* I: reader, descriptor bound, cube path */
+    scanline_source_t *src        /* O: opened source                       */
+)
+{
+    int i;
+    char filename[MAX_STR_LEN];
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "open_scanline_source";
+
+    src->cube = NULL;
+    src->mmap_scenes = NULL;
+    src->pool = NULL;
+    src->gdal = NULL;
+    src->f_bip = NULL;
+    src->num_lines = num_lines;
+    src->num_samples = num_samples;
+    src->num_scenes = num_scenes;
+    src->sdate = sdate;
+
+    if (opts->cube_path[0] != '\0')
+    {
+        src->cube = (time_cube_t *)malloc(sizeof(time_cube_t));
+        if (src->cube == NULL)
+            RETURN_ERROR("Allocating cube memory", FUNC_NAME, ERROR);
+        if (open_time_cube(opts->cube_path, num_lines, num_samples, num_scenes,
+                           src->cube) != SUCCESS)
+        {
+            free(src->cube);
+            src->cube = NULL;
+            RETURN_ERROR("Opening time cube", FUNC_NAME, ERROR);
+        }
+        return (SUCCESS);
+    }
+
+    if (opts->reader == READER_GDAL)
+    {
+        src->gdal = (gdal_scenes_t *)malloc(sizeof(gdal_scenes_t));
+        if (src->gdal == NULL)
+            RETURN_ERROR("Allocating gdal scenes memory", FUNC_NAME, ERROR);
+        if (open_gdal_scenes(in_path, scene_list, num_scenes, num_lines, num_samples,
+                             opts->max_open_files, opts->block_cache_mb,
+                             src->gdal) != SUCCESS)
+        {
+            free(src->gdal);
+            src->gdal = NULL;
+            RETURN_ERROR("Opening scenes with GDAL", FUNC_NAME, ERROR);
+        }
+        return (SUCCESS);
+    }
+
+    if (opts->reader == READER_MMAP)
+    {
+        /* map all scenes once; fall back to pread if any fails */
+        src->mmap_scenes = (mmap_scene_t *)malloc(num_scenes * sizeof(mmap_scene_t));
+        if (src->mmap_scenes == NULL)
+            RETURN_ERROR("Allocating mmap_scenes memory", FUNC_NAME, ERROR);
+
+        if (open_mmap_scenes(in_path, scene_list, num_scenes, num_lines,
+                             num_samples, src->mmap_scenes) == SUCCESS)
+            return (SUCCESS);
+
+        free(src->mmap_scenes);
+        src->mmap_scenes = NULL;
+        WARNING_MESSAGE("Memory-mapping scenes failed, reading scanlines with pread",
+                        FUNC_NAME);
+    }
+
+    if (opts->reader != READER_STDIO)
+    {
+        src->pool = (scene_pool_t *)malloc(sizeof(scene_pool_t));
+        if (src->pool == NULL)
+            RETURN_ERROR("Allocating scene pool memory", FUNC_NAME, ERROR);
+        if (open_scene_pool(in_path, scene_list, num_scenes, opts->max_open_files,
+                            src->pool) != SUCCESS)
+        {
+            free(src->pool);
+            src->pool = NULL;
+            RETURN_ERROR("Opening scene pool", FUNC_NAME, ERROR);
+        }
+        return (SUCCESS);
+    }
+
+    src->f_bip = (FILE **)calloc(num_scenes, sizeof(FILE *));
+    if (src->f_bip == NULL)
+        RETURN_ERROR("Allocating f_bip memory", FUNC_NAME, ERROR);
+
+    for (i = 0; i < num_scenes; i++)
+    {
+        sprintf(filename, "%s/%s", in_path, scene_list[i]);
+        src->f_bip[i] = open_raw_binary(filename, "rb");
+        if (src->f_bip[i] == NULL)
+        {
+            close_scanline_source(src);
+            sprintf(errmsg, "Opening %d scene files\n", i);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+    }
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  close_scanline_source
+
+PURPOSE:  Close whatever open_scanline_source opened
+
+RETURN VALUE: None
+******************************************************************************/
+void close_scanline_source
+(
+    scanline_source_t *src        /* I/O: opened source                     */
+)
+{
+    int i;
+
+    if (src->cube != NULL)
+    {
+        close_time_cube(src->cube);
+        free(src->cube);
+        src->cube = NULL;
+    }
+
+    if (src->mmap_scenes != NULL)
+    {
+        close_mmap_scenes(src->mmap_scenes, src->num_scenes);
+        free(src->mmap_scenes);
+        src->mmap_scenes = NULL;
+    }
+
+    if (src->pool != NULL)
+    {
+        close_scene_pool(src->pool);
+        free(src->pool);
+        src->pool = NULL;
+    }
+
+    if (src->gdal != NULL)
+    {
+        close_gdal_scenes(src->gdal);
+        free(src->gdal);
+        src->gdal = NULL;
+    }
+
+    if (src->f_bip != NULL)
+    {
+        for (i = 0; i < src->num_scenes; i++)
+            if (src->f_bip[i] != NULL)
+                close_raw_binary(src->f_bip[i]);
+        free(src->f_bip);
+        src->f_bip = NULL;
+    }
+}
+
+/******************************************************************************
+MODULE:  scanline_source_concurrent
+
+PURPOSE:  Tell whether threads may read different rows of a source at once
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+TRUE            mapped scenes or the pread pool
+FALSE           the cube, GDAL and stdio readers keep a position or a cache
+                and need one reader at a time
+******************************************************************************/
+int scanline_source_concurrent
+(
+    scanline_source_t *src        /* I: scanline source                     */
+)
+{
+    return ((src->mmap_scenes != NULL) || (src->pool != NULL)) ? TRUE : FALSE;
+}
+
+/******************************************************************************
+MODULE:  read_scanline
+
+PURPOSE:  Fill a slot with the per-pixel series of one scanline
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           reading the scanline failed
+SUCCESS         No errors encountered
+******************************************************************************/
+int read_scanline
+(
+    scanline_source_t *src,       /* I: scanline source                     */
+    scanline_slot_t *slot,        /* O: slot to fill                        */
+    int row                       /* I: row to read                         */
+)
+{
+    if (src->cube != NULL)
+        return read_cube_lines(src->cube, src->num_scenes, slot->buf,
+                               slot->valid_scene_count, slot->valid_date_array, row);
+
+    memset(slot->valid_scene_count, 0, src->num_samples * sizeof(int));
+
+    if (src->mmap_scenes != NULL)
+        return read_mmap_lines(src->mmap_scenes, src->num_lines, src->num_samples,
+                               src->num_scenes, src->sdate, slot->buf,
+                               slot->valid_scene_count, slot->valid_date_array, row);
+    else if (src->pool != NULL)
+        return read_pool_lines(src->pool, src->num_samples,
+                               src->num_scenes, src->sdate, slot->buf,
+                               slot->valid_scene_count, slot->valid_date_array, row);
+    else if (src->gdal != NULL)
+        return read_gdal_lines(src->gdal, src->num_samples,
+                               src->num_scenes, src->sdate, slot->buf,
+                               slot->valid_scene_count, slot->valid_date_array, row);
+    else
+        return read_bip_scanlines(src->f_bip, src->num_samples,
+                                  src->num_scenes, src->sdate, slot->buf,
+                                  slot->valid_scene_count, slot->valid_date_array, row);
+}
+
+/******************************************************************************
+MODULE:  prefetch_thread
+
+PURPOSE:  Reader thread: read the scanlines in row order, each into its slot
+          as soon as the compositing loop has released it
+
+RETURN VALUE: NULL
+
+NOTES: stops after the first failed read; the error is handed over in the
+       slot so the compositing loop reports it for the right row
+******************************************************************************/
+static void *prefetch_thread
+(
+    void *arg                     /* I/O: prefetch state                    */
+)
+{
+    scanline_prefetch_t *pf = (scanline_prefetch_t *)arg;
+    scanline_slot_t *slot;
+    int row;
+    int status;
+
+    for (row = 0; row < pf->src->num_lines; row++)
+    {
+        slot = &pf->slots[row % pf->n_slots];
+
+        pthread_mutex_lock(&pf->lock);
+        while ((slot->row >= 0) && (pf->stop == FALSE))
+            pthread_cond_wait(&pf->released, &pf->lock);
+        if (pf->stop == TRUE)
+        {
+            pthread_mutex_unlock(&pf->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pf->lock);
+
+        status = read_scanline(pf->src, slot, row);
+
+        pthread_mutex_lock(&pf->lock);
+        slot->row = row;
+        slot->status = status;
+        slot->ready = TRUE;
+        pthread_cond_broadcast(&pf->filled);
+        pthread_mutex_unlock(&pf->lock);
+
+        if (status != SUCCESS)
+            break;
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+MODULE:  free_scanline_slots
+
+PURPOSE:  Free the buffers of the first n_slots slots and the slot array
+
+RETURN VALUE: None
+******************************************************************************/
+void free_scanline_slots
+(
+    scanline_slot_t *slots,       /* I/O: slot array                        */
+    int n_slots                   /* I:   number of allocated slots         */
+)
+{
+    int i;
+
+    for (i = 0; i < n_slots; i++)
+    {
+        if (slots[i].buf != NULL)
+            free_2d_array((void **)slots[i].buf);
+        if (slots[i].valid_date_array != NULL)
+            free_2d_array((void **)slots[i].valid_date_array);
+        free(slots[i].valid_scene_count);
+    }
+    free(slots);
+}
+
+/******************************************************************************
+MODULE:  allocate_scanline_slots
+
+PURPOSE:  Allocate n_slots empty slots, each with the buffers of a scanline
+          of the source
+
+RETURN VALUE:
+Type = scanline_slot_t *
+Value           Description
+-----           -----------
+NULL            memory allocation failed
+slots           array of n_slots slots, freed with free_scanline_slots
+******************************************************************************/
+scanline_slot_t *allocate_scanline_slots
+(
+    scanline_source_t *src,       /* I: scanline source                     */
+    int n_slots                   /* I: number of slots                     */
+)
+{
+    int i;
+    scanline_slot_t *slots;
+    char FUNC_NAME[] = "allocate_scanline_slots";
+
+    slots = (scanline_slot_t *)calloc(n_slots, sizeof(scanline_slot_t));
+    if (slots == NULL)
+        RETURN_ERROR("Allocating scanline slots", FUNC_NAME, NULL);
+
+    for (i = 0; i < n_slots; i++)
+    {
+        slots[i].row = -1;
+        slots[i].ready = FALSE;
+        slots[i].buf = (short int **)allocate_2d_array(get_band_layout()->image_bands,
+                        src->num_scenes * src->num_samples, sizeof(short int));
+        slots[i].valid_date_array = (int **)allocate_2d_array(src->num_samples,
+                        src->num_scenes, sizeof(int));
+        slots[i].valid_scene_count = (int *)malloc(src->num_samples * sizeof(int));
+        if ((slots[i].buf == NULL) || (slots[i].valid_date_array == NULL)
+            || (slots[i].valid_scene_count == NULL))
+        {
+            free_scanline_slots(slots, i + 1);
+            RETURN_ERROR("Allocating scanline slot buffers", FUNC_NAME, NULL);
+        }
+    }
+
+    return slots;
+}
+
+/******************************************************************************
+MODULE:  open_scanline_prefetch
+
+PURPOSE:  Allocate depth + 1 scanline buffers and start a reader thread that
+          keeps up to depth scanlines ready ahead of the one being composited,
+          so reading and compositing overlap
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           memory allocation or thread creation failed
+SUCCESS         No errors encountered
+
+NOTES: with depth 0 no thread is started and acquire_scanline reads the
+       row itself, which is the serial loop of earlier versions
+******************************************************************************/
+int open_scanline_prefetch
+(
+    scanline_source_t *src,       /* I: scanline source                     */
+    int depth,                    /* I: scanlines read ahead, 0 = serial    */
+    scanline_prefetch_t *pf       /* O: prefetch state                      */
+)
+{
+    char FUNC_NAME[] = "open_scanline_prefetch";
+
+    pf->src = src;
+    pf->depth = depth;
+    pf->n_slots = depth + 1;
+    pf->stop = FALSE;
+
+    pf->slots = allocate_scanline_slots(src, pf->n_slots);
+    if (pf->slots == NULL)
+        RETURN_ERROR("Allocating scanline slots", FUNC_NAME, ERROR);
+
+    if (depth == 0)
+        return (SUCCESS);
+
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->filled, NULL);
+    pthread_cond_init(&pf->released, NULL);
+
+    if (pthread_create(&pf->thread, NULL, prefetch_thread, pf) != 0)
+    {
+        pthread_mutex_destroy(&pf->lock);
+        pthread_cond_destroy(&pf->filled);
+        pthread_cond_destroy(&pf->released);
+        free_scanline_slots(pf->slots, pf->n_slots);
+        RETURN_ERROR("Starting the prefetch thread", FUNC_NAME, ERROR);
+    }
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  acquire_scanline
+
+PURPOSE:  Get the slot holding a row, waiting for the reader if it is not
+          there yet
+
+RETURN VALUE:
+Type = scanline_slot_t *
+Value           Description
+-----           -----------
+NULL            reading the row failed
+slot            filled slot, to be handed back with release_scanline
+
+NOTES: rows have to be acquired in increasing order, one at a time
+******************************************************************************/
+scanline_slot_t *acquire_scanline
+(
+    scanline_prefetch_t *pf,      /* I/O: prefetch state                    */
+    int row                       /* I:   row wanted, in increasing order   */
+)
+{
+    scanline_slot_t *slot = &pf->slots[row % pf->n_slots];
+
+    if (pf->depth == 0)
+    {
+        slot->row = row;
+        slot->status = read_scanline(pf->src, slot, row);
+        slot->ready = TRUE;
+    }
+    else
+    {
+        pthread_mutex_lock(&pf->lock);
+        while ((slot->ready == FALSE) || (slot->row != row))
+            pthread_cond_wait(&pf->filled, &pf->lock);
+        pthread_mutex_unlock(&pf->lock);
+    }
+
+    if (slot->status != SUCCESS)
+        return NULL;
+
+    return slot;
+}
+
+/******************************************************************************
+MODULE:  release_scanline
+
+PURPOSE:  Hand a slot back to the reader once its row has been composited
+
+RETURN VALUE: None
+******************************************************************************/
+void release_scanline
+(
+    scanline_prefetch_t *pf,      /* I/O: prefetch state                    */
+    scanline_slot_t *slot         /* I:   slot returned by acquire_scanline */
+)
+{
+    if (pf->depth == 0)
+    {
+        slot->row = -1;
+        slot->ready = FALSE;
+        return;
+    }
+
+    pthread_mutex_lock(&pf->lock);
+    slot->row = -1;
+    slot->ready = FALSE;
+    pthread_cond_broadcast(&pf->released);
+    pthread_mutex_unlock(&pf->lock);
+}
+
+/******************************************************************************
+MODULE:  close_scanline_prefetch
+
+PURPOSE:  Stop the reader thread and free the scanline buffers
+
+RETURN VALUE: None
+******************************************************************************/
+void close_scanline_prefetch
+(
+    scanline_prefetch_t *pf       /* I/O: prefetch state                    */
+)
+{
+    if (pf->depth > 0)
+    {
+        pthread_mutex_lock(&pf->lock);
+        pf->stop = TRUE;
+        pthread_cond_broadcast(&pf->released);
+        pthread_mutex_unlock(&pf->lock);
+
+        pthread_join(pf->thread, NULL);
+
+        pthread_mutex_destroy(&pf->lock);
+        pthread_cond_destroy(&pf->filled);
+        pthread_cond_destroy(&pf->released);
+    }
+
+    free_scanline_slots(pf->slots, pf->n_slots);
+    pf->slots = NULL;
+}
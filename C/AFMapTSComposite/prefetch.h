@@ -0,0 +1,113 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "input_mmap.h"
+#include "input_cube.h"
+#include "input_pool.h"
+#include "input_gdal.h"
+#include "utilities.h"
+
+/* where scanlines come from: exactly one of cube, mmap_scenes, pool, gdal
+   and f_bip is not NULL */
+typedef struct scanline_source {
+    time_cube_t *cube;            /* pixel-major time cube                  */
+    mmap_scene_t *mmap_scenes;    /* mapped scenes                          */
+    scene_pool_t *pool;           /* scenes read with pread                 */
+    gdal_scenes_t *gdal;          /* scenes read by GDAL block              */
+    FILE **f_bip;                 /* open BIP files, read with stdio        */
+    int num_lines;                /* number of image lines (Y height)       */
+    int num_samples;              /* number of image samples (X width)      */
+    int num_scenes;               /* number of scenes                       */
+    int *sdate;                   /* julian date of every scene             */
+} scanline_source_t;
+
+/* per-pixel series of one scanline, as built by read_bip_lines */
+typedef struct {
+    short int **buf;              /* band values, valid pixels only         */
+    int **valid_date_array;       /* dates of the valid values, per pixel   */
+    int *valid_scene_count;       /* number of valid values, per pixel      */
+    int row;                      /* scanline held by the slot, -1 if none  */
+    int ready;                    /* TRUE once the reader has filled it     */
+    int status;                   /* SUCCESS or the reader's error          */
+} scanline_slot_t;
+
+typedef struct {
+    scanline_source_t *src;
+    int depth;                    /* scanlines read ahead, 0 = serial       */
+    int n_slots;                  /* depth + 1                              */
+    scanline_slot_t *slots;       /* row r lives in slots[r % n_slots]      */
+    int stop;                     /* TRUE asks the reader thread to quit    */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;        /* a slot became ready                    */
+    pthread_cond_t released;      /* a slot was handed back                 */
+} scanline_prefetch_t;
+
+int open_scanline_source
+(
+    char *in_path,                /* I: ARD image directory                 */
+    char **scene_list,            /* I: list of scene names                 */
+    int num_scenes,               /* I: number of scenes in the list        */
+    int num_lines,                /* I: number of lines in a scene          */
+    int num_samples,              /* I: number of samples in a scene        */
+    int *sdate,                   /* I: julian date of every scene          */
+    run_opts_t *opts,             /* I: reader, descriptor bound, cube path */
+    scanline_source_t *src        /* O: opened source                       */
+);
+
+void close_scanline_source
+(
+    scanline_source_t *src        /* I/O: opened source                     */
+);
+
+int scanline_source_concurrent
+(
+    scanline_source_t *src        /* I: scanline source                     */
+);
+
+int read_scanline
+(
+    scanline_source_t *src,       /* I: scanline source                     */
+    scanline_slot_t *slot,        /* O: slot to fill                        */
+    int row                       /* I: row to read                         */
+);
+
+scanline_slot_t *allocate_scanline_slots
+(
+    scanline_source_t *src,       /* I: scanline source                     */
+    int n_slots                   /* I: number of slots                     */
+);
+
+void free_scanline_slots
+(
+    scanline_slot_t *slots,       /* I/O: slot array                        */
+    int n_slots                   /* I:   number of allocated slots         */
+);
+
+int open_scanline_prefetch
+(
+    scanline_source_t *src,       /* I: scanline source                     */
+    int depth,                    /* I: scanlines read ahead, 0 = serial    */
+    scanline_prefetch_t *pf       /* O: prefetch state                      */
+);
+
+scanline_slot_t *acquire_scanline
+(
+    scanline_prefetch_t *pf,      /* I/O: prefetch state                    */
+    int row                       /* I:   row wanted, in increasing order   */
+);
+
+void release_scanline
+(
+    scanline_prefetch_t *pf,      /* I/O: prefetch state                    */
+    scanline_slot_t *slot         /* I:   slot returned by acquire_scanline */
+);
+
+void close_scanline_prefetch
+(
+    scanline_prefetch_t *pf       /* I/O: prefetch state                    */
+);
+
+#endif // PREFETCH_H
@@ -0,0 +1,299 @@
+#include <stdlib.h>
+
+#include "raster_writer.h"
+#include "2d_array.h"
+#include "utilities.h"
+
+/******************************************************************************
+MODULE:  write_raster_block
+
+PURPOSE:  Write a block of rows to every output dataset, all bands of a
+          window in one call
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           GDAL failed to write a window
+SUCCESS         No errors encountered
+******************************************************************************/
+static int write_raster_block
+(
+    raster_writer_t *wr,          /* I: writer                              */
+    raster_block_t *blk           /* I: block to write                      */
+)
+{
+    int w;
+    int ps = wr->image_bands * (int)sizeof(short int);
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "write_raster_block";
+
+    for (w = 0; w < wr->n_windows; w++)
+    {
+        if (GDALDatasetRasterIO(wr->ds[w], GF_Write, 0, blk->first_row, wr->samples,
+                                blk->n_rows, blk->buf[w], wr->samples, blk->n_rows,
+                                GDT_Int16, wr->image_bands, NULL, ps,
+                                ps * wr->samples, sizeof(short int)) != CE_None)
+        {
+            sprintf(errmsg, "Writing rows %d to %d of window %d", blk->first_row,
+                    blk->first_row + blk->n_rows - 1, w);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+    }
+
+    return SUCCESS;
+}
+
+/******************************************************************************
+MODULE:  raster_writer_thread
+
+PURPOSE:  Writer thread: write the queued blocks in ring order until the
+          end marker
+
+RETURN VALUE: NULL
+
+NOTES: after a failed write the blocks are still taken off the ring, unwritten,
+       so the producer never waits on a writer that has given up
+******************************************************************************/
+static void *raster_writer_thread
+(
+    void *arg                     /* I/O: writer                            */
+)
+{
+    raster_writer_t *wr = (raster_writer_t *)arg;
+    raster_block_t *blk;
+
+    for (;;)
+    {
+        while (sem_wait(&wr->full_blocks) != 0)
+            ;
+        blk = &wr->ring[wr->head % wr->depth];
+        if (blk->first_row < 0)
+            break;
+
+        if ((__atomic_load_n(&wr->status, __ATOMIC_RELAXED) == SUCCESS)
+            && (write_raster_block(wr, blk) != SUCCESS))
+            __atomic_store_n(&wr->status, ERROR, __ATOMIC_RELAXED);
+
+        wr->head++;
+        sem_post(&wr->free_blocks);
+    }
+
+    return NULL;
+}
+
+/******************************************************************************
+MODULE:  free_raster_ring
+
+PURPOSE:  Free the buffers of the first n blocks and the ring
+
+RETURN VALUE: None
+******************************************************************************/
+static void free_raster_ring
+(
+    raster_block_t *ring,         /* I/O: ring                              */
+    int n                         /* I:   blocks with a buffer              */
+)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (ring[i].buf != NULL)
+            free_2d_array((void **)ring[i].buf);
+    free(ring);
+}
+
+/******************************************************************************
+MODULE:  open_raster_writer
+
+PURPOSE:  Allocate a ring of depth row blocks and start the thread that
+          writes them to the output datasets in row order
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           memory allocation or thread creation failed
+SUCCESS         No errors encountered
+
+NOTES: a block holds as many rows as the block height of the output, so
+       every write covers whole blocks of the file; from here on only the
+       writer thread uses the datasets, until close_raster_writer returns
+******************************************************************************/
+int open_raster_writer
+(
+    GDALDatasetH *ds,             /* I: output dataset of every window      */
+    int n_windows,                /* I: number of windows                   */
+    int image_bands,              /* I: bands of a dataset                  */
+    int samples,                  /* I: samples of a row                    */
+    int depth,                    /* I: blocks in the ring                  */
+    raster_writer_t *wr           /* O: writer, its thread running          */
+)
+{
+    int i;
+    int block_xsize, block_ysize;
+    char FUNC_NAME[] = "open_raster_writer";
+
+    GDALGetBlockSize(GDALGetRasterBand(ds[0], 1), &block_xsize, &block_ysize);
+
+    wr->ds = ds;
+    wr->n_windows = n_windows;
+    wr->image_bands = image_bands;
+    wr->samples = samples;
+    wr->rows = (block_ysize > 0) ? block_ysize : 1;
+    wr->depth = depth;
+    wr->head = 0;
+    wr->tail = 0;
+    wr->fill = 0;
+    wr->status = SUCCESS;
+
+    wr->ring = (raster_block_t *)calloc(depth, sizeof(raster_block_t));
+    if (wr->ring == NULL)
+        RETURN_ERROR("Allocating the writer ring", FUNC_NAME, ERROR);
+
+    for (i = 0; i < depth; i++)
+    {
+        wr->ring[i].buf = (short int **)allocate_2d_array(n_windows,
+                           wr->rows * samples * image_bands, sizeof(short int));
+        if (wr->ring[i].buf == NULL)
+        {
+            free_raster_ring(wr->ring, i);
+            RETURN_ERROR("Allocating the writer blocks", FUNC_NAME, ERROR);
+        }
+    }
+
+    sem_init(&wr->free_blocks, 0, depth);
+    sem_init(&wr->full_blocks, 0, 0);
+
+    if (pthread_create(&wr->thread, NULL, raster_writer_thread, wr) != 0)
+    {
+        sem_destroy(&wr->free_blocks);
+        sem_destroy(&wr->full_blocks);
+        free_raster_ring(wr->ring, depth);
+        RETURN_ERROR("Starting the writer thread", FUNC_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+/******************************************************************************
+MODULE:  queue_raster_block
+
+PURPOSE:  Hand the block being filled to the writer thread
+
+RETURN VALUE: None
+******************************************************************************/
+static void queue_raster_block
+(
+    raster_writer_t *wr           /* I/O: writer                            */
+)
+{
+    wr->ring[wr->tail % wr->depth].n_rows = wr->fill;
+    wr->tail++;
+    wr->fill = 0;
+    sem_post(&wr->full_blocks);
+}
+
+/******************************************************************************
+MODULE:  put_raster_rows
+
+PURPOSE:  Copy composited rows into the ring, pixel-interleaved, queueing
+          every block that fills up
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           an earlier write failed
+SUCCESS         No errors encountered
+
+NOTES: rows have to come in order from row 0, from one thread. The ring
+       takes no lock; the caller waits only when all depth blocks are
+       queued, which bounds the memory held for the output.
+******************************************************************************/
+int put_raster_rows
+(
+    raster_writer_t *wr,          /* I/O: writer                            */
+    int first_row,                /* I: first row, next after the last put  */
+    int n_rows,                   /* I: rows to put                         */
+    short int **out               /* I: band b of window w at
+                                        out[w * image_bands + b], n_rows x
+                                        samples values                      */
+)
+{
+    int r, w, b, c;
+    int ib = wr->image_bands;
+    raster_block_t *blk;
+    short int *dst;
+    const short int *src;
+    char FUNC_NAME[] = "put_raster_rows";
+
+    for (r = 0; r < n_rows; r++)
+    {
+        blk = &wr->ring[wr->tail % wr->depth];
+        if (wr->fill == 0)
+        {
+            while (sem_wait(&wr->free_blocks) != 0)
+                ;
+            blk->first_row = first_row + r;
+        }
+
+        for (w = 0; w < wr->n_windows; w++)
+        {
+            dst = blk->buf[w] + (size_t)wr->fill * wr->samples * ib;
+            for (b = 0; b < ib; b++)
+            {
+                src = out[w * ib + b] + (size_t)r * wr->samples;
+                for (c = 0; c < wr->samples; c++)
+                    dst[c * ib + b] = src[c];
+            }
+        }
+
+        wr->fill++;
+        if (wr->fill == wr->rows)
+            queue_raster_block(wr);
+    }
+
+    if (__atomic_load_n(&wr->status, __ATOMIC_RELAXED) != SUCCESS)
+        RETURN_ERROR("The writer thread failed", FUNC_NAME, ERROR);
+
+    return SUCCESS;
+}
+
+/******************************************************************************
+MODULE:  close_raster_writer
+
+PURPOSE:  Queue the last, partly filled block, wait until everything is
+          written and stop the writer thread
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           a write failed
+SUCCESS         every row was written
+******************************************************************************/
+int close_raster_writer
+(
+    raster_writer_t *wr           /* I/O: writer                            */
+)
+{
+    if (wr->fill > 0)
+        queue_raster_block(wr);
+
+    /* the end marker takes a block like any other */
+    while (sem_wait(&wr->free_blocks) != 0)
+        ;
+    wr->ring[wr->tail % wr->depth].first_row = -1;
+    wr->tail++;
+    sem_post(&wr->full_blocks);
+
+    pthread_join(wr->thread, NULL);
+
+    sem_destroy(&wr->free_blocks);
+    sem_destroy(&wr->full_blocks);
+    free_raster_ring(wr->ring, wr->depth);
+    wr->ring = NULL;
+
+    return wr->status;
+}
@@ -0,0 +1,61 @@
+#ifndef RASTER_WRITER_H
+#define RASTER_WRITER_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include "gdal/gdal.h"
+#include "const.h"
+
+/* rows of every window on their way to the output, pixel-interleaved */
+typedef struct {
+    int first_row;                /* first row held, -1 ends the writer     */
+    int n_rows;                   /* rows held                              */
+    short int **buf;              /* window w at buf[w], rows x samples x
+                                     image_bands values                     */
+} raster_block_t;
+
+/* ring of row blocks between the compositing loop, the only producer, and
+   a thread that alone owns the output datasets */
+typedef struct {
+    GDALDatasetH *ds;             /* output dataset of every window         */
+    int n_windows;
+    int image_bands;
+    int samples;
+    int rows;                     /* rows of a block, the output block height */
+    int depth;                    /* blocks in the ring                     */
+    raster_block_t *ring;
+    unsigned long head;           /* next block written, writer thread only */
+    unsigned long tail;           /* block being filled, producer only      */
+    int fill;                     /* rows of the tail block filled so far   */
+    sem_t free_blocks;            /* blocks the producer may fill           */
+    sem_t full_blocks;            /* blocks queued for the writer thread    */
+    int status;                   /* SUCCESS until a write fails            */
+    pthread_t thread;
+} raster_writer_t;
+
+int open_raster_writer
+(
+    GDALDatasetH *ds,             /* I: output dataset of every window      */
+    int n_windows,                /* I: number of windows                   */
+    int image_bands,              /* I: bands of a dataset                  */
+    int samples,                  /* I: samples of a row                    */
+    int depth,                    /* I: blocks in the ring                  */
+    raster_writer_t *wr           /* O: writer, its thread running          */
+);
+
+int put_raster_rows
+(
+    raster_writer_t *wr,          /* I/O: writer                            */
+    int first_row,                /* I: first row, next after the last put  */
+    int n_rows,                   /* I: rows to put                         */
+    short int **out               /* I: band b of window w at
+                                        out[w * image_bands + b], n_rows x
+                                        samples values                      */
+);
+
+int close_raster_writer
+(
+    raster_writer_t *wr           /* I/O: writer                            */
+);
+
+#endif // RASTER_WRITER_H
@@ -0,0 +1,675 @@
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "robust_fit.h"
+#include "const.h"
+#include "utilities.h"
+#include "median_select.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define FIT_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* the lanes of a batch and a single fit must round alike, so no a * b + c
+   may be fused into one instruction behind our back */
+#ifdef __GNUC__
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+/* lanes per SIMD step */
+#define FIT_AVX2_STEP 8
+
+typedef void (*lane_residual_kernel_t)(const float *, const float *,
+                                       const float *, const int *, int, int,
+                                       int, const float *, const float *,
+                                       float *, float *);
+typedef void (*lane_weight_kernel_t)(const float *, const int *, int, int,
+                                     int, int, const float *, float *);
+typedef void (*lane_wls_kernel_t)(const float *, const float *, const float *,
+                                  const int *, int, int, int, float *,
+                                  float *, float *, float *);
+
+static lane_residual_kernel_t lane_residual_kernel = NULL;
+static lane_weight_kernel_t lane_weight_kernel = NULL;
+static lane_wls_kernel_t lane_wls_kernel = NULL;
+static const char *fit_isa = "scalar";
+static pthread_once_t fit_once = PTHREAD_ONCE_INIT;
+
+/******************************************************************************
+MODULE:  lane_residuals_scalar
+
+PURPOSE:  Reference kernel: leverage-corrected residuals of every lane and
+          their magnitudes
+
+RETURN VALUE: None
+
+NOTES: arrays are lane-major, observation i of lane l at i * stride + l;
+       the SIMD kernels fall back to it for the lanes that do not fill a
+       vector
+******************************************************************************/
+static void lane_residuals_scalar
+(
+    const float *tc,
+    const float *y,
+    const float *resfac,
+    const int *n,
+    int stride,
+    int first,                /* I: first lane to process                   */
+    int lanes,
+    const float *c0,
+    const float *c1,
+    float *r,
+    float *abs_r
+)
+{
+    int i, l, p;
+
+    for (l = first; l < lanes; l++)
+    {
+        for (i = 0; i < n[l]; i++)
+        {
+            p = i * stride + l;
+            r[p] = (y[p] - c0[l] - c1[l] * tc[p]) * resfac[p];
+            abs_r[p] = fabsf(r[p]);
+        }
+    }
+}
+
+/******************************************************************************
+MODULE:  lane_weights_scalar
+
+PURPOSE:  Reference kernel: bisquare weight (1 - u^2)^2 of every residual,
+          u being the residual times the scale of its lane
+
+RETURN VALUE: None
+******************************************************************************/
+static void lane_weights_scalar
+(
+    const float *r,
+    const int *n,
+    int max_n,
+    int stride,
+    int first,                /* I: first lane to process                   */
+    int lanes,
+    const float *scale,
+    float *wt
+)
+{
+    int i, l, p;
+    float u;
+
+    for (l = first; l < lanes; l++)
+    {
+        for (i = 0; i < max_n; i++)
+        {
+            p = i * stride + l;
+            if (i >= n[l])
+            {
+                wt[p] = 0.0f;
+                continue;
+            }
+            u = r[p] * scale[l];
+            wt[p] = (fabsf(u) < 1.0f) ? (1.0f - u * u) * (1.0f - u * u) : 0.0f;
+        }
+    }
+}
+
+/******************************************************************************
+MODULE:  lane_wls_scalar
+
+PURPOSE:  Reference kernel: weighted least squares line of every lane from
+          the closed-form 2x2 normal equations, taking the weighted means
+          out first
+
+RETURN VALUE: None
+
+NOTES: sum_w and s_tt come back so the caller can tell a singular lane
+******************************************************************************/
+static void lane_wls_scalar
+(
+    const float *tc,
+    const float *y,
+    const float *wt,
+    const int *n,
+    int stride,
+    int first,                /* I: first lane to process                   */
+    int lanes,
+    float *c0,
+    float *c1,
+    float *sum_w,
+    float *s_tt
+)
+{
+    int i, l, p;
+    float w, dt;
+    float sw, swt, swy, stt, sty;
+    float mean_t, mean_y;
+
+    for (l = first; l < lanes; l++)
+    {
+        sw = 0.0f;
+        swt = 0.0f;
+        swy = 0.0f;
+        for (i = 0; i < n[l]; i++)
+        {
+            p = i * stride + l;
+            w = wt[p];
+            sw += w;
+            swt += w * tc[p];
+            swy += w * y[p];
+        }
+        mean_t = swt / sw;
+        mean_y = swy / sw;
+
+        stt = 0.0f;
+        sty = 0.0f;
+        for (i = 0; i < n[l]; i++)
+        {
+            p = i * stride + l;
+            w = wt[p];
+            dt = tc[p] - mean_t;
+            stt += w * dt * dt;
+            sty += w * dt * (y[p] - mean_y);
+        }
+
+        c1[l] = sty / stt;
+        c0[l] = mean_y - c1[l] * mean_t;
+        sum_w[l] = sw;
+        s_tt[l] = stt;
+    }
+}
+
+#ifdef FIT_X86_SIMD
+
+/******************************************************************************
+MODULE:  lane_mask_avx2
+
+PURPOSE:  All-ones in the lanes whose series still has observation i
+
+RETURN VALUE:
+Type = __m256
+******************************************************************************/
+__attribute__((target("avx2")))
+static inline __m256 lane_mask_avx2
+(
+    __m256i n,
+    int i
+)
+{
+    return _mm256_castsi256_ps(_mm256_cmpgt_epi32(n, _mm256_set1_epi32(i)));
+}
+
+/******************************************************************************
+MODULE:  lane_residuals_avx2
+
+PURPOSE:  Residuals of 8 lanes per step
+
+RETURN VALUE: None
+
+NOTES: observations past the end of a lane are computed and never read
+******************************************************************************/
+__attribute__((target("avx2")))
+static void lane_residuals_avx2
+(
+    const float *tc,
+    const float *y,
+    const float *resfac,
+    const int *n,
+    int stride,
+    int first,
+    int lanes,
+    const float *c0,
+    const float *c1,
+    float *r,
+    float *abs_r
+)
+{
+    int i, l, p, max_n;
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 v_c0, v_c1, v_r;
+
+    for (l = first; l + FIT_AVX2_STEP <= lanes; l += FIT_AVX2_STEP)
+    {
+        max_n = 0;
+        for (p = l; p < l + FIT_AVX2_STEP; p++)
+            if (n[p] > max_n)
+                max_n = n[p];
+
+        v_c0 = _mm256_loadu_ps(c0 + l);
+        v_c1 = _mm256_loadu_ps(c1 + l);
+        for (i = 0; i < max_n; i++)
+        {
+            p = i * stride + l;
+            v_r = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(y + p), v_c0),
+                                _mm256_mul_ps(v_c1, _mm256_loadu_ps(tc + p)));
+            v_r = _mm256_mul_ps(v_r, _mm256_loadu_ps(resfac + p));
+            _mm256_storeu_ps(r + p, v_r);
+            _mm256_storeu_ps(abs_r + p, _mm256_andnot_ps(sign, v_r));
+        }
+    }
+
+    lane_residuals_scalar(tc, y, resfac, n, stride, l, lanes, c0, c1,
+                          r, abs_r);
+}
+
+/******************************************************************************
+MODULE:  lane_weights_avx2
+
+PURPOSE:  Bisquare weights of 8 lanes per step
+
+RETURN VALUE: None
+******************************************************************************/
+__attribute__((target("avx2")))
+static void lane_weights_avx2
+(
+    const float *r,
+    const int *n,
+    int max_n,
+    int stride,
+    int first,
+    int lanes,
+    const float *scale,
+    float *wt
+)
+{
+    int i, l, p;
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256i v_n;
+    __m256 v_scale, u, v, inside;
+
+    for (l = first; l + FIT_AVX2_STEP <= lanes; l += FIT_AVX2_STEP)
+    {
+        v_n = _mm256_loadu_si256((const __m256i *)(n + l));
+        v_scale = _mm256_loadu_ps(scale + l);
+        for (i = 0; i < max_n; i++)
+        {
+            p = i * stride + l;
+            u = _mm256_mul_ps(_mm256_loadu_ps(r + p), v_scale);
+            inside = _mm256_and_ps(lane_mask_avx2(v_n, i),
+                _mm256_cmp_ps(_mm256_andnot_ps(sign, u), one, _CMP_LT_OQ));
+            v = _mm256_sub_ps(one, _mm256_mul_ps(u, u));
+            _mm256_storeu_ps(wt + p, _mm256_and_ps(inside, _mm256_mul_ps(v, v)));
+        }
+    }
+
+    lane_weights_scalar(r, n, max_n, stride, l, lanes, scale, wt);
+}
+
+/******************************************************************************
+MODULE:  lane_wls_avx2
+
+PURPOSE:  Weighted least squares lines of 8 lanes per step
+
+RETURN VALUE: None
+
+NOTES: every lane accumulates its observations in order, as the scalar
+       kernel does, so the lines are the same to the last bit
+******************************************************************************/
+__attribute__((target("avx2")))
+static void lane_wls_avx2
+(
+    const float *tc,
+    const float *y,
+    const float *wt,
+    const int *n,
+    int stride,
+    int first,
+    int lanes,
+    float *c0,
+    float *c1,
+    float *sum_w,
+    float *s_tt
+)
+{
+    int i, l, p, max_n;
+    __m256i v_n;
+    __m256 mask, w, v_t, v_y, dt, wdt;
+    __m256 sw, swt, swy, stt, sty, mean_t, mean_y, v_c1;
+
+    for (l = first; l + FIT_AVX2_STEP <= lanes; l += FIT_AVX2_STEP)
+    {
+        max_n = 0;
+        for (p = l; p < l + FIT_AVX2_STEP; p++)
+            if (n[p] > max_n)
+                max_n = n[p];
+        v_n = _mm256_loadu_si256((const __m256i *)(n + l));
+
+        sw = _mm256_setzero_ps();
+        swt = _mm256_setzero_ps();
+        swy = _mm256_setzero_ps();
+        for (i = 0; i < max_n; i++)
+        {
+            p = i * stride + l;
+            mask = lane_mask_avx2(v_n, i);
+            w = _mm256_and_ps(mask, _mm256_loadu_ps(wt + p));
+            v_t = _mm256_loadu_ps(tc + p);
+            v_y = _mm256_loadu_ps(y + p);
+            sw = _mm256_add_ps(sw, w);
+            swt = _mm256_add_ps(swt, _mm256_and_ps(mask, _mm256_mul_ps(w, v_t)));
+            swy = _mm256_add_ps(swy, _mm256_and_ps(mask, _mm256_mul_ps(w, v_y)));
+        }
+        mean_t = _mm256_div_ps(swt, sw);
+        mean_y = _mm256_div_ps(swy, sw);
+
+        stt = _mm256_setzero_ps();
+        sty = _mm256_setzero_ps();
+        for (i = 0; i < max_n; i++)
+        {
+            p = i * stride + l;
+            mask = lane_mask_avx2(v_n, i);
+            w = _mm256_and_ps(mask, _mm256_loadu_ps(wt + p));
+            dt = _mm256_sub_ps(_mm256_loadu_ps(tc + p), mean_t);
+            wdt = _mm256_mul_ps(w, dt);
+            stt = _mm256_add_ps(stt, _mm256_and_ps(mask, _mm256_mul_ps(wdt, dt)));
+            sty = _mm256_add_ps(sty, _mm256_and_ps(mask, _mm256_mul_ps(wdt,
+                      _mm256_sub_ps(_mm256_loadu_ps(y + p), mean_y))));
+        }
+
+        v_c1 = _mm256_div_ps(sty, stt);
+        _mm256_storeu_ps(c1 + l, v_c1);
+        _mm256_storeu_ps(c0 + l, _mm256_sub_ps(mean_y, _mm256_mul_ps(v_c1, mean_t)));
+        _mm256_storeu_ps(sum_w + l, sw);
+        _mm256_storeu_ps(s_tt + l, stt);
+    }
+
+    lane_wls_scalar(tc, y, wt, n, stride, l, lanes, c0, c1, sum_w, s_tt);
+}
+
+#endif // FIT_X86_SIMD
+
+/******************************************************************************
+MODULE:  init_fit_dispatch
+
+PURPOSE:  Pick the widest lane kernels the running CPU supports
+
+RETURN VALUE: None
+******************************************************************************/
+static void init_fit_dispatch(void)
+{
+    lane_residual_kernel = lane_residuals_scalar;
+    lane_weight_kernel = lane_weights_scalar;
+    lane_wls_kernel = lane_wls_scalar;
+    fit_isa = "scalar";
+
+#ifdef FIT_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        lane_residual_kernel = lane_residuals_avx2;
+        lane_weight_kernel = lane_weights_avx2;
+        lane_wls_kernel = lane_wls_avx2;
+        fit_isa = "avx2";
+    }
+#endif
+}
+
+/******************************************************************************
+MODULE:  bisquare_fit_lanes
+
+PURPOSE:  Robust fits of y = c0 + c1 * t for up to FIT_LANES series at once,
+          by iteratively reweighted least squares with bisquare weights,
+          following the vendored gsl_multifit_robust step for step
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           error allocating memory
+SUCCESS         no error encountered; status tells the lanes apart
+
+NOTES: the OLS start, leverage correction 1/sqrt(1 - h), MAD scale without
+       the smallest residual, lower bound 1e-6 sd(y) on the scale, tuning
+       constant, iteration limit and convergence test are GSL's; the work
+       is in single precision on dates taken relative to the first one of
+       each lane.  A lane that converges stops updating while the others
+       go on.  A lane is FAILURE when it has too few observations or its
+       weighted system turns singular; the GSL path has to take it then.
+******************************************************************************/
+int bisquare_fit_lanes
+(
+    const float *t,           /* I: dates, observation i of lane l at
+                                    i * stride + l, max(n) rows               */
+    const float *y,           /* I: values, laid out as t                     */
+    const int *n,             /* I: number of observations of every lane      */
+    int lanes,                /* I: lanes in use, at most FIT_LANES           */
+    int stride,               /* I: distance between observations, >= lanes   */
+    float *coefs,             /* O: intercept and slope of lane l at 2l, 2l+1 */
+    int *status,              /* O: SUCCESS or FAILURE of every lane          */
+    scratch_arena_t *arena    /* I/O: per-pixel scratch memory                */
+)
+{
+    char FUNC_NAME[] = "bisquare_fit_lanes";
+    int i, l, p, iter, max_n, running;
+    int n_lane[FIT_LANES];   /* observations, 0 for lanes out of the fit     */
+    int state[FIT_LANES];    /* 0 failed, 1 iterating, 2 converged           */
+    int m[FIT_LANES], k[FIT_LANES];
+    float c0[FIT_LANES], c1[FIT_LANES], new_c0[FIT_LANES], new_c1[FIT_LANES];
+    float sum_w[FIT_LANES], s_tt[FIT_LANES], scale[FIT_LANES];
+    double t_ref[FIT_LANES];
+    float *tc;              /* dates relative to the first one               */
+    float *resfac;          /* leverage factor of every residual             */
+    float *r;               /* scaled residuals                              */
+    float *abs_r;           /* their magnitudes                              */
+    float *wt;              /* bisquare weights                              */
+    float *sel;             /* magnitudes of one lane, reordered by selection */
+    float mean_t, mean_y, s_yy, dt, h, sig, sig_lower[FIT_LANES];
+    float kth, below;
+    double a0, b0, a1, b1;
+    size_t mark;
+
+    pthread_once(&fit_once, init_fit_dispatch);
+
+    max_n = 0;
+    for (l = 0; l < lanes; l++)
+    {
+        n_lane[l] = (n[l] < ROBUST_COEFFS) ? 0 : n[l];
+        state[l] = 0;
+        status[l] = FAILURE;
+        if (n_lane[l] > max_n)
+            max_n = n_lane[l];
+    }
+    if (max_n == 0)
+        return SUCCESS;
+
+    mark = scratch_mark(arena);
+    tc = scratch_alloc(arena, max_n * stride * sizeof(float));
+    resfac = scratch_alloc(arena, max_n * stride * sizeof(float));
+    r = scratch_alloc(arena, max_n * stride * sizeof(float));
+    abs_r = scratch_alloc(arena, max_n * stride * sizeof(float));
+    wt = scratch_alloc(arena, max_n * stride * sizeof(float));
+    sel = scratch_alloc(arena, max_n * sizeof(float));
+    if ((tc == NULL) || (resfac == NULL) || (r == NULL) ||
+        (abs_r == NULL) || (wt == NULL) || (sel == NULL))
+    {
+        RETURN_ERROR("Allocating fit memory", FUNC_NAME, ERROR);
+    }
+    memset(tc, 0, max_n * stride * sizeof(float));
+    memset(resfac, 0, max_n * stride * sizeof(float));
+    memset(wt, 0, max_n * stride * sizeof(float));
+
+    /* dates relative to the first one, the lower bound on the scale and
+       the leverage of every date; OLS weighs everything alike */
+    for (l = 0; l < lanes; l++)
+    {
+        if (n_lane[l] == 0)
+            continue;
+
+        t_ref[l] = t[l];
+        mean_t = 0.0f;
+        mean_y = 0.0f;
+        for (i = 0; i < n_lane[l]; i++)
+        {
+            p = i * stride + l;
+            tc[p] = (float)(t[p] - t_ref[l]);
+            mean_t += tc[p];
+            mean_y += y[p];
+        }
+        mean_t /= n_lane[l];
+        mean_y /= n_lane[l];
+
+        s_tt[l] = 0.0f;
+        s_yy = 0.0f;
+        for (i = 0; i < n_lane[l]; i++)
+        {
+            p = i * stride + l;
+            dt = tc[p] - mean_t;
+            s_tt[l] += dt * dt;
+            s_yy += (y[p] - mean_y) * (y[p] - mean_y);
+        }
+        if (s_tt[l] <= 0.0f)
+        {
+            n_lane[l] = 0;
+            continue;
+        }
+
+        /* a lower bound on the scale keeps near-perfect fits from
+           flagging everything as an outlier */
+        sig_lower[l] = 1.0e-6f * sqrtf(s_yy / (n_lane[l] - 1));
+        if (sig_lower[l] == 0.0f)
+            sig_lower[l] = 1.0f;
+
+        for (i = 0; i < n_lane[l]; i++)
+        {
+            p = i * stride + l;
+            dt = tc[p] - mean_t;
+            h = 1.0f / n_lane[l] + dt * dt / s_tt[l];
+            if (h > 0.9999f)
+                h = 0.9999f;
+            resfac[p] = 1.0f / sqrtf(1.0f - h);
+            wt[p] = 1.0f;
+        }
+
+        /* median of the absolute residuals past the smallest
+           ROBUST_COEFFS - 1 */
+        m[l] = n_lane[l] - ROBUST_COEFFS + 1;
+        k[l] = ROBUST_COEFFS - 1 + m[l] / 2;
+        state[l] = 1;
+    }
+
+    lane_wls_kernel(tc, y, wt, n_lane, stride, 0, lanes, c0, c1, sum_w, s_tt);
+
+    running = 0;
+    for (l = 0; l < lanes; l++)
+        if (state[l] == 1)
+            running++;
+
+    for (iter = 0; (iter < BISQUARE_MAXITER) && (running > 0); iter++)
+    {
+        lane_residual_kernel(tc, y, resfac, n_lane, stride, 0, lanes, c0, c1,
+                             r, abs_r);
+
+        for (l = 0; l < lanes; l++)
+        {
+            scale[l] = 0.0f;
+            if (state[l] != 1)
+                continue;
+
+            for (i = 0; i < n_lane[l]; i++)
+                sel[i] = abs_r[i * stride + l];
+            select_float(sel, n_lane[l], k[l], &kth, &below);
+            sig = ((m[l] % 2 == 1) ? kth : 0.5f * (below + kth)) / 0.6745f;
+            scale[l] = 1.0f / ((sig > sig_lower[l] ? sig : sig_lower[l]) *
+                               (float)BISQUARE_TUNE);
+        }
+
+        lane_weight_kernel(r, n_lane, max_n, stride, 0, lanes, scale, wt);
+        lane_wls_kernel(tc, y, wt, n_lane, stride, 0, lanes, new_c0, new_c1,
+                        sum_w, s_tt);
+
+        for (l = 0; l < lanes; l++)
+        {
+            if (state[l] != 1)
+                continue;
+
+            if ((sum_w[l] <= 0.0f) || (s_tt[l] <= 0.0f))
+            {
+                state[l] = 0;
+                running--;
+                continue;
+            }
+
+            /* convergence is judged on the intercept at t = 0, as GSL
+               has it */
+            a0 = c0[l] - c1[l] * t_ref[l];
+            a1 = c1[l];
+            c0[l] = new_c0[l];
+            c1[l] = new_c1[l];
+            b0 = c0[l] - c1[l] * t_ref[l];
+            b1 = c1[l];
+
+            if ((fabs(b0 - a0) <= BISQUARE_TOL * fmax(fabs(a0), fabs(b0))) &&
+                (fabs(b1 - a1) <= BISQUARE_TOL * fmax(fabs(a1), fabs(b1))))
+            {
+                state[l] = 2;
+                running--;
+            }
+        }
+    }
+
+    for (l = 0; l < lanes; l++)
+    {
+        if (state[l] == 0)
+            continue;
+        coefs[2 * l] = (float)((double)c0[l] - (double)c1[l] * t_ref[l]);
+        coefs[2 * l + 1] = c1[l];
+        status[l] = SUCCESS;
+    }
+
+    scratch_release(arena, mark);
+
+    return SUCCESS;
+}
+
+/******************************************************************************
+MODULE:  bisquare_fit_2param
+
+PURPOSE:  Robust fit of y = c0 + c1 * t for one series
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           error allocating memory
+FAILURE         the weighted system is singular; use the GSL path
+SUCCESS         no error encountered
+
+NOTES: one lane of bisquare_fit_lanes, so a pixel fitted alone and in a
+       batch gets the same coefficients
+******************************************************************************/
+int bisquare_fit_2param
+(
+    const float *t,           /* I: dates of the observations                 */
+    const float *y,           /* I: values of the observations                */
+    int n,                    /* I: number of observations                    */
+    float *coefs,             /* O: intercept and slope                       */
+    scratch_arena_t *arena    /* I/O: per-pixel scratch memory                */
+)
+{
+    int status;
+
+    if (bisquare_fit_lanes(t, y, &n, 1, 1, coefs, &status, arena) != SUCCESS)
+        return ERROR;
+
+    return status;
+}
+
+/******************************************************************************
+MODULE:  robust_fit_isa_name
+
+PURPOSE:  Name of the kernels the lane fits dispatch to, for logging
+
+RETURN VALUE:
+Type = const char *
+Value           Description
+-----           -----------
+name            "avx2" or "scalar"
+******************************************************************************/
+const char *robust_fit_isa_name(void)
+{
+    pthread_once(&fit_once, init_fit_dispatch);
+
+    return fit_isa;
+}
@@ -0,0 +1,48 @@
+#ifndef ROBUST_FIT_H
+#define ROBUST_FIT_H
+
+#include "scratch.h"
+
+/* settings of the vendored gsl_multifit_robust with the bisquare weights */
+#define BISQUARE_TUNE 4.685
+#define BISQUARE_MAXITER 5
+#define BISQUARE_TOL 1.4901161193847656e-08 /* GSL_SQRT_DBL_EPSILON   */
+
+/* series fitted side by side by bisquare_fit_lanes */
+#define FIT_LANES 16
+
+/* Tolerance against GSL, checked by test/test_robust_fit.c (make check):
+   on 200k synthetic series (5-125 dates, noise and 10% outliers) the
+   fitted values at the ends of a series differ from gsl_multifit_robust
+   by less than 0.02 DN on average, by at most 0.5 DN in 99.6% of cases
+   and never by more than 10 DN.  The larger differences are in series of
+   5-8 dates, whose MAD scale rests on a few residuals that single
+   precision rounds.  An observation on the bisquare cutoff moves little,
+   as its weight goes to 0 smoothly, and series without outliers agree
+   within 0.01 DN. */
+
+int bisquare_fit_lanes
+(
+    const float *t,           /* I: dates, observation i of lane l at
+                                    i * stride + l, max(n) rows               */
+    const float *y,           /* I: values, laid out as t                     */
+    const int *n,             /* I: number of observations of every lane      */
+    int lanes,                /* I: lanes in use, at most FIT_LANES           */
+    int stride,               /* I: distance between observations, >= lanes   */
+    float *coefs,             /* O: intercept and slope of lane l at 2l, 2l+1 */
+    int *status,              /* O: SUCCESS or FAILURE of every lane          */
+    scratch_arena_t *arena    /* I/O: per-pixel scratch memory                */
+);
+
+int bisquare_fit_2param
+(
+    const float *t,           /* I: dates of the observations                 */
+    const float *y,           /* I: values of the observations                */
+    int n,                    /* I: number of observations                    */
+    float *coefs,             /* O: intercept and slope                       */
+    scratch_arena_t *arena    /* I/O: per-pixel scratch memory                */
+);
+
+const char *robust_fit_isa_name(void);
+
+#endif // ROBUST_FIT_H
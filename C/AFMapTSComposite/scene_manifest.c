@@ -0,0 +1,489 @@
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "scene_manifest.h"
+#include "input_gdal.h"
+#include "utilities.h"
+#include "const.h"
+
+#define SCENE_LIST_FILENAME "scene_list.txt"
+
+/******************************************************************************
+MODULE:  mtime_ns
+
+PURPOSE:  Modification time of a stat result in nanoseconds
+
+RETURN VALUE:
+Type = long long
+Value           Description
+-----           -----------
+ns              st_mtim as nanoseconds since the epoch
+******************************************************************************/
+static long long mtime_ns
+(
+    struct stat *st           /* I: stat result                             */
+)
+{
+    return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+/******************************************************************************
+MODULE:  list_scene_names
+
+PURPOSE:  List the scenes of an ARD directory: the names of scene_list.txt if
+          there is one, otherwise every file but the headers and the list
+          and manifest files themselves
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the directory or list cannot be read, or has too many scenes
+SUCCESS         No errors encountered
+******************************************************************************/
+static int list_scene_names
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char **scene_list,        /* O: scene names in listing order            */
+    int *num_scenes           /* O: number of scenes                        */
+)
+{
+    DIR *dirp;
+    struct dirent *dp;
+    FILE *fd;
+    int n = 0;
+    int len;
+    char tmpstr[MAX_STR_LEN];
+    char filename[MAX_STR_LEN];
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "list_scene_names";
+
+    sprintf(filename, "%s/%s", in_path, SCENE_LIST_FILENAME);
+    fd = fopen(filename, "r");
+    if (fd != NULL)
+    {
+        while ((n < MAX_SCENE_LIST) && (fscanf(fd, "%s", tmpstr) != EOF))
+        {
+            if (strlen(tmpstr) >= ARD_STR_LEN)
+            {
+                fclose(fd);
+                sprintf(errmsg, "Scene name %s is too long", tmpstr);
+                RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+            }
+            strcpy(scene_list[n++], tmpstr);
+        }
+        fclose(fd);
+        *num_scenes = n;
+        return (SUCCESS);
+    }
+
+    dirp = opendir(in_path);
+    if (dirp == NULL)
+    {
+        sprintf(errmsg, "Opening ARD directory %s", in_path);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    while ((dp = readdir(dirp)) != NULL)
+    {
+        if ((strcmp(dp->d_name, ".") == 0) || (strcmp(dp->d_name, "..") == 0)
+            || (strncmp(dp->d_name, MANIFEST_FILENAME, strlen(MANIFEST_FILENAME)) == 0))
+            continue;
+
+        len = strlen(dp->d_name);
+        if ((len >= 3) && (strcmp(dp->d_name + len - 3, "hdr") == 0))
+            continue;
+
+        if ((n == MAX_SCENE_LIST) || (len >= ARD_STR_LEN))
+        {
+            closedir(dirp);
+            sprintf(errmsg, "More than %d scenes or scene name %s too long",
+                    MAX_SCENE_LIST, dp->d_name);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+        strcpy(scene_list[n++], dp->d_name);
+    }
+    closedir(dirp);
+
+    *num_scenes = n;
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  load_manifest
+
+PURPOSE:  Read the manifest with a single read and check it still describes
+          the directory: same reader, same directory and list mtimes, and
+          every scene with the size and mtime it was built with
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+FAILURE         no manifest, or a stale one that has to be rebuilt
+SUCCESS         entries hold the valid manifest
+******************************************************************************/
+static int load_manifest
+(
+    char *in_path,            /* I: ARD image directory                     */
+    int reader_format,        /* I: TRUE if scenes are read with GDAL       */
+    manifest_entry_t **entries, /* O: scenes, allocated here                */
+    int *num_scenes           /* O: number of scenes                        */
+)
+{
+    FILE *fp;
+    struct stat st;
+    char *buf;
+    manifest_header_t *header;
+    manifest_entry_t *entry;
+    long long list_mtime = 0;
+    int i;
+    char filename[MAX_STR_LEN];
+
+    sprintf(filename, "%s/%s", in_path, MANIFEST_FILENAME);
+    fp = fopen(filename, "rb");
+    if (fp == NULL)
+        return (FAILURE);
+
+    if ((fstat(fileno(fp), &st) != 0) || (st.st_size < (off_t)sizeof(manifest_header_t)))
+    {
+        fclose(fp);
+        return (FAILURE);
+    }
+
+    buf = (char *)malloc(st.st_size);
+    if ((buf == NULL) || (fread(buf, 1, st.st_size, fp) != (size_t)st.st_size))
+    {
+        free(buf);
+        fclose(fp);
+        return (FAILURE);
+    }
+    fclose(fp);
+
+    header = (manifest_header_t *)buf;
+    entry = (manifest_entry_t *)(buf + sizeof(manifest_header_t));
+    if ((memcmp(header->magic, MANIFEST_MAGIC, 8) != 0)
+        || (header->version != MANIFEST_VERSION)
+        || (header->reader_format != reader_format)
+        || (header->num_scenes < 1) || (header->num_scenes > MAX_SCENE_LIST)
+        || (st.st_size != (off_t)(sizeof(manifest_header_t)
+                                  + header->num_scenes * sizeof(manifest_entry_t))))
+    {
+        free(buf);
+        return (FAILURE);
+    }
+
+    /* a scene added or removed changes the directory mtime */
+    if ((stat(in_path, &st) != 0) || (mtime_ns(&st) != header->dir_mtime))
+    {
+        free(buf);
+        return (FAILURE);
+    }
+
+    sprintf(filename, "%s/%s", in_path, SCENE_LIST_FILENAME);
+    if (stat(filename, &st) == 0)
+        list_mtime = mtime_ns(&st);
+    if (list_mtime != header->list_mtime)
+    {
+        free(buf);
+        return (FAILURE);
+    }
+
+    for (i = 0; i < header->num_scenes; i++)
+    {
+        sprintf(filename, "%s/%s", in_path, entry[i].name);
+        if ((stat(filename, &st) != 0) || ((long long)st.st_size != entry[i].file_size)
+            || (mtime_ns(&st) != entry[i].mtime))
+        {
+            free(buf);
+            return (FAILURE);
+        }
+    }
+
+    *num_scenes = header->num_scenes;
+    *entries = (manifest_entry_t *)malloc(*num_scenes * sizeof(manifest_entry_t));
+    if (*entries == NULL)
+    {
+        free(buf);
+        return (FAILURE);
+    }
+    memcpy(*entries, entry, *num_scenes * sizeof(manifest_entry_t));
+    free(buf);
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  build_manifest
+
+PURPOSE:  Describe every scene of the directory from its header (or GDAL
+          dataset), check that all of them match the first, and save the
+          result as the manifest of the directory
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           a scene cannot be described or does not match the first one
+SUCCESS         No errors encountered
+
+NOTES: scene_list and sdate are used as scratch and hold the sorted scenes
+       on return. Not being able to save the manifest (read-only ARD, say)
+       is only a warning. A scene must also have the geotransform and the
+       projection (UTM zone of the ENVI header, WKT of a GDAL dataset) of
+       the first one: the readers take pixel (i, j) of every scene as the
+       same ground, and the output gets the projection of the first scene.
+******************************************************************************/
+static int build_manifest
+(
+    char *in_path,            /* I: ARD image directory                     */
+    int reader_format,        /* I: TRUE if scenes are read with GDAL       */
+    char **scene_list,        /* O: scene names sorted by date              */
+    int *sdate,               /* O: julian date of every scene              */
+    manifest_entry_t **entries, /* O: scenes, allocated here                */
+    int *num_scenes           /* O: number of scenes                        */
+)
+{
+    int i;
+    int n;
+    FILE *fp;
+    struct stat st;
+    input_meta_t m;
+    manifest_header_t header;
+    manifest_entry_t *e;
+    long long expected;
+    char *wkt_first = NULL;
+    char *wkt;
+    char filename[MAX_STR_LEN];
+    char tmp_filename[MAX_STR_LEN];
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "build_manifest";
+
+    if (list_scene_names(in_path, scene_list, &n) != SUCCESS)
+        RETURN_ERROR("Listing the scenes", FUNC_NAME, ERROR);
+    if (n == 0)
+        RETURN_ERROR("No scene in the ARD directory", FUNC_NAME, ERROR);
+
+    if (sort_scene_based_on_year_doy_row(scene_list, n, sdate) != SUCCESS)
+        RETURN_ERROR("Calling sort_scene_based_on_year_doy_row", FUNC_NAME, ERROR);
+
+    e = (manifest_entry_t *)calloc(n, sizeof(manifest_entry_t));
+    if (e == NULL)
+        RETURN_ERROR("Allocating manifest memory", FUNC_NAME, ERROR);
+
+    for (i = 0; i < n; i++)
+    {
+        if (((reader_format) ? read_gdal_meta(in_path, scene_list[i], &m)
+                             : read_envi_header(in_path, scene_list[i], &m)) != SUCCESS)
+        {
+            free(wkt_first);
+            free(e);
+            sprintf(errmsg, "Reading the metadata of %s", scene_list[i]);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        sprintf(filename, "%s/%s", in_path, scene_list[i]);
+        if (stat(filename, &st) != 0)
+        {
+            free(wkt_first);
+            free(e);
+            sprintf(errmsg, "Scene %s does not exist", filename);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        strcpy(e[i].name, scene_list[i]);
+        e[i].sdate = sdate[i];
+        e[i].lines = m.lines;
+        e[i].samples = m.samples;
+        e[i].data_type = m.data_type;
+        e[i].byte_order = m.byte_order;
+        e[i].utm_zone = m.utm_zone;
+        e[i].bands = m.bands;
+        e[i].geotransform[0] = m.upper_left_x;
+        e[i].geotransform[1] = m.pixel_size;
+        e[i].geotransform[3] = m.upper_left_y;
+        e[i].geotransform[5] = -m.pixel_size;
+        e[i].file_size = (long long)st.st_size;
+        e[i].mtime = mtime_ns(&st);
+
+        if ((e[i].lines != e[0].lines) || (e[i].samples != e[0].samples)
+            || (e[i].bands != e[0].bands)
+            || (e[i].data_type != e[0].data_type) || (e[i].byte_order != e[0].byte_order))
+        {
+            sprintf(errmsg, "Scene %s is %dx%dx%d, type %d, byte order %d; %s is "
+                    "%dx%dx%d, type %d, byte order %d", scene_list[i], e[i].samples,
+                    e[i].lines, e[i].bands, e[i].data_type, e[i].byte_order,
+                    scene_list[0], e[0].samples, e[0].lines, e[0].bands,
+                    e[0].data_type, e[0].byte_order);
+            free(wkt_first);
+            free(e);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        if ((e[i].utm_zone != e[0].utm_zone)
+            || (memcmp(e[i].geotransform, e[0].geotransform, sizeof(e[0].geotransform)) != 0))
+        {
+            sprintf(errmsg, "Scene %s has upper left (%.0f, %.0f), pixel size %.0f, "
+                    "UTM zone %d; %s has (%.0f, %.0f), %.0f, zone %d", scene_list[i],
+                    e[i].geotransform[0], e[i].geotransform[3], e[i].geotransform[1],
+                    e[i].utm_zone, scene_list[0], e[0].geotransform[0],
+                    e[0].geotransform[3], e[0].geotransform[1], e[0].utm_zone);
+            free(wkt_first);
+            free(e);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+
+        if (reader_format)
+        {
+            wkt = read_gdal_projection(in_path, scene_list[i]);
+            if (wkt == NULL)
+            {
+                free(wkt_first);
+                free(e);
+                sprintf(errmsg, "Reading the projection of %s", scene_list[i]);
+                RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+            }
+            if (i == 0)
+            {
+                wkt_first = wkt;
+            }
+            else
+            {
+                if (strcmp(wkt, wkt_first) != 0)
+                {
+                    sprintf(errmsg, "Scene %s is not in the projection of %s",
+                            scene_list[i], scene_list[0]);
+                    free(wkt);
+                    free(wkt_first);
+                    free(e);
+                    RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+                }
+                free(wkt);
+            }
+        }
+
+        /* raw BIP scenes are read by offset, so a short one fails mid-run */
+        expected = (long long)e[i].lines * e[i].samples * e[i].bands * sizeof(short int);
+        if (!reader_format && (e[i].file_size != expected))
+        {
+            sprintf(errmsg, "Scene %s has %lld bytes instead of %lld", scene_list[i],
+                    e[i].file_size, expected);
+            free(wkt_first);
+            free(e);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+    }
+
+    free(wkt_first);
+    *entries = e;
+    *num_scenes = n;
+
+    /* save under a temporary name, so a concurrent run never reads half of it */
+    memset(&header, 0, sizeof(manifest_header_t));
+    memcpy(header.magic, MANIFEST_MAGIC, 8);
+    header.version = MANIFEST_VERSION;
+    header.num_scenes = n;
+    header.reader_format = reader_format;
+    sprintf(filename, "%s/%s", in_path, SCENE_LIST_FILENAME);
+    if (stat(filename, &st) == 0)
+        header.list_mtime = mtime_ns(&st);
+
+    sprintf(filename, "%s/%s", in_path, MANIFEST_FILENAME);
+    sprintf(tmp_filename, "%s.%d.tmp", filename, (int)getpid());
+    fp = fopen(tmp_filename, "wb");
+    if ((fp == NULL)
+        || (fwrite(&header, sizeof(manifest_header_t), 1, fp) != 1)
+        || (fwrite(e, sizeof(manifest_entry_t), n, fp) != (size_t)n)
+        || (fclose(fp) != 0) || (rename(tmp_filename, filename) != 0))
+    {
+        unlink(tmp_filename);
+        WARNING_MESSAGE("Saving the scene manifest failed, it is rebuilt next run",
+                        FUNC_NAME);
+        return (SUCCESS);
+    }
+
+    /* the rename changed the directory mtime; record the new one in place,
+       which leaves the directory untouched */
+    fp = fopen(filename, "r+b");
+    if ((fp != NULL) && (stat(in_path, &st) == 0))
+    {
+        header.dir_mtime = mtime_ns(&st);
+        fwrite(&header, sizeof(manifest_header_t), 1, fp);
+    }
+    if (fp != NULL)
+        fclose(fp);
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  read_scene_manifest
+
+PURPOSE:  Get the sorted scene list, dates and shared metadata of an ARD
+          directory from its manifest, building the manifest first if it is
+          missing or stale
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the manifest cannot be built
+SUCCESS         No errors encountered
+
+NOTES: replaces reading scene_list.txt, sorting the names by date and parsing
+       the header of the first scene on every run; a scene_list.txt in the
+       directory still selects the scenes when the manifest is built
+******************************************************************************/
+int read_scene_manifest
+(
+    char *in_path,            /* I: ARD image directory                     */
+    int reader,               /* I: reader of the run options               */
+    char **scene_list,        /* O: scene names sorted by date              */
+    int *sdate,               /* O: julian date of every scene              */
+    int *num_scenes,          /* O: number of scenes                        */
+    input_meta_t *meta        /* O: metadata shared by all scenes           */
+)
+{
+    int i;
+    int reader_format = (reader == READER_GDAL) ? TRUE : FALSE;
+    manifest_entry_t *entries = NULL;
+    char msg_str[MAX_STR_LEN];
+    char FUNC_NAME[] = "read_scene_manifest";
+
+    if (load_manifest(in_path, reader_format, &entries, num_scenes) == SUCCESS)
+    {
+        for (i = 0; i < *num_scenes; i++)
+        {
+            strcpy(scene_list[i], entries[i].name);
+            sdate[i] = entries[i].sdate;
+        }
+        sprintf(msg_str, "scene manifest loaded, %d scenes\n", *num_scenes);
+    }
+    else
+    {
+        if (build_manifest(in_path, reader_format, scene_list, sdate, &entries,
+                           num_scenes) != SUCCESS)
+            RETURN_ERROR("Building the scene manifest", FUNC_NAME, ERROR);
+        sprintf(msg_str, "scene manifest built, %d scenes\n", *num_scenes);
+    }
+    LOG_MESSAGE(msg_str, FUNC_NAME);
+
+    meta->lines = entries[0].lines;
+    meta->samples = entries[0].samples;
+    meta->bands = entries[0].bands;
+    meta->data_type = entries[0].data_type;
+    meta->byte_order = entries[0].byte_order;
+    meta->utm_zone = entries[0].utm_zone;
+    meta->pixel_size = (int)entries[0].geotransform[1];
+    meta->upper_left_x = (int)entries[0].geotransform[0];
+    meta->upper_left_y = (int)entries[0].geotransform[3];
+    strcpy(meta->interleave, "bip");
+
+    free(entries);
+
+    return (SUCCESS);
+}
@@ -0,0 +1,47 @@
+#ifndef SCENE_MANIFEST_H
+#define SCENE_MANIFEST_H
+
+#include "input.h"
+#include "const.h"
+
+#define MANIFEST_FILENAME "scene_manifest.bin"
+#define MANIFEST_MAGIC "AFTSSCNM"
+#define MANIFEST_VERSION 3
+
+/* binary scene manifest kept in the ARD directory:
+   manifest_header_t, then one manifest_entry_t per scene in date order */
+typedef struct {
+    char magic[8];            /* MANIFEST_MAGIC, not terminated             */
+    int version;              /* MANIFEST_VERSION                           */
+    int num_scenes;           /* number of entries                          */
+    int reader_format;        /* TRUE if built from GDAL datasets           */
+    int reserved;
+    long long dir_mtime;      /* ARD directory mtime (ns) when built        */
+    long long list_mtime;     /* scene_list.txt mtime (ns), 0 if none       */
+} manifest_header_t;
+
+typedef struct {
+    char name[ARD_STR_LEN];   /* scene file name                            */
+    int sdate;                /* julian date counted from year 0000         */
+    int lines;                /* number of lines                            */
+    int samples;              /* number of samples                          */
+    int data_type;            /* envi data type                             */
+    int byte_order;           /* envi byte order                            */
+    int utm_zone;             /* UTM zone, 0 if unknown                     */
+    int bands;                /* bands of the scene, the mask included      */
+    double geotransform[6];   /* GDAL-style geotransform                    */
+    long long file_size;      /* bytes of the scene file                    */
+    long long mtime;          /* mtime (ns) of the scene file               */
+} manifest_entry_t;
+
+int read_scene_manifest
+(
+    char *in_path,            /* I: ARD image directory                     */
+    int reader,               /* I: reader of the run options               */
+    char **scene_list,        /* O: scene names sorted by date              */
+    int *sdate,               /* O: julian date of every scene              */
+    int *num_scenes,          /* O: number of scenes                        */
+    input_meta_t *meta        /* O: metadata shared by all scenes           */
+);
+
+#endif // SCENE_MANIFEST_H
@@ -0,0 +1,175 @@
+#include <stdlib.h>
+
+#include "scratch.h"
+#include "utilities.h"
+#include "const.h"
+
+/******************************************************************************
+MODULE:  scratch_init
+
+PURPOSE:  Allocate the block of an arena, large enough for the kernels of a
+          method on a pixel with num_scenes observations
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           memory allocation failed
+SUCCESS         No errors encountered
+******************************************************************************/
+int scratch_init
+(
+    scratch_arena_t *arena,   /* O: arena                                   */
+    int num_scenes,           /* I: longest series a pixel can have         */
+    int bytes_per_scene       /* I: what the method needs per observation   */
+)
+{
+    char FUNC_NAME[] = "scratch_init";
+
+    arena->size = (size_t)num_scenes * bytes_per_scene + SCRATCH_FIXED_BYTES;
+    arena->used = 0;
+    arena->high_water = 0;
+    if (posix_memalign((void **)&arena->base, SCRATCH_ALIGN, arena->size) != 0)
+    {
+        arena->base = NULL;
+        arena->size = 0;
+        RETURN_ERROR("Allocating scratch arena memory", FUNC_NAME, ERROR);
+    }
+
+    return (SUCCESS);
+}
+
+/******************************************************************************
+MODULE:  scratch_alloc
+
+PURPOSE:  Hand out an aligned piece of the arena
+
+RETURN VALUE:
+Type = void *
+Value           Description
+-----           -----------
+NULL            the arena is exhausted
+pointer         SCRATCH_ALIGN aligned, uninitialised memory
+******************************************************************************/
+void *scratch_alloc
+(
+    scratch_arena_t *arena,   /* I/O: arena                                 */
+    size_t bytes              /* I:   bytes wanted                          */
+)
+{
+    size_t start = (arena->used + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+
+    if (start + bytes > arena->size)
+        return NULL;
+
+    arena->used = start + bytes;
+    if (arena->used > arena->high_water)
+        arena->high_water = arena->used;
+
+    return arena->base + start;
+}
+
+/******************************************************************************
+MODULE:  scratch_alloc_2d
+
+PURPOSE:  Scratch counterpart of allocate_2d_array: row pointers followed by
+          one contiguous block of rows x columns members
+
+RETURN VALUE:
+Type = void **
+Value           Description
+-----           -----------
+NULL            the arena is exhausted
+pointer         array of row pointers; nothing to free
+******************************************************************************/
+void **scratch_alloc_2d
+(
+    scratch_arena_t *arena,   /* I/O: arena                                 */
+    int rows,                 /* I:   number of rows                        */
+    int columns,              /* I:   number of columns                     */
+    size_t member_size        /* I:   size of an element                    */
+)
+{
+    int i;
+    void **row_ptr;
+    char *block;
+
+    row_ptr = (void **)scratch_alloc(arena, rows * sizeof(void *));
+    block = (char *)scratch_alloc(arena, (size_t)rows * columns * member_size);
+    if ((row_ptr == NULL) || (block == NULL))
+        return NULL;
+
+    for (i = 0; i < rows; i++)
+        row_ptr[i] = block + (size_t)i * columns * member_size;
+
+    return row_ptr;
+}
+
+/******************************************************************************
+MODULE:  scratch_mark
+
+PURPOSE:  Remember how much of the arena is in use, to give back everything
+          allocated after this point with scratch_release
+
+RETURN VALUE:
+Type = size_t
+Value           Description
+-----           -----------
+mark            bytes in use
+******************************************************************************/
+size_t scratch_mark
+(
+    scratch_arena_t *arena    /* I: arena                                   */
+)
+{
+    return arena->used;
+}
+
+/******************************************************************************
+MODULE:  scratch_release
+
+PURPOSE:  Give back everything allocated since a mark
+
+RETURN VALUE: None
+******************************************************************************/
+void scratch_release
+(
+    scratch_arena_t *arena,   /* I/O: arena                                 */
+    size_t mark               /* I:   value of scratch_mark to go back to   */
+)
+{
+    arena->used = mark;
+}
+
+/******************************************************************************
+MODULE:  scratch_reset
+
+PURPOSE:  Give back the whole arena, before the next pixel
+
+RETURN VALUE: None
+******************************************************************************/
+void scratch_reset
+(
+    scratch_arena_t *arena    /* I/O: arena                                 */
+)
+{
+    arena->used = 0;
+}
+
+/******************************************************************************
+MODULE:  scratch_free
+
+PURPOSE:  Free the block of an arena
+
+RETURN VALUE: None
+******************************************************************************/
+void scratch_free
+(
+    scratch_arena_t *arena    /* I/O: arena                                 */
+)
+{
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <stddef.h>
+
+/* scratch memory the fitting methods declare: a batch of
+   fitting_compositing_lanes holds about 1.5 KB per observation at its
+   deepest call, a single pixel about 150 bytes */
+#define SCRATCH_BYTES_PER_SCENE 2048
+#define SCRATCH_FIXED_BYTES 16384
+#define SCRATCH_ALIGN 32
+
+/* bump allocator reset for every pixel; each compositing thread owns one,
+   so the per-pixel kernels make no heap calls */
+typedef struct {
+    char *base;               /* one block, allocated when sized            */
+    size_t size;              /* bytes in the block                         */
+    size_t used;              /* bytes handed out since the last reset      */
+    size_t high_water;        /* largest used seen, for sizing checks       */
+} scratch_arena_t;
+
+int scratch_init
+(
+    scratch_arena_t *arena,   /* O: arena                                   */
+    int num_scenes,           /* I: longest series a pixel can have         */
+    int bytes_per_scene       /* I: what the method needs per observation   */
+);
+
+void *scratch_alloc
+(
+    scratch_arena_t *arena,   /* I/O: arena                                 */
+    size_t bytes              /* I:   bytes wanted                          */
+);
+
+void **scratch_alloc_2d
+(
+    scratch_arena_t *arena,   /* I/O: arena                                 */
+    int rows,                 /* I:   number of rows                        */
+    int columns,              /* I:   number of columns                     */
+    size_t member_size        /* I:   size of an element                    */
+);
+
+size_t scratch_mark
+(
+    scratch_arena_t *arena    /* I: arena                                   */
+);
+
+void scratch_release
+(
+    scratch_arena_t *arena,   /* I/O: arena                                 */
+    size_t mark               /* I:   value of scratch_mark to go back to   */
+);
+
+void scratch_reset
+(
+    scratch_arena_t *arena    /* I/O: arena                                 */
+);
+
+void scratch_free
+(
+    scratch_arena_t *arena    /* I/O: arena                                 */
+);
+
+#endif // SCRATCH_H
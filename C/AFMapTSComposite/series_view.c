@@ -0,0 +1,75 @@
+#include "series_view.h"
+#include "band_layout.h"
+
+/******************************************************************************
+MODULE:  first_date_above
+
+PURPOSE:  Index of the first date greater than the given one, by binary
+          search
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+index           0 to count, count when no date is greater
+******************************************************************************/
+static int first_date_above
+(
+    const int *dates,
+    int count,
+    int date
+)
+{
+    int lo = 0;
+    int hi = count;
+    int mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (dates[mid] > date)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return lo;
+}
+
+/******************************************************************************
+MODULE:  series_view_window
+
+PURPOSE:  Find the observations of a pixel inside [lower_ordinal,
+          upper_ordinal] and point the view at them
+
+RETURN VALUE: None
+
+NOTES: the same observations the linear scans with
+       date > lower_ordinal - 1 && date < upper_ordinal + 1 keep, in the
+       same order; nothing is copied
+******************************************************************************/
+void series_view_window
+(
+    short int **buf,          /* I: band series of one pixel                  */
+    int *valid_date_array,    /* I: sorted date of every observation          */
+    int valid_date_count,     /* I: number of observations                    */
+    int lower_ordinal,        /* I: first date of the window                  */
+    int upper_ordinal,        /* I: last date of the window                   */
+    series_view_t *view       /* O: the window span                           */
+)
+{
+    int b;
+    int end;
+    int image_bands = get_band_layout()->image_bands;
+
+    view->first = first_date_above(valid_date_array, valid_date_count,
+                                   lower_ordinal - 1);
+    end = first_date_above(valid_date_array, valid_date_count, upper_ordinal);
+    view->count = (end > view->first) ? end - view->first : 0;
+
+    view->dates = valid_date_array + view->first;
+    for (b = 0; b < image_bands; b++)
+    {
+        view->band[b] = buf[b] + view->first;
+    }
+}
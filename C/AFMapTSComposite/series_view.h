@@ -0,0 +1,27 @@
+#ifndef SERIES_VIEW_H
+#define SERIES_VIEW_H
+
+#include "const.h"
+
+/* the observations of a pixel inside the compositing window; the dates of
+   a pixel follow the sorted scene dates, so the window is one contiguous
+   span of every band series and the view only points into them */
+typedef struct
+{
+    short int *band[MAX_IMAGE_BANDS]; /* first window value of every band */
+    int *dates;               /* date of every window observation           */
+    int first;                /* index of the first one in the full series  */
+    int count;                /* number of window observations              */
+} series_view_t;
+
+void series_view_window
+(
+    short int **buf,          /* I: band series of one pixel                  */
+    int *valid_date_array,    /* I: sorted date of every observation          */
+    int valid_date_count,     /* I: number of observations                    */
+    int lower_ordinal,        /* I: first date of the window                  */
+    int upper_ordinal,        /* I: last date of the window                   */
+    series_view_t *view       /* O: the window span                           */
+);
+
+#endif // SERIES_VIEW_H
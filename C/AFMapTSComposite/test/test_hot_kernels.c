@@ -0,0 +1,260 @@
+/******************************************************************************
+Agreement test of the HOT weighting kernels: the AVX2 and AVX-512 kernels
+against the scalar reference, on random series of 3-600 observations, for
+both band layouts. A composite band may differ from the reference by 1 DN,
+as the vector kernels sum in single precision.
+
+Run with 'make check'. Kernels the running CPU does not support are skipped.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+
+/* the kernel instances are static, the test is built with them */
+#include "hot_kernels.c"
+
+#define TEST_SERIES 20000     /* random series per band layout              */
+#define TEST_MIN_OBS 3
+#define TEST_MAX_OBS 600
+#define TEST_MAX_DN_DIFF 1
+#define TEST_SEED 7
+
+/* the kernels of one ISA, [0] 4-band and [1] 8-band */
+typedef struct {
+    const char *name;
+    hot_kernel_t hot[2];
+    modified_hot_kernel_t modified_hot[2];
+    int supported;
+} kernel_set_t;
+
+/******************************************************************************
+MODULE:  composite_dn
+
+PURPOSE:  The composite bands hot_compositing and modified_hot_compositing
+          make from the sums
+
+RETURN VALUE: None
+******************************************************************************/
+static void composite_dn
+(
+    double *index_sum,        /* I: weighted sum of every band              */
+    double wt_sum,            /* I: sum of the weights                      */
+    int image_bands,          /* I: bands of the layout                     */
+    short int *dn             /* O: composite of every band                 */
+)
+{
+    int j;
+
+    for (j = 0; j < image_bands; j++)
+        dn[j] = (short int)(index_sum[j] / wt_sum);
+}
+
+/******************************************************************************
+MODULE:  random_series
+
+PURPOSE:  Fill a pixel series with reflectances, dates 8 days apart and a
+          window over part of it
+
+RETURN VALUE: None
+
+NOTES: blue is never half of red, so no HOT weight divides by zero
+******************************************************************************/
+static void random_series
+(
+    short int **buf,          /* O: band series                             */
+    int *dates,               /* O: date of every observation               */
+    int n_obs,                /* I: observations                            */
+    int image_bands,          /* I: bands of the layout                     */
+    int blue,                 /* I: blue band of the layout                 */
+    int red,                  /* I: red band of the layout                  */
+    int nir,                  /* I: nir band of the layout                  */
+    int *lower_ordinal,       /* O: first date of the window                */
+    int *upper_ordinal,       /* O: last date of the window                 */
+    short int *medium_shadow  /* O: a nir value of the series               */
+)
+{
+    int i, j;
+
+    for (i = 0; i < n_obs; i++)
+    {
+        for (j = 0; j < image_bands; j++)
+            buf[j][i] = (short int)(rand() % 5000);
+        buf[blue][i] = (short int)(50 + rand() % 3000);
+        buf[nir][i] = (short int)(100 + rand() % 6000);
+        if (buf[red][i] == 2 * buf[blue][i])
+            buf[red][i]++;
+        dates[i] = 736000 + 8 * i;
+    }
+    *lower_ordinal = 736000 + rand() % (8 * n_obs);
+    *upper_ordinal = *lower_ordinal + rand() % 2000;
+    *medium_shadow = buf[nir][rand() % n_obs];
+}
+
+/******************************************************************************
+MODULE:  compare_bands
+
+PURPOSE:  Count the bands off the reference and keep the largest difference
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+n               bands more than TEST_MAX_DN_DIFF off the reference
+******************************************************************************/
+static int compare_bands
+(
+    short int *ref,           /* I: composite of the scalar kernel          */
+    short int *dn,            /* I: composite of the kernel under test      */
+    int image_bands,          /* I: bands of the layout                     */
+    int *max_diff             /* I/O: largest difference so far             */
+)
+{
+    int j, diff;
+    int n_bad = 0;
+
+    for (j = 0; j < image_bands; j++)
+    {
+        diff = abs(dn[j] - ref[j]);
+        if (diff > *max_diff)
+            *max_diff = diff;
+        if (diff > TEST_MAX_DN_DIFF)
+            n_bad++;
+    }
+
+    return n_bad;
+}
+
+int main(void)
+{
+    int t, k, j, n_obs;
+    int sd8, image_bands, blue, red, nir;
+    int lower_ordinal, upper_ordinal;
+    int count_ref, count;
+    int n_sets = 0;
+    int n_bad = 0;
+    long n_compared = 0;
+    int max_diff = 0;
+    double index_sum[MAX_IMAGE_BANDS];
+    double wt_sum;
+    short int ref[MAX_IMAGE_BANDS];
+    short int dn[MAX_IMAGE_BANDS];
+    short int medium_shadow;
+    short int *buf[MAX_IMAGE_BANDS];
+    int dates[TEST_MAX_OBS];
+    kernel_set_t sets[2];
+
+#ifdef HOT_X86_SIMD
+    __builtin_cpu_init();
+    sets[n_sets].name = "avx2";
+    sets[n_sets].hot[0] = hot_sums_avx2_4;
+    sets[n_sets].hot[1] = hot_sums_avx2_8;
+    sets[n_sets].modified_hot[0] = modified_hot_sums_avx2_4;
+    sets[n_sets].modified_hot[1] = modified_hot_sums_avx2_8;
+    sets[n_sets].supported = __builtin_cpu_supports("avx2");
+    n_sets++;
+    sets[n_sets].name = "avx512";
+    sets[n_sets].hot[0] = hot_sums_avx512_4;
+    sets[n_sets].hot[1] = hot_sums_avx512_8;
+    sets[n_sets].modified_hot[0] = modified_hot_sums_avx512_4;
+    sets[n_sets].modified_hot[1] = modified_hot_sums_avx512_8;
+    sets[n_sets].supported = __builtin_cpu_supports("avx512f");
+    n_sets++;
+#endif
+
+    for (k = 0; k < n_sets; k++)
+        printf("%s kernels: %s\n", sets[k].name,
+               sets[k].supported ? "tested" : "not supported by this CPU, skipped");
+
+    for (j = 0; j < MAX_IMAGE_BANDS; j++)
+    {
+        buf[j] = (short int *)malloc(TEST_MAX_OBS * sizeof(short int));
+        if (buf[j] == NULL)
+        {
+            printf("FAILED: allocating the series\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    srand(TEST_SEED);
+    for (sd8 = 0; sd8 < 2; sd8++)
+    {
+        image_bands = sd8 ? SD8_IMAGE_BANDS : PS4_IMAGE_BANDS;
+        blue = sd8 ? SD8_BLUE : PS4_BLUE;
+        red = sd8 ? SD8_RED : PS4_RED;
+        nir = sd8 ? SD8_NIR : PS4_NIR;
+
+        for (t = 0; t < TEST_SERIES; t++)
+        {
+            n_obs = TEST_MIN_OBS + rand() % (TEST_MAX_OBS - TEST_MIN_OBS + 1);
+            random_series(buf, dates, n_obs, image_bands, blue, red, nir,
+                          &lower_ordinal, &upper_ordinal, &medium_shadow);
+
+            for (k = 0; k < n_sets; k++)
+            {
+                if (!sets[k].supported)
+                    continue;
+
+                /* HOT over the window */
+                for (j = 0; j < image_bands; j++)
+                    index_sum[j] = 0;
+                wt_sum = 0;
+                count_ref = 0;
+                (sd8 ? hot_sums_scalar_8 : hot_sums_scalar_4)(buf, dates, 0, n_obs,
+                    lower_ordinal, upper_ordinal, index_sum, &wt_sum, &count_ref);
+                composite_dn(index_sum, wt_sum, image_bands, ref);
+
+                for (j = 0; j < image_bands; j++)
+                    index_sum[j] = 0;
+                wt_sum = 0;
+                count = 0;
+                sets[k].hot[sd8](buf, dates, 0, n_obs, lower_ordinal, upper_ordinal,
+                                 index_sum, &wt_sum, &count);
+                composite_dn(index_sum, wt_sum, image_bands, dn);
+
+                if (count != count_ref)
+                {
+                    printf("FAILED: %s HOT kernel counts %d observations in the "
+                           "window, the reference %d\n", sets[k].name, count, count_ref);
+                    n_bad++;
+                }
+                else if (count_ref > 0)
+                {
+                    n_bad += compare_bands(ref, dn, image_bands, &max_diff);
+                    n_compared += image_bands;
+                }
+
+                /* modified HOT over the whole series */
+                for (j = 0; j < image_bands; j++)
+                    index_sum[j] = 0;
+                wt_sum = 0;
+                (sd8 ? modified_hot_sums_scalar_8 : modified_hot_sums_scalar_4)(buf, 0,
+                    n_obs, medium_shadow, index_sum, &wt_sum);
+                composite_dn(index_sum, wt_sum, image_bands, ref);
+
+                for (j = 0; j < image_bands; j++)
+                    index_sum[j] = 0;
+                wt_sum = 0;
+                sets[k].modified_hot[sd8](buf, 0, n_obs, medium_shadow, index_sum,
+                                          &wt_sum);
+                composite_dn(index_sum, wt_sum, image_bands, dn);
+
+                n_bad += compare_bands(ref, dn, image_bands, &max_diff);
+                n_compared += image_bands;
+            }
+        }
+    }
+
+    for (j = 0; j < MAX_IMAGE_BANDS; j++)
+        free(buf[j]);
+
+    printf("%ld composite bands compared, largest difference %d DN\n",
+           n_compared, max_diff);
+    if (n_bad > 0)
+    {
+        printf("FAILED: %d bands more than %d DN off the scalar kernel\n",
+               n_bad, TEST_MAX_DN_DIFF);
+        return EXIT_FAILURE;
+    }
+    printf("PASSED\n");
+
+    return EXIT_SUCCESS;
+}
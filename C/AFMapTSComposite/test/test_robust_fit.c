@@ -0,0 +1,596 @@
+/******************************************************************************
+Agreement test of the single-precision bisquare fits: the scalar and AVX2
+lane kernels of robust_fit.c against gsl_multifit_robust with the bisquare
+weights, on three kinds of series:
+  random        5-125 dates, noise and 10% outliers
+  near cutoff   one observation put on the bisquare cutoff of the first
+                iteration, on either side of which it is weighted or not
+  equal weights series on an exact line and constant series, where every
+                weight stays 1
+The fitted values at both ends of a series are compared with the bounds
+robust_fit.h documents. The AVX2 lanes must match the scalar lanes bit for
+bit, and a series fitted alone must match its lane in a batch.
+
+Run with 'make check'. The AVX2 kernels are skipped on a CPU without them.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <gsl/gsl_multifit.h>
+
+/* the lane kernels are static, the test is built with them */
+#include "robust_fit.c"
+
+#define TEST_BATCHES 12500    /* batches of FIT_LANES random series         */
+#define TEST_CUTOFF_SERIES 2000
+#define TEST_EQUAL_SERIES 2000
+#define TEST_MIN_OBS 5
+#define TEST_MAX_OBS 125
+#define TEST_CUTOFF_MIN_OBS 12 /* shorter series rarely reach the cutoff     */
+#define TEST_OUTLIER_PCT 10
+#define TEST_SEED 11
+
+/* the tolerance robust_fit.h documents, in DN */
+#define TEST_MEAN_DN 0.02
+#define TEST_CLOSE_DN 0.5
+#define TEST_CLOSE_SHARE 0.996
+#define TEST_MAX_DN 10.0
+#define TEST_EXACT_DN 0.01        /* series without outliers                */
+
+/* the lane kernels of one ISA */
+typedef struct {
+    const char *name;
+    lane_residual_kernel_t residual;
+    lane_weight_kernel_t weight;
+    lane_wls_kernel_t wls;
+    int supported;
+} kernel_set_t;
+
+/* differences to GSL of one kind of series */
+typedef struct {
+    const char *name;
+    long n_fits;
+    long n_close;             /* within TEST_CLOSE_DN                       */
+    double sum_diff;
+    double max_diff;
+} agreement_t;
+
+/******************************************************************************
+MODULE:  uniform
+
+PURPOSE:  Random number in [0, 1)
+
+RETURN VALUE:
+Type = double
+******************************************************************************/
+static double uniform(void)
+{
+    return rand() / ((double)RAND_MAX + 1.0);
+}
+
+/******************************************************************************
+MODULE:  random_series
+
+PURPOSE:  Fill lane l of a batch with a surface reflectance series: a trend,
+          noise of about 40 DN and clouds as positive outliers
+
+RETURN VALUE: None
+******************************************************************************/
+static void random_series
+(
+    float *t,                 /* O: dates, lane-major                       */
+    float *y,                 /* O: values, lane-major                      */
+    int n_obs,                /* I: observations                            */
+    int stride,               /* I: distance between observations           */
+    int l                     /* I: lane to fill                            */
+)
+{
+    int i, k;
+    double date = 736000 + rand() % 365;
+    double level = 300 + rand() % 3000;
+    double slope = (uniform() - 0.5) * 2.0;
+    double noise;
+
+    for (i = 0; i < n_obs; i++)
+    {
+        noise = 0;
+        for (k = 0; k < 4; k++)
+            noise += uniform() - 0.5;
+        t[i * stride + l] = (float)date;
+        y[i * stride + l] = (float)(int)(level + slope * (date - 736000) +
+                                         70.0 * noise);
+        if (rand() % 100 < TEST_OUTLIER_PCT)
+            y[i * stride + l] += (float)(500 + rand() % 3000);
+        date += 1 + rand() % 16;
+    }
+}
+
+/******************************************************************************
+MODULE:  first_scaled_residual
+
+PURPOSE:  Scaled residual u of observation j in the first bisquare iteration
+          of GSL, in double precision
+
+RETURN VALUE:
+Type = double
+
+NOTES: OLS start, leverage factor, MAD without the smallest residual and
+       lower bound on the scale, as in multirobust.c
+******************************************************************************/
+static double first_scaled_residual
+(
+    const float *t,           /* I: dates                                   */
+    const float *y,           /* I: values                                  */
+    int n,                    /* I: observations                            */
+    int j,                    /* I: observation wanted                      */
+    double *abs_r             /* I/O: n doubles of work space               */
+)
+{
+    int i, k;
+    double mean_t = 0, mean_y = 0, s_tt = 0, s_ty = 0, s_yy = 0;
+    double c0, c1, h, r, sig, sig_lower, tmp;
+    double r_j = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        mean_t += t[i];
+        mean_y += y[i];
+    }
+    mean_t /= n;
+    mean_y /= n;
+    for (i = 0; i < n; i++)
+    {
+        s_tt += (t[i] - mean_t) * (t[i] - mean_t);
+        s_ty += (t[i] - mean_t) * (y[i] - mean_y);
+        s_yy += (y[i] - mean_y) * (y[i] - mean_y);
+    }
+    c1 = s_ty / s_tt;
+    c0 = mean_y - c1 * mean_t;
+    sig_lower = 1.0e-6 * sqrt(s_yy / (n - 1));
+    if (sig_lower == 0.0)
+        sig_lower = 1.0;
+
+    for (i = 0; i < n; i++)
+    {
+        h = 1.0 / n + (t[i] - mean_t) * (t[i] - mean_t) / s_tt;
+        if (h > 0.9999)
+            h = 0.9999;
+        r = (y[i] - c0 - c1 * t[i]) / sqrt(1.0 - h);
+        abs_r[i] = fabs(r);
+        if (i == j)
+            r_j = r;
+    }
+
+    /* insertion sort, the series are short */
+    for (i = 1; i < n; i++)
+    {
+        tmp = abs_r[i];
+        for (k = i - 1; (k >= 0) && (abs_r[k] > tmp); k--)
+            abs_r[k + 1] = abs_r[k];
+        abs_r[k + 1] = tmp;
+    }
+    k = n - ROBUST_COEFFS + 1;
+    sig = ((k % 2 == 1) ? abs_r[ROBUST_COEFFS - 1 + k / 2]
+           : 0.5 * (abs_r[ROBUST_COEFFS - 2 + k / 2] +
+                    abs_r[ROBUST_COEFFS - 1 + k / 2])) / 0.6745;
+
+    return r_j / ((sig > sig_lower ? sig : sig_lower) * BISQUARE_TUNE);
+}
+
+/******************************************************************************
+MODULE:  cutoff_series
+
+PURPOSE:  Fill lane l with a random series and move one observation onto
+          the bisquare cutoff, |u| = 1, of the first iteration
+
+RETURN VALUE: None
+
+NOTES: the observation is found by bisection on its value; it is not
+       rounded to a whole DN, so it sits on the cutoff to the last bit
+******************************************************************************/
+static void cutoff_series
+(
+    float *t,                 /* O: dates, lane-major                       */
+    float *y,                 /* O: values, lane-major                      */
+    int n_obs,                /* I: observations                            */
+    int stride,               /* I: distance between observations           */
+    int l,                    /* I: lane to fill                            */
+    float *t_lane,            /* I/O: n_obs floats of work space            */
+    float *y_lane,            /* I/O: n_obs floats of work space            */
+    double *work              /* I/O: n_obs doubles of work space           */
+)
+{
+    int i, j, iter;
+    double lo, hi, mid;
+
+    /* the observation can drag the scale along so far that it never
+       reaches the cutoff; draw another series then */
+    do
+    {
+        random_series(t, y, n_obs, stride, l);
+        for (i = 0; i < n_obs; i++)
+        {
+            t_lane[i] = t[i * stride + l];
+            y_lane[i] = y[i * stride + l];
+        }
+        j = rand() % n_obs;
+        lo = y_lane[j];
+        hi = y_lane[j] + 20000.0;
+        y_lane[j] = (float)lo;
+        mid = first_scaled_residual(t_lane, y_lane, n_obs, j, work);
+        y_lane[j] = (float)hi;
+    } while ((mid >= 1.0) ||
+             (first_scaled_residual(t_lane, y_lane, n_obs, j, work) < 1.0));
+
+    for (iter = 0; iter < 60; iter++)
+    {
+        mid = 0.5 * (lo + hi);
+        y_lane[j] = (float)mid;
+        if (first_scaled_residual(t_lane, y_lane, n_obs, j, work) < 1.0)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    y[j * stride + l] = (float)lo;
+}
+
+/******************************************************************************
+MODULE:  equal_weight_series
+
+PURPOSE:  Fill lane l with a series on an exact line, every other one
+          constant, so that no observation is down-weighted
+
+RETURN VALUE: None
+******************************************************************************/
+static void equal_weight_series
+(
+    float *t,                 /* O: dates, lane-major                       */
+    float *y,                 /* O: values, lane-major                      */
+    int n_obs,                /* I: observations                            */
+    int stride,               /* I: distance between observations           */
+    int l,                    /* I: lane to fill                            */
+    int constant              /* I: TRUE for a constant series              */
+)
+{
+    int i;
+    int date = 736000 + rand() % 365;
+    int level = 300 + rand() % 3000;
+    int slope = constant ? 0 : 1 + rand() % 4;
+
+    for (i = 0; i < n_obs; i++)
+    {
+        t[i * stride + l] = (float)date;
+        y[i * stride + l] = (float)(level + slope * i);
+        date += 8;
+    }
+}
+
+/******************************************************************************
+MODULE:  gsl_fit
+
+PURPOSE:  Fit one lane with gsl_multifit_robust and the bisquare weights, as
+          auto_robust_fit does on its GSL path
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           GSL failed
+SUCCESS         no error encountered
+******************************************************************************/
+static int gsl_fit
+(
+    const float *t,           /* I: dates, lane-major                       */
+    const float *y,           /* I: values, lane-major                      */
+    int n_obs,                /* I: observations                            */
+    int stride,               /* I: distance between observations           */
+    int l,                    /* I: lane to fit                             */
+    double *coefs             /* O: intercept and slope                     */
+)
+{
+    int i, status;
+    gsl_matrix *x = gsl_matrix_alloc(n_obs, ROBUST_COEFFS);
+    gsl_matrix *cov = gsl_matrix_alloc(ROBUST_COEFFS, ROBUST_COEFFS);
+    gsl_vector *v = gsl_vector_alloc(n_obs);
+    gsl_vector *c = gsl_vector_alloc(ROBUST_COEFFS);
+    gsl_multifit_robust_workspace *work =
+        gsl_multifit_robust_alloc(gsl_multifit_robust_bisquare, n_obs,
+                                  ROBUST_COEFFS);
+
+    for (i = 0; i < n_obs; i++)
+    {
+        gsl_matrix_set(x, i, 0, 1.0);
+        gsl_matrix_set(x, i, 1, (double)t[i * stride + l]);
+        gsl_vector_set(v, i, (double)y[i * stride + l]);
+    }
+    status = gsl_multifit_robust(x, v, c, cov, work);
+    coefs[0] = gsl_vector_get(c, 0);
+    coefs[1] = gsl_vector_get(c, 1);
+
+    gsl_multifit_robust_free(work);
+    gsl_vector_free(c);
+    gsl_vector_free(v);
+    gsl_matrix_free(cov);
+    gsl_matrix_free(x);
+
+    return (status == 0) ? SUCCESS : ERROR;
+}
+
+/******************************************************************************
+MODULE:  fit_batch
+
+PURPOSE:  Fit a batch with the lane kernels of one ISA
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           bisquare_fit_lanes failed
+SUCCESS         no error encountered
+******************************************************************************/
+static int fit_batch
+(
+    kernel_set_t *set,        /* I: kernels to use                          */
+    const float *t,           /* I: dates, lane-major                       */
+    const float *y,           /* I: values, lane-major                      */
+    const int *n,             /* I: observations of every lane              */
+    float *coefs,             /* O: intercept and slope of every lane       */
+    int *status,              /* O: SUCCESS or FAILURE of every lane        */
+    scratch_arena_t *arena    /* I/O: scratch memory                        */
+)
+{
+    lane_residual_kernel = set->residual;
+    lane_weight_kernel = set->weight;
+    lane_wls_kernel = set->wls;
+
+    return bisquare_fit_lanes(t, y, n, FIT_LANES, FIT_LANES, coefs, status,
+                              arena);
+}
+
+/******************************************************************************
+MODULE:  check_batch
+
+PURPOSE:  Fit a batch with every supported ISA, check that they agree bit
+          for bit and with the lane fitted alone, and add the differences
+          of the scalar fits to GSL to the agreement of the series kind
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+n               failed checks
+******************************************************************************/
+static int check_batch
+(
+    kernel_set_t *sets,       /* I: kernels of every ISA                    */
+    int n_sets,               /* I: number of ISAs                          */
+    const float *t,           /* I: dates, lane-major                       */
+    const float *y,           /* I: values, lane-major                      */
+    const int *n,             /* I: observations of every lane              */
+    agreement_t *agreement,   /* I/O: differences of the series kind        */
+    float *t_lane,            /* I/O: TEST_MAX_OBS floats of work space     */
+    float *y_lane,            /* I/O: TEST_MAX_OBS floats of work space     */
+    scratch_arena_t *arena    /* I/O: scratch memory                        */
+)
+{
+    int k, l, i, e, single_status;
+    int n_bad = 0;
+    int status_ref[FIT_LANES], status[FIT_LANES];
+    float ref[2 * FIT_LANES], coefs[2 * FIT_LANES], single[2];
+    double gsl_coefs[2];
+    double t_end, diff, lane_fit, gsl_value, lane_diff;
+
+    if (fit_batch(&sets[0], t, y, n, ref, status_ref, arena) != SUCCESS)
+    {
+        printf("FAILED: %s lane fit\n", sets[0].name);
+        return 1;
+    }
+
+    for (k = 1; k < n_sets; k++)
+    {
+        if (!sets[k].supported)
+            continue;
+        if (fit_batch(&sets[k], t, y, n, coefs, status, arena) != SUCCESS)
+        {
+            printf("FAILED: %s lane fit\n", sets[k].name);
+            return n_bad + 1;
+        }
+        for (l = 0; l < FIT_LANES; l++)
+        {
+            if ((status[l] != status_ref[l]) || ((status[l] == SUCCESS) &&
+                (memcmp(&coefs[2 * l], &ref[2 * l], 2 * sizeof(float)) != 0)))
+            {
+                printf("FAILED: %s lane %d differs from the scalar lane\n",
+                       sets[k].name, l);
+                n_bad++;
+            }
+        }
+    }
+
+    /* a series fitted alone, as auto_robust_fit does */
+    for (i = 0; i < n[0]; i++)
+    {
+        t_lane[i] = t[i * FIT_LANES];
+        y_lane[i] = y[i * FIT_LANES];
+    }
+    single_status = bisquare_fit_2param(t_lane, y_lane, n[0], single, arena);
+    if ((single_status != status_ref[0]) || ((single_status == SUCCESS) &&
+        (memcmp(single, ref, 2 * sizeof(float)) != 0)))
+    {
+        printf("FAILED: a series fitted alone differs from its lane\n");
+        n_bad++;
+    }
+
+    for (l = 0; l < FIT_LANES; l++)
+    {
+        /* a lane the fitter gives up on goes to GSL itself */
+        if (status_ref[l] != SUCCESS)
+            continue;
+        if (gsl_fit(t, y, n[l], FIT_LANES, l, gsl_coefs) != SUCCESS)
+        {
+            printf("FAILED: gsl_multifit_robust\n");
+            return n_bad + 1;
+        }
+
+        lane_diff = 0;
+        for (e = 0; e < 2; e++)
+        {
+            t_end = t[(e ? n[l] - 1 : 0) * FIT_LANES + l];
+            lane_fit = (double)ref[2 * l] + (double)ref[2 * l + 1] * t_end;
+            gsl_value = gsl_coefs[0] + gsl_coefs[1] * t_end;
+            diff = fabs(lane_fit - gsl_value);
+            if (diff > lane_diff)
+                lane_diff = diff;
+        }
+        agreement->n_fits++;
+        agreement->sum_diff += lane_diff;
+        if (lane_diff <= TEST_CLOSE_DN)
+            agreement->n_close++;
+        if (lane_diff > agreement->max_diff)
+            agreement->max_diff = lane_diff;
+    }
+
+    return n_bad;
+}
+
+/******************************************************************************
+MODULE:  report
+
+PURPOSE:  Print the agreement of one kind of series with GSL
+
+RETURN VALUE: None
+******************************************************************************/
+static void report
+(
+    agreement_t *agreement    /* I: differences of the series kind          */
+)
+{
+    printf("%-13s %7ld fits: mean %.4f DN, %.2f%% within %.1f DN, "
+           "largest %.3f DN\n", agreement->name, agreement->n_fits,
+           agreement->sum_diff / agreement->n_fits,
+           100.0 * agreement->n_close / agreement->n_fits, TEST_CLOSE_DN,
+           agreement->max_diff);
+}
+
+int main(void)
+{
+    int b, l, k;
+    int n_sets = 0;
+    int n_bad = 0;
+    int n[FIT_LANES];
+    float *t, *y;
+    float t_lane[TEST_MAX_OBS], y_lane[TEST_MAX_OBS];
+    double work[TEST_MAX_OBS];
+    kernel_set_t sets[2];
+    scratch_arena_t arena;
+    agreement_t random = {"random", 0, 0, 0, 0};
+    agreement_t cutoff = {"near cutoff", 0, 0, 0, 0};
+    agreement_t equal = {"equal weights", 0, 0, 0, 0};
+
+    /* run the dispatch first, so it does not undo the kernels set here */
+    pthread_once(&fit_once, init_fit_dispatch);
+
+    sets[n_sets].name = "scalar";
+    sets[n_sets].residual = lane_residuals_scalar;
+    sets[n_sets].weight = lane_weights_scalar;
+    sets[n_sets].wls = lane_wls_scalar;
+    sets[n_sets].supported = 1;
+    n_sets++;
+#ifdef FIT_X86_SIMD
+    sets[n_sets].name = "avx2";
+    sets[n_sets].residual = lane_residuals_avx2;
+    sets[n_sets].weight = lane_weights_avx2;
+    sets[n_sets].wls = lane_wls_avx2;
+    sets[n_sets].supported = __builtin_cpu_supports("avx2");
+    n_sets++;
+#endif
+
+    for (k = 0; k < n_sets; k++)
+        printf("%s kernels: %s\n", sets[k].name,
+               sets[k].supported ? "tested" : "not supported by this CPU, skipped");
+
+    t = (float *)malloc(TEST_MAX_OBS * FIT_LANES * sizeof(float));
+    y = (float *)malloc(TEST_MAX_OBS * FIT_LANES * sizeof(float));
+    /* bisquare_fit_lanes takes five lane arrays and one series */
+    if ((t == NULL) || (y == NULL) ||
+        (scratch_init(&arena, TEST_MAX_OBS,
+                      6 * FIT_LANES * sizeof(float)) != SUCCESS))
+    {
+        printf("FAILED: allocating the series\n");
+        return EXIT_FAILURE;
+    }
+
+    srand(TEST_SEED);
+    for (b = 0; b < TEST_BATCHES; b++)
+    {
+        for (l = 0; l < FIT_LANES; l++)
+        {
+            n[l] = TEST_MIN_OBS + rand() % (TEST_MAX_OBS - TEST_MIN_OBS + 1);
+            random_series(t, y, n[l], FIT_LANES, l);
+        }
+        n_bad += check_batch(sets, n_sets, t, y, n, &random, t_lane, y_lane,
+                             &arena);
+    }
+
+    for (b = 0; b < TEST_CUTOFF_SERIES / FIT_LANES; b++)
+    {
+        for (l = 0; l < FIT_LANES; l++)
+        {
+            n[l] = TEST_CUTOFF_MIN_OBS +
+                   rand() % (TEST_MAX_OBS - TEST_CUTOFF_MIN_OBS + 1);
+            cutoff_series(t, y, n[l], FIT_LANES, l, t_lane, y_lane, work);
+        }
+        n_bad += check_batch(sets, n_sets, t, y, n, &cutoff, t_lane, y_lane,
+                             &arena);
+    }
+
+    for (b = 0; b < TEST_EQUAL_SERIES / FIT_LANES; b++)
+    {
+        for (l = 0; l < FIT_LANES; l++)
+        {
+            n[l] = TEST_MIN_OBS + rand() % (TEST_MAX_OBS - TEST_MIN_OBS + 1);
+            equal_weight_series(t, y, n[l], FIT_LANES, l, l % 2);
+        }
+        n_bad += check_batch(sets, n_sets, t, y, n, &equal, t_lane, y_lane,
+                             &arena);
+    }
+
+    free(t);
+    free(y);
+    scratch_free(&arena);
+
+    report(&random);
+    report(&cutoff);
+    report(&equal);
+
+    if (random.sum_diff / random.n_fits > TEST_MEAN_DN)
+    {
+        printf("FAILED: mean difference over %.2f DN\n", TEST_MEAN_DN);
+        n_bad++;
+    }
+    if (random.n_close < TEST_CLOSE_SHARE * random.n_fits)
+    {
+        printf("FAILED: fewer than %.1f%% of the fits within %.1f DN\n",
+               100.0 * TEST_CLOSE_SHARE, TEST_CLOSE_DN);
+        n_bad++;
+    }
+    if ((random.max_diff > TEST_MAX_DN) || (cutoff.max_diff > TEST_MAX_DN))
+    {
+        printf("FAILED: a fit more than %.0f DN off GSL\n", TEST_MAX_DN);
+        n_bad++;
+    }
+    if (equal.max_diff > TEST_EXACT_DN)
+    {
+        printf("FAILED: a fit without outliers more than %.2f DN off GSL\n",
+               TEST_EXACT_DN);
+        n_bad++;
+    }
+
+    if (n_bad > 0)
+    {
+        printf("FAILED: %d checks\n", n_bad);
+        return EXIT_FAILURE;
+    }
+    printf("PASSED\n");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,247 @@
+/******************************************************************************
+Thread-count test of compositing_scanline: the same random scanline is
+composited with one thread and with several, for methods 1-6 and both band
+layouts, and the composites have to match bit for bit. Every pixel writes
+only its own column and the lane batches do not depend on the thread that
+runs them, so any difference is a race or state shared between threads.
+
+Run with 'make check'.
+******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "const.h"
+#include "utilities.h"
+#include "2d_array.h"
+#include "band_layout.h"
+#include "scratch.h"
+#include "misc.h"
+#include "compositing.h"
+#include "composite_methods.h"
+
+#define TEST_SAMPLES 531      /* pixels of the scanline, not a multiple of
+                                 FIT_LANES                                  */
+#define TEST_SCENES 150
+#define TEST_FIRST_DATE 736500
+#define TEST_DATE_STEP 3
+#define TEST_LOWER 736695     /* the compositing window                     */
+#define TEST_UPPER 736784
+#define TEST_METHODS 6
+#define TEST_SEED 11
+
+/* thread counts compared against one thread */
+static const int test_threads[] = {2, 4, 7};
+#define TEST_MAX_THREADS 7
+
+/******************************************************************************
+MODULE:  random_scanline
+
+PURPOSE:  Fill a scanline with series of a seasonal surface, noise, clouds
+          and shadows; pixels keep between none and all of the scenes
+
+RETURN VALUE: None
+
+NOTES: a quarter of the pixels keep few scenes, so the fitting methods also
+       take their median and no-observation paths
+******************************************************************************/
+static void random_scanline
+(
+    short int **buf,          /* O: band series, pixel c at c * TEST_SCENES */
+    int **dates,              /* O: valid dates of every pixel              */
+    int *counts,              /* O: number of valid dates of every pixel    */
+    int image_bands,          /* I: bands of the layout                     */
+    const band_layout_t *layout /* I: roles of the bands                   */
+)
+{
+    int c, s, j, n, keep;
+    int date;
+    float base[MAX_IMAGE_BANDS];
+    float slope[MAX_IMAGE_BANDS];
+
+    for (c = 0; c < TEST_SAMPLES; c++)
+    {
+        for (j = 0; j < image_bands; j++)
+        {
+            base[j] = (float)(300 + rand() % 2500);
+            slope[j] = (float)(rand() % 21 - 10) / 10.0;
+        }
+        keep = (rand() % 4 == 0) ? 5 + rand() % 10 : 40 + rand() % 61;
+
+        n = 0;
+        for (s = 0; s < TEST_SCENES; s++)
+        {
+            if (rand() % 100 >= keep)
+                continue;
+
+            date = TEST_FIRST_DATE + TEST_DATE_STEP * s;
+            for (j = 0; j < image_bands; j++)
+                buf[j][c * TEST_SCENES + n] = (short int)(base[j] + slope[j] *
+                    (date - TEST_LOWER) + rand() % 201 - 100);
+            if (rand() % 10 == 0)
+            {
+                buf[layout->blue][c * TEST_SCENES + n] += 2500;
+                buf[layout->green][c * TEST_SCENES + n] += 2500;
+            }
+            else if (rand() % 20 == 0)
+            {
+                buf[layout->nir][c * TEST_SCENES + n] -= 1500;
+            }
+            dates[c][n] = date;
+            n++;
+        }
+        counts[c] = n;
+    }
+}
+
+/******************************************************************************
+MODULE:  composite_with
+
+PURPOSE:  Composite the scanline with n_threads threads, starting from an
+          output that holds fill values
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           compositing_scanline failed
+SUCCESS         No errors encountered
+******************************************************************************/
+static int composite_with
+(
+    short int **buf,          /* I: band series                             */
+    int **dates,              /* I: valid dates of every pixel              */
+    int *counts,              /* I: number of valid dates of every pixel    */
+    int method,               /* I: compositing method                      */
+    int image_bands,          /* I: bands of the layout                     */
+    scratch_arena_t *arenas,  /* I/O: scratch memory, one per thread        */
+    int n_threads,            /* I: compositing threads                     */
+    short int **out           /* O: composites of every band                */
+)
+{
+    int j, c;
+
+    for (j = 0; j < image_bands; j++)
+        for (c = 0; c < TEST_SAMPLES; c++)
+            out[j][c] = IMAGE_FILL;
+
+    return compositing_scanline(buf, dates, counts, TEST_LOWER, TEST_UPPER,
+                                TEST_SAMPLES, TEST_SCENES, out, method,
+                                arenas, n_threads);
+}
+
+int main(void)
+{
+    int sd8, m, t, j, a;
+    int image_bands;
+    int n_bad = 0;
+    int n_runs = 0;
+    const band_layout_t *layout;
+    const composite_method_t *composite;
+    short int **buf;
+    int **dates;
+    int counts[TEST_SAMPLES];
+    short int **ref;
+    short int **out;
+    scratch_arena_t arenas[TEST_MAX_THREADS];
+
+    buf = (short int **)allocate_2d_array(MAX_IMAGE_BANDS,
+                                          TEST_SAMPLES * TEST_SCENES,
+                                          sizeof(short int));
+    dates = (int **)allocate_2d_array(TEST_SAMPLES, TEST_SCENES, sizeof(int));
+    ref = (short int **)allocate_2d_array(MAX_IMAGE_BANDS, TEST_SAMPLES,
+                                          sizeof(short int));
+    out = (short int **)allocate_2d_array(MAX_IMAGE_BANDS, TEST_SAMPLES,
+                                          sizeof(short int));
+    if ((buf == NULL) || (dates == NULL) || (ref == NULL) || (out == NULL))
+    {
+        printf("FAILED: allocating the scanline\n");
+        return EXIT_FAILURE;
+    }
+
+    srand(TEST_SEED);
+    for (sd8 = 0; sd8 < 2; sd8++)
+    {
+        if (set_band_layout(sd8 ? SD8_IMAGE_BANDS + 1 : PS4_IMAGE_BANDS + 1)
+            != SUCCESS)
+        {
+            printf("FAILED: setting the band layout\n");
+            return EXIT_FAILURE;
+        }
+        layout = get_band_layout();
+        image_bands = layout->image_bands;
+        random_scanline(buf, dates, counts, image_bands, layout);
+
+        for (m = 1; m <= TEST_METHODS; m++)
+        {
+            composite = find_composite_method(m);
+            if (composite == NULL)
+            {
+                printf("FAILED: no method %d\n", m);
+                return EXIT_FAILURE;
+            }
+
+            /* the scratch of a method is declared for 4-band series */
+            for (a = 0; a < TEST_MAX_THREADS; a++)
+            {
+                if (scratch_init(&arenas[a], TEST_SCENES,
+                                 composite->scratch_per_scene * image_bands /
+                                 PS4_IMAGE_BANDS) != SUCCESS)
+                {
+                    printf("FAILED: allocating the scratch arenas\n");
+                    return EXIT_FAILURE;
+                }
+            }
+            if (composite->init != NULL)
+                composite->init();
+
+            if (composite_with(buf, dates, counts, m, image_bands, arenas, 1,
+                               ref) != SUCCESS)
+            {
+                printf("FAILED: %s method %d with 1 thread\n", layout->name, m);
+                n_bad++;
+            }
+
+            for (t = 0; t < (int)(sizeof(test_threads) / sizeof(test_threads[0])); t++)
+            {
+                if (composite_with(buf, dates, counts, m, image_bands, arenas,
+                                   test_threads[t], out) != SUCCESS)
+                {
+                    printf("FAILED: %s method %d with %d threads\n",
+                           layout->name, m, test_threads[t]);
+                    n_bad++;
+                    continue;
+                }
+                for (j = 0; j < image_bands; j++)
+                {
+                    if (memcmp(ref[j], out[j], TEST_SAMPLES * sizeof(short int)) != 0)
+                    {
+                        printf("FAILED: %s method %d band %d differs between 1 "
+                               "and %d threads\n", layout->name, m, j + 1,
+                               test_threads[t]);
+                        n_bad++;
+                    }
+                }
+                n_runs++;
+            }
+
+            for (a = 0; a < TEST_MAX_THREADS; a++)
+                scratch_free(&arenas[a]);
+        }
+    }
+
+    free_2d_array((void **)buf);
+    free_2d_array((void **)dates);
+    free_2d_array((void **)ref);
+    free_2d_array((void **)out);
+
+    printf("%d multi-threaded scanlines compared with one thread\n", n_runs);
+    if (n_bad > 0)
+    {
+        printf("FAILED: %d checks\n", n_bad);
+        return EXIT_FAILURE;
+    }
+    printf("PASSED\n");
+
+    return EXIT_SUCCESS;
+}
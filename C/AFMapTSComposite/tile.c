@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gdal/gdal.h"
+#include "const.h"
+#include "utilities.h"
+#include "input.h"
+#include "input_compact.h"
+#include "hot_kernels.h"
+#include "robust_fit.h"
+#include "prefetch.h"
+#include "2d_array.h"
+#include "misc.h"
+#include "compositing.h"
+#include "band_layout.h"
+#include "block_scheduler.h"
+#include "raster_writer.h"
+#include "tile.h"
+
+
+/******************************************************************************
+MODULE:  queue_composite_rows
+
+PURPOSE:  Block writer of composite_row_blocks: hand the rows of a block to
+          the raster writer thread
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           the writer thread failed
+SUCCESS         No errors encountered
+******************************************************************************/
+static int queue_composite_rows
+(
+    void *arg,                  /* I/O: raster_writer_t of the outputs    */
+    int first_row,              /* I: first row of the block              */
+    int n_rows,                 /* I: rows in the block                   */
+    short int **out             /* I: composites of the block             */
+)
+{
+    return put_raster_rows((raster_writer_t *)arg, first_row, n_rows, out);
+}
+
+/******************************************************************************
+MODULE:  composite_tile
+
+PURPOSE:  Composite every window of a tile into tile<id>_<lower>_<upper>_pcs.tif,
+          the whole-scene processing of mode 3
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           reading, compositing or writing the tile failed
+SUCCESS         No errors encountered
+
+NOTES: GDAL has to be registered by the caller. Everything opened here is
+       closed again on failure too, so a batch can go on with its next tile.
+******************************************************************************/
+int composite_tile
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char *out_path,           /* I: directory for the composites            */
+    int tile_id,              /* I: tile id of the output names             */
+    char **scene_list,        /* I: sorted scene names, pruned to the windows */
+    int *sdate,               /* I: julian date of every scene              */
+    int num_scenes,           /* I: number of scenes in the list            */
+    input_meta_t *meta,       /* I: metadata shared by all scenes           */
+    run_opts_t *opts,         /* I: windows, reader and scheduling settings */
+    int method,               /* I: compositing method                      */
+    scratch_arena_t *arenas,  /* I/O: scratch memory, one per thread        */
+    int n_threads             /* I: compositing threads                     */
+)
+{
+    int i, w;
+    int status = SUCCESS;
+    int image_bands = get_band_layout()->image_bands;
+    int prefetch_open = FALSE;
+    int writer_open = FALSE;
+    int n_datasets = 0;
+    scanline_source_t scanline_src;  /* where the scanline loop reads from     */
+    scanline_prefetch_t prefetch;    /* scanlines read ahead of compositing    */
+    scanline_slot_t *slot;           /* per-pixel series of the current row    */
+    raster_writer_t raster_out;      /* thread writing the composites          */
+    short int **poutScanline = NULL; /* image_bands rows per window            */
+    GDALDatasetH hDstDS[MAX_WINDOWS];  /* one composite per window            */
+    GDALDriverH hDriver;
+    GDALDatasetH srsDataset;
+    const char *pszSRS_ref;
+    char **papszOptions = NULL;
+    double adfGeoTransform[6];
+    const char *pszFormat = "GTiff";
+    char filename[MAX_STR_LEN];
+    char msg_str[MAX_STR_LEN];
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "composite_tile";
+
+    /* a time cube, if given, replaces reading the scenes */
+    if (open_scanline_source(in_path, scene_list, num_scenes, meta->lines,
+                             meta->samples, sdate, opts, &scanline_src) != SUCCESS)
+        RETURN_ERROR("Opening ARD scanline source", FUNC_NAME, ERROR);
+
+    snprintf (msg_str, sizeof(msg_str), "scanline compaction kernel=%s\n",
+              compact_bip_isa_name());
+    LOG_MESSAGE (msg_str, FUNC_NAME);
+    snprintf (msg_str, sizeof(msg_str), "HOT weighting kernel=%s\n",
+              hot_kernels_isa_name());
+    LOG_MESSAGE (msg_str, FUNC_NAME);
+    snprintf (msg_str, sizeof(msg_str), "robust fitting lanes=%d kernel=%s\n",
+              FIT_LANES, robust_fit_isa_name());
+    LOG_MESSAGE (msg_str, FUNC_NAME);
+
+    if (opts->block_rows > 0)
+    {
+        /* every worker reads and composites its own rows */
+        snprintf (msg_str, sizeof(msg_str), "row blocks of %d rows\n",
+                  opts->block_rows);
+        LOG_MESSAGE (msg_str, FUNC_NAME);
+    }
+    else
+    {
+        /* scanline buffers are owned by the prefetcher; with a depth above
+           0 a reader thread fills the next rows while this one is composited */
+        if (open_scanline_prefetch(&scanline_src, opts->prefetch_depth, &prefetch) != SUCCESS)
+        {
+            ERROR_MESSAGE("Starting scanline prefetch", FUNC_NAME);
+            status = ERROR;
+            goto cleanup;
+        }
+        prefetch_open = TRUE;
+
+        snprintf (msg_str, sizeof(msg_str), "scanline prefetch depth=%d\n",
+                  opts->prefetch_depth);
+        LOG_MESSAGE (msg_str, FUNC_NAME);
+    }
+    snprintf (msg_str, sizeof(msg_str), "compositing threads=%d\n",
+              n_threads);
+    LOG_MESSAGE (msg_str, FUNC_NAME);
+
+    /* image_bands rows for every compositing window */
+    poutScanline = (short int **) allocate_2d_array (opts->n_windows * image_bands, meta->samples,
+                                               sizeof(short int));
+    if (poutScanline == NULL)
+    {
+        ERROR_MESSAGE("Allocating poutScanline memory", FUNC_NAME);
+        status = ERROR;
+        goto cleanup;
+    }
+
+    /**************************************************************/
+    /*                                                            */
+    /*            create gdal dataset                             */
+    /*                                                            */
+    /**************************************************************/
+
+    hDriver = GDALGetDriverByName(pszFormat);
+
+    sprintf(filename, "%s/%s", in_path, scene_list[0]);
+    srsDataset = GDALOpen(filename, GA_ReadOnly);
+    if (srsDataset == NULL)
+    {
+        sprintf(errmsg, "Opening %s for the projection", filename);
+        ERROR_MESSAGE(errmsg, FUNC_NAME);
+        status = ERROR;
+        goto cleanup;
+    }
+    pszSRS_ref = GDALGetProjectionRef(srsDataset);
+
+    adfGeoTransform[0] = meta->upper_left_x;
+    adfGeoTransform[1] = PLANET_RES;
+    adfGeoTransform[2] = 0;
+    adfGeoTransform[3] = meta->upper_left_y;
+    adfGeoTransform[4] = 0;
+    adfGeoTransform[5] = -PLANET_RES;
+
+    for (w = 0; w < opts->n_windows; w++)
+    {
+        // create a complete path for output composite file
+        sprintf(filename, "%s/tile%d_%d_%d_pcs.tif", out_path, tile_id,
+                opts->window_lower[w], opts->window_upper[w]);
+
+        hDstDS[w] = GDALCreate(hDriver, filename, meta->samples, meta->lines, image_bands,  GDT_Int16,
+                               papszOptions);
+        if (hDstDS[w] == NULL)
+        {
+            sprintf(errmsg, "Creating %s", filename);
+            ERROR_MESSAGE(errmsg, FUNC_NAME);
+            status = ERROR;
+            break;
+        }
+        n_datasets++;
+
+        /* projection from srs file */
+        GDALSetProjection(hDstDS[w], pszSRS_ref);
+
+        /* geotransform from ENVI header */
+        GDALSetGeoTransform( hDstDS[w], adfGeoTransform);
+    }
+
+    GDALClose(srsDataset);
+    if (status != SUCCESS)
+        goto cleanup;
+
+    /* from here until close_raster_writer only the writer thread touches
+       the datasets; compositing hands it rows through a ring */
+    if (open_raster_writer(hDstDS, opts->n_windows, image_bands, meta->samples,
+                           opts->write_depth, &raster_out) != SUCCESS)
+    {
+        ERROR_MESSAGE("Starting the raster writer", FUNC_NAME);
+        status = ERROR;
+        goto cleanup;
+    }
+    writer_open = TRUE;
+    snprintf (msg_str, sizeof(msg_str), "raster writer blocks of %d rows, depth=%d\n",
+              raster_out.rows, opts->write_depth);
+    LOG_MESSAGE (msg_str, FUNC_NAME);
+
+    if (opts->block_rows > 0)
+    {
+        status = composite_row_blocks(&scanline_src, opts, method, opts->block_rows,
+                                      n_threads, arenas, queue_composite_rows,
+                                      &raster_out);
+        if (status != SUCCESS)
+            ERROR_MESSAGE("Compositing the tile by row blocks", FUNC_NAME);
+    }
+    else
+    {
+        for (i = 0; (status == SUCCESS) && (i < meta->lines); i++)
+        {
+            slot = acquire_scanline(&prefetch, i);
+            if (slot == NULL)
+            {
+                sprintf(errmsg, "Error in reading ARD data for row_%d \n", i);
+                ERROR_MESSAGE(errmsg, FUNC_NAME);
+                status = ERROR;
+                break;
+            }
+
+            /**************************************************************/
+            /*                                                            */
+            /*   compositing based on scanline, every window from the     */
+            /*   same in-memory series                                    */
+            /*                                                            */
+            /**************************************************************/
+            for (w = 0; w < opts->n_windows; w++)
+            {
+                if (compositing_scanline(slot->buf, slot->valid_date_array, slot->valid_scene_count,
+                                         opts->window_lower[w], opts->window_upper[w],
+                                         meta->samples, num_scenes,
+                                         poutScanline + w * image_bands, method,
+                                         arenas, n_threads) != SUCCESS)
+                {
+                    sprintf(errmsg, "Error in compositing for row_%d \n", i);
+                    ERROR_MESSAGE(errmsg, FUNC_NAME);
+                    status = ERROR;
+                    break;
+                }
+            }
+            release_scanline(&prefetch, slot);
+
+            if ((status == SUCCESS)
+                && (put_raster_rows(&raster_out, i, 1, poutScanline) != SUCCESS))
+            {
+                sprintf(errmsg, "Error in writing row_%d \n", i);
+                ERROR_MESSAGE(errmsg, FUNC_NAME);
+                status = ERROR;
+            }
+        }
+    }
+
+cleanup:
+    if (prefetch_open)
+        close_scanline_prefetch(&prefetch);
+    if (writer_open && (close_raster_writer(&raster_out) != SUCCESS))
+    {
+        ERROR_MESSAGE("Writing the composites", FUNC_NAME);
+        status = ERROR;
+    }
+    for (w = 0; w < n_datasets; w++)
+        GDALClose(hDstDS[w]);
+    close_scanline_source(&scanline_src);
+    if (poutScanline != NULL)
+        free_2d_array((void **)poutScanline);
+
+    return status;
+}
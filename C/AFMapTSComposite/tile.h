@@ -0,0 +1,24 @@
+#ifndef TILE_H
+#define TILE_H
+
+#include "const.h"
+#include "input.h"
+#include "scratch.h"
+#include "utilities.h"
+
+int composite_tile
+(
+    char *in_path,            /* I: ARD image directory                     */
+    char *out_path,           /* I: directory for the composites            */
+    int tile_id,              /* I: tile id of the output names             */
+    char **scene_list,        /* I: sorted scene names, pruned to the windows */
+    int *sdate,               /* I: julian date of every scene              */
+    int num_scenes,           /* I: number of scenes in the list            */
+    input_meta_t *meta,       /* I: metadata shared by all scenes           */
+    run_opts_t *opts,         /* I: windows, reader and scheduling settings */
+    int method,               /* I: compositing method                      */
+    scratch_arena_t *arenas,  /* I/O: scratch memory, one per thread        */
+    int n_threads             /* I: compositing threads                     */
+);
+
+#endif // TILE_H
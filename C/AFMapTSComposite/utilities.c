@@ -20,6 +20,8 @@
   NOTES:
       - Log Message Format:
             yyyy-mm-dd HH:mm:ss pid:module [filename]:line message
+      - Called by several threads at once (e.g. the job loader of a batch),
+        so the time is broken down with localtime_r into a local struct tm
 *****************************************************************************/
 
 void write_message
@@ -34,23 +36,23 @@ void write_message
 )
 {
     time_t current_time;
-    struct tm *time_info;
+    struct tm time_info;
     int year;
     pid_t pid;
 
     time (&current_time);
-    time_info = localtime (&current_time);
-    year = time_info->tm_year + 1900;
+    localtime_r (&current_time, &time_info);
+    year = time_info.tm_year + 1900;
 
     pid = getpid ();
 
     fprintf (fd, "%04d:%02d:%02d %02d:%02d:%02d %d:%s [%s]:%d [%s]:%s\n",
              year,
-             time_info->tm_mon,
-             time_info->tm_mday,
-             time_info->tm_hour,
-             time_info->tm_min,
-             time_info->tm_sec,
+             time_info.tm_mon,
+             time_info.tm_mday,
+             time_info.tm_hour,
+             time_info.tm_min,
+             time_info.tm_sec,
              pid, module, basename (file), line, type, message);
 }
 
@@ -338,6 +340,165 @@ int partition_shortint_index (short int arr[], int index[], int left, int right)
 }
 
 
+/******************************************************************************
+MODULE: parse_windows
+
+PURPOSE:  Append compositing windows given as lower-upper pairs separated by
+          commas, e.g. 736785-736876,736877-736968
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           a pair is not lower-upper or there are too many windows
+SUCCESS         No errors encountered
+******************************************************************************/
+int parse_windows
+(
+    char *value,           /* I: lower-upper pairs separated by commas      */
+    run_opts_t *opts       /* I/O: windows appended to the run settings     */
+)
+{
+    char *next;
+    int lower, upper;
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "parse_windows";
+
+    while (*value != '\0')
+    {
+        if (opts->n_windows == MAX_WINDOWS)
+        {
+            sprintf(errmsg, "At most %d compositing windows", MAX_WINDOWS);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+        if ((sscanf(value, "%d-%d", &lower, &upper) != 2) || (lower > upper))
+        {
+            sprintf(errmsg, "Compositing window %s is not lower-upper", value);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+        opts->window_lower[opts->n_windows] = lower;
+        opts->window_upper[opts->n_windows] = upper;
+        opts->n_windows++;
+
+        next = strchr(value, ',');
+        if (next == NULL)
+            break;
+        value = next + 1;
+    }
+
+    return SUCCESS;
+}
+
+/******************************************************************************
+MODULE: parse_run_option
+
+PURPOSE:  Parse one optional key=value setting into the run options
+
+RETURN VALUE:
+Type = int
+Value           Description
+-----           -----------
+ERROR           unknown key or value out of range
+SUCCESS         No errors encountered
+******************************************************************************/
+static int parse_run_option
+(
+    char *token,           /* I: key=value string                           */
+    run_opts_t *opts       /* I/O: run settings updated with the value      */
+)
+{
+    char *value;
+    char errmsg[MAX_STR_LEN];
+    char FUNC_NAME[] = "parse_run_option";
+
+    value = strchr(token, '=') + 1;
+
+    if (strncmp(token, "prefetch_depth=", strlen("prefetch_depth=")) == 0)
+    {
+        opts->prefetch_depth = atoi(value);
+        if ((opts->prefetch_depth < 0) || (opts->prefetch_depth > MAX_PREFETCH_DEPTH))
+        {
+            sprintf(errmsg, "prefetch_depth has to be between 0 and %d", MAX_PREFETCH_DEPTH);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+    }
+    else if (strncmp(token, "write_depth=", strlen("write_depth=")) == 0)
+    {
+        opts->write_depth = atoi(value);
+        if ((opts->write_depth < 1) || (opts->write_depth > MAX_WRITE_DEPTH))
+        {
+            sprintf(errmsg, "write_depth has to be between 1 and %d", MAX_WRITE_DEPTH);
+            RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+        }
+    }
+    else if (strncmp(token, "reader=", strlen("reader=")) == 0)
+    {
+        if (strcmp(value, "mmap") == 0)
+            opts->reader = READER_MMAP;
+        else if (strcmp(value, "pread") == 0)
+            opts->reader = READER_PREAD;
+        else if (strcmp(value, "stdio") == 0)
+            opts->reader = READER_STDIO;
+        else if (strcmp(value, "gdal") == 0)
+            opts->reader = READER_GDAL;
+        else
+            RETURN_ERROR("reader has to be mmap, pread, stdio or gdal", FUNC_NAME, ERROR);
+    }
+    else if (strncmp(token, "max_open_files=", strlen("max_open_files=")) == 0)
+    {
+        opts->max_open_files = atoi(value);
+        if (opts->max_open_files < 0)
+            RETURN_ERROR("max_open_files cannot be negative", FUNC_NAME, ERROR);
+    }
+    else if (strncmp(token, "block_cache_mb=", strlen("block_cache_mb=")) == 0)
+    {
+        opts->block_cache_mb = atoi(value);
+        if (opts->block_cache_mb < 0)
+            RETURN_ERROR("block_cache_mb cannot be negative", FUNC_NAME, ERROR);
+    }
+    else if (strncmp(token, "threads=", strlen("threads=")) == 0)
+    {
+        opts->threads = atoi(value);
+        if (opts->threads < 0)
+            RETURN_ERROR("threads cannot be negative", FUNC_NAME, ERROR);
+    }
+    else if (strncmp(token, "block_rows=", strlen("block_rows=")) == 0)
+    {
+        opts->block_rows = atoi(value);
+        if (opts->block_rows < 0)
+            RETURN_ERROR("block_rows cannot be negative", FUNC_NAME, ERROR);
+    }
+    else if (strncmp(token, "cube=", strlen("cube=")) == 0)
+    {
+        strcpy(opts->cube_path, value);
+    }
+    else if (strncmp(token, "points=", strlen("points=")) == 0)
+    {
+        strcpy(opts->points_path, value);
+    }
+    else if (strncmp(token, "jobs=", strlen("jobs=")) == 0)
+    {
+        strcpy(opts->jobs_path, value);
+    }
+    else if (strncmp(token, "results=", strlen("results=")) == 0)
+    {
+        strcpy(opts->results_path, value);
+    }
+    /* further windows as lower-upper pairs, e.g. windows=736785-736876,736877-736968 */
+    else if (strncmp(token, "windows=", strlen("windows=")) == 0)
+    {
+        if (parse_windows(value, opts) != SUCCESS)
+            RETURN_ERROR("Parsing windows", FUNC_NAME, ERROR);
+    }
+    else
+    {
+        sprintf(errmsg, "Unknown option %s", token);
+        RETURN_ERROR(errmsg, FUNC_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
 /******************************************************************************
 MODULE: get_args
 PURPOSE:  Gets the command-line arguments and validates that the required
@@ -366,9 +527,12 @@ int get_args
     int *mode,               /* O: the mode                */
     int *row,
     int *col,
-    int *method
+    int *method,
+    run_opts_t *opts       /* O: optional run settings                      */
 )
 {
+    int i;
+    char token[MAX_STR_LEN];
     char cwd[MAX_STR_LEN]; // current directory path
     char var_path[MAX_STR_LEN];
     FILE *var_fp;
@@ -377,6 +541,18 @@ int get_args
             line7[MAX_STR_LEN], line8[MAX_STR_LEN], line9[MAX_STR_LEN];
     char FUNC_NAME[] = "get_args";
 
+    opts->prefetch_depth = DEFAULT_PREFETCH_DEPTH;
+    opts->write_depth = DEFAULT_WRITE_DEPTH;
+    opts->cube_path[0] = '\0';
+    opts->reader = READER_MMAP;
+    opts->max_open_files = 0;
+    opts->block_cache_mb = 0;
+    opts->threads = 0;
+    opts->block_rows = 0;
+    opts->points_path[0] = '\0';
+    opts->jobs_path[0] = '\0';
+    opts->results_path[0] = '\0';
+
     // when there is no variable command-line argument,
     // use the default variable text path
     if(argc < 2)
@@ -385,8 +561,30 @@ int get_args
         //printf("getvariable");
         sprintf(var_path, "%s/%s", cwd, "variables");
     }
-    // for production
-    else if(argc == 6)
+    // batch of tiles; every argument is key=value, jobs= names the job file
+    else if(strchr(argv[1], '=') != NULL)
+    {
+        in_path[0] = '\0';
+        out_path[0] = '\0';
+        *tile_id = 0;
+        *lower_ordinal = 0;
+        *upper_ordinal = 0;
+        *mode = 6;
+        *row = 0;
+        *col = 0;
+        *method = DEFAULT_COMPOSITING_METHOD;
+        opts->n_windows = 0;
+        for (i = 1; i < argc; i++)
+        {
+            if (strchr(argv[i], '=') == NULL)
+                RETURN_ERROR("A batch takes key=value arguments only", FUNC_NAME, ERROR);
+            if (parse_run_option(argv[i], opts) != SUCCESS)
+                RETURN_ERROR("Parsing optional arguments", FUNC_NAME, ERROR);
+        }
+        return SUCCESS;
+    }
+    // for production; key=value settings may follow the five arguments
+    else if(argc >= 6)
     {
         // printf("argc == 6 \n");
         strcpy(in_path, argv[1]);
@@ -398,11 +596,21 @@ int get_args
         *row = 0;
         *col = 0;
         *method = DEFAULT_COMPOSITING_METHOD;
+        opts->n_windows = 1;
+        opts->window_lower[0] = *lower_ordinal;
+        opts->window_upper[0] = *upper_ordinal;
+        for (i = 6; i < argc; i++)
+        {
+            if (strchr(argv[i], '=') == NULL)
+                RETURN_ERROR("Arguments after the fifth have to be key=value", FUNC_NAME, ERROR);
+            if (parse_run_option(argv[i], opts) != SUCCESS)
+                RETURN_ERROR("Parsing optional arguments", FUNC_NAME, ERROR);
+        }
         return SUCCESS;
     }
     else
     {
-        RETURN_ERROR("Inputted arg parameter number has to be 0 or 5 ", FUNC_NAME, ERROR);
+        RETURN_ERROR("Inputted arg parameter number has to be 0 or at least 5, or key=value only", FUNC_NAME, ERROR);
     }
 
     var_fp = fopen(var_path, "r");
@@ -450,6 +658,25 @@ int get_args
     fscanf(var_fp, "%s\n", line9);
     *method = atoi(strchr(line9, '=') + 1);
 
+    opts->n_windows = 1;
+    opts->window_lower[0] = *lower_ordinal;
+    opts->window_upper[0] = *upper_ordinal;
+
+    /* optional key=value lines, up to the explanation block */
+    while (fscanf(var_fp, "%s", token) == 1)
+    {
+        if (token[0] == '#')
+            break;
+        if (strchr(token, '=') == NULL)
+            continue;
+        if (parse_run_option(token, opts) != SUCCESS)
+        {
+            fclose(var_fp);
+            RETURN_ERROR("Parsing optional lines of 'Variables' file", FUNC_NAME, ERROR);
+        }
+    }
+
+    fclose(var_fp);
 
     return SUCCESS;
 
@@ -2,6 +2,7 @@
 #define UTILITIES_H
 
 #include <stdio.h>
+#include "const.h"
 
 
 #define LOG_MESSAGE(message, module) \
@@ -81,6 +82,24 @@ void quick_sort_shortint
     int right
 );
 
+/* optional run settings, given as key=value after the fixed arguments */
+typedef struct {
+    int prefetch_depth;   /* scanlines read ahead of compositing, 0 = serial */
+    int write_depth;      /* row blocks queued for the writer thread   */
+    char cube_path[MAX_STR_LEN]; /* time cube to read (mode 3) or write (mode 4) */
+    int reader;           /* READER_MMAP, READER_PREAD, READER_STDIO or READER_GDAL */
+    int max_open_files;   /* descriptor bound of the pread pool, 0 = from ulimit */
+    int block_cache_mb;   /* decoded block rows of reader=gdal, 0 = no limit */
+    int threads;          /* compositing threads, 0 = OMP_NUM_THREADS or all cores */
+    int block_rows;       /* rows of a scheduler task, 0 = scanline loop */
+    char points_path[MAX_STR_LEN]; /* row,col csv of the points of mode 5  */
+    char jobs_path[MAX_STR_LEN];   /* job file of the tiles of mode 6      */
+    char results_path[MAX_STR_LEN]; /* status of every job of mode 6        */
+    int n_windows;        /* compositing windows, the first is lower/upper_ordinal */
+    int window_lower[MAX_WINDOWS];
+    int window_upper[MAX_WINDOWS];
+} run_opts_t;
+
 int get_args
 (
     int argc,              /* I: number of cmd-line args                    */
@@ -93,7 +112,14 @@ int get_args
     int *mode,               /* O: the mode                */
     int *row,
     int *col,
-    int *method
+    int *method,
+    run_opts_t *opts       /* O: optional run settings                      */
+);
+
+int parse_windows
+(
+    char *value,           /* I: lower-upper pairs separated by commas      */
+    run_opts_t *opts       /* I/O: windows appended to the run settings     */
 );
 
 void quick_sort_shortint_index(short int arr[], int index_list[], int left, int right);
@@ -24,6 +24,7 @@ import subprocess
 import multiprocessing
 from pytz import timezone
 from fixed_thread_pool_executor import FixedThreadPoolExecutor
+from tile_queue import TileQueue
 from osgeo import gdal_array
 import numpy as np
 import shutil
@@ -372,38 +373,47 @@ def composite_generation(compositing_exe_path, bucket, prefix, foc_gpd_tile, til
     tymin = extent_geojson_gcs['bbox'][1] - gcs_res * buf
     tymax = extent_geojson_gcs['bbox'][3] + gcs_res * buf
 
-    #######################################################
-    #           1. begin compositing dryseason            #
-    #######################################################
-    cmd = [compositing_exe_path, ard_folder, tmp_pth, str(tile_id), str(dry_lower_ordinal), str(dry_upper_ordinal)]
+    out_path_pcs_dry = os.path.join(tmp_pth, 'tile{}_{}_{}_pcs.tif'.format(tile_id, dry_lower_ordinal, dry_upper_ordinal))
+    out_path_gcs_dry = os.path.join(tmp_pth, 'tile{}_{}_{}_gcs.tif'.format(tile_id, dry_lower_ordinal, dry_upper_ordinal))
+    out_path_gcs_dry_TCI = os.path.join(tmp_pth, 'tile{}_{}_{}_gcs_TCI.tif'.format(tile_id, dry_lower_ordinal, dry_upper_ordinal))
+    out_path_dry = os.path.join(tmp_pth, 'tile{}_{}_{}.tif'.format(tile_id, dry_lower_ordinal, dry_upper_ordinal))
+
+    out_path_pcs_wet = os.path.join(tmp_pth, 'tile{}_{}_{}_pcs.tif'.format(tile_id, wet_lower_ordinal, wet_upper_ordinal))
+    out_path_gcs_wet = os.path.join(tmp_pth, 'tile{}_{}_{}_gcs.tif'.format(tile_id, wet_lower_ordinal, wet_upper_ordinal))
+    out_path_gcs_wet_TCI = os.path.join(tmp_pth, 'tile{}_{}_{}_gcs_TCI.tif'.format(tile_id, wet_lower_ordinal, wet_upper_ordinal))
+    out_path_wet = os.path.join(tmp_pth, 'tile{}_{}_{}.tif'.format(tile_id, wet_lower_ordinal, wet_upper_ordinal))
+
+    ##############################################################
+    #    1. compositing dry and wet season in a single pass      #
+    ##############################################################
+    # every window gets the composite of a run of its own, the binary reads the scenes once for both
+    cmd = [compositing_exe_path, ard_folder, tmp_pth, str(tile_id), str(dry_lower_ordinal), str(dry_upper_ordinal),
+           'windows={}-{}'.format(wet_lower_ordinal, wet_upper_ordinal)]
     # run composite exe
     try:
         p = subprocess.check_output(cmd, stderr=subprocess.STDOUT)
     except subprocess.CalledProcessError as e:
-        logger.error("compositing error for tile {} at dry season: {}".format(tile_id, e))
+        logger.error("compositing error for tile {}: {}".format(tile_id, e))
         raise
 
-    # reproject and crop compositing image to align with GCS tile system
-    out_path_pcs_dry = os.path.join(tmp_pth, 'tile{}_{}_{}_pcs.tif'.format(tile_id, dry_lower_ordinal, dry_upper_ordinal))
-    out_path_gcs_dry = os.path.join(tmp_pth, 'tile{}_{}_{}_gcs.tif'.format(tile_id, dry_lower_ordinal, dry_upper_ordinal))
-    out_path_gcs_dry_TCI = os.path.join(tmp_pth, 'tile{}_{}_{}_gcs_TCI.tif'.format(tile_id, dry_lower_ordinal, dry_upper_ordinal))
-    out_path_dry = os.path.join(tmp_pth, 'tile{}_{}_{}.tif'.format(tile_id, dry_lower_ordinal, dry_upper_ordinal))
-
-    # check if composite image is valid
-    if not is_valid_image(out_path_pcs_dry):
-        logger.info("Composition fails for the first time for tile{}_{}_{} at dry season".format(tile_id,
-                                                                                                 dry_lower_ordinal,
-                                                                                                 dry_upper_ordinal))
+    # check if composite images are valid
+    if not (is_valid_image(out_path_pcs_dry) and is_valid_image(out_path_pcs_wet)):
+        logger.info("Composition fails for the first time for tile{}_{}_{} and tile{}_{}_{}".format(
+            tile_id, dry_lower_ordinal, dry_upper_ordinal, tile_id, wet_lower_ordinal, wet_upper_ordinal))
         # run composite exe
         p = subprocess.check_output(cmd, stderr=subprocess.STDOUT)
 
-        if not is_valid_image(out_path_pcs_dry):
-            logger.info("composition fails for tile {} for twice at dry season".format(tile_id))
+        if not (is_valid_image(out_path_pcs_dry) and is_valid_image(out_path_pcs_wet)):
+            logger.info("composition fails for tile {} for twice".format(tile_id))
             p = subprocess.check_output(cmd, stderr=subprocess.STDOUT)
-            if not is_valid_image(out_path_pcs_dry):
-                logger.error("compositing error for tile {} for the third time at dry season".format(tile_id))
+            if not (is_valid_image(out_path_pcs_dry) and is_valid_image(out_path_pcs_wet)):
+                logger.error("compositing error for tile {} for the third time".format(tile_id))
                 raise FuncException("Composition fails")
 
+    #######################################################
+    #           2. reproject dry season composite         #
+    #######################################################
+    # reproject and crop compositing image to align with GCS tile system
     # here call gdalwarp directly instead of gdal.warp, cause unexpected bug for gdal.warp
     cmd = 'gdalwarp -q -overwrite -t_srs EPSG:4326 -te {} {} {} {} -r bilinear -ts {} {} -srcnodata -9999 -dstnodata -9999 -ot ' \
           'Int16 {} {}'.format(txmin, tymin, txmax, tymax, 2000 + buf * 2, 2000 + buf * 2, out_path_pcs_dry, out_path_gcs_dry)
@@ -430,36 +440,9 @@ def composite_generation(compositing_exe_path, bucket, prefix, foc_gpd_tile, til
 
 
     #########################################################
-    #            2. begin compositing wet season            #
+    #            3. reproject wet season composite          #
     #########################################################
-    cmd = [compositing_exe_path, ard_folder, tmp_pth, str(tile_id), str(wet_lower_ordinal), str(wet_upper_ordinal)]
-    # run composite exe
-    try:
-        p = subprocess.check_output(cmd, stderr=subprocess.STDOUT)
-    except subprocess.CalledProcessError as e:
-        logger.error("compositing error for tile {} at wet season: {}".format(tile_id, e))
-        raise
-
-    # reproject and crop compositing image to align with GCS tile system         
-    out_path_pcs_wet = os.path.join(tmp_pth, 'tile{}_{}_{}_pcs.tif'.format(tile_id, wet_lower_ordinal, wet_upper_ordinal))
-    out_path_gcs_wet = os.path.join(tmp_pth, 'tile{}_{}_{}_gcs.tif'.format(tile_id, wet_lower_ordinal, wet_upper_ordinal))
-    out_path_gcs_wet_TCI = os.path.join(tmp_pth, 'tile{}_{}_{}_gcs_TCI.tif'.format(tile_id, wet_lower_ordinal, wet_upper_ordinal))
-    out_path_wet = os.path.join(tmp_pth, 'tile{}_{}_{}.tif'.format(tile_id, wet_lower_ordinal, wet_upper_ordinal))
-
-    # check if composite image is valid
-    if not is_valid_image(out_path_pcs_wet):
-        logger.info("Composition fails for the first time for tile{}_{}_{} at wet season".format(tile_id, wet_lower_ordinal,
-                                                                                                 wet_upper_ordinal))
-        # run composite exe
-        p = subprocess.check_output(cmd, stderr=subprocess.STDOUT)
-
-        if not is_valid_image(out_path_pcs_wet):
-            logger.info("composition fail for twice for tile {} at wet season".format(tile_id))
-            p = subprocess.check_output(cmd, stderr=subprocess.STDOUT)
-            if not is_valid_image(out_path_pcs_wet):
-                logger.error("composition fail for the third time for tile {} at wet season".format(tile_id))
-                raise FuncException("Composition fails")
-
+    # reproject and crop compositing image to align with GCS tile system
     # img = gdal.Open(out_path_pcs_wet)
     # if img is None:
         # logger.error("couldn't find pcs-based compositing result for tile {}".format(tile_id))
@@ -485,7 +468,7 @@ def composite_generation(compositing_exe_path, bucket, prefix, foc_gpd_tile, til
 
 
     ############################################################
-    #             3.upload compositing image to s3             #
+    #             4.upload compositing image to s3             #
     ############################################################
     s3 = boto3.client('s3')
     try:
@@ -579,6 +562,84 @@ def ard_composition_execution(foc_img_catalog, foc_gpd_tile, tile_id, s3_bucket,
         return True
 
 
+def queue_worker(tile_queue, img_catalog, gpd_tile, s3_bucket, prefix, img_fullpth_catalog, tmp_pth,
+                 compositing_exe_path, dry_lower_ordinal, dry_upper_ordinal, wet_lower_ordinal, wet_upper_ordinal,
+                 bsave_ard, output_prefix, res, logger, gcs_res, buf, poll_seconds=60):
+    """
+    claiming tiles from a shared tile queue and compositing them until no tile is left to any worker. Leases of
+    other workers are waited for, so a tile whose worker was interrupted is picked up once its lease expires.
+    arg:
+        tile_queue: TileQueue object
+        img_catalog: a table linking planet image names and tile id
+        gpd_tile: geopandas object of all tiles, using GCS system
+        poll_seconds: waiting time when every unfinished tile is leased by other workers
+        (the others are the arguments of ard_composition_execution)
+    return
+        (success_count, failure_count)
+    """
+    success_count = 0
+    failure_count = 0
+    while True:
+        lease = tile_queue.claim()
+        if lease is None:
+            if tile_queue.unfinished() == 0:
+                return success_count, failure_count
+            time.sleep(poll_seconds)
+            continue
+
+        tile_id = int(lease.tile)
+        foc_img_catalog = img_catalog.loc[img_catalog['tile'] == tile_id]
+        foc_gpd_tile = gpd_tile[gpd_tile['tile'] == tile_id]
+        try:
+            success = ard_composition_execution(foc_img_catalog, foc_gpd_tile, tile_id, s3_bucket, prefix,
+                                                img_fullpth_catalog, tmp_pth, compositing_exe_path, dry_lower_ordinal,
+                                                dry_upper_ordinal, wet_lower_ordinal, wet_upper_ordinal, bsave_ard,
+                                                output_prefix, res, logger, gcs_res, buf)
+        except Exception as e:
+            # a failed ARD generation must give the tile back too
+            logger.error("ARD generation failed for tile_id {}: {}".format(tile_id, e))
+            success = False
+
+        if success:
+            success_count = success_count + 1
+            if not lease.complete():
+                logger.warning("the lease of tile_id {} expired before it was finished".format(tile_id))
+        else:
+            failure_count = failure_count + 1
+            lease.fail()
+
+
+def queue_composition_execution(tile_queue, tiles, threads_number, img_catalog, gpd_tile, s3_bucket, prefix,
+                                img_fullpth_catalog, tmp_pth, compositing_exe_path, dry_lower_ordinal,
+                                dry_upper_ordinal, wet_lower_ordinal, wet_upper_ordinal, bsave_ard, output_prefix, res,
+                                logger, gcs_res, buf):
+    """
+    seeding a tile queue and running threads_number queue workers on it until no tile is left to any instance. Every
+    instance seeds the same tiles and only the first one adds them
+    arg:
+        tile_queue: TileQueue object
+        tiles: tile ids to be composited
+        threads_number: the number of queue workers
+        (the others are the arguments of queue_worker)
+    return
+        (success_count, failure_count) of this instance
+    """
+    logger.info("Progress: {} tiles added to the queue {}".format(tile_queue.seed(tiles.astype(int)), tile_queue.root))
+
+    ard_composition_executor = FixedThreadPoolExecutor(size=threads_number)
+    for i in range(threads_number):
+        ard_composition_executor.submit(queue_worker, tile_queue, img_catalog, gpd_tile, s3_bucket, prefix,
+                                        img_fullpth_catalog, tmp_pth, compositing_exe_path, dry_lower_ordinal,
+                                        dry_upper_ordinal, wet_lower_ordinal, wet_upper_ordinal, bsave_ard,
+                                        output_prefix, res, logger, gcs_res, buf)
+    ard_composition_executor.drain()
+    ard_composition_executor.close()
+
+    success_count = sum(r[0] for r in ard_composition_executor.returns)
+    failure_count = sum(r[1] for r in ard_composition_executor.returns)
+    return success_count, failure_count
+
+
 @click.command()
 @click.option('--config_filename', default='cvmapper_config_composite.yaml', help='The name of the config to use.')
 @click.option('--tile_id', default=None, help='only used for debug mode, user-defined tile_id')
@@ -588,13 +649,20 @@ def ard_composition_execution(foc_img_catalog, foc_gpd_tile, tile_id, s3_bucket,
 @click.option('--bsave_ard', default=False, help='only used for debug mode, user-defined tile_id')
 @click.option('--s3_bucket', default='***REMOVED***', help='s3 bucket name')
 @click.option('--threads_number', default='default', help='output folder prefix')
-def main(s3_bucket, config_filename, tile_id, aoi, aoi_csv_pth, csv_pth, bsave_ard, threads_number):
+@click.option('--queue_dir', default=None, help='shared directory of a tile queue; the tiles of --aoi or --csv_pth are '
+                                                'split with every other instance using the same directory, the tiles '
+                                                'of an aoi of --aoi_csv_pth in its subfolder aoi<id>')
+@click.option('--lease_seconds', default=1800, help='a queued tile whose worker gives no heartbeat for this long '
+                                                    'is given to another worker')
+def main(s3_bucket, config_filename, tile_id, aoi, aoi_csv_pth, csv_pth, bsave_ard, threads_number, queue_dir,
+         lease_seconds):
     """ The primary script
         Args:        
         s3_bucket (str): Name of the S3 bucket to search for configuration objects
             and save results to
         config_filename: configuration file name
         tile_id(optional, only for testing stage)
+        queue_dir(optional): shared tile queue directory for running several instances on one aoi, csv or aoi list
     """
 
     # define res
@@ -665,9 +733,24 @@ def main(s3_bucket, config_filename, tile_id, aoi, aoi_csv_pth, csv_pth, bsave_a
             else:
                 threads_number = int(threads_number)
 
-            ard_composition_executor = FixedThreadPoolExecutor(size=threads_number)
             aoi_alltiles = gpd_tile.loc[gpd_tile['production_aoi'] == float(aoi)]['tile']
 
+            # queue mode: one queue per aoi, the folder run_composition_aoi.sh uses for it
+            if queue_dir is not None:
+                aoi_queue_dir = os.path.join(queue_dir, 'aoi{}'.format(aoi))
+                tile_queue = TileQueue(aoi_queue_dir, lease_seconds=lease_seconds, logger=logger)
+                success_count, failure_count = queue_composition_execution(
+                    tile_queue, aoi_alltiles, threads_number, img_catalog, gpd_tile, s3_bucket, prefix,
+                    img_fullpth_catalog, tmp_pth, compositing_exe_path, dry_lower_ordinal, dry_upper_ordinal,
+                    wet_lower_ordinal, wet_upper_ordinal, bsave_ard, output_prefix, res, logger, gcs_res, buf)
+                logger.info("Progress: finished the queue {} on this instance; the success_count is {}; the "
+                            "failure_count is {}; the queue state is {} ({})"
+                            .format(aoi_queue_dir, success_count, failure_count, tile_queue.counts(),
+                                    datetime.now(tz).strftime('%Y-%m-%d %H:%M:%S')))
+                continue
+
+            ard_composition_executor = FixedThreadPoolExecutor(size=threads_number)
+
             success_count = 0
             failure_count = 0
             # looping over each tile
@@ -746,7 +829,22 @@ def main(s3_bucket, config_filename, tile_id, aoi, aoi_csv_pth, csv_pth, bsave_a
                 logger.error("reading geojson tile '{}' failed". format(uri_tile))
             
             aoi_alltiles = gpd_tile.loc[gpd_tile['production_aoi'] == float(aoi)]['tile']
-        
+
+        # queue mode: every instance seeds the same tiles (only the first one adds them) and takes tiles from the
+        # queue until all are done or failed, so an interrupted instance's tiles are finished by the others
+        if queue_dir is not None:
+            ard_composition_executor.close()
+            tile_queue = TileQueue(queue_dir, lease_seconds=lease_seconds, logger=logger)
+            success_count, failure_count = queue_composition_execution(
+                tile_queue, aoi_alltiles, threads_number, img_catalog, gpd_tile, s3_bucket, prefix,
+                img_fullpth_catalog, tmp_pth, compositing_exe_path, dry_lower_ordinal, dry_upper_ordinal,
+                wet_lower_ordinal, wet_upper_ordinal, bsave_ard, output_prefix, res, logger, gcs_res, buf)
+            logger.info("Progress: finished the queue {} on this instance; the success_count is {}; the failure_count "
+                        "is {}; the queue state is {} ({})".format(queue_dir, success_count, failure_count,
+                                                                 tile_queue.counts(),
+                                                                 datetime.now(tz).strftime('%Y-%m-%d %H:%M:%S')))
+            return
+
         failure_count = 0
         success_count = 0
         # looping over each tile
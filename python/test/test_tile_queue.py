@@ -0,0 +1,135 @@
+"""
+Tests of the shared-directory tile queue with several worker processes on one machine. Leases are 1 second long, so
+an expired lease is reclaimed within the test.
+"""
+
+import os
+import time
+import signal
+import multiprocessing
+
+from tile_queue import TileQueue, parse_entry
+
+LEASE_SECONDS = 1
+N_TILES = 60
+N_WORKERS = 4
+SLOW_TILE = '7'
+
+
+def run_worker(queue_dir, log_dir):
+    """
+    claim tiles until no tile is left, recording every tile worked on in log_dir/<pid>
+    arg:
+        queue_dir: the queue directory
+        log_dir: folder of the work logs
+    """
+    queue = TileQueue(queue_dir, lease_seconds=LEASE_SECONDS)
+    queue.seed(range(N_TILES))
+    with open(os.path.join(log_dir, str(os.getpid())), 'w') as log:
+        while True:
+            lease = queue.claim()
+            if lease is None:
+                if queue.unfinished() == 0:
+                    return
+                time.sleep(0.05)
+                continue
+            # a tile taking longer than a lease stays with its worker through the heartbeat
+            time.sleep(2.5 * LEASE_SECONDS if lease.tile == SLOW_TILE else 0.01)
+            log.write(lease.tile + '\n')
+            log.flush()
+            lease.complete()
+
+
+def run_stalled_worker(queue_dir, claimed_path):
+    """
+    claim one tile and hold its lease until killed
+    arg:
+        queue_dir: the queue directory
+        claimed_path: file the claimed tile is written to
+    """
+    queue = TileQueue(queue_dir, lease_seconds=LEASE_SECONDS)
+    queue.seed(range(N_TILES))
+    lease = queue.claim()
+    with open(claimed_path + '.tmp', 'w') as f:
+        f.write(lease.tile)
+    os.rename(claimed_path + '.tmp', claimed_path)
+    time.sleep(3600)
+
+
+def read_work_logs(log_dir):
+    """
+    return
+        the tiles worked on by all workers, a tile once for every time it was worked on
+    """
+    tiles = []
+    for name in os.listdir(log_dir):
+        with open(os.path.join(log_dir, name)) as log:
+            tiles.extend(log.read().split())
+    return tiles
+
+
+def test_workers_split_tiles_and_reclaim_a_killed_lease(tmp_path):
+    ctx = multiprocessing.get_context('fork')
+    queue_dir = str(tmp_path / 'queue')
+    log_dir = str(tmp_path / 'logs')
+    claimed_path = str(tmp_path / 'claimed')
+    os.makedirs(log_dir)
+
+    # a worker killed while it holds a lease, as a spot instance taken back
+    stalled = ctx.Process(target=run_stalled_worker, args=(queue_dir, claimed_path))
+    stalled.start()
+    deadline = time.time() + 30
+    while not os.path.exists(claimed_path):
+        assert time.time() < deadline, "the stalled worker claimed no tile"
+        time.sleep(0.01)
+    with open(claimed_path) as f:
+        killed_tile = f.read()
+    os.kill(stalled.pid, signal.SIGKILL)
+    stalled.join()
+
+    workers = [ctx.Process(target=run_worker, args=(queue_dir, log_dir)) for i in range(N_WORKERS)]
+    for worker in workers:
+        worker.start()
+    deadline = time.time() + 120
+    try:
+        for worker in workers:
+            worker.join(max(0, deadline - time.time()))
+            assert worker.exitcode == 0
+    finally:
+        for worker in workers:
+            if worker.is_alive():
+                worker.terminate()
+
+    worked = read_work_logs(log_dir)
+    assert sorted(worked, key=int) == [str(tile) for tile in range(N_TILES)]
+    assert killed_tile in worked
+
+    queue = TileQueue(queue_dir)
+    assert queue.counts() == {'pending': 0, 'leases': 0, 'done': N_TILES, 'failed': 0}
+    assert sorted(os.listdir(os.path.join(queue_dir, 'done')), key=int) == [str(tile) for tile in range(N_TILES)]
+
+
+def test_tile_failing_max_attempts_goes_to_failed(tmp_path):
+    queue = TileQueue(str(tmp_path), lease_seconds=LEASE_SECONDS, max_attempts=3)
+    queue.seed(['1'])
+    for attempt in range(3):
+        lease = queue.claim()
+        assert lease.tile == '1' and lease.attempts == attempt
+        lease.fail()
+
+    assert queue.claim() is None
+    assert os.listdir(os.path.join(str(tmp_path), 'failed')) == ['1#3']
+    assert queue.retry_failed() == 1
+    assert parse_entry(os.listdir(os.path.join(str(tmp_path), 'pending'))[0]) == ('1', 0)
+
+
+def test_seed_finishes_an_interrupted_seed(tmp_path):
+    queue = TileQueue(str(tmp_path), lease_seconds=LEASE_SECONDS)
+    # a seeder that stopped between linking known/1 and moving its tile file to pending/
+    seed_path = os.path.join(str(tmp_path), 'known', '.1@stopped')
+    open(seed_path, 'w').close()
+    os.link(seed_path, os.path.join(str(tmp_path), 'known', '1'))
+
+    assert queue.seed(['1', '2']) == 1
+    assert sorted(os.listdir(os.path.join(str(tmp_path), 'pending'))) == ['1#0', '2#0']
+    assert sorted(os.listdir(os.path.join(str(tmp_path), 'known'))) == ['1', '2']
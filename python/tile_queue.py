@@ -0,0 +1,371 @@
+"""
+A work queue of tiles kept in a shared directory, so that several CompositionMaker processes, on one host or on many
+hosts mounting the same directory (e.g. EFS), can split an AOI without doing a tile twice.
+
+Every tile is an empty file that moves between four folders of the queue directory:
+    pending/<tile>#<attempts>                 waiting, after <attempts> failed attempts
+    leases/<tile>#<attempts>@<worker token>   claimed by a worker; its mtime is the heartbeat
+    done/<tile>                               composited
+    failed/<tile>#<attempts>                  given up after max_attempts
+and known/<tile> records every tile seeded, so that seeding the same tiles again adds none of them.
+The state of a tile is all in its path, so claiming, finishing, requeueing and reclaiming a tile are single renames.
+They are atomic on a local file system and on NFS, so exactly one worker wins a tile. A lease whose heartbeat is
+older than lease_seconds (e.g. its spot instance was taken back) is moved to pending/ again by the next worker that
+looks for work. The hosts sharing a queue need synchronized clocks (NTP), since a host compares its own clock with
+the mtime of the leases.
+
+Usage from the command line:
+    python tile_queue.py seed --queue_dir=/efs/queue --csv_pth=tiles.csv
+    python tile_queue.py status --queue_dir=/efs/queue
+    python tile_queue.py retry --queue_dir=/efs/queue
+"""
+
+import os
+import json
+import time
+import uuid
+import random
+import socket
+import threading
+import click
+import pandas as pd
+
+
+STATES = ('pending', 'leases', 'done', 'failed')
+
+
+def parse_entry(name):
+    """
+    split the name of a tile file into its tile id and attempts
+    arg:
+        name: <tile>#<attempts>, optionally followed by @<worker token>
+    return
+        tile, attempts
+    """
+    tile, attempts = name.split('@', 1)[0].split('#', 1)
+    return tile, int(attempts)
+
+
+class LeaseLost(Exception):
+    """
+    the lease expired and was reclaimed by another worker
+    """
+    pass
+
+
+class Lease(object):
+    """
+    a tile claimed from the queue by this worker
+    """
+
+    def __init__(self, queue, tile, attempts):
+        self.queue = queue
+        self.tile = tile
+        self.attempts = attempts
+        self.path = os.path.join(queue.root, 'leases', '{}#{}@{}'.format(tile, attempts, queue.token))
+
+    def heartbeat(self):
+        """
+        extend the lease; raises LeaseLost if it has been reclaimed in the meantime
+        """
+        try:
+            os.utime(self.path, None)
+        except FileNotFoundError:
+            raise LeaseLost(self.tile)
+
+    def complete(self):
+        """
+        record the tile as done
+        return
+            True, or False if the lease had been lost, in which case another worker may do the tile again
+        """
+        self.queue.keeper.discard(self)
+        try:
+            os.rename(self.path, os.path.join(self.queue.root, 'done', self.tile))
+        except FileNotFoundError:
+            return False
+        return True
+
+    def fail(self):
+        """
+        give the tile back after a failed attempt; after max_attempts it goes to failed/
+        return
+            True, or False if the lease had been lost
+        """
+        self.queue.keeper.discard(self)
+        return self.queue.requeue(self.path, self.tile, self.attempts + 1)
+
+
+class LeaseKeeper(object):
+    """
+    a daemon thread refreshing the heartbeat of every lease of the process, every lease_seconds / 3
+    """
+
+    def __init__(self, lease_seconds, logger=None):
+        self.interval = lease_seconds / 3.0
+        self.logger = logger
+        self._leases = set()
+        self._lock = threading.Lock()
+        self._thread = threading.Thread(target=self._run, name='lease-keeper')
+        self._thread.daemon = True
+        self._thread.start()
+
+    def add(self, lease):
+        with self._lock:
+            self._leases.add(lease)
+
+    def discard(self, lease):
+        with self._lock:
+            self._leases.discard(lease)
+
+    def _run(self):
+        while True:
+            time.sleep(self.interval)
+            with self._lock:
+                leases = list(self._leases)
+            for lease in leases:
+                try:
+                    lease.heartbeat()
+                except LeaseLost:
+                    self.discard(lease)
+                    if self.logger is not None:
+                        self.logger.warning("lease of tile {} was lost".format(lease.tile))
+
+
+class TileQueue(object):
+    """
+    a tile queue in a shared directory
+
+    Example::
+
+        queue = TileQueue('/efs/queue')
+        queue.seed(tiles)
+        while True:
+            lease = queue.claim()
+            if lease is None:
+                if queue.unfinished() == 0:
+                    break
+                time.sleep(60)
+                continue
+            if composite(lease.tile):
+                lease.complete()
+            else:
+                lease.fail()
+    """
+
+    def __init__(self, root, lease_seconds=1800, max_attempts=3, logger=None):
+        """
+        arg:
+            root: queue directory, created if missing
+            lease_seconds: a lease without heartbeat for this long is reclaimed
+            max_attempts: failed attempts before a tile goes to failed/
+            logger: logging object, optional
+        """
+        self.root = root
+        self.lease_seconds = lease_seconds
+        self.max_attempts = max_attempts
+        self.logger = logger
+        self.token = '{}.{}.{}'.format(socket.gethostname(), os.getpid(), uuid.uuid4().hex[:8])
+        for state in STATES + ('known',):
+            os.makedirs(os.path.join(root, state), exist_ok=True)
+        self._keeper = None
+        self._keeper_lock = threading.Lock()
+
+    @property
+    def keeper(self):
+        """
+        the heartbeat thread, started with the first claim
+        """
+        with self._keeper_lock:
+            if self._keeper is None:
+                self._keeper = LeaseKeeper(self.lease_seconds, self.logger)
+            return self._keeper
+
+    def requeue(self, lease_path, tile, attempts):
+        """
+        move a lease back to pending/, or to failed/ once attempts reaches max_attempts
+        arg:
+            lease_path: path of the lease
+            tile: tile id
+            attempts: failed attempts, this one included
+        return
+            True, or False if another worker moved the lease first
+        """
+        state = 'failed' if attempts >= self.max_attempts else 'pending'
+        try:
+            os.rename(lease_path, os.path.join(self.root, state, '{}#{}'.format(tile, attempts)))
+        except FileNotFoundError:
+            return False
+        return True
+
+    def seed(self, tiles):
+        """
+        add tiles to the queue; a tile the queue has seen before is skipped, so every worker may seed the same list.
+        A tile file is made in known/ under a name of this worker, linked to known/<tile> and then renamed into
+        pending/. The link fails if the tile is known, so exactly one caller adds it, and a seed interrupted between
+        link and rename is finished by the next call of seed
+        arg:
+            tiles: iterable of tile ids
+        return
+            the number of tiles added
+        """
+        self.finish_seeds()
+        added = 0
+        for tile in tiles:
+            tile = str(tile)
+            known_path = os.path.join(self.root, 'known', tile)
+            if os.path.exists(known_path):
+                continue
+            seed_path = os.path.join(self.root, 'known', '.{}@{}'.format(tile, self.token))
+            open(seed_path, 'w').close()
+            try:
+                os.link(seed_path, known_path)
+            except FileExistsError:
+                os.remove(seed_path)
+                continue
+            try:
+                os.rename(seed_path, os.path.join(self.root, 'pending', '{}#0'.format(tile)))
+            except FileNotFoundError:
+                # finished by finish_seeds of another worker
+                pass
+            added = added + 1
+        return added
+
+    def finish_seeds(self):
+        """
+        move the tiles whose seeding was interrupted after the link into known/ to pending/, and remove the tile files
+        of seeds interrupted before it
+        return
+            the number of tiles moved to pending/
+        """
+        moved = 0
+        now = time.time()
+        for name in os.listdir(os.path.join(self.root, 'known')):
+            if not name.startswith('.'):
+                continue
+            seed_path = os.path.join(self.root, 'known', name)
+            try:
+                stat = os.stat(seed_path)
+                if stat.st_nlink > 1:
+                    tile = name[1:].split('@', 1)[0]
+                    os.rename(seed_path, os.path.join(self.root, 'pending', '{}#0'.format(tile)))
+                    moved = moved + 1
+                    if self.logger is not None:
+                        self.logger.warning("finished the interrupted seed of tile {}".format(tile))
+                # a seed not linked for this long is not running any more
+                elif now - stat.st_mtime > self.lease_seconds:
+                    os.remove(seed_path)
+            except FileNotFoundError:
+                continue
+        return moved
+
+    def reclaim(self):
+        """
+        move the leases whose heartbeat is older than lease_seconds back to pending/; an expired lease counts as a
+        failed attempt, so a tile that keeps killing its worker ends in failed/
+        return
+            the number of leases reclaimed
+        """
+        reclaimed = 0
+        now = time.time()
+        for name in os.listdir(os.path.join(self.root, 'leases')):
+            path = os.path.join(self.root, 'leases', name)
+            try:
+                if now - os.stat(path).st_mtime < self.lease_seconds:
+                    continue
+            except FileNotFoundError:
+                continue
+            tile, attempts = parse_entry(name)
+            if self.requeue(path, tile, attempts + 1):
+                reclaimed = reclaimed + 1
+                if self.logger is not None:
+                    self.logger.warning("reclaimed the expired lease {}".format(name))
+        return reclaimed
+
+    def claim(self):
+        """
+        take a pending tile, reclaiming expired leases first
+        return
+            a Lease whose heartbeat is kept by a background thread, or None if no tile is pending
+        """
+        self.reclaim()
+        names = os.listdir(os.path.join(self.root, 'pending'))
+        # workers starting together would otherwise all race for the same tile
+        random.shuffle(names)
+        for name in names:
+            tile, attempts = parse_entry(name)
+            lease = Lease(self, tile, attempts)
+            pending_path = os.path.join(self.root, 'pending', name)
+            try:
+                # rename keeps the mtime, so the heartbeat is set before the file becomes a lease
+                os.utime(pending_path, None)
+                os.rename(pending_path, lease.path)
+            except FileNotFoundError:
+                continue
+            self.keeper.add(lease)
+            return lease
+        return None
+
+    def retry_failed(self):
+        """
+        move every failed tile back to pending/ with its attempts reset
+        return
+            the number of tiles moved
+        """
+        moved = 0
+        for name in os.listdir(os.path.join(self.root, 'failed')):
+            tile, attempts = parse_entry(name)
+            try:
+                os.rename(os.path.join(self.root, 'failed', name),
+                          os.path.join(self.root, 'pending', '{}#0'.format(tile)))
+            except FileNotFoundError:
+                continue
+            moved = moved + 1
+        return moved
+
+    def counts(self):
+        """
+        return
+            a dict with the number of tiles in each state
+        """
+        return {state: len(os.listdir(os.path.join(self.root, state))) for state in STATES}
+
+    def unfinished(self):
+        """
+        return
+            the number of tiles pending or leased, i.e. that a worker may still get
+        """
+        counts = self.counts()
+        return counts['pending'] + counts['leases']
+
+
+@click.group()
+def cli():
+    pass
+
+
+@cli.command()
+@click.option('--queue_dir', required=True, help='the queue directory')
+@click.option('--csv_pth', required=True, help='csv with a tile column')
+def seed(queue_dir, csv_pth):
+    """ add the tiles of a csv to the queue """
+    added = TileQueue(queue_dir).seed(pd.read_csv(csv_pth)['tile'])
+    print("{} tiles added".format(added))
+
+
+@cli.command()
+@click.option('--queue_dir', required=True, help='the queue directory')
+def status(queue_dir):
+    """ print the number of tiles in each state """
+    print(json.dumps(TileQueue(queue_dir).counts()))
+
+
+@cli.command()
+@click.option('--queue_dir', required=True, help='the queue directory')
+def retry(queue_dir):
+    """ move the failed tiles back to pending """
+    print("{} tiles moved back to pending".format(TileQueue(queue_dir).retry_failed()))
+
+
+if __name__ == '__main__':
+    cli()
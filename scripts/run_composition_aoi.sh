@@ -2,9 +2,11 @@
 composite_exe=/home/ubuntu/imager/python/CompositionMaker.py
 config_filenm=cvmapper_config_composite_congo.yaml
 threads_num=4
+# shared directory (e.g. on EFS) splitting an aoi between instances; leave empty for a single instance
+queue_root=
 echo "Enter aoi"
 read aoi_id
 
 conda activate composite
-python $composite_exe --aoi=$aoi_id --threads_number=$threads_num --config_filename=$config_filenm
+python $composite_exe --aoi=$aoi_id --threads_number=$threads_num --config_filename=$config_filenm ${queue_root:+--queue_dir=$queue_root/aoi$aoi_id}
 mail -s "Composition Finished!" <emailaddress> <<< 'The composition task for finished: aoi'$aoi_id